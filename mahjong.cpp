@@ -8,6 +8,10 @@
 #include <limits>
 #include <assert.h>
 #include <time.h>
+#include <chrono>
+#ifdef __linux__
+#include <sys/resource.h>
+#endif
 
 #include <assert.h>
 #include <stddef.h>
@@ -170,6 +174,17 @@ static const tile_t all_tiles[] = {
     TILE_E , TILE_S , TILE_W , TILE_N , TILE_C , TILE_F , TILE_P
 };
 
+/**
+ * @brief 牌在all_tiles中的下标
+ *  数牌为(花色-1)*9+点数-1，字牌的花色为4，恰好接在饼子之后
+ *
+ * @param [in] tile 牌
+ * @return int 下标，0-33
+ */
+static FORCE_INLINE int tile_index(tile_t tile) {
+    return ((tile >> 4) - 1) * 9 + (tile & 0xF) - 1;
+}
+
 /**
  * @brief 牌表类型
  *
@@ -179,6 +194,174 @@ static const tile_t all_tiles[] = {
  */
 typedef uint16_t tile_table_t[TILE_TABLE_SIZE];
 
+/**
+ * @brief 压缩牌表类型
+ *  每种牌的枚数占3bit，一门牌占一个32bit的道，34种牌共用2个64bit
+ *
+ * 内存结构：
+ * - words[0] 0-26 27bit 万子，32-58 27bit 条子
+ * - words[1] 0-26 27bit 饼子，32-52 21bit 字牌（东南西北中发白）
+ *
+ *       第n种牌（点数n或字牌序号n，从1开始）在道内的偏移为(n-1)*3\n
+ *       由于字牌的花色为4，道的编号恰好为花色-1，所以偏移可以直接由牌的值算出\n
+ *       增减牌只需对相应的位加减1，各种牌的状态可以用掩码一次算出，见下面的函数
+ */
+struct packed_hand_t {
+    uint64_t words[2];  ///< 各道的枚数
+};
+
+#define PACKED_HAND_LOW_BITS_0 0x0124924901249249ULL  ///< words[0]每种牌的最低位
+#define PACKED_HAND_LOW_BITS_1 0x0004924901249249ULL  ///< words[1]每种牌的最低位
+
+/**
+ * @brief 牌在压缩牌表中的位偏移
+ *
+ * @param [in] tile 牌
+ * @return int 偏移，0-63在words[0]中，64-127在words[1]中
+ */
+static FORCE_INLINE int packed_hand_offset(tile_t tile) {
+    return ((tile >> 4) - 1) * 32 + ((tile & 0xF) - 1) * 3;
+}
+
+/**
+ * @brief 压缩牌表中位对应的牌
+ *
+ * @param [in] word 第几个64bit
+ * @param [in] bit 在这个64bit中的位，须为一种牌的最低位
+ * @return tile_t 牌
+ */
+static FORCE_INLINE tile_t packed_hand_bit_tile(int word, int bit) {
+    return static_cast<tile_t>(((word * 2 + (bit >> 5) + 1) << 4) | ((bit & 31) / 3 + 1));
+}
+
+/**
+ * @brief 压缩牌表中某种牌的枚数
+ *
+ * @param [in] hand 压缩牌表
+ * @param [in] tile 牌
+ * @return int 枚数
+ */
+static FORCE_INLINE int packed_hand_count(const packed_hand_t &hand, tile_t tile) {
+    int offset = packed_hand_offset(tile);
+    return static_cast<int>((hand.words[offset >> 6] >> (offset & 63)) & 7);
+}
+
+/**
+ * @brief 压缩牌表中添加1张牌
+ *  不检查枚数，调用者保证一种牌不超过7张
+ *
+ * @param [in,out] hand 压缩牌表
+ * @param [in] tile 牌
+ */
+static FORCE_INLINE void packed_hand_add(packed_hand_t *hand, tile_t tile) {
+    int offset = packed_hand_offset(tile);
+    hand->words[offset >> 6] += 1ULL << (offset & 63);
+}
+
+/**
+ * @brief 压缩牌表中删除1张牌
+ *  不检查枚数，调用者保证有这张牌
+ *
+ * @param [in,out] hand 压缩牌表
+ * @param [in] tile 牌
+ */
+static FORCE_INLINE void packed_hand_remove(packed_hand_t *hand, tile_t tile) {
+    int offset = packed_hand_offset(tile);
+    hand->words[offset >> 6] -= 1ULL << (offset & 63);
+}
+
+/**
+ * @brief 有这种牌的掩码
+ *  每种牌有1张及以上时，其最低位为1
+ *
+ * @param [in] word 压缩牌表的一个64bit
+ * @return uint64_t 掩码
+ */
+static FORCE_INLINE uint64_t packed_hand_present(uint64_t word) {
+    return (word | (word >> 1) | (word >> 2)) & PACKED_HAND_LOW_BITS_0;
+}
+
+/**
+ * @brief 对子的掩码
+ *  每种牌有2张及以上时，其最低位为1
+ *
+ * @param [in] word 压缩牌表的一个64bit
+ * @return uint64_t 掩码
+ */
+static FORCE_INLINE uint64_t packed_hand_pairs(uint64_t word) {
+    return ((word >> 1) | (word >> 2)) & PACKED_HAND_LOW_BITS_0;
+}
+
+/**
+ * @brief 刻子的掩码
+ *  每种牌有3张及以上时，其最低位为1
+ *
+ * @param [in] word 压缩牌表的一个64bit
+ * @return uint64_t 掩码
+ */
+static FORCE_INLINE uint64_t packed_hand_pungs(uint64_t word) {
+    return ((word >> 2) | (word & (word >> 1))) & PACKED_HAND_LOW_BITS_0;
+}
+
+/**
+ * @brief 顺子的掩码
+ *  从某种牌开始连续3种牌都有时，其最低位为1。每道的27-31bit恒为0，所以不会跨门相连
+ *
+ * @param [in] word 压缩牌表的一个64bit
+ * @param [in] numbered_lanes 哪些道是数牌：words[0]为0xFFFFFFFFFFFFFFFF，words[1]为0xFFFFFFFF
+ * @return uint64_t 掩码
+ */
+static FORCE_INLINE uint64_t packed_hand_chows(uint64_t word, uint64_t numbered_lanes) {
+    uint64_t present = packed_hand_present(word);
+    return present & (present >> 3) & (present >> 6) & numbered_lanes;
+}
+
+/**
+ * @brief 有超过4张的牌的掩码
+ *
+ * @param [in] word 压缩牌表的一个64bit
+ * @return uint64_t 掩码
+ */
+static FORCE_INLINE uint64_t packed_hand_overflow(uint64_t word) {
+    return (word >> 2) & (word | (word >> 1)) & PACKED_HAND_LOW_BITS_0;
+}
+
+/**
+ * @brief 掩码中最低的1位
+ *
+ * @param [in] mask 掩码，不能为0
+ * @return int 位置
+ */
+static FORCE_INLINE int packed_hand_lowest_bit(uint64_t mask) {
+#if defined(__GNUC__)
+    return __builtin_ctzll(mask);
+#else
+    int n = 0;
+    while ((mask & 1) == 0) {
+        mask >>= 1;
+        ++n;
+    }
+    return n;
+#endif
+}
+
+/**
+ * @brief 掩码中1的个数
+ *
+ * @param [in] mask 掩码
+ * @return int 个数
+ */
+static FORCE_INLINE int popcount64(uint64_t mask) {
+#if defined(__GNUC__)
+    return __builtin_popcountll(mask);
+#else
+    mask = mask - ((mask >> 1) & 0x5555555555555555ULL);
+    mask = (mask & 0x3333333333333333ULL) + ((mask >> 2) & 0x3333333333333333ULL);
+    mask = (mask + (mask >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return static_cast<int>((mask * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
 #define PACK_TYPE_NONE 0  ///< 无效
 #define PACK_TYPE_CHOW 1  ///< 顺子
 #define PACK_TYPE_PUNG 2  ///< 刻子
@@ -593,11 +776,81 @@ bool map_hand_tiles(const hand_tiles_t *hand_tiles, tile_table_t *cnt_table);
  */
 intptr_t table_to_tiles(const tile_table_t &cnt_table, tile_t *tiles, intptr_t max_cnt);
 
+/**
+ * @brief 将牌打成压缩牌表
+ *
+ * @param [in] tiles 牌
+ * @param [in] cnt 牌的数量
+ * @param [out] packed_hand 压缩牌表
+ */
+void map_tiles(const tile_t *tiles, intptr_t cnt, packed_hand_t *packed_hand);
+
+/**
+ * @brief 将表转换成压缩牌表
+ *  超过7张的牌会溢出到相邻的牌，调用者保证不出现
+ *
+ * @param [in] cnt_table 牌的数量表
+ * @param [out] packed_hand 压缩牌表
+ */
+void table_to_packed_hand(const tile_table_t &cnt_table, packed_hand_t *packed_hand);
+
+/**
+ * @brief 将压缩牌表转换成表
+ *
+ * @param [in] packed_hand 压缩牌表
+ * @param [out] cnt_table 牌的数量表
+ */
+void packed_hand_to_table(const packed_hand_t &packed_hand, tile_table_t *cnt_table);
+
 /**
  * @brief 有效牌标记表类型
  */
 typedef bool useful_table_t[TILE_TABLE_SIZE];
 
+/**
+ * @brief 密集牌表类型
+ *  以tile_index为下标，只有34项，每项1字节。在递归中频繁复制时比tile_table_t省得多
+ */
+typedef uint8_t dense_tile_table_t[34];
+
+/**
+ * @brief 密集有效牌标记类型
+ *  第tile_index位为1表示该牌有效
+ */
+typedef uint64_t dense_useful_table_t;
+
+/**
+ * @brief 将表转换成密集牌表
+ *
+ * @param [in] cnt_table 牌的数量表
+ * @param [out] dense_table 密集牌表
+ */
+void table_to_dense_table(const tile_table_t &cnt_table, dense_tile_table_t *dense_table);
+
+/**
+ * @brief 将密集牌表转换成表
+ *
+ * @param [in] dense_table 密集牌表
+ * @param [out] cnt_table 牌的数量表
+ */
+void dense_table_to_table(const dense_tile_table_t &dense_table, tile_table_t *cnt_table);
+
+/**
+ * @brief 将有效牌标记表转换成密集有效牌标记
+ *
+ * @param [in] useful_table 有效牌标记表
+ * @return dense_useful_table_t 密集有效牌标记
+ */
+dense_useful_table_t useful_table_to_dense(const useful_table_t &useful_table);
+
+/**
+ * @brief 将密集有效牌标记转换成有效牌标记表
+ *
+ * @param [in] dense_useful 密集有效牌标记
+ * @param [out] useful_table 有效牌标记表
+ */
+void dense_to_useful_table(dense_useful_table_t dense_useful, useful_table_t *useful_table);
+
 /**
  * @addtogroup shanten
  * @{
@@ -638,6 +891,63 @@ bool is_basic_form_wait(const tile_t *standing_tiles, intptr_t standing_cnt, use
  */
 bool is_basic_form_win(const tile_t *standing_tiles, intptr_t standing_cnt, tile_t test_tile);
 
+/**
+ * @brief 基本和型打牌的计算结果
+ */
+struct basic_form_discard_t {
+    int shanten;                            ///< 打牌后的最小上听数
+    intptr_t discard_cnt;                   ///< 达到最小上听数的打法数
+    tile_t discard_tiles[14];               ///< 达到最小上听数的打出牌，按牌的顺序排列
+    useful_table_t useful_tables[14];       ///< 各打法对应的有效牌标记表
+};
+
+/**
+ * @brief 基本和型打哪张牌上听数最小
+ *  一次遍历立牌和上牌，各打法共用未变动的各门拆分。不考虑番数，与basic_form_shanten不同
+ *
+ * @param [in] hand_tiles 手牌结构
+ * @param [in] serving_tile 上牌
+ * @param [out] result 计算结果
+ * @return int 打牌后的最小上听数
+ */
+int basic_form_discard_shanten(const hand_tiles_t *hand_tiles, tile_t serving_tile, basic_form_discard_t *result);
+
+/**
+ * @brief 基本和型打哪张牌上听数最小（压缩牌表）
+ *  只遍历手中有的牌，结果与上面的函数一致
+ *
+ * @param [in] standing_hand 立牌连同上牌，张数须为3n+2（n为0~4）
+ * @param [out] result 计算结果
+ * @return int 打牌后的最小上听数
+ */
+int basic_form_discard_shanten(const packed_hand_t &standing_hand, basic_form_discard_t *result);
+
+/**
+ * @brief 不考虑番数的基本和型上听数（压缩牌表）
+ *  与basic_form_shanten不同，只看牌的拆分，结果与历史调用无关
+ *
+ * @param [in] standing_hand 立牌（可连同上牌），张数须为3n+1或3n+2（n为0~4）
+ * @return int 上听数，3n+2张时已和牌为-1
+ */
+int basic_form_shanten_ignoring_fan(const packed_hand_t &standing_hand);
+
+/**
+ * @brief 基本和型是否听牌（压缩牌表）
+ *
+ * @param [in] standing_hand 立牌
+ * @param [out] waiting_table 听牌标记表（可为null）
+ * @return bool 是否听牌
+ */
+bool is_basic_form_wait(const packed_hand_t &standing_hand, useful_table_t *waiting_table);
+
+/**
+ * @brief 基本和型是否和牌（压缩牌表）
+ *
+ * @param [in] standing_hand 立牌连同和牌
+ * @return bool 是否和牌
+ */
+bool is_basic_form_win(const packed_hand_t &standing_hand);
+
 /**
  * end group
  * @}
@@ -832,6 +1142,65 @@ bool is_waiting(const hand_tiles_t &hand_tiles, useful_table_t *useful_table);
  * @}
  */
 
+/**
+ * @brief 各和型上听数的计算结果
+ *  下标i对应和型标记(1 << i)，依次为基本和型、七对、十三幺、全不靠、组合龙
+ */
+struct shanten_all_t {
+    int shanten[5];                         ///< 各和型的上听数，未计算的为INT_MAX
+    useful_table_t useful_table[5];         ///< 各和型的有效牌标记表
+    uint8_t form_flag;                      ///< 上听数最小的和型
+    useful_table_t all_useful_table;        ///< 上听数最小的各和型的有效牌合并
+};
+
+/**
+ * @brief 一次计算多种和型的上听数
+ *  立牌只打表一次，各和型共用
+ *
+ * @param [in] standing_tiles 立牌
+ * @param [in] standing_cnt 立牌数
+ * @param [in] form_flag 计算哪些和型
+ * @param [out] result 计算结果
+ * @return int 最小上听数（没有可计算的和型时为INT_MAX）
+ */
+int calculate_shanten_all(const tile_t *standing_tiles, intptr_t standing_cnt, uint8_t form_flag, shanten_all_t *result);
+
+/**
+ * @brief 各张数的牌的位掩码
+ *  第(tile - TILE_1m)位表示一种牌
+ */
+struct tile_count_masks_t {
+    uint64_t at_least[5];                   ///< at_least[n]为有n+1张及以上的牌，at_least[4]非0说明牌不合法
+};
+
+/**
+ * @brief 将牌打成各张数的位掩码
+ *
+ * @param [in] tiles 牌
+ * @param [in] cnt 牌的数量
+ * @param [out] masks 各张数的位掩码
+ */
+void map_tile_count_masks(const tile_t *tiles, intptr_t cnt, tile_count_masks_t *masks);
+
+/**
+ * @brief 七对、十三幺、全不靠的上听数
+ *  有效牌以位掩码表示，位定义同tile_count_masks_t
+ */
+struct special_shanten_t {
+    int shanten[3];                         ///< 依次为七对、十三幺、全不靠的上听数
+    uint64_t useful_mask[3];                ///< 各和型的有效牌
+};
+
+/**
+ * @brief 一次计算七对、十三幺、全不靠的上听数
+ *  全部由位运算和popcount得到，不遍历牌
+ *
+ * @param [in] masks 13张立牌的各张数的位掩码
+ * @param [out] result 计算结果
+ * @return int 三者中最小的上听数（有超过4张的牌时为INT_MAX）
+ */
+int special_forms_shanten(const tile_count_masks_t &masks, special_shanten_t *result);
+
 /**
  * @brief 枚举打哪张牌的计算结果信息
  */
@@ -902,85 +1271,300 @@ static const tile_t standard_knitted_straight[6][9] = {
     { TILE_3m, TILE_6m, TILE_9m, TILE_2s, TILE_5s, TILE_8s, TILE_1p, TILE_4p, TILE_7p },
 };
 
+// 以上牌型的位掩码，每一位表示一种牌，第(tile - TILE_1m)位为1表示含有该牌，算法原理同绿一色构成牌判断函数
+// 用于快速排除不可能的特殊和型
+static const uint64_t standard_thirteen_orphans_mask = 0x007F010101010101ULL;
+static const uint64_t standard_honors_mask = 0x007F000000000000ULL;
+static const uint64_t standard_knitted_straight_mask[6] = {
+    0x0000012400920049ULL,  // 147m 258s 369p
+    0x0000009201240049ULL,  // 147m 369s 258p
+    0x0000012400490092ULL,  // 258m 147s 369p
+    0x0000004901240092ULL,  // 258m 369s 147p
+    0x0000009200490124ULL,  // 369m 147s 258p
+    0x0000004900920124ULL,  // 369m 258s 147p
+};
+
 }
 
 #endif
 
-#ifndef __MAHJONG_ALGORITHM__FAN_CALCULATOR_H__
-#define __MAHJONG_ALGORITHM__FAN_CALCULATOR_H__
+#ifndef __MAHJONG_ALGORITHM__STACK_STATS_H__
+#define __MAHJONG_ALGORITHM__STACK_STATS_H__
 
+// 搜索统计默认打开，定义MAHJONG_NO_SEARCH_STATS可完全去掉。这里是栈用量的部分，其余在机器人的代码中
+#if !defined(MAHJONG_NO_SEARCH_STATS) && !defined(MAHJONG_SEARCH_STATS)
+#define MAHJONG_SEARCH_STATS
+#endif
 
+#ifdef MAHJONG_SEARCH_STATS
+namespace mahjong {
 
-#define SUPPORT_CONCEALED_KONG_AND_MELDED_KONG 1  // 支持明暗杠
+/**
+ * @brief 栈用量统计
+ *  在递归函数的入口记下栈上的位置，与开始统计时的位置相减得到用到的栈字节数（栈向低地址增长）。
+ *  最深一层函数的栈帧只算到统计对象所在处，结果略小于实际
+ */
+struct stack_stats_t {
+    uintptr_t base;         ///< 开始统计时的位置，0为未开始
+    uintptr_t lowest;       ///< 见到的最低位置
+    intptr_t depth;         ///< 当前被统计函数的嵌套层数
+    intptr_t peak_depth;    ///< 嵌套层数的峰值
+};
 
-namespace mahjong {
+// 每个线程各有一份，库函数在工具程序中会被多个线程调用
+thread_local stack_stats_t stack_stats;
 
 /**
- * @addtogroup calculator
- * @{
+ * @brief 以position为起点重新开始统计
  */
+static inline void stack_stats_begin(uintptr_t position) {
+    stack_stats.base = position;
+    stack_stats.lowest = position;
+    stack_stats.depth = 0;
+    stack_stats.peak_depth = 0;
+}
 
 /**
- * @brief 番种
+ * @brief 开始统计以来用到的栈字节数的峰值
  */
-enum fan_t {
-    FAN_NONE = 0,                       ///< 无效
-    BIG_FOUR_WINDS,                     ///< 大四喜
-    BIG_THREE_DRAGONS,                  ///< 大三元
-    ALL_GREEN,                          ///< 绿一色
-    NINE_GATES,                         ///< 九莲宝灯
-    FOUR_KONGS,                         ///< 四杠
-    SEVEN_SHIFTED_PAIRS,                ///< 连七对
-    THIRTEEN_ORPHANS,                   ///< 十三幺
+static inline size_t stack_stats_peak_bytes() {
+    return stack_stats.base > stack_stats.lowest ? static_cast<size_t>(stack_stats.base - stack_stats.lowest) : 0;
+}
 
-    ALL_TERMINALS,                      ///< 清幺九
-    LITTLE_FOUR_WINDS,                  ///< 小四喜
-    LITTLE_THREE_DRAGONS,               ///< 小三元
-    ALL_HONORS,                         ///< 字一色
-    FOUR_CONCEALED_PUNGS,               ///< 四暗刻
-    PURE_TERMINAL_CHOWS,                ///< 一色双龙会
+// 放在被统计函数的开头，构造时记下位置和层数，析构时退出一层
+struct stack_frame_mark_t {
+    stack_frame_mark_t() {
+        stack_stats.lowest = std::min(stack_stats.lowest, reinterpret_cast<uintptr_t>(this));
+        stack_stats.peak_depth = std::max(stack_stats.peak_depth, ++stack_stats.depth);
+    }
+    ~stack_frame_mark_t() {
+        --stack_stats.depth;
+    }
+};
 
-    QUADRUPLE_CHOW,                     ///< 一色四同顺
-    FOUR_PURE_SHIFTED_PUNGS,            ///< 一色四节高
+}
 
-    FOUR_PURE_SHIFTED_CHOWS,            ///< 一色四步高
-    THREE_KONGS,                        ///< 三杠
-    ALL_TERMINALS_AND_HONORS,           ///< 混幺九
+#define SEARCH_STATS_STACK_BEGIN() do { char stack_marker_; mahjong::stack_stats_begin(reinterpret_cast<uintptr_t>(&stack_marker_)); } while (0)
+#define SEARCH_STATS_STACK_FRAME() mahjong::stack_frame_mark_t stack_frame_mark_
+#else
+#define SEARCH_STATS_STACK_BEGIN() ((void)0)
+#define SEARCH_STATS_STACK_FRAME() ((void)0)
+#endif
 
-    SEVEN_PAIRS,                        ///< 七对
-    GREATER_HONORS_AND_KNITTED_TILES,   ///< 七星不靠
-    ALL_EVEN_PUNGS,                     ///< 全双刻
-    FULL_FLUSH,                         ///< 清一色
-    PURE_TRIPLE_CHOW,                   ///< 一色三同顺
-    PURE_SHIFTED_PUNGS,                 ///< 一色三节高
-    UPPER_TILES,                        ///< 全大
-    MIDDLE_TILES,                       ///< 全中
-    LOWER_TILES,                        ///< 全小
+#endif
 
-    PURE_STRAIGHT,                      ///< 清龙
-    THREE_SUITED_TERMINAL_CHOWS,        ///< 三色双龙会
-    PURE_SHIFTED_CHOWS,                 ///< 一色三步高
-    ALL_FIVE,                           ///< 全带五
-    TRIPLE_PUNG,                        ///< 三同刻
-    THREE_CONCEALED_PUNGS,              ///< 三暗刻
+#ifndef __MAHJONG_ALGORITHM__TRACE_H__
+#define __MAHJONG_ALGORITHM__TRACE_H__
 
-    LESSER_HONORS_AND_KNITTED_TILES,    ///< 全不靠
-    KNITTED_STRAIGHT,                   ///< 组合龙
-    UPPER_FOUR,                         ///< 大于五
-    LOWER_FOUR,                         ///< 小于五
-    BIG_THREE_WINDS,                    ///< 三风刻
+// 作用域追踪：定义MAHJONG_TRACE时，用MAHJONG_TRACE_SCOPE标记的作用域退出时记下一个事件，
+// 存进每线程的环形缓冲区，需要时用trace_dump写成Chrome的trace event格式，可用chrome://tracing或Perfetto打开
+// 不定义时宏展开为空，没有任何开销
+#ifdef MAHJONG_TRACE
 
-    MIXED_STRAIGHT,                     ///< 花龙
-    REVERSIBLE_TILES,                   ///< 推不倒
-    MIXED_TRIPLE_CHOW,                  ///< 三色三同顺
-    MIXED_SHIFTED_PUNGS,                ///< 三色三节高
-    CHICKEN_HAND,                       ///< 无番和
-    LAST_TILE_DRAW,                     ///< 妙手回春
-    LAST_TILE_CLAIM,                    ///< 海底捞月
-    OUT_WITH_REPLACEMENT_TILE,          ///< 杠上开花
-    ROBBING_THE_KONG,                   ///< 抢杠和
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include <atomic>
 
-    ALL_PUNGS,                          ///< 碰碰和
+#ifndef TRACE_BUFFER_SIZE
+#define TRACE_BUFFER_SIZE 65536  ///< 每个线程保留的事件数，必须为2的幂，写满后覆盖最早的事件
+#endif
+
+namespace mahjong {
+
+/**
+ * @brief 追踪事件，即一次作用域的进出
+ */
+struct trace_event_t {
+    const char *name;   ///< 作用域名，须为字符串字面量
+    uint64_t begin;     ///< 进入时的时钟
+    uint64_t end;       ///< 退出时的时钟
+};
+
+/**
+ * @brief 每线程的事件环形缓冲区
+ */
+struct trace_buffer_t {
+    trace_event_t events[TRACE_BUFFER_SIZE];
+    uint64_t count;     ///< 写入过的事件总数
+    int tid;            ///< 输出时的线程编号
+};
+
+// x86上直接读TSC，其他平台用steady_clock的纳秒数
+static FORCE_INLINE uint64_t trace_clock() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+}
+
+// 时钟的起点，第一次记录事件时确定，输出时据此换算成微秒
+struct trace_epoch_t {
+    uint64_t clock;
+    std::chrono::steady_clock::time_point time;
+};
+
+static inline const trace_epoch_t &trace_epoch() {
+    static const trace_epoch_t epoch = { trace_clock(), std::chrono::steady_clock::now() };
+    return epoch;
+}
+
+static inline trace_buffer_t &trace_buffer() {
+    static std::atomic<int> next_tid(1);
+    thread_local trace_buffer_t buffer = { { }, 0, next_tid.fetch_add(1) };
+    return buffer;
+}
+
+/**
+ * @brief 作用域计时，析构时把事件写入当前线程的缓冲区
+ */
+struct trace_scope_t {
+    const char *name;
+    uint64_t begin;
+
+    explicit trace_scope_t(const char *scope_name) : name(scope_name) {
+        trace_epoch();
+        begin = trace_clock();
+    }
+    ~trace_scope_t() {
+        trace_buffer_t &buffer = trace_buffer();
+        trace_event_t &event = buffer.events[buffer.count++ & (TRACE_BUFFER_SIZE - 1)];
+        event.name = name;
+        event.begin = begin;
+        event.end = trace_clock();
+    }
+};
+
+/**
+ * @brief 清空当前线程的事件
+ */
+static inline void trace_clear() {
+    trace_buffer().count = 0;
+}
+
+// 每个时钟周期的微秒数。x86上用起点和现在两对(时钟, steady_clock)的间隔之比，
+// steady_clock精确到纳秒，所有事件都在这段间隔内，间隔再短换算误差也不影响事件的相对长短
+static inline double trace_us_per_tick(const trace_epoch_t &epoch) {
+#if defined(__x86_64__) || defined(__i386__)
+    const uint64_t now_clock = trace_clock();
+    const double elapsed_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - epoch.time).count();
+    return now_clock > epoch.clock ? elapsed_us / static_cast<double>(now_clock - epoch.clock) : 0.0;
+#else
+    (void)epoch;
+    return 0.001;
+#endif
+}
+
+/**
+ * @brief 把当前线程缓冲区中的事件写成Chrome trace event格式的JSON
+ *  时钟按起点到现在的间隔换算成微秒
+ *
+ * @param [in] fp 输出文件
+ * @return bool 是否写成功
+ */
+static inline bool trace_dump(FILE *fp) {
+    const trace_epoch_t &epoch = trace_epoch();
+    const double us_per_tick = trace_us_per_tick(epoch);
+
+    const trace_buffer_t &buffer = trace_buffer();
+    const uint64_t first = buffer.count > TRACE_BUFFER_SIZE ? buffer.count - TRACE_BUFFER_SIZE : 0;
+    fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    for (uint64_t i = first; i < buffer.count; ++i) {
+        const trace_event_t &event = buffer.events[i & (TRACE_BUFFER_SIZE - 1)];
+        fprintf(fp, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}", i == first ? "" : ",",
+            event.name, buffer.tid, static_cast<double>(event.begin - epoch.clock) * us_per_tick,
+            static_cast<double>(event.end - event.begin) * us_per_tick);
+    }
+    fprintf(fp, "\n]}\n");
+    return ferror(fp) == 0;
+}
+
+}
+
+#define MAHJONG_TRACE_SCOPE(name_) mahjong::trace_scope_t mahjong_trace_scope_(name_)
+#else
+#define MAHJONG_TRACE_SCOPE(name_) ((void)0)
+#endif
+
+#endif
+
+#ifndef __MAHJONG_ALGORITHM__FAN_CALCULATOR_H__
+#define __MAHJONG_ALGORITHM__FAN_CALCULATOR_H__
+
+
+
+#define SUPPORT_CONCEALED_KONG_AND_MELDED_KONG 1  // 支持明暗杠
+
+namespace mahjong {
+
+/**
+ * @addtogroup calculator
+ * @{
+ */
+
+/**
+ * @brief 番种
+ */
+enum fan_t {
+    FAN_NONE = 0,                       ///< 无效
+    BIG_FOUR_WINDS,                     ///< 大四喜
+    BIG_THREE_DRAGONS,                  ///< 大三元
+    ALL_GREEN,                          ///< 绿一色
+    NINE_GATES,                         ///< 九莲宝灯
+    FOUR_KONGS,                         ///< 四杠
+    SEVEN_SHIFTED_PAIRS,                ///< 连七对
+    THIRTEEN_ORPHANS,                   ///< 十三幺
+
+    ALL_TERMINALS,                      ///< 清幺九
+    LITTLE_FOUR_WINDS,                  ///< 小四喜
+    LITTLE_THREE_DRAGONS,               ///< 小三元
+    ALL_HONORS,                         ///< 字一色
+    FOUR_CONCEALED_PUNGS,               ///< 四暗刻
+    PURE_TERMINAL_CHOWS,                ///< 一色双龙会
+
+    QUADRUPLE_CHOW,                     ///< 一色四同顺
+    FOUR_PURE_SHIFTED_PUNGS,            ///< 一色四节高
+
+    FOUR_PURE_SHIFTED_CHOWS,            ///< 一色四步高
+    THREE_KONGS,                        ///< 三杠
+    ALL_TERMINALS_AND_HONORS,           ///< 混幺九
+
+    SEVEN_PAIRS,                        ///< 七对
+    GREATER_HONORS_AND_KNITTED_TILES,   ///< 七星不靠
+    ALL_EVEN_PUNGS,                     ///< 全双刻
+    FULL_FLUSH,                         ///< 清一色
+    PURE_TRIPLE_CHOW,                   ///< 一色三同顺
+    PURE_SHIFTED_PUNGS,                 ///< 一色三节高
+    UPPER_TILES,                        ///< 全大
+    MIDDLE_TILES,                       ///< 全中
+    LOWER_TILES,                        ///< 全小
+
+    PURE_STRAIGHT,                      ///< 清龙
+    THREE_SUITED_TERMINAL_CHOWS,        ///< 三色双龙会
+    PURE_SHIFTED_CHOWS,                 ///< 一色三步高
+    ALL_FIVE,                           ///< 全带五
+    TRIPLE_PUNG,                        ///< 三同刻
+    THREE_CONCEALED_PUNGS,              ///< 三暗刻
+
+    LESSER_HONORS_AND_KNITTED_TILES,    ///< 全不靠
+    KNITTED_STRAIGHT,                   ///< 组合龙
+    UPPER_FOUR,                         ///< 大于五
+    LOWER_FOUR,                         ///< 小于五
+    BIG_THREE_WINDS,                    ///< 三风刻
+
+    MIXED_STRAIGHT,                     ///< 花龙
+    REVERSIBLE_TILES,                   ///< 推不倒
+    MIXED_TRIPLE_CHOW,                  ///< 三色三同顺
+    MIXED_SHIFTED_PUNGS,                ///< 三色三节高
+    CHICKEN_HAND,                       ///< 无番和
+    LAST_TILE_DRAW,                     ///< 妙手回春
+    LAST_TILE_CLAIM,                    ///< 海底捞月
+    OUT_WITH_REPLACEMENT_TILE,          ///< 杠上开花
+    ROBBING_THE_KONG,                   ///< 抢杠和
+
+    ALL_PUNGS,                          ///< 碰碰和
     HALF_FLUSH,                         ///< 混一色
     MIXED_SHIFTED_CHOWS,                ///< 三色三步高
     ALL_TYPES,                          ///< 五门齐
@@ -1104,6 +1688,159 @@ typedef uint16_t fan_table_t[FAN_TABLE_SIZE];
  */
 int calculate_fan(const calculate_param_t *calculate_param, fan_table_t *fan_table);
 
+#define MAX_DIVISION_CNT 20  // 一副牌最多也没有20种划分吧，够用了
+
+/**
+ * @name fan form
+ * @{
+ */
+#define FAN_FORM_NONE               0   ///< 无效划分
+#define FAN_FORM_BASIC              1   ///< 基本和型
+#define FAN_FORM_KNITTED_STRAIGHT   2   ///< 组合龙+面子+雀头
+#define FAN_FORM_SPECIAL            3   ///< 七对、十三幺、全不靠/七星不靠
+/**
+ * @}
+ */
+
+/**
+ * @brief 算番候选
+ *  每种特殊和型或每种基本和型划分对应一个候选，记录不含场况的番数以及叠加场况所需的信息
+ */
+struct fan_candidate_t {
+    uint16_t fan;               ///< 不含场况的番数
+    uint8_t form;               ///< 和型，取值为FAN_FORM_*
+    uint8_t wind_pungs;         ///< 风刻，bit0~3依次对应东南西北（大四喜时为0，不计圈风刻、门风刻）
+    uint8_t self_drawn;         ///< 番表中自摸的计数
+    bool winds_deducted;        ///< 是否已经扣除过风刻的幺九刻（三风刻、混幺九、字一色、小四喜）
+};
+
+/**
+ * @brief 与场况无关的算番摘要
+ *  只依赖手牌、和牌张以及自摸、起手标记，和绝张、海底、杠、圈风、门风、花牌均不参与计算，
+ *  所以同一手牌在不同场况下可以复用，再叠加场况相关的番种。只求番数时有摘要就够了
+ */
+struct fan_summary_t {
+    int error;                  ///< 错误码，0为正常
+    win_flag_t win_flag;        ///< 计算时使用的和牌标记（只有自摸、起手）
+    bool standing_contains_win_tile;    ///< 立牌是否包含和牌
+    bool fixed_contains_kong;   ///< 副露是否包含杠
+    uint8_t win_tile_in_fixed_packs;    ///< 和牌在副露中出现的张数
+    intptr_t candidate_count;   ///< 候选数，下标0可能为特殊和型，其余为基本和型划分
+    fan_candidate_t candidates[MAX_DIVISION_CNT + 1];   ///< 候选
+};
+
+/**
+ * @brief 与场况无关的算番结果，在摘要的基础上附带各候选的番表
+ */
+struct fan_core_t : fan_summary_t {
+    fan_table_t fan_tables[MAX_DIVISION_CNT + 1];       ///< 候选对应的番表（不含场况相关的番种）
+};
+
+/**
+ * @brief 计算与场况无关的部分
+ *
+ * @param [in] hand_tiles 手牌
+ * @param [in] win_tile 和牌张
+ * @param [in] win_flag 和牌标记，只使用其中的自摸、起手
+ * @param [out] fan_core 结果
+ * @retval 0 成功
+ * @retval ERROR_WRONG_TILES_COUNT 错误的张数
+ * @retval ERROR_TILE_COUNT_GREATER_THAN_4 某张牌出现超过4枚
+ * @retval ERROR_NOT_WIN 没和牌
+ */
+int calculate_fan_core(const hand_tiles_t *hand_tiles, tile_t win_tile, win_flag_t win_flag, fan_core_t *fan_core);
+
+/**
+ * @brief 在与场况无关的结果上叠加场况，得到最终的番
+ *  涉及番种：和绝张、妙手回春、海底捞月、杠上开花、抢杠和、圈风刻、门风刻、无番和、花牌
+ *
+ * @param [in] fan_core calculate_fan_core的结果
+ * @param [in] win_flag 和牌标记，其中的自摸、起手以fan_core为准
+ * @param [in] prevalent_wind 圈风
+ * @param [in] seat_wind 门风
+ * @param [in] flower_count 花牌数
+ * @param [out] fan_table 番表，可为nullptr
+ * @return 同calculate_fan
+ */
+int apply_fan_context(const fan_core_t *fan_core, win_flag_t win_flag, wind_t prevalent_wind, wind_t seat_wind,
+    uint8_t flower_count, fan_table_t *fan_table);
+
+#ifndef FAN_CACHE_SIZE
+#define FAN_CACHE_SIZE 4096  ///< 算番缓存的条目数，必须为2的幂
+#endif
+
+/**
+ * @brief 带缓存的算番，只求番数
+ *  以排序后的副露、立牌、和牌张以及自摸、起手标记拼成128位的规范键，缓存与场况无关的算番摘要，
+ *  命中后再叠加场况。和绝张、海底、杠等其余标记不进键，由叠加场况处理。
+ *  缓存为直接映射，冲突时直接覆盖旧条目。每个线程各有一份缓存
+ *
+ * @param [in] calculate_param 算番参数
+ * @return 同calculate_fan
+ */
+int calculate_fan_cached(const calculate_param_t *calculate_param);
+
+/**
+ * @brief 算番缓存统计
+ */
+struct fan_cache_stats_t {
+    uint64_t hit;       ///< 命中次数
+    uint64_t miss;      ///< 未命中次数
+    uint64_t evict;     ///< 覆盖旧条目的次数
+    uint64_t bypass;    ///< 输入无法构造规范键而直接算番的次数
+};
+
+/**
+ * @brief 获取当前线程的算番缓存统计
+ *
+ * @param [out] stats 统计
+ */
+void get_fan_cache_stats(fan_cache_stats_t *stats);
+
+/**
+ * @brief 清空当前线程的算番缓存及统计
+ */
+void clear_fan_cache();
+
+#define FAN_DISTANCE_UNREACHABLE 127        ///< 无论怎么摸都和不了
+#define FAN_DISTANCE_DEFAULT_BUDGET 65536   ///< 基本和型默认最多生成的节点数
+
+/**
+ * @brief 8番和牌距离的参数
+ */
+struct fan_distance_param_t {
+    hand_tiles_t hand_tiles;        ///< 手牌，立牌须为13-3n张
+    tile_table_t wall_table;        ///< 每种牌还可能摸到的张数（不含手牌和副露）
+    win_flag_t win_flag;            ///< 和牌标记，和牌张由搜索决定
+    wind_t prevalent_wind;          ///< 圈风
+    wind_t seat_wind;               ///< 门风
+    int min_fan;                    ///< 起和番
+    int node_budget;                ///< 基本和型最多生成的节点数，不大于0时取默认值
+};
+
+/**
+ * @brief 8番和牌距离的结果
+ */
+struct fan_distance_result_t {
+    int distance;                   ///< 至少还要摸的张数（上听数+1）
+    uint8_t form_flag;              ///< 达到最短距离的和型
+    useful_table_t useful_table;    ///< 摸到后能缩短距离的牌
+    bool complete;                  ///< 是否在节点预算内搜完，否则distance只是找到的最好结果（可能为FAN_DISTANCE_UNREACHABLE）
+    int node_count;                 ///< 生成的节点数
+};
+
+/**
+ * @brief 8番和牌距离
+ *  求至少还要摸几张牌才能和出不少于起和番的牌，以及摸到后能缩短这个距离的牌。
+ *  与带番数限制的basic_form_shanten不同，不读写Table、useful、cur_min等全局状态，结果只取决于参数
+ *
+ * @param [in] param 参数
+ * @param [out] result 结果
+ * @retval true 成功
+ * @retval false 手牌张数或副露数不合法
+ */
+bool fan_distance(const fan_distance_param_t *param, fan_distance_result_t *result);
+
 #if 0
 
 /**
@@ -1265,10 +2002,13 @@ bool is_fixed_packs_contains_kong(const pack_t *fixed_packs, intptr_t fixed_cnt)
  * 12. 统一调整规则中规定不计的
  * 13. 最后调整圈风门风
  * 14. 以上流程走完，得到算番结果。如果为0番，则调整为无番和
+ *
+ * 其中和牌标记里的和绝张、海底、杠以及圈风门风只影响少数几个番种，所以算番拆成两步：
+ * 1. calculate_fan_core按自摸、起手算出每种和型/划分的番表（不含上述番种，也不做无番和调整）
+ * 2. apply_fan_context叠加场况相关的番种，再取最大值
+ * 同一手牌换场况时只需要重做第2步
  */
 
-#define MAX_DIVISION_CNT 20  // 一副牌最多也没有20种划分吧，够用了
-
 #if 0
 #else
 #define LOG(...) ((void)0)
@@ -1366,6 +2106,7 @@ static bool is_division_branch_exist(intptr_t fixed_cnt, intptr_t step, const di
 
 // 递归划分
 static bool divide_recursively(tile_table_t &cnt_table, intptr_t fixed_cnt, intptr_t step, division_t *work_division, division_result_t *result) {
+    SEARCH_STATS_STACK_FRAME();
     const intptr_t idx = step + fixed_cnt;
     if (idx == 4) {  // 4组面子都有了
         return divide_tail(cnt_table, fixed_cnt, work_division, result);
@@ -1420,6 +2161,7 @@ static bool divide_recursively(tile_table_t &cnt_table, intptr_t fixed_cnt, intp
 
 // 划分一手牌
 static bool divide_win_hand(const tile_t *standing_tiles, const pack_t *fixed_packs, intptr_t fixed_cnt, division_result_t *result) {
+    MAHJONG_TRACE_SCOPE("divide_win_hand");
     intptr_t standing_cnt = 14 - fixed_cnt * 3;
 
     // 对立牌的种类进行打表
@@ -2745,27 +3487,6 @@ static void adjust_fan_table(fan_table_t &fan_table) {
 }
 
 
-// 调整圈风刻、门风刻
-static void adjust_by_winds(tile_t tile, wind_t prevalent_wind, wind_t seat_wind, fan_table_t &fan_table) {
-    // 三风刻、混幺九、字一色、小四喜，这些番种已经扣除过幺九刻了
-    bool is_deducted = (fan_table[BIG_THREE_WINDS] || fan_table[ALL_TERMINALS_AND_HONORS] || fan_table[ALL_HONORS] || fan_table[LITTLE_FOUR_WINDS]);
-
-    rank_t delta = tile - TILE_E;
-    if (delta == static_cast<int>(prevalent_wind) - static_cast<int>(wind_t::EAST)) {
-        fan_table[PREVALENT_WIND] = 1;
-        if (!is_deducted) {
-            --fan_table[PUNG_OF_TERMINALS_OR_HONORS];
-        }
-    }
-    if (delta == static_cast<int>(seat_wind) - static_cast<int>(wind_t::EAST)) {
-        fan_table[SEAT_WIND] = 1;
-        // 当圈风门风相同时，已经扣除过幺九刻了
-        if (seat_wind != prevalent_wind && !is_deducted) {
-            --fan_table[PUNG_OF_TERMINALS_OR_HONORS];
-        }
-    }
-}
-
 // 根据和牌标记调整——涉及番种：和绝张、妙手回春、海底捞月、自摸
 static void adjust_by_win_flag(win_flag_t win_flag, fan_table_t &fan_table) {
     if (win_flag & WIN_FLAG_4TH_TILE) {
@@ -2782,8 +3503,9 @@ static void adjust_by_win_flag(win_flag_t win_flag, fan_table_t &fan_table) {
     }
 }
 
-// 基本和型算番
-static void calculate_basic_form_fan(const pack_t (&packs)[5], const calculate_param_t *calculate_param, win_flag_t win_flag, fan_table_t &fan_table) {
+// 基本和型算番（不含场况），返回风刻
+static bool calculate_basic_form_fan(const pack_t (&packs)[5], const hand_tiles_t *hand_tiles, tile_t win_tile, win_flag_t win_flag,
+    fan_table_t &fan_table, uint8_t &wind_pungs) {
     pack_t pair_pack = 0;
     pack_t chow_packs[4];
     pack_t pung_packs[4];
@@ -2795,17 +3517,15 @@ static void calculate_basic_form_fan(const pack_t (&packs)[5], const calculate_p
         case PACK_TYPE_PUNG:
         case PACK_TYPE_KONG: pung_packs[pung_cnt++] = packs[i]; break;
         case PACK_TYPE_PAIR: pair_pack = packs[i]; break;
-        default: UNREACHABLE(); return;
+        default: UNREACHABLE(); return false;
         }
     }
 
     if (pair_pack == 0 || chow_cnt + pung_cnt != 4) {
-        return;
+        return false;
     }
 
-    tile_t win_tile = calculate_param->win_tile;
-
-    // 根据和牌标记调整——涉及番种：和绝张、妙手回春、海底捞月、自摸
+    // 根据和牌标记调整——涉及番种：自摸
     adjust_by_win_flag(win_flag, fan_table);
 
     // 点和的牌张，如果不能解释为顺子中的一张，那么将其解释为刻子，并标记这个刻子为明刻
@@ -2899,11 +3619,9 @@ static void calculate_basic_form_fan(const pack_t (&packs)[5], const calculate_p
         break;
     }
 
-    intptr_t fixed_cnt = calculate_param->hand_tiles.pack_count;
-    const tile_t *standing_tiles = calculate_param->hand_tiles.standing_tiles;
-    intptr_t standing_cnt = calculate_param->hand_tiles.tile_count;
-    wind_t prevalent_wind = calculate_param->prevalent_wind;
-    wind_t seat_wind = calculate_param->seat_wind;
+    intptr_t fixed_cnt = hand_tiles->pack_count;
+    const tile_t *standing_tiles = hand_tiles->standing_tiles;
+    intptr_t standing_cnt = hand_tiles->tile_count;
 
     bool heaven_win = (win_flag & (WIN_FLAG_INIT | WIN_FLAG_SELF_DRAWN)) == (WIN_FLAG_INIT | WIN_FLAG_SELF_DRAWN);
 
@@ -2944,28 +3662,22 @@ static void calculate_basic_form_fan(const pack_t (&packs)[5], const calculate_p
     // 统一调整一些不计的
     adjust_fan_table(fan_table);
 
-    // 调整圈风刻、门风刻（大四喜不计圈风刻、门风刻）
+    // 记录风刻，圈风刻、门风刻以及无番和在叠加场况时调整（大四喜不计圈风刻、门风刻）
+    wind_pungs = 0;
     if (fan_table[BIG_FOUR_WINDS] == 0) {
         for (intptr_t i = 0; i < pung_cnt; ++i) {
             tile_t tile = pack_get_tile(pung_packs[i]);
             if (is_winds(tile)) {
-                adjust_by_winds(tile, prevalent_wind, seat_wind, fan_table);
+                wind_pungs |= 1 << (tile - TILE_E);
             }
         }
     }
-
-    // 如果什么番都没有，则计为无番和
-    if (std::all_of(std::begin(fan_table), std::end(fan_table), [](uint16_t p) { return p == 0; })) {
-        fan_table[CHICKEN_HAND] = 1;
-    }
+    return true;
 }
 
-// “组合龙+面子+雀头”和型算番
-static bool calculate_knitted_straight_fan(const calculate_param_t *calculate_param, win_flag_t win_flag, fan_table_t &fan_table) {
-    const hand_tiles_t *hand_tiles = &calculate_param->hand_tiles;
-    tile_t win_tile = calculate_param->win_tile;
-    wind_t prevalent_wind = calculate_param->prevalent_wind;
-    wind_t seat_wind = calculate_param->seat_wind;
+// “组合龙+面子+雀头”和型算番（不含场况），返回风刻
+static bool calculate_knitted_straight_fan(const hand_tiles_t *hand_tiles, tile_t win_tile, win_flag_t win_flag,
+    fan_table_t &fan_table, uint8_t &wind_pungs) {
 
     intptr_t fixed_cnt = hand_tiles->pack_count;
     if (fixed_cnt > 1) {
@@ -3067,11 +3779,9 @@ static bool calculate_knitted_straight_fan(const calculate_param_t *calculate_pa
     // 统一调整一些不计的
     adjust_fan_table(fan_table);
 
-    // 调整圈风刻、门风刻
+    // 记录风刻，圈风刻、门风刻在叠加场况时调整
     tile_t tile = pack_get_tile(packs[3]);
-    if (is_winds(tile)) {
-        adjust_by_winds(tile, prevalent_wind, seat_wind, fan_table);
-    }
+    wind_pungs = is_winds(tile) ? static_cast<uint8_t>(1 << (tile - TILE_E)) : 0;
 
     return true;
 }
@@ -3245,120 +3955,417 @@ int check_calculator_input(const hand_tiles_t *hand_tiles, tile_t win_tile) {
 ////////////////////////////////////////////////////////////////////////////////////////////////////////
 // 算番
 //
-int calculate_fan(const calculate_param_t *calculate_param, fan_table_t *fan_table) {
-    const hand_tiles_t *hand_tiles = &calculate_param->hand_tiles;
-    tile_t win_tile = calculate_param->win_tile;
-    win_flag_t win_flag = calculate_param->win_flag;
+
+// 特殊和型预筛：用牌的位掩码在O(1)内排除绝大多数不可能的情况，通过预筛的再做完整判断
+
+// 构造牌的位掩码，并统计牌的种类数
+static FORCE_INLINE uint64_t make_tiles_mask(const tile_t *tiles, intptr_t cnt, int &kinds) {
+    uint64_t mask = 0;
+    kinds = 0;
+    for (intptr_t i = 0; i < cnt; ++i) {
+        uint64_t bit = 1ULL << (tiles[i] - TILE_1m);
+        if ((mask & bit) == 0) {
+            mask |= bit;
+            ++kinds;
+        }
+    }
+    return mask;
+}
+
+// 是否可能为“组合龙+面子+雀头”：必须包含某一种组合龙的全部9种牌
+static FORCE_INLINE bool may_be_knitted_straight(uint64_t mask) {
+    for (int i = 0; i < 6; ++i) {
+        if ((mask & standard_knitted_straight_mask[i]) == standard_knitted_straight_mask[i]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// 是否可能为七对、十三幺、全不靠/七星不靠（门清14张）
+static FORCE_INLINE bool may_be_special_form(uint64_t mask, int kinds) {
+    // 七对：最多7种牌
+    if (kinds <= 7) {
+        return true;
+    }
+    // 十三幺：恰好是13种幺九牌
+    if (mask == standard_thirteen_orphans_mask) {
+        return true;
+    }
+    // 全不靠：14张各不相同，且数牌全部落在某一种组合龙中
+    if (kinds == 14) {
+        uint64_t numbered = mask & ~standard_honors_mask;
+        for (int i = 0; i < 6; ++i) {
+            if ((numbered & ~standard_knitted_straight_mask[i]) == 0) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// 记录一个候选
+static void add_fan_candidate(fan_core_t *fan_core, uint8_t form, uint8_t wind_pungs) {
+    intptr_t idx = fan_core->candidate_count++;
+    const fan_table_t &fan_table = fan_core->fan_tables[idx];
+    fan_candidate_t &candidate = fan_core->candidates[idx];
+    candidate.fan = static_cast<uint16_t>(get_fan_by_table(fan_table));
+    candidate.form = form;
+    candidate.wind_pungs = wind_pungs;
+    candidate.self_drawn = static_cast<uint8_t>(fan_table[SELF_DRAWN]);
+    // 三风刻、混幺九、字一色、小四喜，这些番种已经扣除过幺九刻了
+    candidate.winds_deducted = (fan_table[BIG_THREE_WINDS] || fan_table[ALL_TERMINALS_AND_HONORS]
+        || fan_table[ALL_HONORS] || fan_table[LITTLE_FOUR_WINDS]);
+    LOG("fan = %d\n\n", candidate.fan);
+}
+
+int calculate_fan_core(const hand_tiles_t *hand_tiles, tile_t win_tile, win_flag_t win_flag, fan_core_t *fan_core) {
+    // 只保留自摸、起手标记，其余的和牌标记在叠加场况时处理
+    win_flag &= (WIN_FLAG_SELF_DRAWN | WIN_FLAG_INIT);
+    fan_core->win_flag = win_flag;
+    fan_core->candidate_count = 0;
 
     if (int ret = check_calculator_input(hand_tiles, win_tile)) {
+        fan_core->error = ret;
         return ret;
     }
 
     intptr_t fixed_cnt = hand_tiles->pack_count;
     intptr_t standing_cnt = hand_tiles->tile_count;
 
-    // 校正和牌标记
-    // 如果立牌包含和牌，则必然不是和绝张
-    const bool standing_tiles_contains_win_tile = is_standing_tiles_contains_win_tile(hand_tiles->standing_tiles, standing_cnt, win_tile);
-    if (standing_tiles_contains_win_tile) {
-        win_flag &= ~WIN_FLAG_4TH_TILE;
-    }
+    // 校正和牌标记要用到的手牌特征
+    fan_core->standing_contains_win_tile = is_standing_tiles_contains_win_tile(hand_tiles->standing_tiles, standing_cnt, win_tile);
+    fan_core->win_tile_in_fixed_packs = static_cast<uint8_t>(count_win_tile_in_fixed_packs(hand_tiles->fixed_packs, fixed_cnt, win_tile));
+    fan_core->fixed_contains_kong = is_fixed_packs_contains_kong(hand_tiles->fixed_packs, fixed_cnt);
 
-    // 如果和牌在副露中出现3张，则必然为和绝张
-    const size_t win_tile_in_fixed_packs = count_win_tile_in_fixed_packs(hand_tiles->fixed_packs, fixed_cnt, win_tile);
-    if (3 == win_tile_in_fixed_packs) {
-        win_flag |= WIN_FLAG_4TH_TILE;
+    // 合并立牌与和牌，并排序，最多为14张
+    tile_t standing_tiles[14];
+    memcpy(standing_tiles, hand_tiles->standing_tiles, standing_cnt * sizeof(tile_t));
+    standing_tiles[standing_cnt] = win_tile;
+    std::sort(standing_tiles, standing_tiles + standing_cnt + 1);
+
+    // 先判断各种特殊和型，特殊和型放在下标0处
+    if (fixed_cnt <= 1) {  // 门清或1副露状态，有可能是基本和型组合龙
+        int kinds;
+        uint64_t mask = make_tiles_mask(standing_tiles, standing_cnt + 1, kinds);
+        fan_table_t &special_fan_table = fan_core->fan_tables[0];
+        memset(special_fan_table, 0, sizeof(special_fan_table));
+        uint8_t wind_pungs = 0;
+        if (may_be_knitted_straight(mask)
+            && calculate_knitted_straight_fan(hand_tiles, win_tile, win_flag, special_fan_table, wind_pungs)) {
+            add_fan_candidate(fan_core, FAN_FORM_KNITTED_STRAIGHT, wind_pungs);
+        }
+        else if (fixed_cnt == 0 && may_be_special_form(mask, kinds)
+            && calculate_special_form_fan(standing_tiles, win_flag, special_fan_table)) {
+            add_fan_candidate(fan_core, FAN_FORM_SPECIAL, 0);
+        }
+    }
+
+    // 无法构成特殊和型或者为七对
+    // 七对也要按基本和型划分，因为极端情况下，基本和型的番会超过七对的番
+    if (fan_core->candidate_count == 0 || fan_core->fan_tables[0][SEVEN_PAIRS] == 1) {
+        // 划分
+        division_result_t result;
+        if (divide_win_hand(standing_tiles, hand_tiles->fixed_packs, fixed_cnt, &result)) {
+            // 遍历各种划分方式，分别算番
+            for (intptr_t i = 0; i < result.count; ++i) {
+#if 0  // Debug
+                char str[64];
+                packs_to_string(result.divisions[i].packs, 5, str, sizeof(str));
+                puts(str);
+#endif
+                fan_table_t &fan_table = fan_core->fan_tables[fan_core->candidate_count];
+                memset(fan_table, 0, sizeof(fan_table));
+                uint8_t wind_pungs = 0;
+                bool valid = calculate_basic_form_fan(result.divisions[i].packs, hand_tiles, win_tile, win_flag, fan_table, wind_pungs);
+                add_fan_candidate(fan_core, valid ? FAN_FORM_BASIC : FAN_FORM_NONE, wind_pungs);
+            }
+        }
+    }
+
+    fan_core->error = (fan_core->candidate_count > 0) ? 0 : ERROR_NOT_WIN;
+    return fan_core->error;
+}
+
+// 在一个候选上叠加场况，返回番数（不含花牌）
+// fan_table不为nullptr时，应传入该候选的番表，会在其上做相应的调整
+static int apply_context_to_candidate(const fan_candidate_t &candidate, win_flag_t win_flag,
+    wind_t prevalent_wind, wind_t seat_wind, fan_table_t *fan_table) {
+    if (candidate.form == FAN_FORM_NONE) {
+        return candidate.fan;
+    }
+
+    int fan = candidate.fan;
+    auto add_fan = [&fan, fan_table](fan_t f) {
+        fan += fan_value_table[f];
+        if (fan_table != nullptr) {
+            (*fan_table)[f] = 1;
+        }
+    };
+    auto deduct_fan = [&fan, fan_table](fan_t f, uint16_t cnt) {
+        fan -= fan_value_table[f] * cnt;
+        if (fan_table != nullptr) {
+            (*fan_table)[f] -= cnt;
+        }
+    };
+
+    // 根据和牌标记调整——涉及番种：和绝张、妙手回春、海底捞月、杠上开花、抢杠和
+    const bool self_drawn = (win_flag & WIN_FLAG_SELF_DRAWN) != 0;
+    // 抢杠和不计和绝张
+    if ((win_flag & WIN_FLAG_4TH_TILE) && !(!self_drawn && (win_flag & WIN_FLAG_ABOUT_KONG))) {
+        add_fan(LAST_TILE);
+    }
+    if (win_flag & WIN_FLAG_WALL_LAST) {
+        add_fan(self_drawn ? LAST_TILE_DRAW : LAST_TILE_CLAIM);
+    }
+    if (win_flag & WIN_FLAG_ABOUT_KONG) {
+        add_fan(self_drawn ? OUT_WITH_REPLACEMENT_TILE : ROBBING_THE_KONG);
+    }
+    // 妙手回春、杠上开花不计自摸
+    if (self_drawn && (win_flag & (WIN_FLAG_WALL_LAST | WIN_FLAG_ABOUT_KONG))) {
+        deduct_fan(SELF_DRAWN, candidate.self_drawn);
+    }
+
+    // 调整圈风刻、门风刻
+    for (int delta = 0; delta < 4; ++delta) {
+        if ((candidate.wind_pungs & (1 << delta)) == 0) {
+            continue;
+        }
+        if (delta == static_cast<int>(prevalent_wind) - static_cast<int>(wind_t::EAST)) {
+            add_fan(PREVALENT_WIND);
+            if (!candidate.winds_deducted) {
+                deduct_fan(PUNG_OF_TERMINALS_OR_HONORS, 1);
+            }
+        }
+        if (delta == static_cast<int>(seat_wind) - static_cast<int>(wind_t::EAST)) {
+            add_fan(SEAT_WIND);
+            // 当圈风门风相同时，已经扣除过幺九刻了
+            if (seat_wind != prevalent_wind && !candidate.winds_deducted) {
+                deduct_fan(PUNG_OF_TERMINALS_OR_HONORS, 1);
+            }
+        }
+    }
+
+    // 基本和型如果什么番都没有，则计为无番和
+    if (candidate.form == FAN_FORM_BASIC && fan == 0) {
+        add_fan(CHICKEN_HAND);
+    }
+
+    return fan;
+}
+
+// 在摘要上叠加场况，fan_tables为nullptr时只求番数
+static int apply_fan_context(const fan_summary_t *fan_core, const fan_table_t *fan_tables, win_flag_t win_flag,
+    wind_t prevalent_wind, wind_t seat_wind, uint8_t flower_count, fan_table_t *fan_table) {
+    if (fan_core->error != 0) {
+        return fan_core->error;
+    }
+
+    // 自摸、起手以fan_core为准
+    win_flag = (win_flag & ~(WIN_FLAG_SELF_DRAWN | WIN_FLAG_INIT)) | fan_core->win_flag;
+
+    // 校正和牌标记
+    // 如果立牌包含和牌，则必然不是和绝张
+    if (fan_core->standing_contains_win_tile) {
+        win_flag &= ~WIN_FLAG_4TH_TILE;
+    }
+
+    // 如果和牌在副露中出现3张，则必然为和绝张
+    if (3 == fan_core->win_tile_in_fixed_packs) {
+        win_flag |= WIN_FLAG_4TH_TILE;
     }
 
     // 附加杠标记
     if (win_flag & WIN_FLAG_ABOUT_KONG) {
         if (win_flag & WIN_FLAG_SELF_DRAWN) {  // 自摸
             // 如果手牌没有杠，则必然不是杠上开花
-            if (!is_fixed_packs_contains_kong(hand_tiles->fixed_packs, fixed_cnt)) {
+            if (!fan_core->fixed_contains_kong) {
                 win_flag &= ~WIN_FLAG_ABOUT_KONG;
             }
         }
         else {  // 点和
             // 如果和牌在手牌范围内出现过，则必然不是抢杠和
-            if (win_tile_in_fixed_packs > 0 || standing_tiles_contains_win_tile) {
+            if (fan_core->win_tile_in_fixed_packs > 0 || fan_core->standing_contains_win_tile) {
                 win_flag &= ~WIN_FLAG_ABOUT_KONG;
             }
         }
     }
 
-    // 合并立牌与和牌，并排序，最多为14张
-    tile_t standing_tiles[14];
-    memcpy(standing_tiles, hand_tiles->standing_tiles, standing_cnt * sizeof(tile_t));
-    standing_tiles[standing_cnt] = win_tile;
-    std::sort(standing_tiles, standing_tiles + standing_cnt + 1);
-
     // 最大番标记
+    // 特殊和型在下标0处，有则先选上，基本和型的划分只有番数更大时才替换
     int max_fan = 0;
-    const fan_table_t *selected_fan_table = nullptr;
+    intptr_t selected = -1;
+    for (intptr_t i = 0; i < fan_core->candidate_count; ++i) {
+        const fan_candidate_t &candidate = fan_core->candidates[i];
+        int current_fan = apply_context_to_candidate(candidate, win_flag, prevalent_wind, seat_wind, nullptr);
+        if (current_fan > max_fan || (i == 0 && candidate.form != FAN_FORM_BASIC && candidate.form != FAN_FORM_NONE)) {
+            max_fan = current_fan;
+            selected = i;
+        }
+    }
+
+    if (selected < 0) {
+        return ERROR_NOT_WIN;
+    }
+
+    // 加花牌
+    max_fan += flower_count;
+
+    if (fan_tables != nullptr && fan_table != nullptr) {
+        memcpy(*fan_table, fan_tables[selected], sizeof(*fan_table));
+        apply_context_to_candidate(fan_core->candidates[selected], win_flag, prevalent_wind, seat_wind, fan_table);
+        (*fan_table)[FLOWER_TILES] = flower_count;
+    }
+
+    return max_fan;
+}
+
+int apply_fan_context(const fan_core_t *fan_core, win_flag_t win_flag, wind_t prevalent_wind, wind_t seat_wind,
+    uint8_t flower_count, fan_table_t *fan_table) {
+    return apply_fan_context(fan_core, fan_core->fan_tables, win_flag, prevalent_wind, seat_wind, flower_count, fan_table);
+}
+
+int calculate_fan(const calculate_param_t *calculate_param, fan_table_t *fan_table) {
+    MAHJONG_TRACE_SCOPE("calculate_fan");
+    fan_core_t fan_core;
+    calculate_fan_core(&calculate_param->hand_tiles, calculate_param->win_tile, calculate_param->win_flag, &fan_core);
+    return apply_fan_context(&fan_core, calculate_param->win_flag, calculate_param->prevalent_wind,
+        calculate_param->seat_wind, calculate_param->flower_count, fan_table);
+}
+
+//-------------------------------- 算番缓存 --------------------------------
+
+namespace {
 
-    // 特殊和型的番
-    fan_table_t special_fan_table = { 0 };
+    // 缓存条目
+    struct fan_cache_entry_t {
+        uint64_t key[2];        // 规范键，key[1]为0表示空条目（和牌张编码不为0，所以合法的键key[1]必不为0）
+        fan_summary_t summary;  // 与场况无关的算番摘要
+    };
+
+    // 工具程序会在多个线程中算番，每个线程各用一份
+    thread_local fan_cache_entry_t fan_cache[FAN_CACHE_SIZE];
+    thread_local fan_cache_stats_t fan_cache_stats;
 
-    // 先判断各种特殊和型
-    if (fixed_cnt == 0) {  // 门清状态，有可能是基本和型组合龙
-        if (calculate_knitted_straight_fan(calculate_param, win_flag, special_fan_table)) {
-            max_fan = get_fan_by_table(special_fan_table);
-            selected_fan_table = &special_fan_table;
-            LOG("fan = %d\n\n", max_fan);
+    // 牌的6位编码，1~34，0表示无效
+    FORCE_INLINE uint64_t tile_code(tile_t tile) {
+        suit_t suit = tile_get_suit(tile);
+        rank_t rank = tile_get_rank(tile);
+        if (suit >= TILE_SUIT_CHARACTERS && suit <= TILE_SUIT_DOTS) {
+            return (rank >= 1 && rank <= 9) ? (suit - 1) * 9 + rank : 0;
         }
-        else if (calculate_special_form_fan(standing_tiles, win_flag, special_fan_table)) {
-            max_fan = get_fan_by_table(special_fan_table);
-            selected_fan_table = &special_fan_table;
-            LOG("fan = %d\n\n", max_fan);
+        if (suit == TILE_SUIT_HONORS) {
+            return (rank >= 1 && rank <= 7) ? 27 + rank : 0;
         }
+        return 0;
     }
-    else if (fixed_cnt == 1) {  // 1副露状态，有可能是基本和型组合龙
-        if (calculate_knitted_straight_fan(calculate_param, win_flag, special_fan_table)) {
-            max_fan = get_fan_by_table(special_fan_table);
-            selected_fan_table = &special_fan_table;
-            LOG("fan = %d\n\n", max_fan);
-        }
+
+}
+
+static_assert((FAN_CACHE_SIZE & (FAN_CACHE_SIZE - 1)) == 0, "FAN_CACHE_SIZE must be a power of 2");
+
+// 构造规范键
+// 副露和立牌先排序，再按位拼接：
+// key[0]：立牌前10张（每张6位）| 自摸、起手（2位），摘要只依赖这两个标记，和绝张等其余标记不进键
+// key[1]：立牌后3张（每张6位）| 和牌张（6位）| 4组副露（每组10位：类型2位、供牌2位、牌6位）
+// 每个字段都有确定的位置，所以不同的输入必然得到不同的键
+static bool make_fan_cache_key(const calculate_param_t *calculate_param, uint64_t (&key)[2]) {
+    const hand_tiles_t *hand_tiles = &calculate_param->hand_tiles;
+    intptr_t fixed_cnt = hand_tiles->pack_count;
+    intptr_t standing_cnt = hand_tiles->tile_count;
+    if (fixed_cnt < 0 || fixed_cnt > 4 || standing_cnt < 0 || standing_cnt > 13) {
+        return false;
     }
 
-    // 无法构成特殊和型或者为七对
-    // 七对也要按基本和型划分，因为极端情况下，基本和型的番会超过七对的番
-    if (selected_fan_table == nullptr || special_fan_table[SEVEN_PAIRS] == 1) {
-        // 划分
-        division_result_t result;
-        if (divide_win_hand(standing_tiles, hand_tiles->fixed_packs, fixed_cnt, &result)) {
-            fan_table_t fan_tables[MAX_DIVISION_CNT] = { { 0 } };
+    uint64_t win_code = tile_code(calculate_param->win_tile);
+    if (win_code == 0) {
+        return false;
+    }
 
-            // 遍历各种划分方式，分别算番，找出最大的番的划分方式
-            for (intptr_t i = 0; i < result.count; ++i) {
-#if 0  // Debug
-                char str[64];
-                packs_to_string(result.divisions[i].packs, 5, str, sizeof(str));
-                puts(str);
-#endif
-                calculate_basic_form_fan(result.divisions[i].packs, calculate_param, win_flag, fan_tables[i]);
-                int current_fan = get_fan_by_table(fan_tables[i]);
-                if (current_fan > max_fan) {
-                    max_fan = current_fan;
-                    selected_fan_table = &fan_tables[i];
-                }
-                LOG("fan = %d\n\n", current_fan);
-            }
+    uint64_t tile_codes[13] = { 0 };
+    for (intptr_t i = 0; i < standing_cnt; ++i) {
+        tile_codes[i] = tile_code(hand_tiles->standing_tiles[i]);
+        if (tile_codes[i] == 0) {
+            return false;
         }
     }
+    std::sort(tile_codes, tile_codes + standing_cnt);
 
-    if (selected_fan_table == nullptr) {
-        return ERROR_NOT_WIN;
+    uint64_t pack_codes[4] = { 0 };
+    for (intptr_t i = 0; i < fixed_cnt; ++i) {
+        pack_t pack = hand_tiles->fixed_packs[i];
+        uint8_t type = pack_get_type(pack);
+        uint8_t offer = pack_get_offer(pack);
+        uint64_t code = tile_code(pack_get_tile(pack));
+        if (type < PACK_TYPE_CHOW || type > PACK_TYPE_KONG || offer > 3 || code == 0) {
+            return false;
+        }
+        pack_codes[i] = (static_cast<uint64_t>(type) << 8) | (static_cast<uint64_t>(offer) << 6) | code;
     }
+    std::sort(pack_codes, pack_codes + fixed_cnt);
 
-    // 加花牌
-    max_fan += calculate_param->flower_count;
+    uint64_t k0 = 0, k1 = 0;
+    for (int i = 0; i < 10; ++i) {
+        k0 = (k0 << 6) | tile_codes[i];
+    }
+    k0 = (k0 << 2) | ((calculate_param->win_flag & WIN_FLAG_SELF_DRAWN) ? 0x01 : 0)
+        | ((calculate_param->win_flag & WIN_FLAG_INIT) ? 0x02 : 0);
+    for (int i = 10; i < 13; ++i) {
+        k1 = (k1 << 6) | tile_codes[i];
+    }
+    k1 = (k1 << 6) | win_code;
+    for (int i = 0; i < 4; ++i) {
+        k1 = (k1 << 10) | pack_codes[i];
+    }
+    key[0] = k0;
+    key[1] = k1;
+    return true;
+}
 
-    if (fan_table != nullptr) {
-        memcpy(*fan_table, *selected_fan_table, sizeof(*fan_table));
-        (*fan_table)[FLOWER_TILES] = calculate_param->flower_count;
+// 由规范键计算条目下标
+static FORCE_INLINE size_t fan_cache_index(const uint64_t (&key)[2]) {
+    uint64_t h = key[0] * 0x9E3779B97F4A7C15ULL ^ key[1];
+    h ^= h >> 32;
+    h *= 0xD6E8FEB86659FD93ULL;
+    h ^= h >> 32;
+    return static_cast<size_t>(h & (FAN_CACHE_SIZE - 1));
+}
+
+int calculate_fan_cached(const calculate_param_t *calculate_param) {
+    MAHJONG_TRACE_SCOPE("calculate_fan_cached");
+    uint64_t key[2];
+    if (!make_fan_cache_key(calculate_param, key)) {
+        ++fan_cache_stats.bypass;
+        return calculate_fan(calculate_param, nullptr);
     }
 
-    return max_fan;
+    fan_cache_entry_t &entry = fan_cache[fan_cache_index(key)];
+    if (entry.key[0] == key[0] && entry.key[1] == key[1]) {
+        ++fan_cache_stats.hit;
+    }
+    else {
+        ++fan_cache_stats.miss;
+        if (entry.key[1] != 0) {
+            ++fan_cache_stats.evict;
+        }
+        fan_core_t fan_core;
+        calculate_fan_core(&calculate_param->hand_tiles, calculate_param->win_tile, calculate_param->win_flag, &fan_core);
+        entry.key[0] = key[0];
+        entry.key[1] = key[1];
+        entry.summary = fan_core;
+    }
+
+    return apply_fan_context(&entry.summary, nullptr, calculate_param->win_flag, calculate_param->prevalent_wind,
+        calculate_param->seat_wind, calculate_param->flower_count, nullptr);
+}
+
+void get_fan_cache_stats(fan_cache_stats_t *stats) {
+    *stats = fan_cache_stats;
+}
+
+void clear_fan_cache() {
+    memset(fan_cache, 0, sizeof(fan_cache));
+    memset(&fan_cache_stats, 0, sizeof(fan_cache_stats));
 }
 
 }
@@ -4393,6 +5400,68 @@ intptr_t table_to_tiles(const tile_table_t &cnt_table, tile_t *tiles, intptr_t m
     return cnt;
 }
 
+// 将表转换成密集牌表
+void table_to_dense_table(const tile_table_t &cnt_table, dense_tile_table_t *dense_table) {
+    for (int i = 0; i < 34; ++i) {
+        (*dense_table)[i] = static_cast<uint8_t>(cnt_table[all_tiles[i]]);
+    }
+}
+
+// 将密集牌表转换成表
+void dense_table_to_table(const dense_tile_table_t &dense_table, tile_table_t *cnt_table) {
+    memset(*cnt_table, 0, sizeof(*cnt_table));
+    for (int i = 0; i < 34; ++i) {
+        (*cnt_table)[all_tiles[i]] = dense_table[i];
+    }
+}
+
+// 将有效牌标记表转换成密集有效牌标记
+dense_useful_table_t useful_table_to_dense(const useful_table_t &useful_table) {
+    dense_useful_table_t dense_useful = 0;
+    for (int i = 0; i < 34; ++i) {
+        if (useful_table[all_tiles[i]]) {
+            dense_useful |= 1ULL << i;
+        }
+    }
+    return dense_useful;
+}
+
+// 将密集有效牌标记转换成有效牌标记表
+void dense_to_useful_table(dense_useful_table_t dense_useful, useful_table_t *useful_table) {
+    memset(*useful_table, 0, sizeof(*useful_table));
+    for (int i = 0; i < 34; ++i) {
+        (*useful_table)[all_tiles[i]] = ((dense_useful >> i) & 1) != 0;
+    }
+}
+
+// 将牌打成压缩牌表
+void map_tiles(const tile_t *tiles, intptr_t cnt, packed_hand_t *packed_hand) {
+    packed_hand->words[0] = packed_hand->words[1] = 0;
+    for (intptr_t i = 0; i < cnt; ++i) {
+        packed_hand_add(packed_hand, tiles[i]);
+    }
+}
+
+// 将表转换成压缩牌表
+void table_to_packed_hand(const tile_table_t &cnt_table, packed_hand_t *packed_hand) {
+    packed_hand->words[0] = packed_hand->words[1] = 0;
+    for (int i = 0; i < 34; ++i) {
+        int offset = packed_hand_offset(all_tiles[i]);
+        packed_hand->words[offset >> 6] += static_cast<uint64_t>(cnt_table[all_tiles[i]]) << (offset & 63);
+    }
+}
+
+// 将压缩牌表转换成表，只需遍历有的牌
+void packed_hand_to_table(const packed_hand_t &packed_hand, tile_table_t *cnt_table) {
+    memset(*cnt_table, 0, sizeof(*cnt_table));
+    for (int w = 0; w < 2; ++w) {
+        for (uint64_t mask = packed_hand_present(packed_hand.words[w]); mask != 0; mask &= mask - 1) {
+            int bit = packed_hand_lowest_bit(mask);
+            (*cnt_table)[packed_hand_bit_tile(w, bit)] = static_cast<uint16_t>((packed_hand.words[w] >> bit) & 7);
+        }
+    }
+}
+
 namespace {
 
     // 路径单元，单元有面子、雀头、搭子等种类，见下面的宏
@@ -4419,7 +5488,8 @@ namespace {
     // 一条路径
     struct work_path_t {
         path_unit_t units[UNIT_SIZE];  // 14/2=7最多7个搭子
-        uint16_t depth;  // 当前路径深度
+        uint8_t depth;  // 当前路径深度
+        int8_t result;  // 保存的路径为该节点返回的上听数，凑不到8番时为INT8_MAX
     };
 
     // 当前工作状态
@@ -4429,43 +5499,97 @@ namespace {
     };
 }
 
-// 路径是否来过了
-static bool is_basic_form_branch_exist(const intptr_t fixed_cnt, const work_path_t *work_path, const work_state_t *work_state) {
-    if (work_state->count <= 0 || work_path->depth == 0) {
+// 搜索规模与各决策函数耗时的统计，每回合随输出写到Botzone的debug行，tools目录下的工具也用它
+// 定义MAHJONG_NO_SEARCH_STATS可完全去掉，此时统计的宏展开为空，开关在栈用量统计处
+#ifdef MAHJONG_SEARCH_STATS
+struct search_stats_t {
+    uint64_t recursion_nodes;   // basic_form_shanten_recursively的调用次数
+    uint64_t makeup_nodes;      // Makeup_Packs的调用次数
+    uint64_t makeup_leaves;     // Makeup_Packs补全后算番的次数
+    uint64_t overload_subsets;  // overloaded_packs_fan枚举的牌组组合数
+    uint64_t fan_calls;         // __calcluate_fan的调用次数
+    intptr_t peak_paths;        // 一次搜索中work_state保存的路径数的峰值，上限为MAX_STATE
+    uint64_t check_hu_ns;       // check_hu的累计耗时（纳秒）
+    uint64_t chi_peng_gang_ns;  // Chi_Peng_Gang的累计耗时，含其中调用的Policy
+    uint64_t policy_ns;         // Policy的累计耗时
+};
+
+search_stats_t search_stats;
+
+// 作用域内的耗时累加到统计的某一项
+struct search_stats_timer_t {
+    uint64_t &total_ns;
+    std::chrono::steady_clock::time_point begin;
+
+    explicit search_stats_timer_t(uint64_t &total) : total_ns(total), begin(std::chrono::steady_clock::now()) { }
+    ~search_stats_timer_t() {
+        total_ns += static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count());
+    }
+};
+
+#define SEARCH_STATS_INC(field_) (++search_stats.field_)
+#define SEARCH_STATS_PEAK(field_, value_) (search_stats.field_ = std::max(search_stats.field_, static_cast<intptr_t>(value_)))
+#define SEARCH_STATS_TIME(field_) search_stats_timer_t search_stats_timer_(search_stats.field_)
+#else
+#define SEARCH_STATS_INC(field_) ((void)0)
+#define SEARCH_STATS_PEAK(field_, value_) ((void)0)
+#define SEARCH_STATS_TIME(field_) ((void)0)
+#endif
+
+// 是否用路径查重剪枝，只供测试对照未剪枝的搜索时关掉
+bool basic_form_branch_dedup = true;
+
+// 路径是否来过了，来过时result为那个节点返回的上听数
+// depth为当前节点的深度，当前路径为units[fixed_cnt, depth)，units[depth]为刚记录的分支
+// 深度不放在work_path里，递归返回后再往后的格子还是子节点留下的，只能读到units[depth]为止
+// 只有连同分支排序后与保存过的路径完全相同，即那个子节点已经算过时才算来过；
+// 只是某条路径的子集时剩下的牌不同，结果也不同
+static bool is_basic_form_branch_exist(const intptr_t fixed_cnt, const unsigned depth, const work_path_t *work_path, const work_state_t *work_state,
+    int *result) {
+    if (!basic_form_branch_dedup || work_state->count <= 0 || depth == 0) {
         return false;
     }
 
-    // depth处有信息，所以按stl风格的end应该要+1
-    const uint16_t depth = static_cast<uint16_t>(work_path->depth + 1);
+    // 连同分支一起比较，按stl风格的end应该要+1
+    const unsigned end = depth + 1;
 
-    // std::includes要求有序，但又不能破坏当前数据
+    // 保存的路径是有序的，比较前先排序，但又不能破坏当前数据
     work_path_t temp;
-    std::copy(&work_path->units[fixed_cnt], &work_path->units[depth], &temp.units[fixed_cnt]);
-    std::sort(&temp.units[fixed_cnt], &temp.units[depth]);
+    std::copy(&work_path->units[fixed_cnt], &work_path->units[end], &temp.units[fixed_cnt]);
+    std::sort(&temp.units[fixed_cnt], &temp.units[end]);
 
-    return std::any_of(&work_state->paths[0], &work_state->paths[work_state->count],
-        [&temp, fixed_cnt, depth](const work_path_t &path) {
-        return std::includes(&path.units[fixed_cnt], &path.units[path.depth], &temp.units[fixed_cnt], &temp.units[depth]);
+    const work_path_t *found = std::find_if(&work_state->paths[0], &work_state->paths[work_state->count],
+        [&temp, fixed_cnt, end](const work_path_t &path) {
+        return path.depth == end && std::equal(&path.units[fixed_cnt], &path.units[end], &temp.units[fixed_cnt]);
     });
+    if (found == &work_state->paths[work_state->count]) {
+        return false;
+    }
+    *result = found->result == INT8_MAX ? 2146483647 : found->result;
+    return true;
 }
 
-// 保存路径
-static void save_work_path(const intptr_t fixed_cnt, const work_path_t *work_path, work_state_t *work_state) {
+// 保存路径及该节点返回的上听数
+// depth为当前节点的深度，只保存当前路径units[fixed_cnt, depth)，units[depth]是这一层还没记录或试过的分支
+static void save_work_path(const intptr_t fixed_cnt, const unsigned depth, int result, const work_path_t *work_path, work_state_t *work_state) {
     // 复制一份数据，不破坏当前数据
     work_path_t temp;
-    temp.depth = work_path->depth;
-    std::copy(&work_path->units[fixed_cnt], &work_path->units[temp.depth + 1], &temp.units[fixed_cnt]);
-    std::sort(&temp.units[fixed_cnt], &temp.units[temp.depth + 1]);
+    temp.depth = static_cast<uint8_t>(depth);
+    temp.result = static_cast<int8_t>(std::min(result, static_cast<int>(INT8_MAX)));
+    std::copy(&work_path->units[fixed_cnt], &work_path->units[depth], &temp.units[fixed_cnt]);
+    std::sort(&temp.units[fixed_cnt], &temp.units[depth]);
 
     // 判断是否重复
     if (std::none_of(&work_state->paths[0], &work_state->paths[work_state->count],
         [&temp, fixed_cnt](const work_path_t &path) {
-        return (path.depth == temp.depth && std::equal(&path.units[fixed_cnt], &path.units[path.depth + 1], &temp.units[fixed_cnt]));
+        return (path.depth == temp.depth && std::equal(&path.units[fixed_cnt], &path.units[path.depth], &temp.units[fixed_cnt]));
     })) {
         if (work_state->count < MAX_STATE) {
             work_path_t &path = work_state->paths[work_state->count++];
+            SEARCH_STATS_PEAK(peak_paths, work_state->count);
             path.depth = temp.depth;
-            std::copy(&temp.units[fixed_cnt], &temp.units[temp.depth + 1], &path.units[fixed_cnt]);
+            path.result = temp.result;
+            std::copy(&temp.units[fixed_cnt], &temp.units[temp.depth], &path.units[fixed_cnt]);
         }
         else {
             assert(0 && "too many state!");
@@ -4486,17 +5610,23 @@ static void save_work_path(const intptr_t fixed_cnt, const work_path_t *work_pat
 
 tile_table_t Table;
 tile_table_t Hand_table;
+// Table的密集副本，进入搜索时生成，搜索中每个叶子都要复制一份剩余牌，用密集表只需复制34字节
+dense_tile_table_t Dense_table;
 useful_table_t useful_table;
 pack_t fixed_packs[5];
 intptr_t pack_count;
 
-static bool Makeup_Hu(pack_t* hand,int len,hand_tiles_t *hand_tiles, tile_t *serving_tile,tile_table_t &atmp_table){
+static bool Makeup_Hu(pack_t* hand,int len,hand_tiles_t *hand_tiles, tile_t *serving_tile,dense_tile_table_t &atmp_table){
     int count = 0;
     int flag = 0;
     for(int z = 0 ; z < len; z++){
         pack_t tmp = hand[z];
     }
     
+    // 全是自己的牌时没有和牌张，不算凑成（否则win_tile未赋值，立牌也会超过13张）
+    if(std::none_of(hand, hand + len, [](pack_t pack) { return pack_get_offer(pack) != 0; })){
+        return 0;
+    }
 
     for(int i = 0; i < len; i++){
         tile_t t = pack_get_tile(hand[i]);
@@ -4504,20 +5634,20 @@ static bool Makeup_Hu(pack_t* hand,int len,hand_tiles_t *hand_tiles, tile_t *ser
         switch(pack_type){
             case PACK_TYPE_PAIR:
             //不足时不会最后单吊PAIR赢？
-                if(pack_get_offer(hand[i])!= 0 && atmp_table[t] && flag == 0)
+                if(pack_get_offer(hand[i])!= 0 && atmp_table[tile_index(t)] && flag == 0)
                 {
                     hand_tiles->standing_tiles[count++] = t;
-                    atmp_table[t]--;
+                    atmp_table[tile_index(t)]--;
                     //注意 ： 这里的temp_table是假设对手的牌也在剩余牌池中
                     *serving_tile = t;
                     flag = 1;
                 }
-                else if(pack_get_offer(hand[i])!= 0 && !atmp_table[t]){
+                else if(pack_get_offer(hand[i])!= 0 && !atmp_table[tile_index(t)]){
                     return 0;
                 }
-                else if(pack_get_offer(hand[i])!= 0 && atmp_table[t]){
+                else if(pack_get_offer(hand[i])!= 0 && atmp_table[tile_index(t)]){
 
-                    atmp_table[t]--;
+                    atmp_table[tile_index(t)]--;
                     hand_tiles->standing_tiles[count++] = t;
                     hand_tiles->standing_tiles[count++] = t;
 
@@ -4529,22 +5659,22 @@ static bool Makeup_Hu(pack_t* hand,int len,hand_tiles_t *hand_tiles, tile_t *ser
                 break;
             case PACK_TYPE_PUNG:
             //如果是别人供给，并且当前牌堆中有此牌，并且赢flag = 0
-                if(pack_get_offer(hand[i])!=0 && atmp_table[t] && flag == 0 )
+                if(pack_get_offer(hand[i])!=0 && atmp_table[tile_index(t)] && flag == 0 )
                 {   
                     hand_tiles->standing_tiles[count] = t;
                     hand_tiles->standing_tiles[count + 1] = t;
                     count += 2;
                     *serving_tile = t;
                     flag = 1;
-                    atmp_table[t]-=1;
+                    atmp_table[tile_index(t)]-=1;
                 }
-                else if(pack_get_offer(hand[i])!=0 && !atmp_table[t]){
+                else if(pack_get_offer(hand[i])!=0 && !atmp_table[tile_index(t)]){
                     return 0;
                     //凑不出牌
                 }
-                else if(pack_get_offer(hand[i])!=0 && atmp_table[t] && flag == 1 ){
+                else if(pack_get_offer(hand[i])!=0 && atmp_table[tile_index(t)] && flag == 1 ){
                     //已经赢过
-                    atmp_table[t]--;
+                    atmp_table[tile_index(t)]--;
                     hand_tiles->standing_tiles[count++] = t;
                     hand_tiles->standing_tiles[count++] = t;
                     hand_tiles->standing_tiles[count++] = t;
@@ -4571,56 +5701,60 @@ static bool Makeup_Hu(pack_t* hand,int len,hand_tiles_t *hand_tiles, tile_t *ser
                         hand_tiles->standing_tiles[count++] = t+1;
                         break;
                     case 1:
-                        if(flag == 0 && atmp_table[t-1]){
+                        // 边张搭子12按吃1算时，t-1不是牌，凑不出
+                        if(tile_get_rank(t) == 1){
+                            return 0;
+                        }
+                        if(flag == 0 && atmp_table[tile_index(t-1)]){
                             hand_tiles->standing_tiles[count++] = t;
                             hand_tiles->standing_tiles[count++] = t+1;
                             *serving_tile = t-1;
                             flag = 1;
-                            atmp_table[t-1]--;
+                            atmp_table[tile_index(t-1)]--;
 
                         }
-                        else if(!atmp_table[t-1]){
+                        else if(!atmp_table[tile_index(t-1)]){
                             return 0;
                         }
                         else{
-                            atmp_table[t-1]--;
+                            atmp_table[tile_index(t-1)]--;
                             hand_tiles->standing_tiles[count++] = t-1;
                             hand_tiles->standing_tiles[count++] = t;
                             hand_tiles->standing_tiles[count++] = t+1;
                         }
                         break;
                     case 2:
-                        if(flag == 0 && atmp_table[t]){
+                        if(flag == 0 && atmp_table[tile_index(t)]){
                             hand_tiles->standing_tiles[count++] = t-1;
                             hand_tiles->standing_tiles[count++] = t+1;
                             *serving_tile = t;
                             flag = 1;
-                            atmp_table[t]--;
+                            atmp_table[tile_index(t)]--;
                         }
-                        else if(!atmp_table[t]){
+                        else if(!atmp_table[tile_index(t)]){
                             return 0;
                         }
                         else{
-                            atmp_table[t]--;
+                            atmp_table[tile_index(t)]--;
                             hand_tiles->standing_tiles[count++] = t-1;
                             hand_tiles->standing_tiles[count++] = t;
                             hand_tiles->standing_tiles[count++] = t+1;
                     }
                         break;
                     case 3:
-                        if(flag == 0 && atmp_table[t+1]){
+                        if(flag == 0 && atmp_table[tile_index(t+1)]){
                             hand_tiles->standing_tiles[count++] = t-1;
                             hand_tiles->standing_tiles[count++] = t;
                             *serving_tile = t+1;
                             flag = 1;
-                            atmp_table[t+1]--;
+                            atmp_table[tile_index(t+1)]--;
 
                         }
-                        else if(!atmp_table[t+1]){
+                        else if(!atmp_table[tile_index(t+1)]){
                             return 0;
                         }
                         else{
-                            atmp_table[t+1]--;
+                            atmp_table[tile_index(t+1)]--;
                             hand_tiles->standing_tiles[count++] = t-1;
                             hand_tiles->standing_tiles[count++] = t;
                             hand_tiles->standing_tiles[count++] = t+1;
@@ -4635,17 +5769,17 @@ static bool Makeup_Hu(pack_t* hand,int len,hand_tiles_t *hand_tiles, tile_t *ser
     return 1;
 }
 int cur_min = 2146483647;
-useful_table_t useful;
-useful_table_t useless;
+// 搜索中凑到8番的补牌，用位标记，置位和清空都比bool表省
+dense_useful_table_t useful;
+dense_useful_table_t useless;
 
 win_flag_t win_flag;
 wind_t prevalent_wind;
 wind_t seat_wind;
 
-static int __calcluate_fan(pack_t* hand,int len_,tile_table_t &temp_temp_table){
+static int __calcluate_fan(pack_t* hand,int len_,dense_tile_table_t &temp_temp_table){
+    SEARCH_STATS_INC(fan_calls);
     calculate_param_t param;
-    fan_table_t fan_table;
-    char a;
     bool Can = Makeup_Hu(hand,len_,&param.hand_tiles, &param.win_tile,temp_temp_table);
     if(!Can)
         return 0;
@@ -4657,366 +5791,1038 @@ static int __calcluate_fan(pack_t* hand,int len_,tile_table_t &temp_temp_table){
     param.prevalent_wind = prevalent_wind;
     param.seat_wind = seat_wind;
 
-    int points = calculate_fan(&param, &fan_table);
+    int points = calculate_fan_cached(&param);
     return points;
 }
-void Compart_table(tile_table_t Table,tile_table_t temp_table){
+void Compart_table(const dense_tile_table_t Table,const dense_tile_table_t temp_table){
     for (int i = 0; i < 34; ++i) {
-            tile_t t = all_tiles[i];
-            if (Table[t] != temp_table[t]) {
-                useful[t] = true;
+            if (Table[i] != temp_table[i]) {
+                useful |= 1ULL << i;
             }
         }
 }
-static int bitCount(int i) {
-         int count = 0;
-        while(i!=0){
-            count++;
-            i = (i-1)&i;
-        }
-        return count;
+//-------------------------------- 番数上界估计 --------------------------------
+// 在补全面子之前估计最终能凑出的番数上界，只会偏大不会偏小
+// 上界不足8番时，整个分支都不可能达到起和番，可以直接剪掉
+// 由于算番时会对最终的牌重新划分，除副露外的判断都在牌的层面上进行，而不依赖当前的牌组划分
+
+#define FAN_BOUND_UNLIMITED 1000  // 可能出现8番以上的番种时，不再细算
+
+// 补全时可能用到的牌，位定义同is_green
+struct fan_bound_free_t {
+    int sets;           // 还需补的面子数
+    bool pair;          // 是否还需补雀头
+    uint64_t tiles;     // 补的牌可能用到的牌
+    uint64_t pungs;     // 可能补成刻子的牌
+    uint64_t pairs;     // 可能补成雀头的牌
+};
+
+// 副露和场况
+struct fan_bound_context_t {
+    const pack_t *fixed_packs;
+    intptr_t pack_count;
+    win_flag_t win_flag;
+    wind_t prevalent_wind;
+    wind_t seat_wind;
+};
+
+// 已确定的牌
+struct fan_bound_known_t {
+    tile_table_t table;
+    uint64_t mask;
+};
+
+static FORCE_INLINE uint64_t tile_bit(tile_t tile) {
+    return 1ULL << (tile - TILE_1m);
 }
-static int Makeup_Packs(tile_table_t left_tiles,int need_pack, int has_pair, tile_table_t temp_table, pack_t * hand, int pack_len){
-    if(need_pack == 0){
-        tile_table_t temp_temp_table;                    //全部的牌
-        memcpy(&temp_temp_table, temp_table, sizeof(temp_temp_table));
-        int fan = __calcluate_fan(hand,pack_len,temp_temp_table);
-        if(fan >= 8){
-            //更新useful_table
-            Compart_table(temp_table,temp_temp_table);
-        }
-        return fan;
-    }
-    int max_fan = -1;
-    pack_t temp_pack;
+
+static FORCE_INLINE int count_bits(uint64_t bits) {
+    return popcount64(bits);
+}
+
+// 按Makeup_Packs的规则统计补全时可能用到的牌
+// 更深层的递归只会削减temp_table，所以这里统计出的范围对整个分支都成立
+static void make_fan_bound_free(const tile_table_t left_tiles, const dense_tile_table_t temp_table,
+    int need_pack, bool has_pair, fan_bound_free_t *free_info) {
+    free_info->pair = !has_pair;
+    free_info->sets = need_pack - (has_pair ? 0 : 1);
+    uint64_t chow_tiles = 0, pungs = 0, pairs = 0;
     for (int i = 0; i < 34; ++i) {
         tile_t t = all_tiles[i];
         if (left_tiles[t] < 1) {
             continue;
         }
-    if(!has_pair && temp_table[t])
-        {
-            //注意这个temp_table[t] 是剪枝 如果场上不可能有同类型牌的话pair无意义
-            temp_pack = make_pack(1,PACK_TYPE_PAIR,t);
-            hand[pack_len] = temp_pack;
-            pack_len++;
-            int tmp = Makeup_Packs(left_tiles,need_pack - 1, true,temp_table,hand, pack_len);
-            pack_len--;
-            if(tmp > max_fan)max_fan = tmp;
+        if (temp_table[i]) {
+            pairs |= tile_bit(t);
         }
-    if(is_numbered_suit(t) && has_pair){
-        // t-2 t-1 t   -1 -2
-        // t-1 t t+1    +1 -1
-        // t t+1 t+2    +2 +1
-        int index_[3][3] = {{-1,1,2},{0,1,3},{1,2,3}};
-        int index_for_useful[3][3] = {{0,-1,-2},{0,+1,-1},{0,+2,+1}};
-        for(int j = 0; j < 3 ; j++)
-        {
-            if(j == 0 && tile_get_rank(t)<3)continue;
-            if(j == 1 && tile_get_rank(t)<2)continue;
-            if(j == 1 && tile_get_rank(t)>8)continue;
-            if(j == 2 && tile_get_rank(t)>7)continue;
-            for(int z = 1; z < 3; z++){
-                if(temp_table[t+index_for_useful[j][z]])
-                {
-                    //在该层只保证凑成搭子，不一定能成顺子
-                temp_table[t+index_for_useful[j][z]]--;
-                temp_pack = make_pack(index_[j][z],PACK_TYPE_CHOW,t+index_[j][0]);
-                hand[pack_len] = temp_pack;
-                pack_len++;
-                int tmp = Makeup_Packs(left_tiles,need_pack - 1, has_pair, temp_table, hand, pack_len);
-                pack_len--;
-                temp_table[t+index_for_useful[j][z]]++;
-                if(tmp > 8){
-                    useful[t+index_for_useful[j][z]] = true;
-                }
-                if(tmp > max_fan)max_fan = tmp;
-            }
+        if (temp_table[i] >= 2) {
+            pungs |= tile_bit(t);
         }
-    }}
-    if(temp_table[t] >= 2 && has_pair){
-        temp_table[t]--;
-        //注意这里只减1 因为是将单张凑成对子 并且希望凑成刻字  temp_table >=2 为剪枝
-        temp_pack = make_pack(1,PACK_TYPE_PUNG,t);
-        hand[pack_len] = temp_pack;
-        pack_len++;
-        int tmp = Makeup_Packs(left_tiles,need_pack - 1, has_pair, temp_table,hand,pack_len);
-        pack_len--;
-        temp_table[t]++;
-        if(tmp >= 8)
-            {
-            useful[t] = true;
-            //Compart_table(temp_table,temp_temp_table);
+        if (is_numbered_suit_quick(t)) {
+            // 包含t的顺子覆盖t-2到t+2
+            rank_t r = tile_get_rank(t);
+            for (rank_t k = (r > 3 ? r - 2 : 1); k <= (r < 7 ? r + 2 : 9); ++k) {
+                chow_tiles |= tile_bit(t - r + k);
+            }
         }
-        if(tmp > max_fan)max_fan = tmp;
-    }
     }
-return max_fan;
+    free_info->pungs = free_info->sets > 0 ? pungs : 0;
+    free_info->pairs = free_info->pair ? pairs : 0;
+    free_info->tiles = (free_info->sets > 0 ? chow_tiles | pungs : 0) | free_info->pairs;
 }
-static int basic_form_shanten_recursively(tile_table_t &cnt_table, const bool has_pair, const unsigned pack_cnt, const unsigned incomplete_cnt,
-    const intptr_t fixed_cnt, work_path_t *work_path, work_state_t *work_state, pack_t* hand, int pack_len) {
-    
 
-    if (fixed_cnt == 4) {  // 4副露
-        for (int i = 0; i < 34; ++i) {
-            tile_t t = all_tiles[i];
-            if (cnt_table[t] > 1) {
-                return -1;
-            }
-        }
-        return 0;
-    }
+// 最多还能补的张数
+static FORCE_INLINE int free_capacity(const fan_bound_free_t &free_info) {
+    return free_info.sets * 3 + (free_info.pair ? 2 : 0);
+}
 
-    if (pack_cnt == 4) {  // 已经有4组面子
+// 最多能给几种牌补牌：每组面子最多3种，雀头只有1种
+static FORCE_INLINE int free_slots(const fan_bound_free_t &free_info) {
+    return free_info.sets * 3 + (free_info.pair ? 1 : 0);
+}
 
-        tile_table_t temp_table;
-        //全部的牌
-        int max_fan = -1;
-        int fan = -1;
-        memcpy(&temp_table, &Table, sizeof(temp_table));
-        if(!has_pair){
-        for(int i = 0; i < 34; i++){
+// 同一种牌最多能补几张
+static FORCE_INLINE int free_max_same(const fan_bound_free_t &free_info) {
+    return free_info.sets > 0 ? 4 : (free_info.pair ? 2 : 0);
+}
 
-            tile_t t = all_tiles[i];
-            if(temp_table[t] && cnt_table[t])
-            {
-                temp_table[t]--;
-                pack_t temp_pack = make_pack(1,PACK_TYPE_PAIR,t);
-                hand[pack_len++] = temp_pack;
-                fan = __calcluate_fan(hand,pack_len,temp_table);
-                pack_len--;
-                if(fan >= 8)
-                {
-              
-                Compart_table(Table,temp_table);
-                int temp = has_pair ? -1 : 0;
-                cur_min = temp;
-                }
-                if(fan > max_fan){
-                    max_fan = fan;
-                }
-                temp_table[t]++;
-                }
+static FORCE_INLINE int push_chow(tile_t *req, int n, tile_t mid) {
+    req[n] = mid - 1; req[n + 1] = mid; req[n + 2] = mid + 1;
+    return n + 3;
+}
 
-        }}
-        else 
-            max_fan = __calcluate_fan(hand,pack_len,temp_table);
-        //int fan = __calcluate_fan(hand,pack_len,temp_table);
-        if(max_fan >= 8){
-            cur_min = has_pair ? -1 : 0;
-            //make_useless(cnt_table);
-            return has_pair ? -1 : 0;  // 如果有雀头，则和了；如果无雀头，则是听牌
+static FORCE_INLINE int push_pung(tile_t *req, int n, tile_t tile) {
+    req[n] = tile; req[n + 1] = tile; req[n + 2] = tile;
+    return n + 3;
+}
+
+// 能否补齐req中缺的牌
+static bool is_tiles_reachable(fan_bound_known_t &known, const tile_t *req, int req_cnt, const fan_bound_free_t &free_info) {
+    // 先按种类粗筛：没有的牌必须都能补到
+    uint64_t req_mask = 0;
+    for (int i = 0; i < req_cnt; ++i) {
+        req_mask |= tile_bit(req[i]);
+    }
+    uint64_t lack_mask = req_mask & ~known.mask;
+    if ((lack_mask & ~free_info.tiles) != 0 || count_bits(lack_mask) > free_slots(free_info)) {
+        return false;
+    }
+
+    // 再按张数细算
+    tile_t used[12];
+    int used_cnt = 0;
+    int shortage = 0;
+    for (int i = 0; i < req_cnt; ++i) {
+        tile_t t = req[i];
+        if (known.table[t] > 0) {
+            --known.table[t];
+            used[used_cnt++] = t;
         }
-        else
-            return 2146483647;
+        else {
+            ++shortage;
+            lack_mask |= tile_bit(t);
+        }
+    }
+    for (int i = 0; i < used_cnt; ++i) {
+        ++known.table[used[i]];
     }
+    return shortage == 0 || ((lack_mask & ~free_info.tiles) == 0 && shortage <= free_capacity(free_info)
+        && count_bits(lack_mask) <= free_slots(free_info));
+}
 
-    int max_ret;  // 当前状态能返回的最大上听数
+// 在补牌的限制内，按缺口从小到大最多能凑出几个，shortage_cnt[d]为缺口为d的个数
+static int count_within_capacity(const int (&shortage_cnt)[5], const fan_bound_free_t &free_info) {
+    int capacity = free_capacity(free_info);
+    int slots = free_slots(free_info);
+    int cnt = shortage_cnt[0];
+    for (int d = 1; d < 5; ++d) {
+        for (int i = 0; i < shortage_cnt[d]; ++i) {
+            if (capacity < d || slots == 0) {
+                return cnt;
+            }
+            capacity -= d;
+            --slots;
+            ++cnt;
+        }
+    }
+    return cnt;
+}
 
-    // 算法说明：
-    // 缺少的面子数=4-完成的面子数
-    // 缺少的搭子数=缺少的面子数-已有的搭子数
-    // 两式合并：缺少的搭子数=4-完成的面子数-已有的搭子数
-    int incomplete_need = 4 - pack_cnt - incomplete_cnt;
-    if (incomplete_need > 0) {  // 还需要搭子的情况
-        // 有雀头时，上听数=已有的搭子数+缺少的搭子数*2-1
-        // 无雀头时，上听数=已有的搭子数+缺少的搭子数*2
-        max_ret = incomplete_cnt + incomplete_need * 2 - (has_pair ? 1 : 0);
+// 牌t凑成刻子的缺口，补不到时返回-1
+static int pung_shortage(tile_t t, int cnt, const fan_bound_free_t &free_info) {
+    if (cnt >= 3) {
+        return 0;
     }
-    else {  // 搭子齐了的情况
-        // 有雀头时，上听数=3-完成的面子数
-        // 无雀头时，上听数=4-完成的面子数
-        max_ret = (has_pair ? 3 : 4) - pack_cnt;
+    if (is_honor(t)) {  // 字牌只能整组补刻子
+        return (cnt == 0 && (free_info.pungs & tile_bit(t))) ? 3 : -1;
     }
-    bool can_extend = false;
-    // 当前路径深度
-    const unsigned depth = pack_cnt + incomplete_cnt + has_pair;
-    work_path->depth = static_cast<uint16_t>(depth);
-    int result = max_ret;
-    if (pack_cnt + incomplete_cnt > 4 && result <= cur_min) {  // 搭子超载
-        
-        save_work_path(fixed_cnt, work_path, work_state);
-        tile_table_t temp_table;
-        //全部的牌
-        int max_fan = -1;
-        int fan = -1;
-        memcpy(&temp_table, &Table, sizeof(temp_table));
-        if(!has_pair){
-        for(int i = 0; i < 34; i++){
-            tile_t t = all_tiles[i];
-            if(temp_table[t] && cnt_table[t])
-            {
-                temp_table[t]--;
-                pack_t temp_pack = make_pack(1,PACK_TYPE_PAIR,t);
-                hand[pack_len++] = temp_pack;
-                pack_t tmp_hand[5];
-                int temp_pack_len = 5;
-                int tmp_count = 0;
-                int e = (1<<pack_len);
-                for(int ii = 0; ii < e; ii++){
-                    int tmp = bitCount(ii);
-                    if(tmp == 5){
-                        for(int j = 0; j < pack_len; j++){
-                            bool use = (ii>>j)&0x1;
-                            if(use){
-                                tmp_hand[tmp_count++] = hand[j];
-                            }
-                        }
-                        fan = __calcluate_fan(tmp_hand,temp_pack_len,temp_table);
-                        //Change pack_len to 5145
-                        if(fan >= 8)
-                        {
-                            Compart_table(Table,temp_table);
-                        }
-                        if(fan > max_fan){
-                            max_fan = fan;
-                        }
-                        }
-                    }
-                    pack_len--;
-                    temp_table[t]++;
-                }
+    return ((free_info.tiles & tile_bit(t)) && 3 - cnt <= free_max_same(free_info)) ? 3 - cnt : -1;
+}
 
-        }}
-        else{
-                pack_t tmp_hand[5];
-                int temp_pack_len = 5;
-                int tmp_count = 0;
-                int e = (1<<pack_len);
-                for(int ii = 0; ii < e; ii++){
-                    tmp_count = 0;
-                    int tmp = bitCount(ii);
-                    if(tmp == 5){
-                        for(int j = 0; j <= pack_len; j++){
-                            bool use = (ii>>j)&0x1;
-                            if(use){
-                                tmp_hand[tmp_count++] = hand[j];
-                            }
-                        }
-                        fan = __calcluate_fan(tmp_hand,temp_pack_len,temp_table);
-                        if(fan >= 8)
-                        {
-                        Compart_table(Table,temp_table);
+// 能否凑出一般高、喜相逢、连六、老少副中的任意一种
+static bool is_double_chows_reachable(fan_bound_known_t &known, const fan_bound_free_t &free_info) {
+    tile_t req[6];
+    for (suit_t s = 1; s <= 3; ++s) {
+        for (rank_t r = 2; r <= 8; ++r) {
+            tile_t t = make_tile(s, r);
+            // 一般高
+            if (is_tiles_reachable(known, req, push_chow(req, push_chow(req, 0, t), t), free_info)) {
+                return true;
+            }
+            // 喜相逢
+            tile_t t2 = make_tile(s % 3 + 1, r);
+            if (is_tiles_reachable(known, req, push_chow(req, push_chow(req, 0, t), t2), free_info)) {
+                return true;
+            }
+            // 连六
+            if (r <= 5 && is_tiles_reachable(known, req, push_chow(req, push_chow(req, 0, t), t + 3), free_info)) {
+                return true;
+            }
+        }
+        // 老少副
+        if (is_tiles_reachable(known, req, push_chow(req, push_chow(req, 0, make_tile(s, 2)), make_tile(s, 8)), free_info)) {
+            return true;
+        }
+    }
+    return false;
+}
 
-                        }
-                        if(fan > max_fan){
-                            max_fan = fan;
-                        }
-                        }
-                    }
+// 能否凑出由3组面子构成的8番以上番种，以及三色三步高（6番）
+static bool is_triple_packs_reachable(fan_bound_known_t &known, const fan_bound_free_t &free_info, bool *mixed_shifted_chows) {
+    static const suit_t perms[6][3] = { { 1, 2, 3 }, { 1, 3, 2 }, { 2, 1, 3 }, { 2, 3, 1 }, { 3, 1, 2 }, { 3, 2, 1 } };
+    tile_t req[12];
+    auto reachable = [&known, &req, &free_info](int req_cnt) {
+        return is_tiles_reachable(known, req, req_cnt, free_info);
+    };
+    for (suit_t s = 1; s <= 3; ++s) {
+        // 清龙
+        if (reachable(push_chow(req, push_chow(req, push_chow(req, 0, make_tile(s, 2)), make_tile(s, 5)), make_tile(s, 8)))) {
+            return true;
         }
-        if(max_fan < 8 ){
-            max_ret = 2146483647;
+        for (rank_t r = 2; r <= 8; ++r) {
+            tile_t t = make_tile(s, r);
+            // 一色三同顺、一色三节高
+            if (reachable(push_chow(req, push_chow(req, push_chow(req, 0, t), t), t))
+                || reachable(push_pung(req, push_pung(req, push_pung(req, 0, t - 1), t), t + 1))) {
+                return true;
+            }
+            // 一色三步高（递增1或2）
+            if ((r <= 6 && reachable(push_chow(req, push_chow(req, push_chow(req, 0, t), t + 1), t + 2)))
+                || (r <= 4 && reachable(push_chow(req, push_chow(req, push_chow(req, 0, t), t + 2), t + 4)))) {
+                return true;
+            }
+        }
+        // 三色双龙会，s为雀头的花色
+        suit_t s1 = s % 3 + 1, s2 = s1 % 3 + 1;
+        int n = push_chow(req, push_chow(req, 0, make_tile(s1, 2)), make_tile(s1, 8));
+        if (reachable(push_chow(req, push_chow(req, n, make_tile(s2, 2)), make_tile(s2, 8)))) {
+            return true;
         }
-        if(max_ret < cur_min)
-            cur_min = max_ret;
-        
-        return max_ret;
     }
-    else if(pack_cnt + incomplete_cnt > 4){
-        return 2146483647;
+    for (rank_t r = 1; r <= 9; ++r) {
+        // 三同刻、三色三同顺
+        if (reachable(push_pung(req, push_pung(req, push_pung(req, 0, make_tile(1, r)), make_tile(2, r)), make_tile(3, r)))
+            || (r >= 2 && r <= 8 && reachable(push_chow(req, push_chow(req, push_chow(req, 0, make_tile(1, r)), make_tile(2, r)), make_tile(3, r))))) {
+            return true;
+        }
+    }
+    *mixed_shifted_chows = false;
+    for (int p = 0; p < 6; ++p) {
+        const suit_t (&sp)[3] = perms[p];
+        // 花龙
+        if (reachable(push_chow(req, push_chow(req, push_chow(req, 0, make_tile(sp[0], 2)), make_tile(sp[1], 5)), make_tile(sp[2], 8)))) {
+            return true;
+        }
+        for (rank_t r = 1; r <= 7; ++r) {
+            // 三色三节高
+            if (reachable(push_pung(req, push_pung(req, push_pung(req, 0, make_tile(sp[0], r)), make_tile(sp[1], r + 1)), make_tile(sp[2], r + 2)))) {
+                return true;
+            }
+            // 三色三步高
+            if (!*mixed_shifted_chows && r >= 2 && r <= 6) {
+                *mixed_shifted_chows = reachable(push_chow(req, push_chow(req, push_chow(req, 0, make_tile(sp[0], r)), make_tile(sp[1], r + 1)), make_tile(sp[2], r + 2)));
+            }
+        }
+    }
+    return false;
+}
+
+// 估计番数上界
+// ctx为副露和场况，hand为手牌中已有的牌组（搭子按补全后计），free_info为还需补的牌组
+// 估计值达到limit后不再细算，此时只保证返回值不小于limit
+static int estimate_fan_upper_bound(const fan_bound_context_t &ctx, const pack_t *hand, int pack_len, const fan_bound_free_t &free_info, int limit) {
+    // 妙手回春、海底捞月、杠上开花、抢杠和本身就有8番
+    if (ctx.win_flag & (WIN_FLAG_WALL_LAST | WIN_FLAG_ABOUT_KONG)) {
+        return FAN_BOUND_UNLIMITED;
+    }
+    const bool self_drawn = (ctx.win_flag & WIN_FLAG_SELF_DRAWN) != 0;
+    const int capacity = free_capacity(free_info);
+    const int slots = free_slots(free_info);
+
+    // 已确定的牌，concealed_table不含明的副露
+    fan_bound_known_t known;
+    memset(&known, 0, sizeof(known));
+    tile_table_t concealed_table = { 0 }, fixed_table = { 0 };
+    int melded_cnt = 0, fixed_pung_cnt = 0, concealed_kong_cnt = 0, melded_kong_cnt = 0;
+    bool fixed_has_pung_of_terminals_or_honors = false;
+    uint64_t kong_mask = 0;
+    int hand_tile_cnt = 0;
+    for (intptr_t i = 0; i < ctx.pack_count + pack_len; ++i) {
+        const bool is_fixed = i < ctx.pack_count;
+        pack_t pack = is_fixed ? ctx.fixed_packs[i] : hand[i - ctx.pack_count];
+        tile_t t = pack_get_tile(pack);
+        uint8_t type = pack_get_type(pack);
+        tile_t tiles[4];
+        int cnt = 0;
+        switch (type) {
+        case PACK_TYPE_CHOW:
+            // 边界上的顺子搭子补全后含有不合法的牌，Makeup_Hu必然失败
+            if (tile_get_rank(t) < 2 || tile_get_rank(t) > 8) {
+                return 0;
+            }
+            cnt = push_chow(tiles, 0, t);
+            break;
+        case PACK_TYPE_PUNG: cnt = push_pung(tiles, 0, t); break;
+        case PACK_TYPE_KONG: cnt = push_pung(tiles, 0, t); tiles[cnt++] = t; break;
+        case PACK_TYPE_PAIR: tiles[0] = tiles[1] = t; cnt = 2; break;
+        default: break;
+        }
+        const bool melded = is_fixed && is_pack_melded(pack);
+        for (int k = 0; k < cnt; ++k) {
+            ++known.table[tiles[k]];
+            if (!melded) {
+                ++concealed_table[tiles[k]];
+            }
+            if (is_fixed) {
+                ++fixed_table[tiles[k]];
+            }
+        }
+        if (!is_fixed) {
+            hand_tile_cnt += cnt;
+            continue;
+        }
+        melded_cnt += melded;
+        if (type != PACK_TYPE_CHOW) {
+            ++fixed_pung_cnt;
+            if (is_terminal_or_honor(t)) {
+                fixed_has_pung_of_terminals_or_honors = true;
+            }
+            if (type == PACK_TYPE_KONG) {
+                ++(melded ? melded_kong_cnt : concealed_kong_cnt);
+                kong_mask |= tile_bit(t);
+            }
+        }
     }
 
+    // 张数不对时，Makeup_Hu凑出的手牌无法通过算番的输入检查
+    if (hand_tile_cnt + capacity != 14 - 3 * ctx.pack_count) {
+        return 0;
+    }
 
+    // 三杠、四杠
+    const int kong_cnt = concealed_kong_cnt + melded_kong_cnt;
+    if (kong_cnt >= 3) {
+        return FAN_BOUND_UNLIMITED;
+    }
 
+    // 统计牌的特征
+    int suit_flag = 0;  // 1/2/4/8/16分别为万、条、饼、风、箭
+    int kinds = 0, odd_kinds = 0, single_kinds = 0;
+    uint64_t odd_mask = 0, single_mask = 0;
+    bool has_honor = false, all_terminal_or_honor = true, all_reversible = true, all_simples = true;
+    bool all_even = true, outside = true;  // outside：数牌都在123789中，全带幺的必要条件
+    rank_t min_rank = 9, max_rank = 1;
     for (int i = 0; i < 34; ++i) {
         tile_t t = all_tiles[i];
-        if (cnt_table[t] < 1) {
+        int n = known.table[t];
+        if (n == 0) {
             continue;
         }
-        pack_t temp_pack;
-        // 雀头
-        if (!has_pair && cnt_table[t] > 1) {
-            work_path->units[depth] = MAKE_UNIT(UNIT_TYPE_PAIR, t);  // 记录雀头
-            if (!is_basic_form_branch_exist(fixed_cnt, work_path, work_state)) {
-                // 削减雀头，递归
-                cnt_table[t] -= 2;
-                temp_pack = make_pack(0,PACK_TYPE_PAIR,t);
-                hand[pack_len] = temp_pack;
-                pack_len++;
-                can_extend = true;
-                int ret = basic_form_shanten_recursively(cnt_table, true, pack_cnt, incomplete_cnt,
-                    fixed_cnt, work_path, work_state, hand, pack_len);
-                result = std::min(ret, result);
-                // 还原
-                cnt_table[t] += 2;
-                pack_len--;
+        known.mask |= tile_bit(t);
+        ++kinds;
+        if (n & 1) {
+            ++odd_kinds;
+            odd_mask |= tile_bit(t);
+        }
+        if (n == 1) {
+            ++single_kinds;
+            single_mask |= tile_bit(t);
+        }
+        all_terminal_or_honor &= is_terminal_or_honor(t);
+        all_reversible &= is_reversible(t);
+        if (is_honor(t)) {
+            has_honor = true;
+            all_simples = false;
+            suit_flag |= is_winds(t) ? 8 : 16;
+            continue;
+        }
+        rank_t r = tile_get_rank(t);
+        suit_flag |= 1 << (tile_get_suit(t) - 1);
+        all_simples &= (r != 1 && r != 9);
+        all_even &= ((r & 1) == 0);
+        outside &= (r <= 3 || r >= 7);
+        min_rank = std::min(min_rank, r);
+        max_rank = std::max(max_rank, r);
+    }
+    const int numbered_suit_cnt = !!(suit_flag & 1) + !!(suit_flag & 2) + !!(suit_flag & 4);
+
+    // 清一色、混一色、字一色、绿一色、九莲宝灯、一色双龙会等：数牌最多一种花色
+    // 清幺九、混幺九、推不倒
+    if (numbered_suit_cnt <= 1 || all_terminal_or_honor || all_reversible) {
+        return FAN_BOUND_UNLIMITED;
+    }
+    // 全大、全中、全小、大于五、小于五、全带五、全双刻
+    if (!has_honor && (max_rank <= 4 || min_rank >= 6 || (min_rank >= 3 && max_rank <= 7) || all_even)) {
+        return FAN_BOUND_UNLIMITED;
+    }
+    // 七对：奇数张的牌都要补成对
+    if (ctx.pack_count == 0 && odd_kinds <= std::min(capacity, slots) && (odd_mask & ~free_info.tiles) == 0) {
+        return FAN_BOUND_UNLIMITED;
+    }
+    // 组合龙
+    if (ctx.pack_count <= 1) {
+        for (int i = 0; i < 6; ++i) {
+            uint64_t lack = standard_knitted_straight_mask[i] & ~known.mask;
+            if ((lack & ~free_info.tiles) == 0 && count_bits(lack) <= std::min(capacity, slots)) {
+                return FAN_BOUND_UNLIMITED;
             }
         }
+    }
 
-        // 刻子
-        if (cnt_table[t] > 2) {
-            work_path->units[depth] = MAKE_UNIT(UNIT_TYPE_PUNG, t);  // 记录刻子
-            if (!is_basic_form_branch_exist(fixed_cnt, work_path, work_state)) {
-                // 削减这组刻子，递归
-                cnt_table[t] -= 3;
+    // 以下累加8番以下的番种各自可能的最大值，先算简单的
+    int fan = 0;
 
-                temp_pack = make_pack(0,PACK_TYPE_PUNG,t);
-                hand[pack_len] = temp_pack;
-                pack_len++;
-                can_extend = true;
-                int ret = basic_form_shanten_recursively(cnt_table, has_pair, pack_cnt + 1, incomplete_cnt,
-                    fixed_cnt, work_path, work_state,hand,pack_len);
-                result = std::min(ret, result);
-                // 还原
-                cnt_table[t] += 3;
-                pack_len--;
-            }
+    // 和绝张：有标记，或者和牌在副露中已有3张（手牌中要有第4张）
+    bool last_tile = (ctx.win_flag & WIN_FLAG_4TH_TILE) != 0;
+    for (int i = 0; i < 34 && !last_tile; ++i) {
+        tile_t t = all_tiles[i];
+        last_tile = fixed_table[t] == 3 && (known.table[t] == 4 || (known.table[t] == 3 && (free_info.tiles & tile_bit(t))));
+    }
+    if (last_tile) {
+        fan += 4;
+    }
+    // 不求人、自摸、门前清、全求人
+    if (melded_cnt == 0) {
+        fan += self_drawn ? 4 : 2;
+    }
+    else {
+        fan += self_drawn ? 1 : 0;
+        if (melded_cnt == 4 && !self_drawn) {
+            fan += 6;
         }
-        // 顺子（只能是数牌）
-        bool is_numbered = is_numbered_suit(t);
-        // 顺子t t+1 t+2，显然t不能是8点以上的数牌
-        if (is_numbered && tile_get_rank(t) < 8 && cnt_table[t + 1] && cnt_table[t + 2]) {
-            work_path->units[depth] = MAKE_UNIT(UNIT_TYPE_CHOW, t);  // 记录顺子
-            if (!is_basic_form_branch_exist(fixed_cnt, work_path, work_state)) {
-                // 削减这组顺子，递归
-                --cnt_table[t];
-                --cnt_table[t + 1];
-                --cnt_table[t + 2];
-                temp_pack = make_pack(0,PACK_TYPE_CHOW,t+1);
-                hand[pack_len] = temp_pack;
-                pack_len++;
-                can_extend = true;
-                int ret = basic_form_shanten_recursively(cnt_table, has_pair, pack_cnt + 1, incomplete_cnt,
-                    fixed_cnt, work_path, work_state, hand, pack_len);
-                result = std::min(ret, result);
-                // 还原
-                ++cnt_table[t];
-                ++cnt_table[t + 1];
-                ++cnt_table[t + 2];
-                pack_len--;
+    }
+    // 双暗杠、明暗杠、双明杠、暗杠、明杠
+    if (kong_cnt == 2) {
+        fan += 6;
+    }
+    else if (kong_cnt == 1) {
+        fan += concealed_kong_cnt ? 2 : 1;
+    }
+    // 碰碰和：副露无顺子，单张都要补，且牌的种类不超过5种
+    if (fixed_pung_cnt == ctx.pack_count && kinds <= 5 && single_kinds <= std::min(capacity, slots) && (single_mask & ~free_info.tiles) == 0) {
+        fan += 6;
+    }
+    // 五门齐：缺的每一门都要靠补的牌组
+    {
+        static const uint64_t kind_masks[5] = {
+            0x00000000000001FFULL, 0x0000000001FF0000ULL, 0x000001FF00000000ULL,
+            0x000F000000000000ULL, 0x0070000000000000ULL
+        };
+        int lack_kinds = 0;
+        bool reachable_kinds = true;
+        for (int k = 0; k < 5; ++k) {
+            if ((suit_flag & (1 << k)) == 0) {
+                ++lack_kinds;
+                reachable_kinds &= (free_info.tiles & kind_masks[k]) != 0;
             }
         }
-        // 如果已经通过削减雀头/面子降低了上听数，再按搭子计算的上听数肯定不会更少
-        if (result < max_ret) {
-            continue;
-        }
-        // 刻子搭子
-        if (cnt_table[t] > 1) {
-            work_path->units[depth] = MAKE_UNIT(UNIT_TYPE_INCOMPLETE_PUNG, t);  // 记录刻子搭子
-            if (!is_basic_form_branch_exist(fixed_cnt, work_path, work_state)) {
-                // 削减刻子搭子，递归
-                cnt_table[t] -= 2;
-                temp_pack = make_pack(1,PACK_TYPE_PUNG,t);
-                hand[pack_len] = temp_pack;
-                pack_len++;
-                can_extend = true;
-                int ret = basic_form_shanten_recursively(cnt_table, has_pair, pack_cnt, incomplete_cnt + 1,
-                    fixed_cnt, work_path, work_state, hand, pack_len);
-                result = std::min(ret, result);
-                // 还原
-                cnt_table[t] += 2;
-                pack_len--;
-            }
+        if (reachable_kinds && lack_kinds <= free_info.sets + (free_info.pair ? 1 : 0)) {
+            fan += 6;
         }
-
-
-        // 顺子搭子（只能是数牌）
-        if (is_numbered) {
+    }
+    // 全带幺
+    if (outside) {
+        fan += 4;
+    }
+    // 平和：无字，副露无刻子
+    if (!has_honor && fixed_pung_cnt == 0) {
+        fan += 2;
+    }
+    // 断幺
+    if (all_simples) {
+        fan += 2;
+    }
+    // 缺一门
+    if (numbered_suit_cnt <= 2) {
+        fan += 1;
+    }
+    // 无字
+    if (!has_honor) {
+        fan += 1;
+    }
+    // 边张、嵌张、单钓将
+    fan += 1;
+    if (fan >= limit) {
+        return fan;
+    }
+
+    // 风刻、箭刻
+    int wind_pung_cnt = 0, dragon_pung_cnt = 0, dragon_pair_cnt = 0;
+    int wind_free = 0, dragon_free = 0;
+    bool prevalent_pung = false, seat_pung = false;
+    for (tile_t t = TILE_E; t <= TILE_P; ++t) {
+        int d = pung_shortage(t, known.table[t], free_info);
+        bool dragon = is_dragons(t);
+        if (d == 0) {
+            ++(dragon ? dragon_pung_cnt : wind_pung_cnt);
+        }
+        else if (d > 0) {
+            ++(dragon ? dragon_free : wind_free);
+        }
+        if (dragon && (known.table[t] == 2 || (known.table[t] == 0 && (free_info.pairs & tile_bit(t))))) {
+            ++dragon_pair_cnt;
+        }
+        if (!dragon && d >= 0) {
+            prevalent_pung |= (t == TILE_E + static_cast<int>(ctx.prevalent_wind));
+            seat_pung |= (t == TILE_E + static_cast<int>(ctx.seat_wind));
+        }
+    }
+    // 整组补的刻子受补的面子数限制
+    wind_pung_cnt += std::min(wind_free, free_info.sets);
+    dragon_pung_cnt += std::min(dragon_free, free_info.sets);
+    // 三风刻、小四喜、大四喜、小三元、大三元
+    if (wind_pung_cnt >= 3 || dragon_pung_cnt >= 3 || (dragon_pung_cnt >= 2 && dragon_pair_cnt >= 1)) {
+        return FAN_BOUND_UNLIMITED;
+    }
+    // 双箭刻、箭刻
+    fan += dragon_pung_cnt >= 2 ? 6 : dragon_pung_cnt * 2;
+    // 圈风刻、门风刻
+    fan += (prevalent_pung ? 2 : 0) + (seat_pung ? 2 : 0);
+    if (fan >= limit) {
+        return fan;
+    }
+
+    // 刻子相关的缺口统计
+    int concealed_shortage_cnt[5] = { 0 };  // 暗刻
+    int terminal_shortage_cnt[5] = { 0 };   // 幺九刻（不含箭刻和圈风门风）
+    int hog_shortage_cnt[5] = { 0 };        // 四归一
+    int rank_shortage_cnt[10][5] = { { 0 } };  // 按点数统计，用于双同刻
+    for (int i = 0; i < 34; ++i) {
+        tile_t t = all_tiles[i];
+        int dc = pung_shortage(t, concealed_table[t], free_info);
+        if (dc >= 0) {
+            ++concealed_shortage_cnt[dc];
+        }
+        int d = pung_shortage(t, known.table[t], free_info);
+        if (d < 0) {
+            continue;
+        }
+        if (is_terminal_or_honor(t) && !is_dragons(t)
+            && t != TILE_E + static_cast<int>(ctx.prevalent_wind) && t != TILE_E + static_cast<int>(ctx.seat_wind)) {
+            ++terminal_shortage_cnt[d];
+        }
+        if (is_numbered_suit_quick(t)) {
+            ++rank_shortage_cnt[tile_get_rank(t)][d];
+            // 四归一：不能是杠
+            int h = 4 - known.table[t];
+            if ((kong_mask & tile_bit(t)) == 0 && (h == 0 || ((free_info.tiles & tile_bit(t)) && h <= free_max_same(free_info)))) {
+                ++hog_shortage_cnt[h];
+            }
+        }
+    }
+
+    // 三暗刻、四暗刻：明的副露达到2组时不可能
+    const int concealed_pung_cnt = std::min(count_within_capacity(concealed_shortage_cnt, free_info), 4 - melded_cnt);
+    if (concealed_pung_cnt >= 3) {
+        return FAN_BOUND_UNLIMITED;
+    }
+    // 双暗刻
+    if (concealed_pung_cnt >= 2) {
+        fan += 2;
+    }
+    // 双同刻：4组刻子最多2个
+    int double_pung_cnt = 0;
+    for (int r = 1; r <= 9; ++r) {
+        double_pung_cnt += (count_within_capacity(rank_shortage_cnt[r], free_info) >= 2);
+    }
+    fan += 2 * std::min(double_pung_cnt, 2);
+    // 四归一
+    fan += 2 * std::min(count_within_capacity(hog_shortage_cnt, free_info), 3);
+    // 幺九刻
+    fan += std::min(count_within_capacity(terminal_shortage_cnt, free_info), 4);
+    if (fan >= limit) {
+        return fan;
+    }
+
+    // 无番和：必须是点和、有明副露、三种花色齐、字牌只能作雀头，且副露中不能有杠或幺九刻
+    if (!self_drawn && melded_cnt > 0 && kong_cnt == 0 && !fixed_has_pung_of_terminals_or_honors
+        && 3 - numbered_suit_cnt <= free_info.sets) {
+        int honor_kinds = 0;
+        bool honor_as_pair = true;
+        for (tile_t t = TILE_E; t <= TILE_P; ++t) {
+            if (known.table[t]) {
+                ++honor_kinds;
+                honor_as_pair &= (known.table[t] <= 2);
+            }
+        }
+        if (honor_kinds == 0 ? (free_info.pairs & standard_honors_mask) != 0 : (honor_kinds == 1 && honor_as_pair)) {
+            return FAN_BOUND_UNLIMITED;
+        }
+    }
+
+    // 花龙、清龙、三色三同顺等由3组面子构成的番种
+    bool mixed_shifted_chows = false;
+    if (is_triple_packs_reachable(known, free_info, &mixed_shifted_chows)) {
+        return FAN_BOUND_UNLIMITED;
+    }
+    // 三色三步高
+    if (mixed_shifted_chows) {
+        fan += 6;
+    }
+    if (fan >= limit) {
+        return fan;
+    }
+
+    // 一般高、喜相逢、连六、老少副：4组顺子最多3番，3组最多2番，以此类推
+    // 手牌中已有3张以上的字牌必然是刻子，占去一组面子
+    int chow_cnt = 4 - fixed_pung_cnt;
+    for (tile_t t = TILE_E; t <= TILE_P; ++t) {
+        if (known.table[t] >= 3 && fixed_table[t] == 0) {
+            --chow_cnt;
+        }
+    }
+    if (chow_cnt >= 2 && is_double_chows_reachable(known, free_info)) {
+        fan += chow_cnt - 1;
+    }
+
+    return fan;
+}
+// 以当前的全局场况估计番数上界
+static FORCE_INLINE int estimate_fan_upper_bound(const pack_t *hand, int pack_len, const fan_bound_free_t &free_info, int limit) {
+    fan_bound_context_t ctx = { fixed_packs, pack_count, win_flag, prevalent_wind, seat_wind };
+    return estimate_fan_upper_bound(ctx, hand, pack_len, free_info, limit);
+}
+static int Makeup_Packs(const tile_table_t left_tiles,int need_pack, int has_pair, dense_tile_table_t temp_table, pack_t * hand, int pack_len, int first_choice = 0){
+    SEARCH_STATS_INC(makeup_nodes);
+    SEARCH_STATS_STACK_FRAME();
+    MAHJONG_TRACE_SCOPE("Makeup_Packs");
+    if(need_pack == 0){
+        SEARCH_STATS_INC(makeup_leaves);
+        dense_tile_table_t temp_temp_table;                    //全部的牌
+        memcpy(&temp_temp_table, temp_table, sizeof(temp_temp_table));
+        int fan = __calcluate_fan(hand,pack_len,temp_temp_table);
+        if(fan >= 8){
+            //更新useful_table
+            Compart_table(temp_table,temp_temp_table);
+        }
+        return fan;
+    }
+    // 番数上界不足8番时，后面怎么补都不可能和牌
+    fan_bound_free_t free_info;
+    make_fan_bound_free(left_tiles, temp_table, need_pack, has_pair, &free_info);
+    if (estimate_fan_upper_bound(hand, pack_len, free_info, 8) < 8) {
+        return -1;
+    }
+    int max_fan = -1;
+    pack_t temp_pack;
+    if(!has_pair){
+        for (int i = 0; i < 34; ++i) {
+            tile_t t = all_tiles[i];
+            if (left_tiles[t] < 1 || !temp_table[i]) {
+                continue;
+            }
+            //注意这个temp_table[t] 是剪枝 如果场上不可能有同类型牌的话pair无意义
+            temp_pack = make_pack(1,PACK_TYPE_PAIR,t);
+            hand[pack_len] = temp_pack;
+            pack_len++;
+            int tmp = Makeup_Packs(left_tiles,need_pack - 1, true,temp_table,hand, pack_len);
+            pack_len--;
+            if(tmp > max_fan)max_fan = tmp;
+        }
+        return max_fan;
+    }
+
+    // 补的面子按规范顺序枚举，同一组面子的不同排列只算一次：
+    // 每种补法有一个编号，0~33为刻子，34以后为顺子，每层只尝试编号不小于上一层的补法
+    // 刻子的剪枝条件与先后顺序有关，排在顺子前面时最宽松，因此只要某组面子有一种可行的排列就能被枚举到
+    // 和牌张总是由已有的搭子或补的雀头决定，补的面子的顺序不影响算番结果
+    for (int i = std::max(first_choice, 0); i < 34; ++i) {
+        tile_t t = all_tiles[i];
+        if (left_tiles[t] < 1 || temp_table[i] < 2) {
+            continue;
+        }
+        temp_table[i]--;
+        //注意这里只减1 因为是将单张凑成对子 并且希望凑成刻字  temp_table >=2 为剪枝
+        temp_pack = make_pack(1,PACK_TYPE_PUNG,t);
+        hand[pack_len] = temp_pack;
+        pack_len++;
+        int tmp = Makeup_Packs(left_tiles,need_pack - 1, has_pair, temp_table,hand,pack_len, i);
+        pack_len--;
+        temp_table[i]++;
+        if(tmp >= 8)
+            {
+            useful |= 1ULL << i;
+            //Compart_table(temp_table,temp_temp_table);
+        }
+        if(tmp > max_fan)max_fan = tmp;
+    }
+    // t-2 t-1 t   -1 -2
+    // t-1 t t+1    +1 -1
+    // t t+1 t+2    +2 +1
+    static const int index_[3][3] = {{-1,1,2},{0,1,3},{1,2,3}};
+    static const int index_for_useful[3][3] = {{0,-1,-2},{0,+1,-1},{0,+2,+1}};
+    for (int i = std::max(first_choice - 34, 0) / 6; i < 34; ++i) {
+        tile_t t = all_tiles[i];
+        if (left_tiles[t] < 1 || !is_numbered_suit(t)) {
+            continue;
+        }
+        for(int j = 0; j < 3 ; j++)
+        {
+            if(j == 0 && tile_get_rank(t)<3)continue;
+            if(j == 1 && tile_get_rank(t)<2)continue;
+            if(j == 1 && tile_get_rank(t)>8)continue;
+            if(j == 2 && tile_get_rank(t)>7)continue;
+            for(int z = 1; z < 3; z++){
+                int choice = 34 + i * 6 + j * 2 + (z - 1);
+                if(choice < first_choice || !temp_table[i+index_for_useful[j][z]])
+                    continue;
+                //在该层只保证凑成搭子，不一定能成顺子
+                temp_table[i+index_for_useful[j][z]]--;
+                temp_pack = make_pack(index_[j][z],PACK_TYPE_CHOW,t+index_[j][0]);
+                hand[pack_len] = temp_pack;
+                pack_len++;
+                int tmp = Makeup_Packs(left_tiles,need_pack - 1, has_pair, temp_table, hand, pack_len, choice);
+                pack_len--;
+                temp_table[i+index_for_useful[j][z]]++;
+                if(tmp > 8){
+                    useful |= 1ULL << (i + index_for_useful[j][z]);
+                }
+                if(tmp > max_fan)max_fan = tmp;
+            }
+        }
+    }
+return max_fan;
+}
+// 下一个与x中1的个数相同的数（Gosper's hack），用于按位枚举组合
+static FORCE_INLINE unsigned next_combination(unsigned x) {
+    unsigned c = x & (0U - x);
+    unsigned r = x + c;
+    return (((r ^ x) >> 2) / c) | r;
+}
+
+// 搭子超载时，从hand中选出刚好能组成和牌的牌组算番，返回最大番数
+// 除副露外还需4 - pack_count组面子和1组雀头，只枚举恰好含1组雀头的组合，
+// hand中可能有相同的牌组，所以组合排序后比较，相同的牌组集合只算一次
+#define OVERLOADED_SCORED_MAX 252  // hand最多10组，选5组的组合数C(10,5)
+static int overloaded_packs_fan(const pack_t *hand, int pack_len, const dense_tile_table_t &temp_table) {
+    const int need = 5 - static_cast<int>(pack_count);
+    if (need <= 0 || need > pack_len) {
+        return -1;
+    }
+    fan_bound_free_t no_free;
+    memset(&no_free, 0, sizeof(no_free));
+    int max_fan = -1;
+    pack_t scored[OVERLOADED_SCORED_MAX][5];
+    int scored_cnt = 0;
+    const unsigned end = 1U << pack_len;
+    for (unsigned ii = (1U << need) - 1; ii < end; ii = next_combination(ii)) {
+        pack_t tmp_hand[5];
+        int tmp_count = 0, pair_cnt = 0;
+        for (int j = 0; j < pack_len; ++j) {
+            if ((ii >> j) & 1) {
+                tmp_hand[tmp_count++] = hand[j];
+                pair_cnt += (pack_get_type(hand[j]) == PACK_TYPE_PAIR);
+            }
+        }
+        if (pair_cnt != 1) {  // 雀头不是1组时张数必然不对
+            continue;
+        }
+        // hand中有相同的组时，不同的下标组合会选出同样的序列，只算一次。
+        // Makeup_Hu把和牌张给第一个能补全的搭子，结果与顺序有关，所以按原顺序比较，不排序
+        int k = 0;
+        while (k < scored_cnt && memcmp(scored[k], tmp_hand, need * sizeof(pack_t)) != 0) {
+            ++k;
+        }
+        if (k < scored_cnt) {
+            continue;
+        }
+        if (scored_cnt < OVERLOADED_SCORED_MAX) {
+            memcpy(scored[scored_cnt++], tmp_hand, need * sizeof(pack_t));
+        }
+        else {
+            // hand不超过10组时记录得下，到这里说明调用有误；不中断时只是不再去重，照常算番
+            assert(0 && "too many overloaded packs!");
+        }
+        SEARCH_STATS_INC(overload_subsets);
+        // 番数上界不足8番的组合不必算番
+        if (estimate_fan_upper_bound(tmp_hand, need, no_free, 8) < 8) {
+            continue;
+        }
+        // 每个组合都用一份新的牌表，互不影响
+        dense_tile_table_t temp_temp_table;
+        memcpy(&temp_temp_table, &temp_table, sizeof(temp_temp_table));
+        int fan = __calcluate_fan(tmp_hand, need, temp_temp_table);
+        if (fan >= 8) {
+            Compart_table(Dense_table, temp_temp_table);
+        }
+        if (fan > max_fan) {
+            max_fan = fan;
+        }
+    }
+    return max_fan;
+}
+static int basic_form_shanten_recursively(tile_table_t &cnt_table, const bool has_pair, const unsigned pack_cnt, const unsigned incomplete_cnt,
+    const intptr_t fixed_cnt, work_path_t *work_path, work_state_t *work_state, pack_t* hand, int pack_len) {
+    SEARCH_STATS_INC(recursion_nodes);
+    SEARCH_STATS_STACK_FRAME();
+
+    if (fixed_cnt == 4) {  // 4副露
+        for (int i = 0; i < 34; ++i) {
+            tile_t t = all_tiles[i];
+            if (cnt_table[t] > 1) {
+                return -1;
+            }
+        }
+        return 0;
+    }
+
+    if (pack_cnt == 4) {  // 已经有4组面子
+
+        dense_tile_table_t temp_table;
+        //全部的牌
+        int max_fan = -1;
+        int fan = -1;
+        memcpy(&temp_table, &Dense_table, sizeof(temp_table));
+        if(!has_pair){
+        // 只差雀头，先估计番数上界
+        fan_bound_free_t free_info;
+        make_fan_bound_free(cnt_table, temp_table, 1, false, &free_info);
+        if (estimate_fan_upper_bound(hand, pack_len, free_info, 8) >= 8) {
+            for(int i = 0; i < 34; i++){
+
+                tile_t t = all_tiles[i];
+                if(temp_table[i] && cnt_table[t])
+                {
+                    temp_table[i]--;
+                    pack_t temp_pack = make_pack(1,PACK_TYPE_PAIR,t);
+                    hand[pack_len++] = temp_pack;
+                    fan = __calcluate_fan(hand,pack_len,temp_table);
+                    pack_len--;
+                    if(fan >= 8)
+                    {
+                        Compart_table(Dense_table,temp_table);
+                        int temp = has_pair ? -1 : 0;
+                        cur_min = temp;
+                    }
+                    if(fan > max_fan){
+                        max_fan = fan;
+                    }
+                    temp_table[i]++;
+                }
+            }
+        }
+        }
+        else 
+            max_fan = __calcluate_fan(hand,pack_len,temp_table);
+        //int fan = __calcluate_fan(hand,pack_len,temp_table);
+        if(max_fan >= 8){
+            cur_min = has_pair ? -1 : 0;
+            //make_useless(cnt_table);
+            return has_pair ? -1 : 0;  // 如果有雀头，则和了；如果无雀头，则是听牌
+        }
+        else
+            return 2146483647;
+    }
+
+    int max_ret;  // 当前状态能返回的最大上听数
+
+    // 算法说明：
+    // 缺少的面子数=4-完成的面子数
+    // 缺少的搭子数=缺少的面子数-已有的搭子数
+    // 两式合并：缺少的搭子数=4-完成的面子数-已有的搭子数
+    int incomplete_need = 4 - pack_cnt - incomplete_cnt;
+    if (incomplete_need > 0) {  // 还需要搭子的情况
+        // 有雀头时，上听数=已有的搭子数+缺少的搭子数*2-1
+        // 无雀头时，上听数=已有的搭子数+缺少的搭子数*2
+        max_ret = incomplete_cnt + incomplete_need * 2 - (has_pair ? 1 : 0);
+    }
+    else {  // 搭子齐了的情况
+        // 有雀头时，上听数=3-完成的面子数
+        // 无雀头时，上听数=4-完成的面子数
+        max_ret = (has_pair ? 3 : 4) - pack_cnt;
+    }
+    bool can_extend = false;
+    // 当前路径深度
+    const unsigned depth = pack_cnt + incomplete_cnt + has_pair;
+    int result = max_ret;
+    if (pack_cnt + incomplete_cnt > 4 && result <= cur_min) {  // 搭子超载
+        
+        dense_tile_table_t temp_table;
+        //全部的牌
+        int max_fan = -1;
+        memcpy(&temp_table, &Dense_table, sizeof(temp_table));
+        if(!has_pair){
+        for(int i = 0; i < 34; i++){
+            tile_t t = all_tiles[i];
+            if(temp_table[i] && cnt_table[t])
+            {
+                temp_table[i]--;
+                pack_t temp_pack = make_pack(1,PACK_TYPE_PAIR,t);
+                hand[pack_len++] = temp_pack;
+                int fan = overloaded_packs_fan(hand, pack_len, temp_table);
+                if(fan > max_fan){
+                    max_fan = fan;
+                }
+                pack_len--;
+                temp_table[i]++;
+            }
+        }}
+        else{
+            max_fan = overloaded_packs_fan(hand, pack_len, temp_table);
+        }
+        if(max_fan < 8 ){
+            max_ret = 2146483647;
+        }
+        if(max_ret < cur_min)
+            cur_min = max_ret;
+        save_work_path(fixed_cnt, depth, max_ret, work_path, work_state);
+        
+        return max_ret;
+    }
+    else if(pack_cnt + incomplete_cnt > 4){
+        return 2146483647;
+    }
+
+
+
+    for (int i = 0; i < 34; ++i) {
+        tile_t t = all_tiles[i];
+        if (cnt_table[t] < 1) {
+            continue;
+        }
+        pack_t temp_pack;
+        // 雀头
+        if (!has_pair && cnt_table[t] > 1) {
+            work_path->units[depth] = MAKE_UNIT(UNIT_TYPE_PAIR, t);  // 记录雀头
+            int known = 0;
+            if (is_basic_form_branch_exist(fixed_cnt, depth, work_path, work_state, &known)) {
+                // 算过的子节点直接用它的结果
+                can_extend = true;
+                result = std::min(known, result);
+            }
+            else {
+                // 削减雀头，递归
+                cnt_table[t] -= 2;
+                temp_pack = make_pack(0,PACK_TYPE_PAIR,t);
+                hand[pack_len] = temp_pack;
+                pack_len++;
+                can_extend = true;
+                int ret = basic_form_shanten_recursively(cnt_table, true, pack_cnt, incomplete_cnt,
+                    fixed_cnt, work_path, work_state, hand, pack_len);
+                result = std::min(ret, result);
+                // 还原
+                cnt_table[t] += 2;
+                pack_len--;
+            }
+        }
+
+        // 刻子
+        if (cnt_table[t] > 2) {
+            work_path->units[depth] = MAKE_UNIT(UNIT_TYPE_PUNG, t);  // 记录刻子
+            int known = 0;
+            if (is_basic_form_branch_exist(fixed_cnt, depth, work_path, work_state, &known)) {
+                // 算过的子节点直接用它的结果
+                can_extend = true;
+                result = std::min(known, result);
+            }
+            else {
+                // 削减这组刻子，递归
+                cnt_table[t] -= 3;
+
+                temp_pack = make_pack(0,PACK_TYPE_PUNG,t);
+                hand[pack_len] = temp_pack;
+                pack_len++;
+                can_extend = true;
+                int ret = basic_form_shanten_recursively(cnt_table, has_pair, pack_cnt + 1, incomplete_cnt,
+                    fixed_cnt, work_path, work_state,hand,pack_len);
+                result = std::min(ret, result);
+                // 还原
+                cnt_table[t] += 3;
+                pack_len--;
+            }
+        }
+        // 顺子（只能是数牌）
+        bool is_numbered = is_numbered_suit(t);
+        // 顺子t t+1 t+2，显然t不能是8点以上的数牌
+        if (is_numbered && tile_get_rank(t) < 8 && cnt_table[t + 1] && cnt_table[t + 2]) {
+            work_path->units[depth] = MAKE_UNIT(UNIT_TYPE_CHOW, t);  // 记录顺子
+            int known = 0;
+            if (is_basic_form_branch_exist(fixed_cnt, depth, work_path, work_state, &known)) {
+                // 算过的子节点直接用它的结果
+                can_extend = true;
+                result = std::min(known, result);
+            }
+            else {
+                // 削减这组顺子，递归
+                --cnt_table[t];
+                --cnt_table[t + 1];
+                --cnt_table[t + 2];
+                temp_pack = make_pack(0,PACK_TYPE_CHOW,t+1);
+                hand[pack_len] = temp_pack;
+                pack_len++;
+                can_extend = true;
+                int ret = basic_form_shanten_recursively(cnt_table, has_pair, pack_cnt + 1, incomplete_cnt,
+                    fixed_cnt, work_path, work_state, hand, pack_len);
+                result = std::min(ret, result);
+                // 还原
+                ++cnt_table[t];
+                ++cnt_table[t + 1];
+                ++cnt_table[t + 2];
+                pack_len--;
+            }
+        }
+        // 如果已经通过削减雀头/面子降低了上听数，再按搭子计算的上听数肯定不会更少
+        if (result < max_ret) {
+            continue;
+        }
+        // 刻子搭子
+        if (cnt_table[t] > 1) {
+            work_path->units[depth] = MAKE_UNIT(UNIT_TYPE_INCOMPLETE_PUNG, t);  // 记录刻子搭子
+            int known = 0;
+            if (is_basic_form_branch_exist(fixed_cnt, depth, work_path, work_state, &known)) {
+                // 算过的子节点直接用它的结果
+                can_extend = true;
+                result = std::min(known, result);
+            }
+            else {
+                // 削减刻子搭子，递归
+                cnt_table[t] -= 2;
+                temp_pack = make_pack(1,PACK_TYPE_PUNG,t);
+                hand[pack_len] = temp_pack;
+                pack_len++;
+                can_extend = true;
+                int ret = basic_form_shanten_recursively(cnt_table, has_pair, pack_cnt, incomplete_cnt + 1,
+                    fixed_cnt, work_path, work_state, hand, pack_len);
+                result = std::min(ret, result);
+                // 还原
+                cnt_table[t] += 2;
+                pack_len--;
+            }
+        }
+
+
+        // 顺子搭子（只能是数牌）
+        if (is_numbered) {
             // 两面或者边张搭子t t+1，显然t不能是9点以上的数牌
             if (tile_get_rank(t) < 9 && cnt_table[t + 1]) {  // 两面或者边张
                 work_path->units[depth] = MAKE_UNIT(UNIT_TYPE_CHOW_OPEN_END, t);  // 记录两面或者边张搭子
-                if (!is_basic_form_branch_exist(fixed_cnt, work_path, work_state)) {
+                int known = 0;
+                if (is_basic_form_branch_exist(fixed_cnt, depth, work_path, work_state, &known)) {
+                    // 算过的子节点直接用它的结果
+                    can_extend = true;
+                    result = std::min(known, result);
+                }
+                else {
                     // 削减搭子，递归
                     --cnt_table[t];
                     --cnt_table[t + 1];
@@ -5034,958 +6840,2162 @@ static int basic_form_shanten_recursively(tile_table_t &cnt_table, const bool ha
                     pack_len--;
                 }
             }
-            if (tile_get_rank(t) < 8 && cnt_table[t + 1]) {  // 两面或者边张
-                work_path->units[depth] = MAKE_UNIT(UNIT_TYPE_CHOW_OPEN_BEGIN, t);  // 记录两面或者边张搭子
-                if (!is_basic_form_branch_exist(fixed_cnt, work_path, work_state)) {
-                    // 削减搭子，递归
-                    --cnt_table[t];
-                    --cnt_table[t + 1];
-                    temp_pack = make_pack(3,PACK_TYPE_CHOW,t+1);
-                    // 还有一种pack方案
-                    hand[pack_len] = temp_pack;
-                    pack_len++;
-                    can_extend = true;
-                    int ret = basic_form_shanten_recursively(cnt_table, has_pair, pack_cnt, incomplete_cnt + 1,
-                        fixed_cnt, work_path, work_state,hand,pack_len);
-                    result = std::min(ret, result);
-                    // 还原
-                    ++cnt_table[t];
-                    ++cnt_table[t + 1];
-                    pack_len--;
+            if (tile_get_rank(t) < 8 && cnt_table[t + 1]) {  // 两面或者边张
+                work_path->units[depth] = MAKE_UNIT(UNIT_TYPE_CHOW_OPEN_BEGIN, t);  // 记录两面或者边张搭子
+                int known = 0;
+                if (is_basic_form_branch_exist(fixed_cnt, depth, work_path, work_state, &known)) {
+                    // 算过的子节点直接用它的结果
+                    can_extend = true;
+                    result = std::min(known, result);
+                }
+                else {
+                    // 削减搭子，递归
+                    --cnt_table[t];
+                    --cnt_table[t + 1];
+                    temp_pack = make_pack(3,PACK_TYPE_CHOW,t+1);
+                    // 还有一种pack方案
+                    hand[pack_len] = temp_pack;
+                    pack_len++;
+                    can_extend = true;
+                    int ret = basic_form_shanten_recursively(cnt_table, has_pair, pack_cnt, incomplete_cnt + 1,
+                        fixed_cnt, work_path, work_state,hand,pack_len);
+                    result = std::min(ret, result);
+                    // 还原
+                    ++cnt_table[t];
+                    ++cnt_table[t + 1];
+                    pack_len--;
+                }
+            }
+
+            // 嵌张搭子t t+2，显然t不能是8点以上的数牌
+            if (tile_get_rank(t) < 8 && cnt_table[t + 2]) {  // 嵌张
+                work_path->units[depth] = MAKE_UNIT(UNIT_TYPE_CHOW_CLOSED, t);  // 记录嵌张搭子
+                int known = 0;
+                if (is_basic_form_branch_exist(fixed_cnt, depth, work_path, work_state, &known)) {
+                    // 算过的子节点直接用它的结果
+                    can_extend = true;
+                    result = std::min(known, result);
+                }
+                else {
+                    // 削减搭子，递归
+                    --cnt_table[t];
+                    --cnt_table[t + 2];
+                    temp_pack = make_pack(2,PACK_TYPE_CHOW,t+1);
+                    hand[pack_len] = temp_pack;
+                    pack_len++;
+                    can_extend = true;
+                    int ret = basic_form_shanten_recursively(cnt_table, has_pair, pack_cnt, incomplete_cnt + 1,
+                        fixed_cnt, work_path, work_state,hand,pack_len);
+                    result = std::min(ret, result);
+                    // 还原
+                    ++cnt_table[t];
+                    ++cnt_table[t + 2];
+                    pack_len--;
+                }
+            }
+        }
+    }
+    // 子节点没有降低上听数的路径才保存，叶子算完番后再保存
+    const bool save_path = result == max_ret;
+    if(result<=3 && can_extend == false && result <= cur_min){
+        dense_tile_table_t temp_table;
+        //全部的牌
+        memcpy(&temp_table, &Dense_table, sizeof(temp_table));
+
+        if(result < cur_min)
+            useful = 0;
+
+        int need_pack = 4 - pack_count - pack_len;
+
+        bool has_pair_for_makeup = false;
+        for(int i = 0 ; i < pack_len; i++){
+            if(pack_get_type(hand[i]) == PACK_TYPE_PAIR)
+            {
+                has_pair_for_makeup = true;
+                
+            }
+        }
+        if(!has_pair_for_makeup)need_pack += 1;
+
+
+
+        int fan = -1;
+        int max_fan = -1;
+        if(need_pack > 0)
+            {
+                
+                fan = Makeup_Packs(cnt_table,need_pack, has_pair_for_makeup, temp_table, hand, pack_len);
+            }
+        else{
+                dense_tile_table_t temp_temp_table;       //全部的牌
+                memcpy(&temp_temp_table, &temp_table, sizeof(temp_temp_table));
+                fan = __calcluate_fan(hand,pack_len,temp_temp_table);
+                if(fan >= 8)
+                {
+                    Compart_table(temp_table,temp_temp_table);
+                }
+        }
+        if(fan > max_fan){
+            max_fan = fan;
+        }
+        if(max_fan < 8){
+            result = 2146483647;
+        }
+    }
+
+    if(result < cur_min)
+        cur_min = result;
+    if (save_path) {
+        save_work_path(fixed_cnt, depth, result, work_path, work_state);
+    }
+
+    return result;
+}
+// 数牌是否有搭子
+static bool numbered_tile_has_neighbor(const tile_table_t &cnt_table, tile_t t) {
+    rank_t r = tile_get_rank(t);
+    if (r < 9) { if (cnt_table[t + 1]) return true; }
+    if (r < 8) { if (cnt_table[t + 2]) return true; }
+    if (r > 1) { if (cnt_table[t - 1]) return true; }
+    if (r > 2) { if (cnt_table[t - 2]) return true; }
+    return false;
+}
+
+// 以表格为参数计算基本和型上听数
+static int basic_form_shanten_from_table(tile_table_t &cnt_table, intptr_t fixed_cnt, useful_table_t *useful_table) {
+    MAHJONG_TRACE_SCOPE("basic_form_shanten_from_table");
+    // 计算上听数
+    work_path_t work_path;
+    work_state_t work_state;
+    work_state.count = 0;
+    pack_t hand[10];
+    table_to_dense_table(Table, &Dense_table);
+    int result = basic_form_shanten_recursively(cnt_table, false, static_cast<uint16_t>(fixed_cnt), 0,
+        fixed_cnt, &work_path, &work_state,hand,0);
+
+    if (useful_table == nullptr) {
+        return result;
+    }
+    // 穷举所有的牌，获取能减少上听数的牌
+    for (int i = 0; i < 34; ++i) {
+        tile_t t = all_tiles[i];
+        if (cnt_table[t] == 4 && result > 0) {
+            continue;
+        }
+        if (cnt_table[t] == 0) {
+            // 跳过孤张字牌和不靠张的数牌，这些牌都无法减少上听数
+            if (is_honor(t) || !numbered_tile_has_neighbor(cnt_table, t)) {
+                continue;
+            }
+        }
+        ++cnt_table[t];
+        work_state.count = 0;
+        int temp = basic_form_shanten_recursively(cnt_table, false, static_cast<uint16_t>(fixed_cnt), 0,
+            fixed_cnt, &work_path, &work_state, hand,0);
+        if (temp < result) {
+            (*useful_table)[t] = true;  // 标记为有效牌
+        }
+        --cnt_table[t];
+    }
+
+    return result;
+}
+float Prob_weight = 0.89;
+int total_count = 0;
+
+std::vector<float> calculate_expect(tile_t *standing_tiles, intptr_t tile_count, useful_table_t &Use){
+    MAHJONG_TRACE_SCOPE("calculate_expect");
+
+    float total_prob = 0;
+    int shanten = basic_form_shanten(standing_tiles, tile_count, nullptr);
+    if(shanten >= 0){
+    basic_form_shanten(standing_tiles, tile_count, &Use);
+    }
+    else
+        dense_to_useful_table(useful, &Use);
+    if(shanten <= 10)
+        {
+            float prob = 0;
+            for (int i = 0; i < 34; ++i){  
+                tile_t t = all_tiles[i];
+                if(Use[t]){
+                    prob += ((float)Table[t])/((float)total_count);
+                }
+            }
+            total_prob = prob;
+        }
+    else
+        {
+            for (int i = 0; i < 34; ++i) {
+                tile_t t = all_tiles[i];
+                if(Use[t]){
+                    for(int p = 0; p<tile_count; p++)
+                    {
+                        tile_t tmp = standing_tiles[p];
+                        standing_tiles[p] = t;
+                        int tmp_shanten = basic_form_shanten(standing_tiles, tile_count, nullptr);
+                        if(tmp_shanten < shanten){
+                            useful_table_t tmp_use;
+                            float prob = 0;
+                            float prob_useful = ((float)Table[t])/((float)total_count);
+                            total_prob += Prob_weight * prob_useful * prob;
+                        }
+                        standing_tiles[p] = tmp;
+
+                }
+
+                }
+            }
+        }
+        std::vector<float> tmp;
+        tmp.push_back(shanten);
+        tmp.push_back(total_prob);
+        return tmp;
+}
+
+int Policy(const char *str,int mode = 0) {
+    SEARCH_STATS_TIME(policy_ns);
+    MAHJONG_TRACE_SCOPE("Policy");
+
+    hand_tiles_t hand_tiles;
+    tile_t serving_tile;
+    long ret = string_to_tiles(str, &hand_tiles, &serving_tile);
+
+    if (ret != 0) return 0;
+
+    memcpy(fixed_packs,hand_tiles.fixed_packs,sizeof(fixed_packs));
+    pack_count = hand_tiles.pack_count;
+    char buf[20];
+    ret = hand_tiles_to_string(&hand_tiles, buf, sizeof(buf));
+    useful_table_t useful_table = {false};
+    float max_prob = 0;
+    int max_numebr = hand_tiles.tile_count;
+
+    total_count = 0;
+    for (int i = 0; i < 34; ++i){  
+        tile_t t = all_tiles[i];
+        total_count += Table[t];
+    }
+
+    std::vector<float> max_;
+    max_ = calculate_expect(hand_tiles.standing_tiles, hand_tiles.tile_count, useful_table);
+    for(int ii = 0; ii < hand_tiles.tile_count; ii++)
+    {
+        tile_t temp = hand_tiles.standing_tiles[ii];
+        hand_tiles.standing_tiles[ii] = serving_tile;
+        std::vector<float> ttmp;
+        ttmp = calculate_expect(hand_tiles.standing_tiles, hand_tiles.tile_count, useful_table);
+        hand_tiles.standing_tiles[ii] = temp;
+        if(max_[0] > ttmp[0]){
+
+            max_[0] = ttmp[0];
+            max_[1] = ttmp[1];
+            max_numebr = ii;
+        }
+        if((int)max_[0] == (int)ttmp[0] && max_[1] < ttmp[1]){
+            max_[0] = ttmp[0];
+            max_[1] = ttmp[1];
+            max_numebr = ii;
+        }
+    }
+    if(mode == 0){
+
+        return max_numebr;
+    }
+    else
+    {
+        if(max_numebr == hand_tiles.tile_count){
+            return serving_tile;
+        }
+        else
+            return hand_tiles.standing_tiles[max_numebr];
+    }
+}
+
+
+
+// 基本和型上听数
+int basic_form_shanten(const tile_t *standing_tiles, intptr_t standing_cnt, useful_table_t *useful_table) {
+    if (standing_tiles == nullptr || (standing_cnt != 13
+        && standing_cnt != 10 && standing_cnt != 7 && standing_cnt != 4 && standing_cnt != 1)) {
+        return std::numeric_limits<int>::max();
+    }
+    // 对立牌的种类进行打表
+    tile_table_t cnt_table;
+    map_tiles(standing_tiles, standing_cnt, &cnt_table);
+    if (useful_table != nullptr) {
+        memset(*useful_table, 0, sizeof(*useful_table));
+    }
+    return basic_form_shanten_from_table(cnt_table, (13 - standing_cnt) / 3, useful_table);
+}
+
+// 基本和型和牌表与听牌表
+// 和牌时各门牌互不影响：每门牌都要能全部拆成面子，只有一门再多1对雀头，字牌只能组成刻子。
+// 一门牌的张数模式（每种0~4张）以5进制编码为下标，数牌9种一共5^9种模式，字牌7种一共5^7种模式。
+// 每种模式用2个位分别记录能否全部拆成面子、能否拆成面子加1对雀头，
+// 另用一个掩码记录这门牌再加哪些牌就能全部拆成面子（张数模3余2时）或拆成面子加雀头（张数模3余1时）。
+// 与递归判断一致，听牌张允许是手中已有4张的牌。
+// 表在第一次使用时生成：穷举最多4组面子与可选的1对雀头得到所有能拆开的模式，
+// 每个模式去掉任意1张就是一个听这张牌的模式，无需对每种模式做递归拆解
+#define AGARI_PATTERN_COUNT 1953125  // 5^9
+#define AGARI_HONOR_PATTERN_COUNT 78125  // 5^7
+
+namespace {
+
+    // 一类牌（数牌一门或字牌）的表
+    struct agari_group_t {
+        uint64_t *melds;        // 全部拆成面子
+        uint64_t *melds_pair;   // 拆成面子加1对雀头
+        uint16_t *waits;        // 听牌掩码，第r位表示再加1张第r种牌
+        int len;                // 牌的种数
+        bool numbered;          // 是否为数牌
+    };
+
+    struct agari_table_t {
+        uint64_t suit_melds[(AGARI_PATTERN_COUNT + 63) / 64];
+        uint64_t suit_melds_pair[(AGARI_PATTERN_COUNT + 63) / 64];
+        uint16_t suit_waits[AGARI_PATTERN_COUNT];
+        uint64_t honor_melds[(AGARI_HONOR_PATTERN_COUNT + 63) / 64];
+        uint64_t honor_melds_pair[(AGARI_HONOR_PATTERN_COUNT + 63) / 64];
+        uint16_t honor_waits[AGARI_HONOR_PATTERN_COUNT];
+
+        agari_table_t() {
+            agari_group_t suit = { suit_melds, suit_melds_pair, suit_waits, 9, true };
+            agari_group_t honor = { honor_melds, honor_melds_pair, honor_waits, 7, false };
+            memset(suit_melds, 0, sizeof(suit_melds));
+            memset(suit_melds_pair, 0, sizeof(suit_melds_pair));
+            memset(suit_waits, 0, sizeof(suit_waits));
+            memset(honor_melds, 0, sizeof(honor_melds));
+            memset(honor_melds_pair, 0, sizeof(honor_melds_pair));
+            memset(honor_waits, 0, sizeof(honor_waits));
+            int cnt[9] = { 0 };
+            generate(suit, cnt, 0, 0);
+            generate(honor, cnt, 0, 0);
+        }
+
+        // 编码，有超过4张的牌时返回-1
+        static int encode(const agari_group_t &group, const int *cnt) {
+            int idx = 0;
+            for (int r = group.len - 1; r >= 0; --r) {
+                if (cnt[r] > 4) {
+                    return -1;
+                }
+                idx = idx * 5 + cnt[r];
+            }
+            return idx;
+        }
+
+        // 记录一个能拆开的模式，以及去掉1张后听这张牌的模式
+        static void mark(const agari_group_t &group, int *cnt, uint64_t *bits) {
+            int idx = encode(group, cnt);
+            if (idx >= 0) {
+                bits[idx >> 6] |= 1ULL << (idx & 63);
+            }
+            for (int r = 0; r < group.len; ++r) {
+                if (cnt[r] == 0) {
+                    continue;
+                }
+                --cnt[r];
+                int i = encode(group, cnt);
+                if (i >= 0) {
+                    group.waits[i] |= static_cast<uint16_t>(1 << r);
                 }
+                ++cnt[r];
             }
+        }
 
-            // 嵌张搭子t t+2，显然t不能是8点以上的数牌
-            if (tile_get_rank(t) < 8 && cnt_table[t + 2]) {  // 嵌张
-                work_path->units[depth] = MAKE_UNIT(UNIT_TYPE_CHOW_CLOSED, t);  // 记录嵌张搭子
-                if (!is_basic_form_branch_exist(fixed_cnt, work_path, work_state)) {
-                    // 削减搭子，递归
-                    --cnt_table[t];
-                    --cnt_table[t + 2];
-                    temp_pack = make_pack(2,PACK_TYPE_CHOW,t+1);
-                    hand[pack_len] = temp_pack;
-                    pack_len++;
-                    can_extend = true;
-                    int ret = basic_form_shanten_recursively(cnt_table, has_pair, pack_cnt, incomplete_cnt + 1,
-                        fixed_cnt, work_path, work_state,hand,pack_len);
-                    result = std::min(ret, result);
-                    // 还原
-                    ++cnt_table[t];
-                    ++cnt_table[t + 2];
-                    pack_len--;
+        // 面子编号：0~len-1为刻子，之后为顺子，从编号first开始选，保证同一组合只生成一次
+        // 听牌张可以是第5张，所以生成时允许1种牌有5张
+        static void generate(const agari_group_t &group, int *cnt, int first, int meld_cnt) {
+            mark(group, cnt, group.melds);
+            for (int r = 0; r < group.len; ++r) {
+                if (cnt[r] + 2 <= 5) {
+                    cnt[r] += 2;
+                    mark(group, cnt, group.melds_pair);
+                    cnt[r] -= 2;
+                }
+            }
+
+            if (meld_cnt == 4) {
+                return;
+            }
+            const int kind_cnt = group.numbered ? group.len + 7 : group.len;
+            for (int k = first; k < kind_cnt; ++k) {
+                if (k < group.len) {
+                    if (cnt[k] + 3 > 5) {
+                        continue;
+                    }
+                    cnt[k] += 3;
+                    if (five_count(group, cnt) < 2) {
+                        generate(group, cnt, k, meld_cnt + 1);
+                    }
+                    cnt[k] -= 3;
+                }
+                else {
+                    int r = k - group.len;
+                    if (cnt[r] == 5 || cnt[r + 1] == 5 || cnt[r + 2] == 5) {
+                        continue;
+                    }
+                    ++cnt[r], ++cnt[r + 1], ++cnt[r + 2];
+                    if (five_count(group, cnt) < 2) {
+                        generate(group, cnt, k, meld_cnt + 1);
+                    }
+                    --cnt[r], --cnt[r + 1], --cnt[r + 2];
+                }
+            }
+        }
+
+        // 5张的牌有几种，有2种以上时去掉1张也不合法，不必再往下生成
+        static int five_count(const agari_group_t &group, const int *cnt) {
+            return static_cast<int>(std::count(cnt, cnt + group.len, 5));
+        }
+    };
+
+    const agari_table_t &get_agari_table() {
+        static const agari_table_t table;
+        return table;
+    }
+
+    // 一类牌查表的结果
+    struct agari_probe_t {
+        int idx;        // 编码
+        int remainder;  // 张数模3
+    };
+
+    // 查一类牌的编码，有超过4张的牌时返回false
+    FORCE_INLINE bool agari_probe(const uint16_t *cnt, int len, agari_probe_t *probe) {
+        int idx = 0, n = 0;
+        for (int r = len - 1; r >= 0; --r) {
+            if (cnt[r] > 4) {
+                return false;
+            }
+            idx = idx * 5 + cnt[r];
+            n += cnt[r];
+        }
+        probe->idx = idx;
+        probe->remainder = n % 3;
+        return true;
+    }
+
+    const int agari_pow5[9] = { 1, 5, 25, 125, 625, 3125, 15625, 78125, 390625 };
+
+    // 由压缩牌表查第g组的编码，只遍历有的牌，调用者保证没有超过4张的牌
+    FORCE_INLINE void agari_probe_packed(const packed_hand_t &hand, int g, agari_probe_t *probe) {
+        uint64_t lane = (hand.words[g >> 1] >> ((g & 1) * 32)) & 0x07FFFFFFULL;
+        int idx = 0, n = 0;
+        for (uint64_t mask = packed_hand_present(lane); mask != 0; mask &= mask - 1) {
+            int bit = packed_hand_lowest_bit(mask);
+            int c = static_cast<int>((lane >> bit) & 7);
+            idx += c * agari_pow5[bit / 3];
+            n += c;
+        }
+        probe->idx = idx;
+        probe->remainder = n % 3;
+    }
+
+    FORCE_INLINE bool agari_test(const uint64_t *bits, int idx) {
+        return (bits[idx >> 6] & (1ULL << (idx & 63))) != 0;
+    }
+
+    // 第g组的首张牌，0~2组依次为万条饼，3组为字牌
+    FORCE_INLINE tile_t agari_group_first(int g) {
+        return g < 3 ? make_tile(static_cast<suit_t>(g + 1), 1) : static_cast<tile_t>(TILE_E);
+    }
+
+}
+
+// 由各组的编码计算基本和型是否和牌
+static bool is_basic_form_win_from_probes(const agari_probe_t *probes) {
+    const agari_table_t &table = get_agari_table();
+    int pair_cnt = 0;
+
+    for (int g = 0; g < 4; ++g) {
+        if (probes[g].remainder == 0) {
+            if (!agari_test(g < 3 ? table.suit_melds : table.honor_melds, probes[g].idx)) {
+                return false;
+            }
+        }
+        else if (probes[g].remainder == 2) {
+            if (++pair_cnt > 1 || !agari_test(g < 3 ? table.suit_melds_pair : table.honor_melds_pair, probes[g].idx)) {
+                return false;
+            }
+        }
+        else {
+            return false;
+        }
+    }
+
+    return pair_cnt == 1;
+}
+
+// 由各组的编码计算基本和型是否听牌，听牌张追加标记到waiting_table上
+// 张数模3余1的一门加1张后要拆成面子加雀头，其余各门都要全部拆成面子；
+// 或者有两门张数模3余2，其中一门拆成面子加雀头，另一门加1张后全部拆成面子
+static bool is_basic_form_wait_from_probes(const agari_probe_t *probes, useful_table_t *waiting_table) {
+    const agari_table_t &table = get_agari_table();
+    int odd_groups[4];  // 张数模3不为0的组
+    int odd_cnt = 0;
+    for (int g = 0; g < 4; ++g) {
+        if (probes[g].remainder == 0) {
+            if (!agari_test(g < 3 ? table.suit_melds : table.honor_melds, probes[g].idx)) {
+                return false;
+            }
+        }
+        else {
+            odd_groups[odd_cnt++] = g;
+        }
+    }
+
+    uint16_t masks[4] = { 0 };
+    if (odd_cnt == 1 && probes[odd_groups[0]].remainder == 1) {
+        int g = odd_groups[0];
+        masks[g] = (g < 3 ? table.suit_waits : table.honor_waits)[probes[g].idx];
+    }
+    else if (odd_cnt == 2 && probes[odd_groups[0]].remainder == 2 && probes[odd_groups[1]].remainder == 2) {
+        for (int i = 0; i < 2; ++i) {
+            int pair_group = odd_groups[i], wait_group = odd_groups[1 - i];
+            if (agari_test(pair_group < 3 ? table.suit_melds_pair : table.honor_melds_pair, probes[pair_group].idx)) {
+                masks[wait_group] = (wait_group < 3 ? table.suit_waits : table.honor_waits)[probes[wait_group].idx];
+            }
+        }
+    }
+    else {
+        return false;
+    }
+
+    bool ret = false;
+    for (int g = 0; g < 4; ++g) {
+        if (masks[g] == 0) {
+            continue;
+        }
+        ret = true;
+        if (waiting_table == nullptr) {  // 不需要获取听牌张，则可以直接返回
+            break;
+        }
+        tile_t first = agari_group_first(g);
+        for (int r = 0; r < 9; ++r) {
+            if (masks[g] & (1 << r)) {
+                (*waiting_table)[first + r] = true;
+            }
+        }
+    }
+    return ret;
+}
+
+// 以表格为参数计算基本和型是否听牌，听牌张追加标记到waiting_table上
+static bool is_basic_form_wait_from_table(const tile_table_t &cnt_table, useful_table_t *waiting_table) {
+    agari_probe_t probes[4];
+    for (int g = 0; g < 4; ++g) {
+        if (!agari_probe(&cnt_table[agari_group_first(g)], g < 3 ? 9 : 7, &probes[g])) {
+            return false;
+        }
+    }
+    return is_basic_form_wait_from_probes(probes, waiting_table);
+}
+
+// 有1种牌是第5张时编码放不下，去掉1张后看它是不是听牌张，与听牌表生成时允许的第5张一致
+// 有2种以上的牌超过4张，或者单种牌超过5张的，不可能和牌
+static bool is_basic_form_win_with_fifth_copy(const tile_table_t &cnt_table) {
+    tile_t fifth_tile = 0;
+    for (int i = 0; i < 34; ++i) {
+        tile_t t = all_tiles[i];
+        if (cnt_table[t] > 5 || (cnt_table[t] == 5 && fifth_tile != 0)) {
+            return false;
+        }
+        if (cnt_table[t] == 5) {
+            fifth_tile = t;
+        }
+    }
+    if (fifth_tile == 0) {
+        return false;
+    }
+
+    tile_table_t temp_table;
+    memcpy(temp_table, cnt_table, sizeof(temp_table));
+    --temp_table[fifth_tile];
+    useful_table_t waiting_table = { false };
+    return is_basic_form_wait_from_table(temp_table, &waiting_table) && waiting_table[fifth_tile];
+}
+
+// 以表格为参数计算基本和型是否和牌
+static bool is_basic_form_win_from_table(const tile_table_t &cnt_table) {
+    agari_probe_t probes[4];
+    for (int g = 0; g < 4; ++g) {
+        if (!agari_probe(&cnt_table[agari_group_first(g)], g < 3 ? 9 : 7, &probes[g])) {
+            return is_basic_form_win_with_fifth_copy(cnt_table);
+        }
+    }
+    return is_basic_form_win_from_probes(probes);
+}
+
+// 基本和型是否听牌
+// 这里之所以不用直接调用上听数计算函数，判断其返回值为0的方式
+// 是因为前者会削减搭子，这个操作在和牌判断中是没必要的，所以单独查表
+bool is_basic_form_wait(const tile_t *standing_tiles, intptr_t standing_cnt, useful_table_t *waiting_table) {
+    // 对立牌的种类进行打表
+    tile_table_t cnt_table;
+    map_tiles(standing_tiles, standing_cnt, &cnt_table);
+
+    if (waiting_table != nullptr) {
+        memset(*waiting_table, 0, sizeof(*waiting_table));
+    }
+    return is_basic_form_wait_from_table(cnt_table, waiting_table);
+}
+
+// 基本和型是否和牌
+bool is_basic_form_win(const tile_t *standing_tiles, intptr_t standing_cnt, tile_t test_tile) {
+    // 对立牌的种类进行打表
+    tile_table_t cnt_table;
+    map_tiles(standing_tiles, standing_cnt, &cnt_table);
+    ++cnt_table[test_tile];  // 添加测试的牌
+    return is_basic_form_win_from_table(cnt_table);
+}
+
+// 由压缩牌表查各组的编码，有超过4张的牌时返回false
+static bool agari_probe_packed_hand(const packed_hand_t &standing_hand, agari_probe_t *probes) {
+    if (packed_hand_overflow(standing_hand.words[0]) != 0 || packed_hand_overflow(standing_hand.words[1]) != 0) {
+        return false;
+    }
+    for (int g = 0; g < 4; ++g) {
+        agari_probe_packed(standing_hand, g, &probes[g]);
+    }
+    return true;
+}
+
+// 基本和型是否听牌（压缩牌表）
+bool is_basic_form_wait(const packed_hand_t &standing_hand, useful_table_t *waiting_table) {
+    if (waiting_table != nullptr) {
+        memset(*waiting_table, 0, sizeof(*waiting_table));
+    }
+    agari_probe_t probes[4];
+    return agari_probe_packed_hand(standing_hand, probes) && is_basic_form_wait_from_probes(probes, waiting_table);
+}
+
+// 基本和型是否和牌（压缩牌表），有超过4张的牌时转成表，与表格版本一样处理第5张
+bool is_basic_form_win(const packed_hand_t &standing_hand) {
+    agari_probe_t probes[4];
+    if (!agari_probe_packed_hand(standing_hand, probes)) {
+        tile_table_t cnt_table;
+        packed_hand_to_table(standing_hand, &cnt_table);
+        return is_basic_form_win_from_table(cnt_table);
+    }
+    return is_basic_form_win_from_probes(probes);
+}
+
+//-------------------------------- 基本和型分门拆分 --------------------------------
+// 不带番数限制的基本和型上听数只取决于面子数、搭子数和有无雀头，而各门牌的拆分互不影响，
+// 所以每门牌单独穷举拆分，再把各门的结果合并即可。手牌变动1张时只有那一门需要重新拆分
+
+// 一组牌的拆分结果：[是否含雀头][面子数]能得到的最多搭子数，-1为无此拆分
+typedef int8_t partition_table_t[2][5];
+
+// 拆分的记忆化：同一组牌里，剩余牌相同的子问题结果相同，以剩余各张数的混合进制编码为下标，
+// 各位的进制为该种牌的张数+1。一组牌不超过16张时编码不超过8748，用不着更大的表
+#define PARTITION_MEMO_SIZE 16384
+
+namespace {
+
+    struct partition_memo_t {
+        partition_table_t tables[PARTITION_MEMO_SIZE];
+        uint32_t stamps[PARTITION_MEMO_SIZE];  // 等于当前stamp的条目才有效，换一组牌时递增stamp即可作废全部条目
+        uint32_t stamp;
+    };
+
+    // 工具程序会在多个线程中调用，每个线程各用一份
+    thread_local partition_memo_t partition_memo;
+
+}
+
+// 累计一种拆法：子问题的结果加上这一步拆出的面子、搭子、雀头
+static FORCE_INLINE void accumulate_partition(const partition_table_t &sub, int pack_cnt, int incomplete_cnt, int pair_cnt,
+    partition_table_t &table) {
+    for (int p = 0; p + pair_cnt < 2; ++p) {
+        for (int m = 0; m + pack_cnt < 5; ++m) {
+            if (sub[p][m] < 0) {
+                continue;
+            }
+            int8_t n = static_cast<int8_t>(std::min(sub[p][m] + incomplete_cnt, 4));  // 搭子超过4个的没有意义
+            if (table[p + pair_cnt][m + pack_cnt] < n) {
+                table[p + pair_cnt][m + pack_cnt] = n;
+            }
+        }
+    }
+}
+
+// 穷举从pos开始的剩余牌的拆分，code为剩余牌的编码，weight为各位的权（不使用记忆化时为null）
+static void partition_tiles_recursively(int *cnt, int len, bool numbered, int pos, int code, const int *weight,
+    partition_table_t &table) {
+    while (pos < len && cnt[pos] == 0) {
+        ++pos;
+    }
+    memset(table, -1, sizeof(table));
+    if (pos == len) {
+        table[0][0] = 0;
+        return;
+    }
+    if (weight != nullptr && partition_memo.stamps[code] == partition_memo.stamp) {
+        memcpy(table, partition_memo.tables[code], sizeof(table));
+        return;
+    }
+
+    partition_table_t sub;
+
+    // 刻子
+    if (cnt[pos] > 2) {
+        cnt[pos] -= 3;
+        partition_tiles_recursively(cnt, len, numbered, pos, weight ? code - 3 * weight[pos] : 0, weight, sub);
+        cnt[pos] += 3;
+        accumulate_partition(sub, 1, 0, 0, table);
+    }
+    // 顺子
+    if (numbered && pos + 2 < len && cnt[pos + 1] && cnt[pos + 2]) {
+        --cnt[pos], --cnt[pos + 1], --cnt[pos + 2];
+        partition_tiles_recursively(cnt, len, numbered, pos, weight ? code - weight[pos] - weight[pos + 1] - weight[pos + 2] : 0, weight, sub);
+        ++cnt[pos], ++cnt[pos + 1], ++cnt[pos + 2];
+        accumulate_partition(sub, 1, 0, 0, table);
+    }
+    // 雀头或对子作搭子
+    if (cnt[pos] > 1) {
+        cnt[pos] -= 2;
+        partition_tiles_recursively(cnt, len, numbered, pos, weight ? code - 2 * weight[pos] : 0, weight, sub);
+        cnt[pos] += 2;
+        accumulate_partition(sub, 0, 0, 1, table);
+        accumulate_partition(sub, 0, 1, 0, table);
+    }
+    if (numbered) {
+        // 两面或边张搭子
+        if (pos + 1 < len && cnt[pos + 1]) {
+            --cnt[pos], --cnt[pos + 1];
+            partition_tiles_recursively(cnt, len, numbered, pos, weight ? code - weight[pos] - weight[pos + 1] : 0, weight, sub);
+            ++cnt[pos], ++cnt[pos + 1];
+            accumulate_partition(sub, 0, 1, 0, table);
+        }
+        // 嵌张搭子
+        if (pos + 2 < len && cnt[pos + 2]) {
+            --cnt[pos], --cnt[pos + 2];
+            partition_tiles_recursively(cnt, len, numbered, pos, weight ? code - weight[pos] - weight[pos + 2] : 0, weight, sub);
+            ++cnt[pos], ++cnt[pos + 2];
+            accumulate_partition(sub, 0, 1, 0, table);
+        }
+    }
+    // 孤张
+    --cnt[pos];
+    partition_tiles_recursively(cnt, len, numbered, pos, weight ? code - weight[pos] : 0, weight, sub);
+    ++cnt[pos];
+    accumulate_partition(sub, 0, 0, 0, table);
+
+    if (weight != nullptr) {
+        memcpy(partition_memo.tables[code], table, sizeof(table));
+        partition_memo.stamps[code] = partition_memo.stamp;
+    }
+}
+
+// 一组牌的拆分，数牌len为9，字牌len为7
+static void partition_tiles(const int *cnt, int len, bool numbered, partition_table_t &table) {
+    int temp[9];
+    int weight[9];
+    int code = 0, size = 1;
+    for (int i = 0; i < len; ++i) {
+        temp[i] = cnt[i];
+        weight[i] = size;
+        code += cnt[i] * size;
+        size *= cnt[i] + 1;
+        if (size > PARTITION_MEMO_SIZE) {  // 不合法的输入才会到这里，不做记忆化
+            break;
+        }
+    }
+
+    if (size > PARTITION_MEMO_SIZE) {
+        std::copy(cnt, cnt + len, temp);
+        partition_tiles_recursively(temp, len, numbered, 0, 0, nullptr, table);
+        return;
+    }
+    if (++partition_memo.stamp == 0) {  // 回绕时清空，避免误用很久以前的条目
+        memset(partition_memo.stamps, 0, sizeof(partition_memo.stamps));
+        partition_memo.stamp = 1;
+    }
+    partition_tiles_recursively(temp, len, numbered, 0, code, weight, table);
+}
+
+// 合并两组牌的拆分
+static void merge_partition(const partition_table_t &a, const partition_table_t &b, partition_table_t &out) {
+    partition_table_t temp;
+    memset(temp, -1, sizeof(temp));
+    for (int pa = 0; pa < 2; ++pa) {
+        for (int ma = 0; ma < 5; ++ma) {
+            if (a[pa][ma] < 0) {
+                continue;
+            }
+            for (int pb = 0; pa + pb < 2; ++pb) {
+                for (int mb = 0; ma + mb < 5; ++mb) {
+                    if (b[pb][mb] < 0) {
+                        continue;
+                    }
+                    int8_t n = static_cast<int8_t>(std::min(a[pa][ma] + b[pb][mb], 4));
+                    if (temp[pa + pb][ma + mb] < n) {
+                        temp[pa + pb][ma + mb] = n;
+                    }
                 }
             }
         }
     }
-    if (result == max_ret) {
-        save_work_path(fixed_cnt, work_path, work_state);
-    }
-    if(result<=3 && can_extend == false && result <= cur_min){
-        tile_table_t temp_table;
-        //全部的牌
-        memcpy(&temp_table, &Table, sizeof(temp_table));
+    memcpy(out, temp, sizeof(temp));
+}
+
+// 由拆分结果求上听数，need_cnt为还需的面子数
+// 上听数=缺少的面子数*2-可用的搭子数-有无雀头，与基本和型上听数的算法一致
+static int partition_shanten(const partition_table_t &table, int need_cnt) {
+    int ret = std::numeric_limits<int>::max();
+    for (int p = 0; p < 2; ++p) {
+        for (int m = 0; m <= need_cnt && m < 5; ++m) {
+            if (table[p][m] < 0) {
+                continue;
+            }
+            int st = (need_cnt - m) * 2 - std::min<int>(table[p][m], need_cnt - m) - p;
+            if (st < ret) {
+                ret = st;
+            }
+        }
+    }
+    return ret;
+}
 
-        if(result < cur_min)
-            memset(&useful,0,sizeof(useful));
+// 组号和组内序号对应的牌，0~2组依次为万条饼，3组为字牌
+static FORCE_INLINE tile_t partition_group_tile(int g, int r) {
+    return g < 3 ? make_tile(static_cast<suit_t>(g + 1), static_cast<rank_t>(r + 1)) : static_cast<tile_t>(TILE_E + r);
+}
 
-        tile_table_t left_tiles;
-        memcpy(&left_tiles,&cnt_table,sizeof(left_tiles));
+// 以分组的张数为参数计算基本和型打哪张牌上听数最小，need_cnt为还需的面子数
+static int basic_form_discard_shanten_from_groups(int (&cnt)[4][9], int need_cnt, basic_form_discard_t *result) {
+    static const int group_len[4] = { 9, 9, 9, 7 };
 
-        int need_pack = 4 - pack_count - pack_len;
+    // 以下与打哪张牌无关，所有打法共用：各组的拆分、各组加1张牌后的拆分、两组的合并
+    partition_table_t group_table[4];
+    partition_table_t added_table[4][9];
+    partition_table_t pair_table[4][4];
+    for (int g = 0; g < 4; ++g) {
+        partition_tiles(cnt[g], group_len[g], g < 3, group_table[g]);
+        for (int r = 0; r < group_len[g]; ++r) {
+            ++cnt[g][r];
+            partition_tiles(cnt[g], group_len[g], g < 3, added_table[g][r]);
+            --cnt[g][r];
+        }
+    }
+    for (int a = 0; a < 4; ++a) {
+        for (int b = a + 1; b < 4; ++b) {
+            merge_partition(group_table[a], group_table[b], pair_table[a][b]);
+            memcpy(pair_table[b][a], pair_table[a][b], sizeof(pair_table[a][b]));
+        }
+    }
 
-        bool has_pair_for_makeup = false;
-        for(int i = 0 ; i < pack_len; i++){
-            if(pack_get_type(hand[i]) == PACK_TYPE_PAIR)
-            {
-                has_pair_for_makeup = true;
-                
+    // 逐种打法只重新拆分打出牌所在的那一组
+    partition_table_t removed_table[4][9];
+    int shanten_table[4][9];
+    int ret = std::numeric_limits<int>::max();
+    for (int g = 0; g < 4; ++g) {
+        const int o0 = (g + 1) & 3, o1 = (g + 2) & 3, o2 = (g + 3) & 3;  // 其他3组
+        for (int r = 0; r < group_len[g]; ++r) {
+            if (cnt[g][r] == 0) {
+                continue;
+            }
+            --cnt[g][r];
+            partition_tiles(cnt[g], group_len[g], g < 3, removed_table[g][r]);
+            ++cnt[g][r];
+
+            partition_table_t temp;
+            merge_partition(pair_table[o0][o1], group_table[o2], temp);
+            merge_partition(temp, removed_table[g][r], temp);
+            shanten_table[g][r] = partition_shanten(temp, need_cnt);
+            if (shanten_table[g][r] < ret) {
+                ret = shanten_table[g][r];
             }
         }
-        if(!has_pair_for_makeup)need_pack += 1;
-
-
+    }
 
-        int fan = -1;
-        int max_fan = -1;
-        if(need_pack > 0)
-            {
-                
-                fan = Makeup_Packs(left_tiles,need_pack, has_pair_for_makeup, temp_table, hand, pack_len);
+    // 记录上听数最小的打法及其有效牌
+    result->shanten = ret;
+    result->discard_cnt = 0;
+    for (int g = 0; g < 4; ++g) {
+        for (int r = 0; r < group_len[g]; ++r) {
+            if (cnt[g][r] == 0 || shanten_table[g][r] != ret) {
+                continue;
             }
-        else{
-                tile_table_t temp_temp_table;       //全部的牌
-                memcpy(&temp_temp_table, &temp_table, sizeof(temp_temp_table));
-                fan = __calcluate_fan(hand,pack_len,temp_temp_table);
-                if(fan >= 8)
-                {
-                    Compart_table(temp_table,temp_temp_table);
+            intptr_t idx = result->discard_cnt++;
+            result->discard_tiles[idx] = partition_group_tile(g, r);
+            useful_table_t &useful_table = result->useful_tables[idx];
+            memset(useful_table, 0, sizeof(useful_table));
+
+            --cnt[g][r];  // 打这张牌
+            for (int h = 0; h < 4; ++h) {
+                // 除第h组以外其他各组的合并
+                partition_table_t rest;
+                if (h == g) {
+                    merge_partition(pair_table[(g + 1) & 3][(g + 2) & 3], group_table[(g + 3) & 3], rest);
+                }
+                else {
+                    int x = 0;
+                    while (x == g || x == h) ++x;
+                    int y = x + 1;
+                    while (y == g || y == h) ++y;
+                    merge_partition(pair_table[x][y], removed_table[g][r], rest);
                 }
+
+                for (int rr = 0; rr < group_len[h]; ++rr) {
+                    if (cnt[h][rr] == 4 && ret > 0) {  // 已有4张的不能再摸到
+                        continue;
+                    }
+                    partition_table_t added;
+                    if (h == g) {  // 与打出牌同组的需要重新拆分
+                        ++cnt[h][rr];
+                        partition_tiles(cnt[h], group_len[h], h < 3, added);
+                        --cnt[h][rr];
+                        merge_partition(rest, added, added);
+                    }
+                    else {
+                        merge_partition(rest, added_table[h][rr], added);
+                    }
+                    if (partition_shanten(added, need_cnt) < ret) {
+                        useful_table[partition_group_tile(h, rr)] = true;
+                    }
+                }
+            }
+            ++cnt[g][r];
         }
-        if(fan > max_fan){
-            max_fan = fan;
+    }
+    return ret;
+}
+
+// 基本和型打哪张牌上听数最小
+int basic_form_discard_shanten(const hand_tiles_t *hand_tiles, tile_t serving_tile, basic_form_discard_t *result) {
+    const intptr_t standing_cnt = hand_tiles->tile_count;
+    if (serving_tile == 0 || (standing_cnt != 13
+        && standing_cnt != 10 && standing_cnt != 7 && standing_cnt != 4 && standing_cnt != 1)) {
+        return std::numeric_limits<int>::max();
+    }
+
+    // 连同上牌一起分组打表
+    tile_table_t cnt_table;
+    map_tiles(hand_tiles->standing_tiles, standing_cnt, &cnt_table);
+    ++cnt_table[serving_tile];
+    int cnt[4][9] = { { 0 } };
+    for (int g = 0; g < 4; ++g) {
+        for (int r = 0; r < (g < 3 ? 9 : 7); ++r) {
+            cnt[g][r] = cnt_table[partition_group_tile(g, r)];
         }
-        if(max_fan < 8){
-            result = 2146483647;
+    }
+    return basic_form_discard_shanten_from_groups(cnt, 4 - static_cast<int>((13 - standing_cnt) / 3), result);
+}
+
+// 压缩牌表的各道就是各组，只需遍历有的牌来分组，返回总张数
+static int packed_hand_to_groups(const packed_hand_t &standing_hand, int (&cnt)[4][9]) {
+    int total = 0;
+    for (int w = 0; w < 2; ++w) {
+        for (uint64_t mask = packed_hand_present(standing_hand.words[w]); mask != 0; mask &= mask - 1) {
+            int bit = packed_hand_lowest_bit(mask);
+            int n = static_cast<int>((standing_hand.words[w] >> bit) & 7);
+            cnt[w * 2 + (bit >> 5)][(bit & 31) / 3] = n;
+            total += n;
         }
     }
+    return total;
+}
 
-    if(result < cur_min)
-        cur_min = result;
+// 基本和型打哪张牌上听数最小（压缩牌表）
+int basic_form_discard_shanten(const packed_hand_t &standing_hand, basic_form_discard_t *result) {
+    int cnt[4][9] = { { 0 } };
+    int total = packed_hand_to_groups(standing_hand, cnt);
+    if (total > 14 || total % 3 != 2) {
+        return std::numeric_limits<int>::max();
+    }
+    return basic_form_discard_shanten_from_groups(cnt, (total - 2) / 3, result);
+}
+
+// 各组拆分结果的缓存，以组号和5进制编码为键，直接映射，冲突时覆盖
+// 连续计算的手牌往往只有一两组不同，其余各组直接命中
+#define PARTITION_CACHE_SIZE 65536
+
+namespace {
+
+    struct partition_cache_t {
+        uint32_t keys[PARTITION_CACHE_SIZE];  // 组号*5^9+编码+1，0为空
+        partition_table_t tables[PARTITION_CACHE_SIZE];
+    };
+
+    thread_local partition_cache_t partition_cache;
 
-    return result;
 }
-// 数牌是否有搭子
-static bool numbered_tile_has_neighbor(const tile_table_t &cnt_table, tile_t t) {
-    rank_t r = tile_get_rank(t);
-    if (r < 9) { if (cnt_table[t + 1]) return true; }
-    if (r < 8) { if (cnt_table[t + 2]) return true; }
-    if (r > 1) { if (cnt_table[t - 1]) return true; }
-    if (r > 2) { if (cnt_table[t - 2]) return true; }
-    return false;
+
+// 一组牌的拆分，先查缓存
+static void partition_tiles_cached(const int *cnt, int g, partition_table_t &table) {
+    const int len = g < 3 ? 9 : 7;
+    uint32_t code = 0;
+    for (int r = len - 1; r >= 0; --r) {
+        if (cnt[r] > 4) {  // 不合法的输入不缓存
+            partition_tiles(cnt, len, g < 3, table);
+            return;
+        }
+        code = code * 5 + static_cast<uint32_t>(cnt[r]);
+    }
+    const uint32_t key = static_cast<uint32_t>(g) * AGARI_PATTERN_COUNT + code + 1;
+    const uint32_t slot = (key * 2654435761U) >> 16;
+    if (partition_cache.keys[slot] == key) {
+        memcpy(table, partition_cache.tables[slot], sizeof(table));
+        return;
+    }
+    partition_tiles(cnt, len, g < 3, table);
+    partition_cache.keys[slot] = key;
+    memcpy(partition_cache.tables[slot], table, sizeof(table));
 }
 
-// 以表格为参数计算基本和型上听数
-static int basic_form_shanten_from_table(tile_table_t &cnt_table, intptr_t fixed_cnt, useful_table_t *useful_table) {
-    // 计算上听数
-    work_path_t work_path;
-    work_state_t work_state;
-    work_state.count = 0;
-    pack_t hand[10];
-    int result = basic_form_shanten_recursively(cnt_table, false, static_cast<uint16_t>(fixed_cnt), 0,
-        fixed_cnt, &work_path, &work_state,hand,0);
+// 不考虑番数的基本和型上听数（压缩牌表）：各组拆分合并即可
+int basic_form_shanten_ignoring_fan(const packed_hand_t &standing_hand) {
+    int cnt[4][9] = { { 0 } };
+    int total = packed_hand_to_groups(standing_hand, cnt);
+    if (total > 14 || total % 3 == 0) {
+        return std::numeric_limits<int>::max();
+    }
 
-    if (useful_table == nullptr) {
-        return result;
+    partition_table_t table, group_table;
+    partition_tiles_cached(cnt[0], 0, table);
+    for (int g = 1; g < 4; ++g) {
+        partition_tiles_cached(cnt[g], g, group_table);
+        merge_partition(table, group_table, table);
     }
-    // 穷举所有的牌，获取能减少上听数的牌
+    return partition_shanten(table, total / 3);
+}
+
+//-------------------------------- 七对 --------------------------------
+
+// 以表格为参数计算七对上听数
+static int seven_pairs_shanten_from_table(const tile_table_t &cnt_table, useful_table_t *useful_table) {
+    // 统计对子数，4张相同的牌算2对
+    int pair_cnt = 0;
     for (int i = 0; i < 34; ++i) {
-        tile_t t = all_tiles[i];
-        if (cnt_table[t] == 4 && result > 0) {
-            continue;
-        }
-        if (cnt_table[t] == 0) {
-            // 跳过孤张字牌和不靠张的数牌，这些牌都无法减少上听数
-            if (is_honor(t) || !numbered_tile_has_neighbor(cnt_table, t)) {
-                continue;
-            }
-        }
-        ++cnt_table[t];
-        work_state.count = 0;
-        int temp = basic_form_shanten_recursively(cnt_table, false, static_cast<uint16_t>(fixed_cnt), 0,
-            fixed_cnt, &work_path, &work_state, hand,0);
-        if (temp < result) {
-            (*useful_table)[t] = true;  // 标记为有效牌
-        }
-        --cnt_table[t];
+        pair_cnt += cnt_table[all_tiles[i]] / 2;
     }
 
-    return result;
+    // 有效牌：配对后还剩单张的牌
+    if (useful_table != nullptr) {
+        std::transform(std::begin(cnt_table), std::end(cnt_table), std::begin(*useful_table), [](int n) { return (n & 1) != 0; });
+    }
+    return 6 - pair_cnt;
 }
-float Prob_weight = 0.89;
-int total_count = 0;
 
-std::vector<float> calculate_expect(tile_t *standing_tiles, intptr_t tile_count, useful_table_t &Use){
+// 七对上听数
+int seven_pairs_shanten(const tile_t *standing_tiles, intptr_t standing_cnt, useful_table_t *useful_table) {
+    if (standing_tiles == nullptr || standing_cnt != 13) {
+        return std::numeric_limits<int>::max();
+    }
 
-    float total_prob = 0;
-    int shanten = basic_form_shanten(standing_tiles, tile_count, nullptr);
-    if(shanten >= 0){
-    basic_form_shanten(standing_tiles, tile_count, &Use);
+    // 对牌的种类进行打表
+    tile_table_t cnt_table;
+    map_tiles(standing_tiles, standing_cnt, &cnt_table);
+    return seven_pairs_shanten_from_table(cnt_table, useful_table);
+}
+
+// 七对是否听牌
+bool is_seven_pairs_wait(const tile_t *standing_tiles, intptr_t standing_cnt, useful_table_t *waiting_table) {
+    // 直接计算其上听数，上听数为0即为听牌
+    if (waiting_table == nullptr) {
+        return (0 == seven_pairs_shanten(standing_tiles, standing_cnt, nullptr));
     }
-    else
-        memcpy(Use,useful,sizeof(Use));
-    if(shanten <= 10)
-        {
-            float prob = 0;
-            for (int i = 0; i < 34; ++i){  
-                tile_t t = all_tiles[i];
-                if(Use[t]){
-                    prob += ((float)Table[t])/((float)total_count);
-                }
-            }
-            total_prob = prob;
-        }
-    else
-        {
-            for (int i = 0; i < 34; ++i) {
-                tile_t t = all_tiles[i];
-                if(Use[t]){
-                    for(int p = 0; p<tile_count; p++)
-                    {
-                        tile_t tmp = standing_tiles[p];
-                        standing_tiles[p] = t;
-                        int tmp_shanten = basic_form_shanten(standing_tiles, tile_count, nullptr);
-                        if(tmp_shanten < shanten){
-                            useful_table_t tmp_use;
-                            float prob = 0;
-                            float prob_useful = ((float)Table[t])/((float)total_count);
-                            total_prob += Prob_weight * prob_useful * prob;
-                        }
-                        standing_tiles[p] = tmp;
 
-                }
+    useful_table_t useful_table;
+    if (0 == seven_pairs_shanten(standing_tiles, standing_cnt, &useful_table)) {
+        memcpy(*waiting_table, useful_table, sizeof(*waiting_table));
+        return true;
+    }
+    return false;
+}
 
-                }
+// 七对是否和牌
+bool is_seven_pairs_win(const tile_t *standing_tiles, intptr_t standing_cnt, tile_t test_tile) {
+    useful_table_t useful_table;
+    return (0 == seven_pairs_shanten(standing_tiles, standing_cnt, &useful_table)
+        && useful_table[test_tile]);
+}
+
+//-------------------------------- 十三幺 --------------------------------
+
+// 以表格为参数计算十三幺上听数
+static int thirteen_orphans_shanten_from_table(const tile_table_t &cnt_table, useful_table_t *useful_table) {
+    bool has_pair = false;
+    int cnt = 0;
+    for (int i = 0; i < 13; ++i) {
+        int n = cnt_table[standard_thirteen_orphans[i]];
+        if (n > 0) {
+            ++cnt;  // 幺九牌的种类
+            if (n > 1) {
+                has_pair = true;  // 幺九牌对子
             }
         }
-        std::vector<float> tmp;
-        tmp.push_back(shanten);
-        tmp.push_back(total_prob);
-        return tmp;
-}
+    }
 
-int Policy(const char *str,int mode = 0) {
+    // 当有对子时，上听数为：12-幺九牌的种类
+    // 当没有对子时，上听数为：13-幺九牌的种类
+    int ret = has_pair ? 12 - cnt : 13 - cnt;
 
-    hand_tiles_t hand_tiles;
-    tile_t serving_tile;
-    long ret = string_to_tiles(str, &hand_tiles, &serving_tile);
+    if (useful_table != nullptr) {
+        // 先标记所有的幺九牌为有效牌
+        memset(*useful_table, 0, sizeof(*useful_table));
+        std::for_each(std::begin(standard_thirteen_orphans), std::end(standard_thirteen_orphans),
+            [useful_table](tile_t t) {
+            (*useful_table)[t] = true;
+        });
 
-    if (ret != 0) return 0;
+        // 当有对子时，已有的幺九牌都不需要了
+        if (has_pair) {
+            for (int i = 0; i < 13; ++i) {
+                tile_t t = standard_thirteen_orphans[i];
+                int n = cnt_table[t];
+                if (n > 0) {
+                    (*useful_table)[t] = false;
+                }
+            }
+        }
+    }
 
-    memcpy(fixed_packs,hand_tiles.fixed_packs,sizeof(fixed_packs));
-    pack_count = hand_tiles.pack_count;
-    char buf[20];
-    ret = hand_tiles_to_string(&hand_tiles, buf, sizeof(buf));
-    useful_table_t useful_table = {false};
-    float max_prob = 0;
-    int max_numebr = hand_tiles.tile_count;
+    return ret;
+}
 
-    total_count = 0;
-    for (int i = 0; i < 34; ++i){  
-        tile_t t = all_tiles[i];
-        total_count += Table[t];
+// 十三幺上听数
+int thirteen_orphans_shanten(const tile_t *standing_tiles, intptr_t standing_cnt, useful_table_t *useful_table) {
+    if (standing_tiles == nullptr || standing_cnt != 13) {
+        return std::numeric_limits<int>::max();
     }
 
-    std::vector<float> max_;
-    max_ = calculate_expect(hand_tiles.standing_tiles, hand_tiles.tile_count, useful_table);
-    for(int ii = 0; ii < hand_tiles.tile_count; ii++)
-    {
-        tile_t temp = hand_tiles.standing_tiles[ii];
-        hand_tiles.standing_tiles[ii] = serving_tile;
-        std::vector<float> ttmp;
-        ttmp = calculate_expect(hand_tiles.standing_tiles, hand_tiles.tile_count, useful_table);
-        hand_tiles.standing_tiles[ii] = temp;
-        if(max_[0] > ttmp[0]){
+    // 对牌的种类进行打表
+    tile_table_t cnt_table;
+    map_tiles(standing_tiles, standing_cnt, &cnt_table);
+    return thirteen_orphans_shanten_from_table(cnt_table, useful_table);
+}
 
-            max_[0] = ttmp[0];
-            max_[1] = ttmp[1];
-            max_numebr = ii;
-        }
-        if((int)max_[0] == (int)ttmp[0] && max_[1] < ttmp[1]){
-            max_[0] = ttmp[0];
-            max_[1] = ttmp[1];
-            max_numebr = ii;
-        }
+// 十三幺是否听牌
+bool is_thirteen_orphans_wait(const tile_t *standing_tiles, intptr_t standing_cnt, useful_table_t *waiting_table) {
+    // 直接计算其上听数，上听数为0即为听牌
+    if (waiting_table == nullptr) {
+        return (0 == thirteen_orphans_shanten(standing_tiles, standing_cnt, nullptr));
     }
-    if(mode == 0){
 
-        return max_numebr;
-    }
-    else
-    {
-        if(max_numebr == hand_tiles.tile_count){
-            return serving_tile;
-        }
-        else
-            return hand_tiles.standing_tiles[max_numebr];
+    useful_table_t useful_table;
+    if (0 == thirteen_orphans_shanten(standing_tiles, standing_cnt, &useful_table)) {
+        memcpy(*waiting_table, useful_table, sizeof(*waiting_table));
+        return true;
     }
+    return false;
 }
 
+// 十三幺是否和牌
+bool is_thirteen_orphans_win(const tile_t *standing_tiles, intptr_t standing_cnt, tile_t test_tile) {
+    useful_table_t useful_table;
+    return (0 == thirteen_orphans_shanten(standing_tiles, standing_cnt, &useful_table)
+        && useful_table[test_tile]);
+}
 
+//-------------------------------- “组合龙+面子+雀头”和型 --------------------------------
 
-// 基本和型上听数
-int basic_form_shanten(const tile_t *standing_tiles, intptr_t standing_cnt, useful_table_t *useful_table) {
-    if (standing_tiles == nullptr || (standing_cnt != 13
-        && standing_cnt != 10 && standing_cnt != 7 && standing_cnt != 4 && standing_cnt != 1)) {
-        return std::numeric_limits<int>::max();
+// 以表格为参数计算组合龙是否听牌
+static bool is_knitted_straight_wait_from_table(const tile_table_t &cnt_table, useful_table_t *waiting_table) {
+    // 匹配组合龙
+    const tile_t (*matched_seq)[9] = nullptr;
+    tile_t missing_tiles[9];
+    int missing_cnt = 0;
+    for (int i = 0; i < 6; ++i) {  // 逐个组合龙测试
+        missing_cnt = 0;
+        for (int k = 0; k < 9; ++k) {
+            tile_t t = standard_knitted_straight[i][k];
+            if (cnt_table[t] == 0) {  // 缺失的
+                missing_tiles[missing_cnt++] = t;
+            }
+        }
+        if (missing_cnt < 2) {  // 缺2张或以上的肯定没听
+            matched_seq = &standard_knitted_straight[i];
+            break;
+        }
     }
-    // 对立牌的种类进行打表
-    tile_table_t cnt_table;
-    map_tiles(standing_tiles, standing_cnt, &cnt_table);
-    if (useful_table != nullptr) {
-        memset(*useful_table, 0, sizeof(*useful_table));
+
+    if (matched_seq == nullptr || missing_cnt > 2) {
+        return false;
     }
-    return basic_form_shanten_from_table(cnt_table, (13 - standing_cnt) / 3, useful_table);
-}
 
-// 基本和型判断1张是否听牌
-static bool is_basic_form_wait_1(tile_table_t &cnt_table, useful_table_t *waiting_table) {
-    for (int i = 0; i < 34; ++i) {
-        tile_t t = all_tiles[i];
-        if (cnt_table[t] != 1) {
-            continue;
+    if (waiting_table != nullptr) {
+        memset(*waiting_table, 0, sizeof(*waiting_table));
+    }
+
+    // 剔除组合龙
+    tile_table_t temp_table;
+    memcpy(&temp_table, &cnt_table, sizeof(temp_table));
+    for (int i = 0; i < 9; ++i) {
+        tile_t t = (*matched_seq)[i];
+        if (temp_table[t]) {
+            --temp_table[t];
         }
+    }
 
-        // 单钓将
-        cnt_table[t] = 0;
-        if (std::all_of(std::begin(cnt_table), std::end(cnt_table), [](int n) { return n == 0; })) {
-            cnt_table[t] = 1;
-            if (waiting_table != nullptr) {  // 不需要获取听牌张，则可以直接返回
-                (*waiting_table)[t] = true;
+    if (missing_cnt == 1) {  // 如果缺一张，那么除去组合龙之后的牌应该是完成状态才能听牌
+        if (is_basic_form_win_from_table(temp_table)) {
+            if (waiting_table != nullptr) {  // 获取听牌张，听组合龙缺的一张
+                (*waiting_table)[missing_tiles[0]] = true;
             }
             return true;
         }
-        cnt_table[t] = 1;
+    }
+    else if (missing_cnt == 0) {  // 如果组合龙齐了，那么除去组合龙之后的牌要能听，整手牌才能听
+        return is_basic_form_wait_from_table(temp_table, waiting_table);
     }
 
     return false;
 }
 
-// 基本和型判断2张是否听牌
-static bool is_basic_form_wait_2(const tile_table_t &cnt_table, useful_table_t *waiting_table) {
-    bool ret = false;
-    for (int i = 0; i < 34; ++i) {
-        tile_t t = all_tiles[i];
-        if (cnt_table[t] < 1) {
-            continue;
-        }
-        if (cnt_table[t] > 1) {
-            if (waiting_table != nullptr) {  // 获取听牌张
-                (*waiting_table)[t] = true;  // 对倒
-                ret = true;
-                continue;
-            }
-            else {  // 不需要获取听牌张，则可以直接返回
-                return true;
-            }
-        }
-        if (is_numbered_suit_quick(t)) {  // 数牌搭子
-            rank_t r = tile_get_rank(t);
-            if (r > 1 && cnt_table[t - 1]) {  // 两面或者边张
-                if (waiting_table != nullptr) {  // 获取听牌张
-                    if (r < 9) (*waiting_table)[t + 1] = true;
-                    if (r > 2) (*waiting_table)[t - 2] = true;
-                    ret = true;
-                    continue;
-                }
-                else {  // 不需要获取听牌张，则可以直接返回
-                    return true;
+// 以表格为参数计算组合龙上听数
+// 余牌分门拆分：6种组合龙在每门数牌上只有3种剔除方式，一共只有9种数牌余牌和1种字牌余牌，
+// 6种组合龙共用这些结果，不必各做一遍完整的上听数计算。
+// 组合龙本身就有12番，补全后必然够起和番，所以余牌不需要再做番数限制
+static int knitted_straight_shanten_from_table(const tile_table_t &cnt_table, intptr_t standing_cnt, useful_table_t *useful_table) {
+    // 除组合龙占的3组外，余牌还需的面子数
+    const int need_cnt = 4 - (13 - static_cast<int>(standing_cnt)) / 3 - 3;
+
+    // 各门数牌按剔除147/258/369分别拆分，有效牌还需要每种牌再加1张后的拆分
+    int residual[3][3][9];
+    int exist_cnt[3][3] = { { 0 } };
+    partition_table_t suit_table[3][3];
+    partition_table_t suit_added_table[3][3][9];
+    for (int s = 0; s < 3; ++s) {
+        for (int k = 0; k < 3; ++k) {
+            int *cnt = residual[s][k];
+            for (int r = 0; r < 9; ++r) {
+                cnt[r] = cnt_table[make_tile(static_cast<suit_t>(s + 1), static_cast<rank_t>(r + 1))];
+                if (r % 3 == k && cnt[r] > 0) {  // 有，削减之
+                    --cnt[r];
+                    ++exist_cnt[s][k];
                 }
             }
-            if (r > 2 && cnt_table[t - 2]) {  // 嵌张
-                if (waiting_table != nullptr) {  // 获取听牌张
-                    (*waiting_table)[t - 1] = true;
-                    ret = true;
-                    continue;
-                }
-                else {  // 不需要获取听牌张，则可以直接返回
-                    return true;
+            partition_tiles(cnt, 9, true, suit_table[s][k]);
+            if (useful_table != nullptr) {
+                for (int r = 0; r < 9; ++r) {
+                    ++cnt[r];
+                    partition_tiles(cnt, 9, true, suit_added_table[s][k][r]);
+                    --cnt[r];
                 }
             }
         }
     }
-    return ret;
-}
-
-// 基本和型判断4张是否听牌
-static bool is_basic_form_wait_4(tile_table_t &cnt_table, useful_table_t *waiting_table) {
-    bool ret = false;
-    // 削减雀头
-    for (int i = 0; i < 34; ++i) {
-        tile_t t = all_tiles[i];
-        if (cnt_table[t] < 2) {
-            continue;
-        }
-        // 削减雀头，递归
-        cnt_table[t] -= 2;
-        if (is_basic_form_wait_2(cnt_table, waiting_table)) {
-            ret = true;
-        }
-        // 还原
-        cnt_table[t] += 2;
-        if (ret && waiting_table == nullptr) {  // 不需要获取听牌张，则可以直接结束递归
-            return true;
-        }
-    }
 
-    return ret;
-}
-
-// 递归计算基本和型是否听牌
-static bool is_basic_form_wait_recursively(tile_table_t &cnt_table, intptr_t left_cnt, useful_table_t *waiting_table) {
-    if (left_cnt == 1) {
-        return is_basic_form_wait_1(cnt_table, waiting_table);
+    // 字牌不受组合龙影响，只拆分一次
+    int honor_cnt[7];
+    partition_table_t honor_table;
+    partition_table_t honor_added_table[7];
+    for (int i = 0; i < 7; ++i) {
+        honor_cnt[i] = cnt_table[TILE_E + i];
     }
-
-    bool ret = false;
-    if (left_cnt == 4) {
-        ret = is_basic_form_wait_4(cnt_table, waiting_table);
-        if (ret && waiting_table == nullptr) {  // 不需要获取听牌张，则可以直接结束递归
-            return true;
+    partition_tiles(honor_cnt, 7, false, honor_table);
+    if (useful_table != nullptr) {
+        for (int i = 0; i < 7; ++i) {
+            ++honor_cnt[i];
+            partition_tiles(honor_cnt, 7, false, honor_added_table[i]);
+            --honor_cnt[i];
         }
+        memset(*useful_table, 0, sizeof(*useful_table));
     }
 
-    for (int i = 0; i < 34; ++i) {
-        tile_t t = all_tiles[i];
-        if (cnt_table[t] < 1) {
+    int ret = std::numeric_limits<int>::max();
+    useful_table_t temp_table;
+
+    // 6种组合龙分别合并
+    for (int i = 0; i < 6; ++i) {
+        int which[3];  // 每门剔除的是147/258/369中的哪种
+        int exist = 0;
+        for (int s = 0; s < 3; ++s) {
+            which[s] = tile_get_rank(standard_knitted_straight[i][s * 3]) - 1;
+            exist += exist_cnt[s][which[s]];
+        }
+
+        // rest[g]为除第g组以外其他各组的合并，g为3时表示字牌
+        const partition_table_t &m = suit_table[0][which[0]];
+        const partition_table_t &s = suit_table[1][which[1]];
+        const partition_table_t &p = suit_table[2][which[2]];
+        partition_table_t rest[4], temp, all;
+        merge_partition(s, p, temp);
+        merge_partition(temp, honor_table, rest[0]);
+        merge_partition(m, p, temp);
+        merge_partition(temp, honor_table, rest[1]);
+        merge_partition(m, s, temp);
+        merge_partition(temp, honor_table, rest[2]);
+        merge_partition(temp, p, rest[3]);
+        merge_partition(rest[3], honor_table, all);
+
+        // 上听数=组合龙缺少的张数+余下牌的上听数
+        int result = partition_shanten(all, need_cnt);
+        int st = (9 - exist) + result;
+        if (st > ret || useful_table == nullptr) {
+            ret = std::min(ret, st);
             continue;
         }
 
-        // 刻子
-        if (cnt_table[t] > 2) {
-            // 削减这组刻子，递归
-            cnt_table[t] -= 3;
-            if (is_basic_form_wait_recursively(cnt_table, left_cnt - 3, waiting_table)) {
-                ret = true;
-            }
-            // 还原
-            cnt_table[t] += 3;
-            if (ret && waiting_table == nullptr) {  // 不需要获取听牌张，则可以直接结束递归
-                return true;
+        memset(temp_table, 0, sizeof(temp_table));
+
+        // 组合龙缺失的牌
+        for (int k = 0; k < 9; ++k) {
+            tile_t t = standard_knitted_straight[i][k];
+            if (cnt_table[t] == 0) {
+                temp_table[t] = true;
             }
         }
 
-        // 顺子（只能是数牌）
-        if (is_numbered_suit(t)) {
-            // 顺子t t+1 t+2，显然t不能是8点以上的数牌
-            if (tile_get_rank(t) < 8 && cnt_table[t + 1] && cnt_table[t + 2]) {
-                // 削减这组顺子，递归
-                --cnt_table[t];
-                --cnt_table[t + 1];
-                --cnt_table[t + 2];
-                if (is_basic_form_wait_recursively(cnt_table, left_cnt - 3, waiting_table)) {
-                    ret = true;
+        // 余牌加1张能减少上听数的牌，已有4张的不能再摸到
+        for (int s = 0; s < 3; ++s) {
+            const int *cnt = residual[s][which[s]];
+            for (int r = 0; r < 9; ++r) {
+                if (cnt[r] == 4 && result > 0) {
+                    continue;
                 }
-                // 还原
-                ++cnt_table[t];
-                ++cnt_table[t + 1];
-                ++cnt_table[t + 2];
-                if (ret && waiting_table == nullptr) {  // 不需要获取听牌张，则可以直接结束递归
-                    return true;
+                partition_table_t added;
+                merge_partition(rest[s], suit_added_table[s][which[s]][r], added);
+                if (partition_shanten(added, need_cnt) < result) {
+                    temp_table[make_tile(static_cast<suit_t>(s + 1), static_cast<rank_t>(r + 1))] = true;
                 }
             }
         }
+        for (int k = 0; k < 7; ++k) {
+            if (honor_cnt[k] == 4 && result > 0) {
+                continue;
+            }
+            partition_table_t added;
+            merge_partition(rest[3], honor_added_table[k], added);
+            if (partition_shanten(added, need_cnt) < result) {
+                temp_table[TILE_E + k] = true;
+            }
+        }
+
+        if (st < ret) {  // 上听数小的，直接覆盖数据
+            ret = st;
+            memcpy(*useful_table, temp_table, sizeof(*useful_table));
+        }
+        else {  // 两种不同组合龙上听数如果相等的话，直接合并有效牌
+            std::transform(std::begin(*useful_table), std::end(*useful_table), std::begin(temp_table),
+                std::begin(*useful_table), [](bool u, bool t) { return u || t; });
+        }
     }
 
     return ret;
 }
 
-// 基本和型是否听牌
-// 这里之所以不用直接调用上听数计算函数，判断其返回值为0的方式
-// 是因为前者会削减搭子，这个操作在和牌判断中是没必要的，所以单独写一套更快逻辑
-bool is_basic_form_wait(const tile_t *standing_tiles, intptr_t standing_cnt, useful_table_t *waiting_table) {
-    // 对立牌的种类进行打表
+// 组合龙上听数
+int knitted_straight_shanten(const tile_t *standing_tiles, intptr_t standing_cnt, useful_table_t *useful_table) {
+    if (standing_tiles == nullptr || (standing_cnt != 13 && standing_cnt != 10)) {
+        return std::numeric_limits<int>::max();
+    }
+
+    // 打表
     tile_table_t cnt_table;
     map_tiles(standing_tiles, standing_cnt, &cnt_table);
-
-    if (waiting_table != nullptr) {
-        memset(*waiting_table, 0, sizeof(*waiting_table));
-    }
-    return is_basic_form_wait_recursively(cnt_table, standing_cnt, waiting_table);
+    return knitted_straight_shanten_from_table(cnt_table, standing_cnt, useful_table);
 }
 
-// 基本和型2张能否和牌
-static bool is_basic_form_win_2(const tile_table_t &cnt_table) {
-    // 找到未使用的牌
-    typedef std::remove_all_extents<tile_table_t>::type table_elem_t;
-    const table_elem_t *it = std::find_if(std::begin(cnt_table), std::end(cnt_table), [](table_elem_t n) { return n > 0; });
-    // 存在且张数等于2
-    if (it == std::end(cnt_table) || *it != 2) {
+// 组合龙是否听牌
+bool is_knitted_straight_wait(const tile_t *standing_tiles, intptr_t standing_cnt, useful_table_t *waiting_table) {
+    if (standing_tiles == nullptr || (standing_cnt != 13 && standing_cnt != 10)) {
         return false;
     }
-    // 还有其他未使用的牌
-    return std::none_of(it + 1, std::end(cnt_table), [](int n) { return n > 0; });
+
+    // 对立牌的种类进行打表
+    tile_table_t cnt_table;
+    map_tiles(standing_tiles, standing_cnt, &cnt_table);
+
+    return is_knitted_straight_wait_from_table(cnt_table, waiting_table);
+}
+
+// 组合龙是否和牌
+bool is_knitted_straight_win(const tile_t *standing_tiles, intptr_t standing_cnt, tile_t test_tile) {
+    useful_table_t waiting_table;
+    return (is_knitted_straight_wait(standing_tiles, standing_cnt, &waiting_table)
+        && waiting_table[test_tile]);
 }
 
-// 递归计算基本和型是否和牌
-// 这里之所以不用直接调用上听数计算函数，判断其返回值为-1的方式，
-// 是因为前者会削减搭子，这个操作在和牌判断中是没必要的，所以单独写一套更快逻辑
-static bool is_basic_form_win_recursively(tile_table_t &cnt_table, intptr_t left_cnt) {
-    if (left_cnt == 2) {
-        return is_basic_form_win_2(cnt_table);
+//-------------------------------- 全不靠/七星不靠 --------------------------------
+
+// 1种组合龙的全不靠上听数
+static int honors_and_knitted_tiles_shanten_1(const tile_table_t &cnt_table, int which_seq, useful_table_t *useful_table) {
+    int cnt = 0;
+
+    // 统计组合龙部分的数牌
+    for (int i = 0; i < 9; ++i) {
+        tile_t t = standard_knitted_straight[which_seq][i];
+        int n = cnt_table[t];
+        if (n > 0) {  // 有，增加计数
+            ++cnt;
+        }
     }
 
-    for (int i = 0; i < 34; ++i) {
-        tile_t t = all_tiles[i];
-        if (cnt_table[t] < 1) {
-            continue;
+    // 统计字牌
+    for (int i = 6; i < 13; ++i) {
+        tile_t t = standard_thirteen_orphans[i];
+        int n = cnt_table[t];
+        if (n > 0) {  // 有，增加计数
+            ++cnt;
         }
+    }
 
-        // 刻子
-        if (cnt_table[t] > 2) {
-            // 削减这组刻子，递归
-            cnt_table[t] -= 3;
-            bool ret = is_basic_form_win_recursively(cnt_table, left_cnt - 3);
-            // 还原
-            cnt_table[t] += 3;
-            if (ret) {
-                return true;
+    // 记录有效牌
+    if (useful_table != nullptr) {
+        memset(*useful_table, 0, sizeof(*useful_table));
+
+        // 统计组合龙部分缺失的数牌
+        for (int i = 0; i < 9; ++i) {
+            tile_t t = standard_knitted_straight[which_seq][i];
+            int n = cnt_table[t];
+            if (n <= 0) {
+                (*useful_table)[t] = true;
             }
         }
 
-        // 顺子（只能是数牌）
-        if (is_numbered_suit(t)) {
-            // 顺子t t+1 t+2，显然t不能是8点以上的数牌
-            if (tile_get_rank(t) < 8 && cnt_table[t + 1] && cnt_table[t + 2]) {
-                // 削减这组顺子，递归
-                --cnt_table[t];
-                --cnt_table[t + 1];
-                --cnt_table[t + 2];
-                bool ret = is_basic_form_win_recursively(cnt_table, left_cnt - 3);
-                // 还原
-                ++cnt_table[t];
-                ++cnt_table[t + 1];
-                ++cnt_table[t + 2];
-                if (ret) {
-                    return true;
-                }
+        // 统计缺失的字牌
+        for (int i = 6; i < 13; ++i) {
+            tile_t t = standard_thirteen_orphans[i];
+            int n = cnt_table[t];
+            if (n <= 0) {
+                (*useful_table)[t] = true;
             }
         }
     }
 
-    return false;
+    // 上听数=13-符合牌型的计数
+    return 13 - cnt;
 }
 
-// 基本和型是否和牌
-bool is_basic_form_win(const tile_t *standing_tiles, intptr_t standing_cnt, tile_t test_tile) {
-    // 对立牌的种类进行打表
-    tile_table_t cnt_table;
-    map_tiles(standing_tiles, standing_cnt, &cnt_table);
-    ++cnt_table[test_tile];  // 添加测试的牌
-    return is_basic_form_win_recursively(cnt_table, standing_cnt + 1);
-}
+// 以表格为参数计算全不靠上听数，6种组合龙共用一张表
+static int honors_and_knitted_tiles_shanten_from_table(const tile_table_t &cnt_table, useful_table_t *useful_table) {
+    int ret = std::numeric_limits<int>::max();
 
-//-------------------------------- 七对 --------------------------------
+    // 需要获取有效牌时，计算上听数的同时就获取有效牌了
+    if (useful_table != nullptr) {
+        memset(*useful_table, 0, sizeof(*useful_table));
 
-// 七对上听数
-int seven_pairs_shanten(const tile_t *standing_tiles, intptr_t standing_cnt, useful_table_t *useful_table) {
-    if (standing_tiles == nullptr || standing_cnt != 13) {
-        return std::numeric_limits<int>::max();
-    }
+        useful_table_t temp_table;
 
-    // 对牌的种类进行打表，并统计对子数
-    int pair_cnt = 0;
-    tile_table_t cnt_table = { 0 };
-    for (intptr_t i = 0; i < standing_cnt; ++i) {
-        tile_t tile = standing_tiles[i];
-        ++cnt_table[tile];
-        if (cnt_table[tile] == 2) {
-            ++pair_cnt;
-            cnt_table[tile] = 0;
+        // 6种组合龙分别计算
+        for (int i = 0; i < 6; ++i) {
+            int st = honors_and_knitted_tiles_shanten_1(cnt_table, i, &temp_table);
+            if (st < ret) {  // 上听数小的，直接覆盖数据
+                ret = st;
+                memcpy(*useful_table, temp_table, sizeof(*useful_table));  // 直接覆盖原来的有效牌数据
+            }
+            else if (st == ret) {  // 两种不同组合龙上听数如果相等的话，直接合并有效牌
+                std::transform(std::begin(*useful_table), std::end(*useful_table), std::begin(temp_table),
+                    std::begin(*useful_table), [](bool u, bool t) { return u || t; });
+            }
+        }
+    }
+    else {
+        // 6种组合龙分别计算
+        for (int i = 0; i < 6; ++i) {
+            int st = honors_and_knitted_tiles_shanten_1(cnt_table, i, nullptr);
+            if (st < ret) {
+                ret = st;
+            }
         }
     }
+    return ret;
+}
 
-    // 有效牌
-    if (useful_table != nullptr) {
-        std::transform(std::begin(cnt_table), std::end(cnt_table), std::begin(*useful_table), [](int n) { return n != 0; });
+// 全不靠上听数
+int honors_and_knitted_tiles_shanten(const tile_t *standing_tiles, intptr_t standing_cnt, useful_table_t *useful_table) {
+    if (standing_tiles == nullptr || standing_cnt != 13) {
+        return std::numeric_limits<int>::max();
     }
-    return 6 - pair_cnt;
+
+    // 对牌的种类进行打表
+    tile_table_t cnt_table;
+    map_tiles(standing_tiles, standing_cnt, &cnt_table);
+    return honors_and_knitted_tiles_shanten_from_table(cnt_table, useful_table);
 }
 
-// 七对是否听牌
-bool is_seven_pairs_wait(const tile_t *standing_tiles, intptr_t standing_cnt, useful_table_t *waiting_table) {
+// 全不靠是否听牌
+bool is_honors_and_knitted_tiles_wait(const tile_t *standing_tiles, intptr_t standing_cnt, useful_table_t *waiting_table) {
     // 直接计算其上听数，上听数为0即为听牌
     if (waiting_table == nullptr) {
-        return (0 == seven_pairs_shanten(standing_tiles, standing_cnt, nullptr));
+        return (0 == honors_and_knitted_tiles_shanten(standing_tiles, standing_cnt, nullptr));
     }
 
     useful_table_t useful_table;
-    if (0 == seven_pairs_shanten(standing_tiles, standing_cnt, &useful_table)) {
+    if (0 == honors_and_knitted_tiles_shanten(standing_tiles, standing_cnt, &useful_table)) {
         memcpy(*waiting_table, useful_table, sizeof(*waiting_table));
         return true;
     }
     return false;
 }
 
-// 七对是否和牌
-bool is_seven_pairs_win(const tile_t *standing_tiles, intptr_t standing_cnt, tile_t test_tile) {
+// 全不靠是否和牌
+bool is_honors_and_knitted_tiles_win(const tile_t *standing_tiles, intptr_t standing_cnt, tile_t test_tile) {
     useful_table_t useful_table;
-    return (0 == seven_pairs_shanten(standing_tiles, standing_cnt, &useful_table)
-        && useful_table[test_tile]);
+    if (0 == honors_and_knitted_tiles_shanten(standing_tiles, standing_cnt, &useful_table)) {
+        return useful_table[test_tile];
+    }
+    return false;
 }
 
-//-------------------------------- 十三幺 --------------------------------
+//-------------------------------- 8番和牌距离 --------------------------------
+// 上面带番数限制的上听数计算依赖全局的Table、useful、cur_min，这里提供一个不读写任何全局状态的版本：
+// 给定手牌和每种牌还可能摸到的张数，求至少还要摸几张牌才能和出不少于起和番的牌，以及摸到后能缩短这个距离的牌
+//
+// 七对、十三幺、全不靠本身的番数就够，距离可以直接算出
+// 基本和型（含组合龙）用最佳优先搜索：节点是按规范顺序选出的一部分牌组（先选雀头，之后面子的编号不减），
+// 代价为目标牌型中手牌缺的张数，启发值为剩下的牌组还需的张数减去之后还能用上的手牌张数，不会高估；
+// 番数上界不足起和番的节点直接剪掉。估价相同的节点按入队顺序出队，所以结果是确定的
 
-// 十三幺上听数
-int thirteen_orphans_shanten(const tile_t *standing_tiles, intptr_t standing_cnt, useful_table_t *useful_table) {
-    if (standing_tiles == nullptr || standing_cnt != 13) {
-        return std::numeric_limits<int>::max();
-    }
+namespace {
 
-    // 对牌的种类进行打表
-    tile_table_t cnt_table;
-    map_tiles(standing_tiles, standing_cnt, &cnt_table);
+    // 搜索节点
+    struct fan_distance_node_t {
+        uint32_t seq;               // 入队序号
+        uint8_t estimate;           // 估价：已缺的张数+启发值
+        uint8_t cost;               // 目标牌型中手牌已缺的张数
+        int8_t knitted;             // 组合龙的编号，-1表示没有
+        bool late;                  // 牌组齐了，但要打出一张已有的牌再摸回来和牌，代价多1
+        uint8_t unit_cnt;           // 已选的牌组数
+        uint8_t units[5];           // units[0]为雀头的牌，之后为面子的编号
+    };
 
-    bool has_pair = false;
-    int cnt = 0;
-    for (int i = 0; i < 13; ++i) {
-        int n = cnt_table[standard_thirteen_orphans[i]];
-        if (n > 0) {
-            ++cnt;  // 幺九牌的种类
-            if (n > 1) {
-                has_pair = true;  // 幺九牌对子
-            }
+    // 估价小的先出队，估价相同时先入队的先出队
+    struct fan_distance_node_greater {
+        bool operator()(const fan_distance_node_t &a, const fan_distance_node_t &b) const {
+            return a.estimate != b.estimate ? a.estimate > b.estimate : a.seq > b.seq;
         }
-    }
+    };
 
-    // 当有对子时，上听数为：12-幺九牌的种类
-    // 当没有对子时，上听数为：13-幺九牌的种类
-    int ret = has_pair ? 12 - cnt : 13 - cnt;
+    // 搜索中不变的信息
+    struct fan_distance_search_t {
+        const fan_distance_param_t *param;
+        tile_table_t hand_table;    // 立牌
+        tile_table_t limit_table;   // 目标牌型中每种牌最多能有几张
+        uint8_t last_meld[34];      // 含有每种牌的面子中最大的编号
+        int meld_need;              // 除副露外还需几组面子
+    };
 
-    if (useful_table != nullptr) {
-        // 先标记所有的幺九牌为有效牌
-        memset(*useful_table, 0, sizeof(*useful_table));
-        std::for_each(std::begin(standard_thirteen_orphans), std::end(standard_thirteen_orphans),
-            [useful_table](tile_t t) {
-            (*useful_table)[t] = true;
-        });
+}
 
-        // 当有对子时，已有的幺九牌都不需要了
-        if (has_pair) {
-            for (int i = 0; i < 13; ++i) {
-                tile_t t = standard_thirteen_orphans[i];
-                int n = cnt_table[t];
-                if (n > 0) {
-                    (*useful_table)[t] = false;
-                }
-            }
-        }
-    }
+// 面子的编号：0~33为刻子，34~54为顺子（按花色和中间牌的点数2~8排列）
+#define FAN_DISTANCE_MELD_CNT 55
 
-    return ret;
+static FORCE_INLINE tile_t fan_distance_meld_tile(int meld) {
+    return meld < 34 ? all_tiles[meld]
+        : make_tile(static_cast<suit_t>((meld - 34) / 7 + 1), static_cast<rank_t>((meld - 34) % 7 + 2));
 }
 
-// 十三幺是否听牌
-bool is_thirteen_orphans_wait(const tile_t *standing_tiles, intptr_t standing_cnt, useful_table_t *waiting_table) {
-    // 直接计算其上听数，上听数为0即为听牌
-    if (waiting_table == nullptr) {
-        return (0 == thirteen_orphans_shanten(standing_tiles, standing_cnt, nullptr));
-    }
+static FORCE_INLINE int fan_distance_meld_tiles(int meld, tile_t *tiles) {
+    return meld < 34 ? push_pung(tiles, 0, fan_distance_meld_tile(meld)) : push_chow(tiles, 0, fan_distance_meld_tile(meld));
+}
 
-    useful_table_t useful_table;
-    if (0 == thirteen_orphans_shanten(standing_tiles, standing_cnt, &useful_table)) {
-        memcpy(*waiting_table, useful_table, sizeof(*waiting_table));
-        return true;
+// 节点对应的目标牌型，返回还需的面子数
+static int fan_distance_node_target(const fan_distance_node_t &node, tile_table_t &target, int meld_need) {
+    memset(target, 0, sizeof(tile_table_t));
+    if (node.knitted >= 0) {
+        for (int i = 0; i < 9; ++i) {
+            ++target[standard_knitted_straight[node.knitted][i]];
+        }
+        meld_need -= 3;
     }
-    return false;
+    if (node.unit_cnt > 0) {
+        target[node.units[0]] += 2;
+    }
+    for (int k = 1; k < node.unit_cnt; ++k) {
+        tile_t tiles[3];
+        fan_distance_meld_tiles(node.units[k], tiles);
+        ++target[tiles[0]]; ++target[tiles[1]]; ++target[tiles[2]];
+    }
+    return meld_need - (node.unit_cnt > 0 ? node.unit_cnt - 1 : 0);
 }
 
-// 十三幺是否和牌
-bool is_thirteen_orphans_win(const tile_t *standing_tiles, intptr_t standing_cnt, tile_t test_tile) {
-    useful_table_t useful_table;
-    return (0 == thirteen_orphans_shanten(standing_tiles, standing_cnt, &useful_table)
-        && useful_table[test_tile]);
+// 启发值：剩下的牌组还需的张数，减去之后的牌组还能用上的手牌张数
+static int fan_distance_estimate_rest(const fan_distance_search_t &search, const fan_distance_node_t &node,
+    const tile_table_t &target, int meld_left) {
+    int rest = meld_left * 3 + (node.unit_cnt == 0 ? 2 : 0);
+    if (rest == 0) {
+        return 0;
+    }
+    // 之后的面子编号不小于first
+    int first = node.unit_cnt > 1 ? node.units[node.unit_cnt - 1] : 0;
+    bool any = node.unit_cnt == 0;
+    int usable = 0;
+    for (int i = 0; i < 34 && usable < rest; ++i) {
+        tile_t t = all_tiles[i];
+        if (search.hand_table[t] > target[t] && (any || (meld_left > 0 && search.last_meld[i] >= first))) {
+            usable += search.hand_table[t] - target[t];
+        }
+    }
+    return std::max(rest - usable, 0);
 }
 
-//-------------------------------- “组合龙+面子+雀头”和型 --------------------------------
-
-// 以表格为参数计算组合龙是否听牌
-static bool is_knitted_straight_wait_from_table(const tile_table_t &cnt_table, intptr_t left_cnt, useful_table_t *waiting_table) {
-    // 匹配组合龙
-    const tile_t (*matched_seq)[9] = nullptr;
-    tile_t missing_tiles[9];
-    int missing_cnt = 0;
-    for (int i = 0; i < 6; ++i) {  // 逐个组合龙测试
-        missing_cnt = 0;
-        for (int k = 0; k < 9; ++k) {
-            tile_t t = standard_knitted_straight[i][k];
-            if (cnt_table[t] == 0) {  // 缺失的
-                missing_tiles[missing_cnt++] = t;
+// 番数上界是否可能达到起和番（组合龙不检查，本身就有12番）
+static bool fan_distance_may_reach(const fan_distance_search_t &search, const fan_distance_node_t &node,
+    const tile_table_t &target, int meld_left) {
+    const fan_distance_param_t *param = search.param;
+    if (node.knitted >= 0 || node.unit_cnt == 0) {
+        return true;
+    }
+    pack_t packs[5];
+    packs[0] = make_pack(0, PACK_TYPE_PAIR, node.units[0]);
+    for (int k = 1; k < node.unit_cnt; ++k) {
+        packs[k] = make_pack(0, node.units[k] < 34 ? PACK_TYPE_PUNG : PACK_TYPE_CHOW, fan_distance_meld_tile(node.units[k]));
+    }
+    fan_bound_free_t free_info;
+    free_info.sets = meld_left;
+    free_info.pair = false;
+    free_info.tiles = free_info.pungs = free_info.pairs = 0;
+    if (meld_left > 0) {
+        for (int i = 0; i < 34; ++i) {
+            tile_t t = all_tiles[i];
+            int avail = search.limit_table[t] - target[t];
+            if (avail >= 3) {
+                free_info.pungs |= tile_bit(t);
+            }
+            if (avail >= 3 || (avail >= 1 && is_numbered_suit_quick(t))) {
+                free_info.tiles |= tile_bit(t);
             }
         }
-        if (missing_cnt < 2) {  // 缺2张或以上的肯定没听
-            matched_seq = &standard_knitted_straight[i];
-            break;
+    }
+    fan_bound_context_t ctx = { param->hand_tiles.fixed_packs, param->hand_tiles.pack_count,
+        param->win_flag, param->prevalent_wind, param->seat_wind };
+    return estimate_fan_upper_bound(ctx, packs, node.unit_cnt, free_info, param->min_fan) >= param->min_fan;
+}
+
+// 目标牌型以哪些牌和牌时能达到起和番，返回是否存在这样的和牌张
+// late为false时只试手牌缺的牌；为true时只试手牌已有的牌，此时要先打出一张再从牌墙摸回来
+static bool fan_distance_win_tiles(const fan_distance_search_t &search, const tile_table_t &target, bool late, useful_table_t &win_table) {
+    const fan_distance_param_t *param = search.param;
+    calculate_param_t calculate_param;
+    memcpy(calculate_param.hand_tiles.fixed_packs, param->hand_tiles.fixed_packs, sizeof(calculate_param.hand_tiles.fixed_packs));
+    calculate_param.hand_tiles.pack_count = param->hand_tiles.pack_count;
+    calculate_param.flower_count = 0;
+    calculate_param.win_flag = param->win_flag;
+    calculate_param.prevalent_wind = param->prevalent_wind;
+    calculate_param.seat_wind = param->seat_wind;
+    bool any = false;
+    memset(win_table, 0, sizeof(useful_table_t));
+    for (int i = 0; i < 34; ++i) {
+        tile_t w = all_tiles[i];
+        if (late ? (target[w] == 0 || target[w] > search.hand_table[w] || param->wall_table[w] == 0)
+            : target[w] <= search.hand_table[w]) {
+            continue;
+        }
+        intptr_t cnt = 0;
+        for (int j = 0; j < 34; ++j) {
+            tile_t t = all_tiles[j];
+            for (int k = target[t] - (t == w ? 1 : 0); k > 0; --k) {
+                calculate_param.hand_tiles.standing_tiles[cnt++] = t;
+            }
+        }
+        calculate_param.hand_tiles.tile_count = cnt;
+        calculate_param.win_tile = w;
+        if (calculate_fan(&calculate_param, nullptr) >= param->min_fan) {
+            win_table[w] = true;
+            any = true;
         }
     }
+    return any;
+}
 
-    if (matched_seq == nullptr || missing_cnt > 2) {
-        return false;
+// 七对的距离：每种牌可作1~2组对子，取代价最小的7组
+static int fan_distance_seven_pairs(const fan_distance_search_t &search, useful_table_t &useful_table) {
+    int costs[68];
+    int cost_cnt = 0;
+    for (int i = 0; i < 34; ++i) {
+        tile_t t = all_tiles[i];
+        int n = search.hand_table[t];
+        if (search.limit_table[t] >= 2) {
+            costs[cost_cnt++] = std::max(2 - n, 0);
+        }
+        if (search.limit_table[t] >= 4) {
+            costs[cost_cnt++] = std::max(4 - n, 0) - std::max(2 - n, 0);
+        }
     }
-
-    if (waiting_table != nullptr) {
-        memset(*waiting_table, 0, sizeof(*waiting_table));
+    if (cost_cnt < 7) {
+        return FAN_DISTANCE_UNREACHABLE;
     }
-
-    // 剔除组合龙
-    tile_table_t temp_table;
-    memcpy(&temp_table, &cnt_table, sizeof(temp_table));
-    for (int i = 0; i < 9; ++i) {
-        tile_t t = (*matched_seq)[i];
-        if (temp_table[t]) {
-            --temp_table[t];
+    std::sort(costs, costs + cost_cnt);
+    int distance = 0;
+    for (int i = 0; i < 7; ++i) {
+        distance += costs[i];
+    }
+    // 代价不超过第7小的代价的牌都可能用到
+    int worst = costs[6];
+    for (int i = 0; i < 34; ++i) {
+        tile_t t = all_tiles[i];
+        int n = search.hand_table[t];
+        if ((search.limit_table[t] >= 2 && n < 2 && 2 - n <= worst)
+            || (search.limit_table[t] >= 4 && n < 4 && std::max(4 - n, 0) - std::max(2 - n, 0) <= worst)) {
+            useful_table[t] = true;
         }
     }
+    return distance;
+}
 
-    if (missing_cnt == 1) {  // 如果缺一张，那么除去组合龙之后的牌应该是完成状态才能听牌
-        if (left_cnt == 10) {
-            if (is_basic_form_win_recursively(temp_table, 2)) {
-                if (waiting_table != nullptr) {  // 获取听牌张，听组合龙缺的一张
-                    (*waiting_table)[missing_tiles[0]] = true;
-                }
-                return true;
-            }
+// 十三幺的距离：13种幺九牌各1张，再加其中1种作雀头
+static int fan_distance_thirteen_orphans(const fan_distance_search_t &search, useful_table_t &useful_table) {
+    int missing = 0, pair_cost = 2;
+    for (int i = 0; i < 13; ++i) {
+        tile_t t = standard_thirteen_orphans[i];
+        int n = search.hand_table[t], limit = search.limit_table[t];
+        if (limit < 1) {
+            return FAN_DISTANCE_UNREACHABLE;
         }
-        else {
-            if (is_basic_form_win_recursively(temp_table, 5)) {
-                if (waiting_table != nullptr) {  // 获取听牌张，听组合龙缺的一张
-                    (*waiting_table)[missing_tiles[0]] = true;
-                }
-                return true;
-            }
+        if (n == 0) {
+            ++missing;
+        }
+        if (limit >= 2) {
+            pair_cost = std::min(pair_cost, n >= 2 ? 0 : 1);
         }
     }
-    else if (missing_cnt == 0) {  // 如果组合龙齐了，那么除去组合龙之后的牌要能听，整手牌才能听
-        if (left_cnt == 10) {
-            return is_basic_form_wait_1(temp_table, waiting_table);
+    if (pair_cost > 1) {
+        return FAN_DISTANCE_UNREACHABLE;
+    }
+    for (int i = 0; i < 13; ++i) {
+        tile_t t = standard_thirteen_orphans[i];
+        int n = search.hand_table[t];
+        if (n == 0 || (pair_cost == 1 && n == 1 && search.limit_table[t] >= 2)) {
+            useful_table[t] = true;
+        }
+    }
+    return missing + pair_cost;
+}
+
+// 全不靠的距离：某种组合龙的9张和7种字牌中选14种各1张
+static int fan_distance_honors_and_knitted_tiles(const fan_distance_search_t &search, useful_table_t &useful_table) {
+    int distance = FAN_DISTANCE_UNREACHABLE;
+    useful_table_t temp_table;
+    for (int s = 0; s < 6; ++s) {
+        tile_t candidates[16];
+        memcpy(candidates, standard_knitted_straight[s], 9 * sizeof(tile_t));
+        for (int i = 0; i < 7; ++i) {
+            candidates[9 + i] = static_cast<tile_t>(TILE_E + i);
+        }
+        int held = 0, drawable = 0;
+        memset(temp_table, 0, sizeof(temp_table));
+        for (int i = 0; i < 16; ++i) {
+            tile_t t = candidates[i];
+            if (search.hand_table[t] > 0) {
+                ++held;
+            }
+            else if (search.limit_table[t] > 0) {
+                ++drawable;
+                temp_table[t] = true;
+            }
         }
-        else {
-            return is_basic_form_wait_recursively(temp_table, 4, waiting_table);
+        int d = 14 - held;
+        if (d > drawable || d > distance) {
+            continue;
+        }
+        if (d < distance) {
+            distance = d;
+            memset(useful_table, 0, sizeof(useful_table_t));
+        }
+        for (int i = 0; i < 16; ++i) {
+            useful_table[candidates[i]] |= temp_table[candidates[i]];
         }
     }
-
-    return false;
+    return distance;
 }
 
-// 基本和型包含主番的上听数，可用于计算三步高 三同顺 龙等三组面子的番种整个立牌的上听数
-static int basic_form_shanten_specified(const tile_table_t &cnt_table, const tile_t *main_tiles, int main_cnt,
-    intptr_t fixed_cnt, useful_table_t *useful_table) {
+// 基本和型（含组合龙）的最佳优先搜索
+static int fan_distance_basic_form(const fan_distance_search_t &search, int best, useful_table_t &useful_table, uint8_t *form_flag,
+    int *node_count, bool *complete) {
+    const fan_distance_param_t *param = search.param;
+    const int budget = param->node_budget > 0 ? param->node_budget : FAN_DISTANCE_DEFAULT_BUDGET;
+    int distance = FAN_DISTANCE_UNREACHABLE;
+    uint32_t seq = 0;
+    std::vector<fan_distance_node_t> heap;
+    fan_distance_node_greater greater;
+    tile_table_t target;
 
-    tile_table_t temp_table;
-    memcpy(&temp_table, &cnt_table, sizeof(temp_table));
-    int exist_cnt = 0;
-
-    // 统计主番的牌
-    for (int i = 0; i < main_cnt; ++i) {
-        tile_t t = main_tiles[i];
-        int n = cnt_table[t];
-        if (n > 0) {  // 有，削减之
-            ++exist_cnt;
-            --temp_table[t];
+    // 根节点：不含组合龙，以及副露不超过1组时的6种组合龙
+    for (int knitted = -1; knitted < (search.meld_need >= 3 ? 6 : 0); ++knitted) {
+        fan_distance_node_t node;
+        memset(&node, 0, sizeof(node));
+        node.knitted = static_cast<int8_t>(knitted);
+        int meld_left = fan_distance_node_target(node, target, search.meld_need);
+        bool valid = true;
+        for (int i = 0; i < 34; ++i) {
+            tile_t t = all_tiles[i];
+            valid &= target[t] <= search.limit_table[t];
+            node.cost += static_cast<uint8_t>(std::max(target[t] - search.hand_table[t], 0));
+        }
+        if (!valid) {
+            continue;
         }
+        node.estimate = static_cast<uint8_t>(std::max(node.cost + fan_distance_estimate_rest(search, node, target, meld_left), 1));
+        node.seq = seq++;
+        heap.push_back(node);
+        std::push_heap(heap.begin(), heap.end(), greater);
     }
 
-    // 记录有效牌
-    if (useful_table != nullptr) {
-        memset(*useful_table, 0, sizeof(*useful_table));
+    *complete = true;
+    *node_count = static_cast<int>(heap.size());
+    while (!heap.empty()) {
+        std::pop_heap(heap.begin(), heap.end(), greater);
+        fan_distance_node_t node = heap.back();
+        heap.pop_back();
+        if (node.estimate > std::min(best, distance)) {
+            break;
+        }
 
-        // 统计主番缺失的牌
-        for (int i = 0; i < main_cnt; ++i) {
-            tile_t t = main_tiles[i];
-            int n = cnt_table[t];
-            if (n <= 0) {
-                (*useful_table)[t] = true;
+        int meld_left = fan_distance_node_target(node, target, search.meld_need);
+        if (node.late) {  // 打出再摸回来和牌，缺的牌都是有效牌
+            distance = node.estimate;
+            *form_flag |= node.knitted >= 0 ? FORM_FLAG_KNITTED_STRAIGHT : FORM_FLAG_BASIC_FORM;
+            for (int i = 0; i < 34; ++i) {
+                tile_t t = all_tiles[i];
+                if (target[t] > search.hand_table[t]) {
+                    useful_table[t] = true;
+                }
+            }
+            continue;
+        }
+        if (node.unit_cnt > 0 && meld_left == 0) {  // 牌组齐了
+            useful_table_t win_table;
+            if (fan_distance_win_tiles(search, target, false, win_table)) {
+                distance = node.cost;
+                *form_flag |= node.knitted >= 0 ? FORM_FLAG_KNITTED_STRAIGHT : FORM_FLAG_BASIC_FORM;
+                // 先摸到的牌不能是唯一能和的那张：只差1张时有效牌就是和牌张，
+                // 否则摸到t后剩下缺的牌中还要有能和的
+                int win_kinds = 0;
+                for (int i = 0; i < 34; ++i) {
+                    win_kinds += win_table[all_tiles[i]];
+                }
+                for (int i = 0; i < 34; ++i) {
+                    tile_t t = all_tiles[i];
+                    int missing = target[t] - search.hand_table[t];
+                    if (missing > 0 && (node.cost == 1 ? win_table[t]
+                        : (win_kinds > (win_table[t] ? 1 : 0) || missing >= 2))) {
+                        useful_table[t] = true;
+                    }
+                }
+            }
+            else if (node.cost + 1 <= std::min(best, distance) && fan_distance_win_tiles(search, target, true, win_table)) {
+                // 以缺的牌和不够番，但打出已有的牌再摸回来和可以，代价多1，重新入队
+                node.late = true;
+                node.estimate = static_cast<uint8_t>(node.cost + 1);
+                node.seq = seq++;
+                heap.push_back(node);
+                std::push_heap(heap.begin(), heap.end(), greater);
+            }
+            continue;
+        }
+
+        // 展开：先选雀头，再按编号不减的顺序选面子
+        int first = node.unit_cnt > 1 ? node.units[node.unit_cnt - 1] : 0;
+        int end = node.unit_cnt == 0 ? 34 : FAN_DISTANCE_MELD_CNT;
+        for (int c = first; c < end; ++c) {
+            tile_t tiles[3];
+            int cnt;
+            if (node.unit_cnt == 0) {
+                tiles[0] = tiles[1] = all_tiles[c];
+                cnt = 2;
+            }
+            else {
+                cnt = fan_distance_meld_tiles(c, tiles);
+            }
+            fan_distance_node_t child = node;
+            bool valid = true;
+            for (int k = 0; k < cnt; ++k) {
+                tile_t t = tiles[k];
+                if (target[t] >= search.hand_table[t]) {
+                    ++child.cost;
+                }
+                ++target[t];
+                valid &= target[t] <= search.limit_table[t];
+            }
+            child.units[child.unit_cnt++] = static_cast<uint8_t>(node.unit_cnt == 0 ? all_tiles[c] : c);
+            int child_left = meld_left - (node.unit_cnt == 0 ? 0 : 1);
+            if (valid) {
+                int estimate = std::max(child.cost + fan_distance_estimate_rest(search, child, target, child_left), 1);
+                valid = estimate <= std::min(best, distance) && fan_distance_may_reach(search, child, target, child_left);
+                child.estimate = static_cast<uint8_t>(estimate);
             }
+            for (int k = 0; k < cnt; ++k) {
+                --target[tiles[k]];
+            }
+            if (!valid) {
+                continue;
+            }
+            if (*node_count >= budget) {
+                *complete = false;
+                return distance;
+            }
+            ++*node_count;
+            child.seq = seq++;
+            heap.push_back(child);
+            std::push_heap(heap.begin(), heap.end(), greater);
         }
     }
-
-    // 余下牌的上听数
-    int result = basic_form_shanten_from_table(temp_table, fixed_cnt + main_cnt / 3, useful_table);
-
-    // 上听数=主番缺少的张数+余下牌的上听数
-    return (main_cnt - exist_cnt) + result;
+    return distance;
 }
 
-// 组合龙上听数
-int knitted_straight_shanten(const tile_t *standing_tiles, intptr_t standing_cnt, useful_table_t *useful_table) {
-    if (standing_tiles == nullptr || (standing_cnt != 13 && standing_cnt != 10)) {
-        return std::numeric_limits<int>::max();
+// 计算8番和牌距离，手牌不合法时返回false
+bool fan_distance(const fan_distance_param_t *param, fan_distance_result_t *result) {
+    const hand_tiles_t &hand_tiles = param->hand_tiles;
+    if (hand_tiles.pack_count < 0 || hand_tiles.pack_count > 4 || hand_tiles.tile_count != 13 - 3 * hand_tiles.pack_count) {
+        return false;
     }
 
-    // 打表
-    tile_table_t cnt_table;
-    map_tiles(standing_tiles, standing_cnt, &cnt_table);
-
-    int ret = std::numeric_limits<int>::max();
-
-    // 需要获取有效牌时，计算上听数的同时就获取有效牌了
-    if (useful_table != nullptr) {
-        memset(*useful_table, 0, sizeof(*useful_table));
-
-        useful_table_t temp_table;
-
-        // 6种组合龙分别计算
-        for (int i = 0; i < 6; ++i) {
-            int fixed_cnt = (13 - static_cast<int>(standing_cnt)) / 3;
-            int st = basic_form_shanten_specified(cnt_table, standard_knitted_straight[i], 9, fixed_cnt, &temp_table);
-            if (st < ret) {  // 上听数小的，直接覆盖数据
-                ret = st;
-                memcpy(*useful_table, temp_table, sizeof(*useful_table));  // 直接覆盖原来的有效牌数据
-            }
-            else if (st == ret) {  // 两种不同组合龙上听数如果相等的话，直接合并有效牌
-                std::transform(std::begin(*useful_table), std::end(*useful_table), std::begin(temp_table),
-                    std::begin(*useful_table), [](bool u, bool t) { return u || t; });
-            }
+    fan_distance_search_t search;
+    search.param = param;
+    search.meld_need = 4 - static_cast<int>(hand_tiles.pack_count);
+    map_tiles(hand_tiles.standing_tiles, hand_tiles.tile_count, &search.hand_table);
+    tile_table_t fixed_table = { 0 };
+    for (intptr_t i = 0; i < hand_tiles.pack_count; ++i) {
+        pack_t pack = hand_tiles.fixed_packs[i];
+        tile_t t = pack_get_tile(pack);
+        switch (pack_get_type(pack)) {
+        case PACK_TYPE_CHOW: ++fixed_table[t - 1]; ++fixed_table[t]; ++fixed_table[t + 1]; break;
+        case PACK_TYPE_PUNG: fixed_table[t] += 3; break;
+        case PACK_TYPE_KONG: fixed_table[t] += 4; break;
+        default: break;
         }
     }
-    else {
-        // 6种组合龙分别计算
-        for (int i = 0; i < 6; ++i) {
-            int fixed_cnt = (13 - static_cast<int>(standing_cnt)) / 3;
-            int st = basic_form_shanten_specified(cnt_table, standard_knitted_straight[i], 9, fixed_cnt, nullptr);
-            if (st < ret) {
-                ret = st;
+    for (int i = 0; i < 34; ++i) {
+        tile_t t = all_tiles[i];
+        int limit = std::min(search.hand_table[t] + param->wall_table[t], 4 - fixed_table[t]);
+        search.limit_table[t] = static_cast<uint16_t>(std::max(limit, 0));
+        // 含t的面子中最大的编号：字牌只有刻子，数牌看以t、t+1为中间牌的顺子
+        int last = i;
+        if (is_numbered_suit_quick(t)) {
+            rank_t r = std::min(tile_get_rank(t) + 1, 8);
+            last = 34 + (tile_get_suit(t) - 1) * 7 + r - 2;
+        }
+        search.last_meld[i] = static_cast<uint8_t>(last);
+    }
+
+    result->distance = FAN_DISTANCE_UNREACHABLE;
+    result->form_flag = 0;
+    result->complete = true;
+    result->node_count = 0;
+    memset(result->useful_table, 0, sizeof(result->useful_table));
+
+    // 特殊和型：七对24番，十三幺88番，全不靠12番
+    if (hand_tiles.pack_count == 0) {
+        static const struct { uint8_t form_flag; int fan; int (*func)(const fan_distance_search_t &, useful_table_t &); } special_forms[] = {
+            { FORM_FLAG_SEVEN_PAIRS, 24, &fan_distance_seven_pairs },
+            { FORM_FLAG_THIRTEEN_ORPHANS, 88, &fan_distance_thirteen_orphans },
+            { FORM_FLAG_HONORS_AND_KNITTED_TILES, 12, &fan_distance_honors_and_knitted_tiles },
+        };
+        for (size_t i = 0; i < sizeof(special_forms) / sizeof(special_forms[0]); ++i) {
+            if (special_forms[i].fan < param->min_fan) {
+                continue;
+            }
+            useful_table_t useful_table = { false };
+            int distance = special_forms[i].func(search, useful_table);
+            if (distance > result->distance) {
+                continue;
+            }
+            if (distance < result->distance) {
+                result->distance = distance;
+                result->form_flag = 0;
+                memset(result->useful_table, 0, sizeof(result->useful_table));
+            }
+            result->form_flag |= special_forms[i].form_flag;
+            for (int j = 0; j < 34; ++j) {
+                result->useful_table[all_tiles[j]] |= useful_table[all_tiles[j]];
             }
         }
     }
 
-    return ret;
-}
-
-// 组合龙是否听牌
-bool is_knitted_straight_wait(const tile_t *standing_tiles, intptr_t standing_cnt, useful_table_t *waiting_table) {
-    if (standing_tiles == nullptr || (standing_cnt != 13 && standing_cnt != 10)) {
-        return false;
+    // 基本和型，只搜不比特殊和型远的
+    useful_table_t useful_table = { false };
+    uint8_t form_flag = 0;
+    int distance = fan_distance_basic_form(search, result->distance, useful_table, &form_flag, &result->node_count, &result->complete);
+    if (distance <= result->distance) {
+        if (distance < result->distance) {
+            result->distance = distance;
+            result->form_flag = 0;
+            memset(result->useful_table, 0, sizeof(result->useful_table));
+        }
+        result->form_flag |= form_flag;
+        for (int j = 0; j < 34; ++j) {
+            result->useful_table[all_tiles[j]] |= useful_table[all_tiles[j]];
+        }
     }
+    return true;
+}
 
-    // 对立牌的种类进行打表
-    tile_table_t cnt_table;
-    map_tiles(standing_tiles, standing_cnt, &cnt_table);
+//-------------------------------- 所有情况综合 --------------------------------
 
-    return is_knitted_straight_wait_from_table(cnt_table, standing_cnt, waiting_table);
+// 将表打成各张数的位掩码
+static void table_to_tile_count_masks(const tile_table_t &cnt_table, tile_count_masks_t *masks) {
+    memset(masks->at_least, 0, sizeof(masks->at_least));
+    for (int i = 0; i < 34; ++i) {
+        tile_t t = all_tiles[i];
+        uint64_t bit = 1ULL << (t - TILE_1m);
+        for (int n = 0; n < 5 && n < cnt_table[t]; ++n) {
+            masks->at_least[n] |= bit;
+        }
+    }
 }
 
-// 组合龙是否和牌
-bool is_knitted_straight_win(const tile_t *standing_tiles, intptr_t standing_cnt, tile_t test_tile) {
-    useful_table_t waiting_table;
-    return (is_knitted_straight_wait(standing_tiles, standing_cnt, &waiting_table)
-        && waiting_table[test_tile]);
+// 将牌打成各张数的位掩码，每张牌把它的位推进到下一级
+void map_tile_count_masks(const tile_t *tiles, intptr_t cnt, tile_count_masks_t *masks) {
+    memset(masks->at_least, 0, sizeof(masks->at_least));
+    for (intptr_t i = 0; i < cnt; ++i) {
+        uint64_t bit = 1ULL << (tiles[i] - TILE_1m);
+        masks->at_least[4] |= masks->at_least[3] & bit;
+        masks->at_least[3] |= masks->at_least[2] & bit;
+        masks->at_least[2] |= masks->at_least[1] & bit;
+        masks->at_least[1] |= masks->at_least[0] & bit;
+        masks->at_least[0] |= bit;
+    }
 }
 
-//-------------------------------- 全不靠/七星不靠 --------------------------------
-
-// 1种组合龙的全不靠上听数
-static int honors_and_knitted_tiles_shanten_1(const tile_t *standing_tiles, intptr_t standing_cnt, int which_seq, useful_table_t *useful_table) {
-    if (standing_tiles == nullptr || standing_cnt != 13) {
-        return std::numeric_limits<int>::max();
+// 将有效牌的位掩码转换成有效牌标记表
+static void mask_to_useful_table(uint64_t mask, useful_table_t *useful_table) {
+    memset(*useful_table, 0, sizeof(*useful_table));
+    for (; mask != 0; mask &= mask - 1) {
+        (*useful_table)[TILE_1m + packed_hand_lowest_bit(mask)] = true;
     }
+}
 
-    // 对牌的种类进行打表
-    tile_table_t cnt_table;
-    map_tiles(standing_tiles, standing_cnt, &cnt_table);
-
-    int cnt = 0;
-
-    // 统计组合龙部分的数牌
-    for (int i = 0; i < 9; ++i) {
-        tile_t t = standard_knitted_straight[which_seq][i];
-        int n = cnt_table[t];
-        if (n > 0) {  // 有，增加计数
-            ++cnt;
-        }
+// 一次计算七对、十三幺、全不靠的上听数
+int special_forms_shanten(const tile_count_masks_t &masks, special_shanten_t *result) {
+    if (masks.at_least[4] != 0) {
+        std::fill(std::begin(result->shanten), std::end(result->shanten), std::numeric_limits<int>::max());
+        memset(result->useful_mask, 0, sizeof(result->useful_mask));
+        return std::numeric_limits<int>::max();
     }
+    const uint64_t present = masks.at_least[0];
 
-    // 统计字牌
-    for (int i = 6; i < 13; ++i) {
-        tile_t t = standard_thirteen_orphans[i];
-        int n = cnt_table[t];
-        if (n > 0) {  // 有，增加计数
-            ++cnt;
-        }
-    }
+    // 七对：4张的牌算2对，有效牌为张数是奇数的牌
+    result->shanten[0] = 6 - popcount64(masks.at_least[1]) - popcount64(masks.at_least[3]);
+    result->useful_mask[0] = (present & ~masks.at_least[1]) | (masks.at_least[2] & ~masks.at_least[3]);
 
-    // 记录有效牌
-    if (useful_table != nullptr) {
-        memset(*useful_table, 0, sizeof(*useful_table));
+    // 十三幺：有幺九牌对子时，已有的幺九牌都不需要了
+    const bool has_pair = (masks.at_least[1] & standard_thirteen_orphans_mask) != 0;
+    result->shanten[1] = (has_pair ? 12 : 13) - popcount64(present & standard_thirteen_orphans_mask);
+    result->useful_mask[1] = has_pair ? standard_thirteen_orphans_mask & ~present : standard_thirteen_orphans_mask;
 
-        // 统计组合龙部分缺失的数牌
-        for (int i = 0; i < 9; ++i) {
-            tile_t t = standard_knitted_straight[which_seq][i];
-            int n = cnt_table[t];
-            if (n <= 0) {
-                (*useful_table)[t] = true;
-            }
+    // 全不靠：6种组合龙连同字牌分别计数，上听数相等的合并有效牌
+    int ret = std::numeric_limits<int>::max();
+    uint64_t useful = 0;
+    for (int i = 0; i < 6; ++i) {
+        const uint64_t mask = standard_knitted_straight_mask[i] | standard_honors_mask;
+        int st = 13 - popcount64(present & mask);
+        if (st < ret) {
+            ret = st;
+            useful = mask & ~present;
         }
-
-        // 统计缺失的字牌
-        for (int i = 6; i < 13; ++i) {
-            tile_t t = standard_thirteen_orphans[i];
-            int n = cnt_table[t];
-            if (n <= 0) {
-                (*useful_table)[t] = true;
-            }
+        else if (st == ret) {
+            useful |= mask & ~present;
         }
     }
+    result->shanten[2] = ret;
+    result->useful_mask[2] = useful;
 
-    // 上听数=13-符合牌型的计数
-    return 13 - cnt;
+    return *std::min_element(std::begin(result->shanten), std::end(result->shanten));
 }
 
-// 全不靠上听数
-int honors_and_knitted_tiles_shanten(const tile_t *standing_tiles, intptr_t standing_cnt, useful_table_t *useful_table) {
-    int ret = std::numeric_limits<int>::max();
-
-    // 需要获取有效牌时，计算上听数的同时就获取有效牌了
-    if (useful_table != nullptr) {
-        memset(*useful_table, 0, sizeof(*useful_table));
+// 以表格为参数一次计算多种和型的上听数，计算完成后cnt_table保持原样
+static int calculate_shanten_all_from_table(tile_table_t &cnt_table, intptr_t standing_cnt, uint8_t form_flag, shanten_all_t *result) {
+    std::fill(std::begin(result->shanten), std::end(result->shanten), std::numeric_limits<int>::max());
+    memset(result->useful_table, 0, sizeof(result->useful_table));
 
-        useful_table_t temp_table;
+    if (form_flag & FORM_FLAG_BASIC_FORM) {
+        result->shanten[0] = basic_form_shanten_from_table(cnt_table, (13 - standing_cnt) / 3, &result->useful_table[0]);
+    }
 
-        // 6种组合龙分别计算
-        for (int i = 0; i < 6; ++i) {
-            int st = honors_and_knitted_tiles_shanten_1(standing_tiles, standing_cnt, i, &temp_table);
-            if (st < ret) {  // 上听数小的，直接覆盖数据
-                ret = st;
-                memcpy(*useful_table, temp_table, sizeof(*useful_table));  // 直接覆盖原来的有效牌数据
-            }
-            else if (st == ret) {  // 两种不同组合龙上听数如果相等的话，直接合并有效牌
-                std::transform(std::begin(*useful_table), std::end(*useful_table), std::begin(temp_table),
-                    std::begin(*useful_table), [](bool u, bool t) { return u || t; });
+    // 立牌有13张时，才需要计算七对、十三幺、全不靠
+    // 三者只与各张数的牌的种类有关，打成位掩码后一起算，有超过4张的牌时再逐个计算
+    tile_count_masks_t masks;
+    if (standing_cnt == 13) {
+        table_to_tile_count_masks(cnt_table, &masks);
+    }
+    if (standing_cnt == 13 && masks.at_least[4] == 0) {
+        special_shanten_t special;
+        special_forms_shanten(masks, &special);
+        for (int i = 0; i < 3; ++i) {
+            if (form_flag & (FORM_FLAG_SEVEN_PAIRS << i)) {
+                result->shanten[i + 1] = special.shanten[i];
+                mask_to_useful_table(special.useful_mask[i], &result->useful_table[i + 1]);
             }
         }
     }
-    else {
-        // 6种组合龙分别计算
-        for (int i = 0; i < 6; ++i) {
-            int st = honors_and_knitted_tiles_shanten_1(standing_tiles, standing_cnt, i, nullptr);
-            if (st < ret) {
-                ret = st;
-            }
+    else if (standing_cnt == 13) {
+        if (form_flag & FORM_FLAG_SEVEN_PAIRS) {
+            result->shanten[1] = seven_pairs_shanten_from_table(cnt_table, &result->useful_table[1]);
+        }
+        if (form_flag & FORM_FLAG_THIRTEEN_ORPHANS) {
+            result->shanten[2] = thirteen_orphans_shanten_from_table(cnt_table, &result->useful_table[2]);
+        }
+        if (form_flag & FORM_FLAG_HONORS_AND_KNITTED_TILES) {
+            result->shanten[3] = honors_and_knitted_tiles_shanten_from_table(cnt_table, &result->useful_table[3]);
         }
     }
-    return ret;
-}
 
-// 全不靠是否听牌
-bool is_honors_and_knitted_tiles_wait(const tile_t *standing_tiles, intptr_t standing_cnt, useful_table_t *waiting_table) {
-    // 直接计算其上听数，上听数为0即为听牌
-    if (waiting_table == nullptr) {
-        return (0 == honors_and_knitted_tiles_shanten(standing_tiles, standing_cnt, nullptr));
+    // 立牌有13张或者10张时，才需要计算组合龙
+    if (standing_cnt == 13 || standing_cnt == 10) {
+        if (form_flag & FORM_FLAG_KNITTED_STRAIGHT) {
+            result->shanten[4] = knitted_straight_shanten_from_table(cnt_table, standing_cnt, &result->useful_table[4]);
+        }
     }
 
-    useful_table_t useful_table;
-    if (0 == honors_and_knitted_tiles_shanten(standing_tiles, standing_cnt, &useful_table)) {
-        memcpy(*waiting_table, useful_table, sizeof(*waiting_table));
-        return true;
+    // 合并上听数最小的各和型的有效牌
+    int ret = *std::min_element(std::begin(result->shanten), std::end(result->shanten));
+    result->form_flag = 0;
+    memset(result->all_useful_table, 0, sizeof(result->all_useful_table));
+    if (ret == std::numeric_limits<int>::max()) {
+        return ret;
     }
-    return false;
+    for (int i = 0; i < 5; ++i) {
+        if (result->shanten[i] != ret) {
+            continue;
+        }
+        result->form_flag |= static_cast<uint8_t>(1 << i);
+        std::transform(std::begin(result->all_useful_table), std::end(result->all_useful_table), std::begin(result->useful_table[i]),
+            std::begin(result->all_useful_table), [](bool u, bool t) { return u || t; });
+    }
+    return ret;
 }
 
-// 全不靠是否和牌
-bool is_honors_and_knitted_tiles_win(const tile_t *standing_tiles, intptr_t standing_cnt, tile_t test_tile) {
-    useful_table_t useful_table;
-    if (0 == honors_and_knitted_tiles_shanten(standing_tiles, standing_cnt, &useful_table)) {
-        return useful_table[test_tile];
+// 一次计算多种和型的上听数
+int calculate_shanten_all(const tile_t *standing_tiles, intptr_t standing_cnt, uint8_t form_flag, shanten_all_t *result) {
+    if (standing_tiles == nullptr || result == nullptr || (standing_cnt != 13
+        && standing_cnt != 10 && standing_cnt != 7 && standing_cnt != 4 && standing_cnt != 1)) {
+        return std::numeric_limits<int>::max();
     }
-    return false;
-}
 
-//-------------------------------- 所有情况综合 --------------------------------
+    // 对立牌的种类进行打表，各和型共用
+    tile_table_t cnt_table;
+    map_tiles(standing_tiles, standing_cnt, &cnt_table);
+    return calculate_shanten_all_from_table(cnt_table, standing_cnt, form_flag, result);
+}
 
 bool is_waiting(const hand_tiles_t &hand_tiles, useful_table_t *useful_table) {
     bool spcial_waiting = false, basic_waiting = false;
     useful_table_t table_special, table_basic;
 
+    // 对立牌的种类进行打表，各和型共用
+    tile_table_t cnt_table;
+    map_tiles(hand_tiles.standing_tiles, hand_tiles.tile_count, &cnt_table);
+
+    // 七对、十三幺、全不靠的上听数为0即为听牌
     if (hand_tiles.tile_count == 13) {
-        if (is_thirteen_orphans_wait(hand_tiles.standing_tiles, 13, &table_special)) {
+        if (0 == thirteen_orphans_shanten_from_table(cnt_table, &table_special)) {
             spcial_waiting = true;
         }
-        else if (is_honors_and_knitted_tiles_wait(hand_tiles.standing_tiles, 13, &table_special)) {
+        else if (0 == honors_and_knitted_tiles_shanten_from_table(cnt_table, &table_special)) {
             spcial_waiting = true;
         }
-        else if (is_seven_pairs_wait(hand_tiles.standing_tiles, 13, &table_special)) {
+        else if (0 == seven_pairs_shanten_from_table(cnt_table, &table_special)) {
             spcial_waiting = true;
         }
-        else if (is_knitted_straight_wait(hand_tiles.standing_tiles, 13, &table_special)) {
+        else if (is_knitted_straight_wait_from_table(cnt_table, &table_special)) {
             spcial_waiting = true;
         }
     }
     else if (hand_tiles.tile_count == 10) {
-        if (is_knitted_straight_wait(hand_tiles.standing_tiles, 10, &table_special)) {
+        if (is_knitted_straight_wait_from_table(cnt_table, &table_special)) {
             spcial_waiting = true;
         }
     }
 
-    if (is_basic_form_wait(hand_tiles.standing_tiles, hand_tiles.tile_count, &table_basic)) {
+    memset(table_basic, 0, sizeof(table_basic));
+    if (is_basic_form_wait_from_table(cnt_table, &table_basic)) {
         basic_waiting = true;
     }
 
@@ -6008,66 +9018,26 @@ bool is_waiting(const hand_tiles_t &hand_tiles, useful_table_t *useful_table) {
 //-------------------------------- 枚举打牌 --------------------------------
 
 // 枚举打哪张牌1次
-static bool enum_discard_tile_1(const hand_tiles_t *hand_tiles, tile_t discard_tile, uint8_t form_flag,
+static bool enum_discard_tile_1(tile_table_t &cnt_table, intptr_t tile_count, tile_t discard_tile, uint8_t form_flag,
     void *context, enum_callback_t enum_callback) {
+    // 基本和型总是计算，其余和型由form_flag决定，一次打表算完
+    shanten_all_t all;
+    calculate_shanten_all_from_table(cnt_table, tile_count, form_flag | FORM_FLAG_BASIC_FORM, &all);
+
     enum_result_t result;
     result.discard_tile = discard_tile;
-    result.form_flag = FORM_FLAG_BASIC_FORM;
-    result.shanten = basic_form_shanten(hand_tiles->standing_tiles, hand_tiles->tile_count, &result.useful_table);
-    if (result.shanten == 0 && result.useful_table[discard_tile]) {  // 0上听，并且打出的牌是有效牌，则修正为和了
-        result.shanten = -1;
-    }
-    if (!enum_callback(context, &result)) {
-        return false;
-    }
-
-    // 立牌有13张时，才需要计算特殊和型
-    if (hand_tiles->tile_count == 13) {
-        if (form_flag | FORM_FLAG_SEVEN_PAIRS) {
-            result.form_flag = FORM_FLAG_SEVEN_PAIRS;
-            result.shanten = seven_pairs_shanten(hand_tiles->standing_tiles, hand_tiles->tile_count, &result.useful_table);
-            if (result.shanten == 0 && result.useful_table[discard_tile]) {  // 0上听，并且打出的牌是有效牌，则修正为和了
-                result.shanten = -1;
-            }
-            if (!enum_callback(context, &result)) {
-                return false;
-            }
-        }
-
-        if (form_flag | FORM_FLAG_THIRTEEN_ORPHANS) {
-            result.form_flag = FORM_FLAG_THIRTEEN_ORPHANS;
-            result.shanten = thirteen_orphans_shanten(hand_tiles->standing_tiles, hand_tiles->tile_count, &result.useful_table);
-            if (result.shanten == 0 && result.useful_table[discard_tile]) {  // 0上听，并且打出的牌是有效牌，则修正为和了
-                result.shanten = -1;
-            }
-            if (!enum_callback(context, &result)) {
-                return false;
-            }
+    for (int i = 0; i < 5; ++i) {
+        if (all.shanten[i] == std::numeric_limits<int>::max() && i != 0) {  // 未计算的和型
+            continue;
         }
-
-        if (form_flag | FORM_FLAG_HONORS_AND_KNITTED_TILES) {
-            result.form_flag = FORM_FLAG_HONORS_AND_KNITTED_TILES;
-            result.shanten = honors_and_knitted_tiles_shanten(hand_tiles->standing_tiles, hand_tiles->tile_count, &result.useful_table);
-            if (result.shanten == 0 && result.useful_table[discard_tile]) {  // 0上听，并且打出的牌是有效牌，则修正为和了
-                result.shanten = -1;
-            }
-            if (!enum_callback(context, &result)) {
-                return false;
-            }
+        result.form_flag = static_cast<uint8_t>(1 << i);
+        result.shanten = all.shanten[i];
+        memcpy(result.useful_table, all.useful_table[i], sizeof(result.useful_table));
+        if (result.shanten == 0 && result.useful_table[discard_tile]) {  // 0上听，并且打出的牌是有效牌，则修正为和了
+            result.shanten = -1;
         }
-    }
-
-    // 立牌有13张或者10张时，才需要计算组合龙
-    if (hand_tiles->tile_count == 13 || hand_tiles->tile_count == 10) {
-        if (form_flag | FORM_FLAG_KNITTED_STRAIGHT) {
-            result.form_flag = FORM_FLAG_KNITTED_STRAIGHT;
-            result.shanten = knitted_straight_shanten(hand_tiles->standing_tiles, hand_tiles->tile_count, &result.useful_table);
-            if (result.shanten == 0 && result.useful_table[discard_tile]) {  // 0上听，并且打出的牌是有效牌，则修正为和了
-                result.shanten = -1;
-            }
-            if (!enum_callback(context, &result)) {
-                return false;
-            }
+        if (!enum_callback(context, &result)) {
+            return false;
         }
     }
 
@@ -6077,8 +9047,12 @@ static bool enum_discard_tile_1(const hand_tiles_t *hand_tiles, tile_t discard_t
 // 枚举打哪张牌
 void enum_discard_tile(const hand_tiles_t *hand_tiles, tile_t serving_tile, uint8_t form_flag,
     void *context, enum_callback_t enum_callback) {
+    // 将立牌打表，之后都在这张表上增减，不再转回立牌
+    tile_table_t cnt_table;
+    map_tiles(hand_tiles->standing_tiles, hand_tiles->tile_count, &cnt_table);
+
     // 先计算摸切的
-    if (!enum_discard_tile_1(hand_tiles, serving_tile, form_flag, context, enum_callback)) {
+    if (!enum_discard_tile_1(cnt_table, hand_tiles->tile_count, serving_tile, form_flag, context, enum_callback)) {
         return;
     }
 
@@ -6086,14 +9060,6 @@ void enum_discard_tile(const hand_tiles_t *hand_tiles, tile_t serving_tile, uint
         return;
     }
 
-    // 将立牌打表
-    tile_table_t cnt_table;
-    map_tiles(hand_tiles->standing_tiles, hand_tiles->tile_count, &cnt_table);
-
-    // 复制一份手牌
-    hand_tiles_t temp;
-    memcpy(&temp, hand_tiles, sizeof(temp));
-
     // 依次尝试打手中的立牌
     for (int i = 0; i < 34; ++i) {
         tile_t t = all_tiles[i];
@@ -6101,11 +9067,8 @@ void enum_discard_tile(const hand_tiles_t *hand_tiles, tile_t serving_tile, uint
             --cnt_table[t];  // 打这张牌
             ++cnt_table[serving_tile];  // 上这张牌
 
-            // 从table转成立牌
-            table_to_tiles(cnt_table, temp.standing_tiles, temp.tile_count);
-
             // 计算
-            if (!enum_discard_tile_1(&temp, t, form_flag, context, enum_callback)) {
+            if (!enum_discard_tile_1(cnt_table, hand_tiles->tile_count, t, form_flag, context, enum_callback)) {
                 return;
             }
 
@@ -6230,6 +9193,7 @@ string concat(std::vector<string> hand) {
 }
 
 bool check_hu(string str, win_flag_t win_flag, wind_t prevalent_wind, wind_t seat_wind) {
+    SEARCH_STATS_TIME(check_hu_ns);
     calculate_param_t param;
     string_to_tiles(str.c_str(), &param.hand_tiles, &param.win_tile);
     param.flower_count = 0;
@@ -6238,7 +9202,7 @@ bool check_hu(string str, win_flag_t win_flag, wind_t prevalent_wind, wind_t sea
     param.seat_wind = seat_wind;
     int points;
     try {
-        points = calculate_fan(&param, nullptr);
+        points = calculate_fan_cached(&param);
         if (points >= 8) return true;
         else return false;
     } catch(int e) {
@@ -6329,6 +9293,7 @@ tile_t string_to_tile(string a){
 }
 
 std::vector<string> Chi_Peng_Gang(const char * str, string single_, std::vector<string> vectorform_hand, int cannoteat=0){
+    SEARCH_STATS_TIME(chi_peng_gang_ns);
     tile_t single = string_to_tile(single_);
     string tmp = str;
     int tmp_index = 0;
@@ -6360,6 +9325,7 @@ std::vector<string> Chi_Peng_Gang(const char * str, string single_, std::vector<
         tile_t t = all_tiles[i];
         total_count += Table[t];
     }
+    table_to_dense_table(Table, &Dense_table);  // 下面直接调用basic_form_shanten_recursively
 
     tile_table_t cnt_table;
     map_tiles(hand_tiles.standing_tiles, hand_tiles.tile_count, &cnt_table);
@@ -6552,24 +9518,43 @@ bool is_last_card(string card) {
     else return false;
 }
 
-int main() {
-    int turnID;
+// 把全局状态恢复到进程刚启动时的样子，同一进程中多次调用decide_turn时用
+void reset_turn_state() {
+    request.clear();
+    response.clear();
+    hand.clear();
+    fulu.clear();
+    memset(Table, 0, sizeof(Table));
+    memset(Hand_table, 0, sizeof(Hand_table));
+    memset(Dense_table, 0, sizeof(Dense_table));
+    memset(useful_table, 0, sizeof(useful_table));
+    memset(fixed_packs, 0, sizeof(fixed_packs));
+    pack_count = 0;
+    cur_min = 2146483647;
+    useful = 0;
+    useless = 0;
+    win_flag = 0;
+    prevalent_wind = wind_t::EAST;
+    seat_wind = wind_t::EAST;
+    total_count = 0;
+    clear_fan_cache();
+#ifdef MAHJONG_SEARCH_STATS
+    memset(&search_stats, 0, sizeof(search_stats));
+#endif
+}
+
+// 一回合的决策：requests为到本回合为止的全部请求，responses为之前各回合的输出，返回本回合的输出
+// main()从标准输入读出这两部分后调用它，tools/turn_replay.cpp用它在进程内回放对局
+string decide_turn(const std::vector<string> &requests, const std::vector<string> &responses) {
+    SEARCH_STATS_STACK_BEGIN();
+    int turnID = static_cast<int>(requests.size()) - 1;
     string stmp, op, prevPlayedCard;
     for (int i = 0; i < 34; ++i) {
         tile_t t = all_tiles[i];
         Table[t] = 4;
     }
-    cin >> turnID;
-    turnID--;
-    getline(cin, stmp, '\n');
-    for(int i = 0; i < turnID; i++) {
-        getline(cin, stmp, '\n');
-        request.push_back(stmp);
-        getline(cin, stmp, '\n');
-        response.push_back(stmp);
-    }
-    getline(cin, stmp, '\n');
-    request.push_back(stmp);
+    request = requests;
+    response = responses;
 
     if (turnID < 2) {
         response.push_back("PASS");
@@ -6874,7 +9859,61 @@ int main() {
         response.push_back(sout.str());
     }
 
-    cout << response[turnID] << endl;
+    return response[turnID];
+}
+
+// tools目录下的工具直接包含本文件，定义MAHJONG_NO_MAIN即可去掉Botzone的入口
+#ifndef MAHJONG_NO_MAIN
+int main() {
+    int turnID;
+    string stmp;
+    std::vector<string> requests, responses;
+    cin >> turnID;
+    turnID--;
+    getline(cin, stmp, '\n');
+    for(int i = 0; i < turnID; i++) {
+        getline(cin, stmp, '\n');
+        requests.push_back(stmp);
+        getline(cin, stmp, '\n');
+        responses.push_back(stmp);
+    }
+    getline(cin, stmp, '\n');
+    requests.push_back(stmp);
+
+    cout << decide_turn(requests, responses) << endl;
+
+#ifdef MAHJONG_TRACE
+    // 本地排查时设置MAHJONG_TRACE_FILE，把本回合的追踪写到该文件
+    const char *trace_file = getenv("MAHJONG_TRACE_FILE");
+    if (trace_file != nullptr) {
+        FILE *fp = fopen(trace_file, "w");
+        if (fp != nullptr) {
+            trace_dump(fp);
+            fclose(fp);
+        }
+    }
+#endif
+
+#ifdef MAHJONG_SEARCH_STATS
+    // 简单交互的第二行是debug，在Botzone的对局日志里可以看到
+    fan_cache_stats_t cache_stats;
+    get_fan_cache_stats(&cache_stats);
+    cout << "stats rec=" << search_stats.recursion_nodes << " peak=" << search_stats.peak_paths << "/" << MAX_STATE
+        << " fan=" << search_stats.fan_calls << " leaf=" << search_stats.makeup_leaves << "/" << search_stats.makeup_nodes
+        << " cache=" << cache_stats.hit << "/" << cache_stats.hit + cache_stats.miss + cache_stats.bypass
+        << " hu=" << search_stats.check_hu_ns / 1000 << "us cpg=" << search_stats.chi_peng_gang_ns / 1000
+        << "us policy=" << search_stats.policy_ns / 1000 << "us stack=" << stack_stats_peak_bytes() / 1024
+        << "KB depth=" << stack_stats.peak_depth;
+#ifdef __linux__
+    // 进程的内存峰值，Botzone按它判断是否超出内存限制
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        cout << " rss=" << usage.ru_maxrss << "KB";
+    }
+#endif
+    cout << endl;
+#endif
 
     return 0;
-}
\ No newline at end of file
+}
+#endif
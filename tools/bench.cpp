@@ -0,0 +1,494 @@
+// mahjong.cpp热点函数的微基准测试
+//
+// 编译（在仓库根目录下）：
+//   g++ -O2 -std=c++11 -o bench tools/bench.cpp
+// 运行：
+//   ./bench [--corpus tools/corpus/bench_v1.txt] [--filter 名称子串] [--min-time 毫秒] [--no-counters]
+//
+// 输入为固定的牌例文件，格式见文件头部的注释。牌例文件一经提交就不再修改，需要新牌例时另建v2、v3……
+// 这样不同版本代码的结果可以直接比较。
+//
+// 每个基准输出一行JSON到stdout：
+//   {"bench":名称,"corpus":版本,"ops":调用次数,"ns_per_op":平均耗时,
+//    "p50_ns":..,"p90_ns":..,"p99_ns":..,"max_ns":..,"calls_per_sec":..}
+// 百分位数按样本计算：很快的函数每个样本连续调用同一牌例多次取平均，较慢的函数每次调用是一个样本。
+// Linux上还用perf_event_open读硬件计数器，只统计计时的部分，每行再加上每次调用的平均值：
+//   "cycles":..,"instructions":..,"ipc":..,"l1d_misses":..,"llc_misses":..,"branch_misses":..
+// 某个计数器打不开时该项为null；全都打不开（容器内常见）时在stderr提示一次，输出不带这些项。
+// 搜索统计打开时（默认）还有整个基准中的内存峰值，与耗时一样可用来发现退化：
+//   "peak_stack_bytes":从run_bench起用到的栈,"peak_depth":递归层数,"peak_paths":work_state的路径数,"max_state":MAX_STATE
+// 依赖全局状态的机器人函数（Policy、Chi_Peng_Gang、带番数限制的basic_form_shanten）
+// 每次调用前都按牌例重置全局状态并清空算番缓存，与Botzone上每回合重新启动进程一致，重置不计入耗时。
+
+#define MAHJONG_NO_MAIN
+#include "../mahjong.cpp"
+#include "hand_corpus.h"
+
+#include <chrono>
+#include <fstream>
+#include <functional>
+
+#ifdef __linux__
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+    // 牌例
+    struct bench_case_t {
+        hand_tiles_t hand_tiles;
+        tile_t serving_tile;        // P的上牌、W的和牌
+        tile_t discard_tile;        // C的他家打出的牌
+        int cannoteat;              // C的吃碰杠限制，同Chi_Peng_Gang
+        win_flag_t win_flag;
+        wind_t prevalent_wind;
+        wind_t seat_wind;
+        uint8_t wall[34];           // 剩余牌，顺序同all_tiles
+        string text;                // 原始牌的字符串
+    };
+
+    struct bench_corpus_t {
+        string version;
+        std::vector<bench_case_t> standing;     // S
+        std::vector<bench_case_t> win;          // W
+        std::vector<bench_case_t> policy;       // P
+        std::vector<bench_case_t> claim;        // C
+    };
+
+    bool parse_wall(const string &str, bench_case_t *c) {
+        if (str.length() != 34) {
+            return false;
+        }
+        for (int i = 0; i < 34; ++i) {
+            if (str[i] < '0' || str[i] > '4') {
+                return false;
+            }
+            c->wall[i] = static_cast<uint8_t>(str[i] - '0');
+        }
+        return true;
+    }
+
+    // 读取牌例文件，版本号取自第一行注释的最后一个词
+    bool load_corpus(const char *path, bench_corpus_t *corpus) {
+        std::ifstream in(path);
+        if (!in) {
+            fprintf(stderr, "cannot open corpus %s\n", path);
+            return false;
+        }
+        string line;
+        int line_no = 0;
+        while (std::getline(in, line)) {
+            ++line_no;
+            if (line.empty()) {
+                continue;
+            }
+            if (line[0] == '#') {
+                if (corpus->version.empty()) {
+                    corpus->version = line.substr(line.find_last_of(' ') + 1);
+                }
+                continue;
+            }
+
+            std::istringstream ss(line);
+            string kind, text, wall;
+            ss >> kind >> text;
+            bench_case_t c;
+            memset(&c.hand_tiles, 0, sizeof(c.hand_tiles));
+            c.serving_tile = 0;
+            c.discard_tile = 0;
+            c.cannoteat = 0;
+            c.win_flag = WIN_FLAG_SELF_DRAWN;
+            c.prevalent_wind = wind_t::EAST;
+            c.seat_wind = wind_t::EAST;
+            memset(c.wall, 0, sizeof(c.wall));
+            c.text = text;
+            bool ok = string_to_tiles(text.c_str(), &c.hand_tiles, &c.serving_tile) == 0;
+
+            int flag = 0, prevalent = 0, seat = 0;
+            if (ok && kind == "S") {
+                ok = c.serving_tile == 0;
+                corpus->standing.push_back(c);
+            }
+            else if (ok && kind == "W") {
+                ok = (ss >> flag >> prevalent >> seat) && c.serving_tile != 0;
+                c.win_flag = static_cast<win_flag_t>(flag);
+                c.prevalent_wind = static_cast<wind_t>(prevalent);
+                c.seat_wind = static_cast<wind_t>(seat);
+                corpus->win.push_back(c);
+            }
+            else if (ok && kind == "P") {
+                ok = (ss >> prevalent >> seat >> wall) && c.serving_tile != 0 && parse_wall(wall, &c);
+                c.prevalent_wind = static_cast<wind_t>(prevalent);
+                c.seat_wind = static_cast<wind_t>(seat);
+                corpus->policy.push_back(c);
+            }
+            else if (ok && kind == "C") {
+                string tile;
+                ok = (ss >> tile >> c.cannoteat >> prevalent >> seat >> wall) && c.serving_tile == 0 && parse_wall(wall, &c);
+                c.discard_tile = ok ? string_to_tile(tile) : 0;
+                c.prevalent_wind = static_cast<wind_t>(prevalent);
+                c.seat_wind = static_cast<wind_t>(seat);
+                corpus->claim.push_back(c);
+            }
+            else {
+                ok = false;
+            }
+            if (!ok) {
+                fprintf(stderr, "%s:%d: bad corpus line\n", path, line_no);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // 按牌例重置机器人的全局状态
+    void reset_bot_state(const bench_case_t &c) {
+        ::reset_bot_state(c.hand_tiles, c.wall, c.prevalent_wind, c.seat_wind);
+    }
+
+    // 硬件计数器，顺序同输出
+    enum {
+        COUNTER_CYCLES, COUNTER_INSTRUCTIONS, COUNTER_L1D_MISSES, COUNTER_LLC_MISSES, COUNTER_BRANCH_MISSES, COUNTER_COUNT
+    };
+
+    const char *const counter_names[COUNTER_COUNT] = {
+        "cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses"
+    };
+
+    // 一组计数器，以cycles为组长，一起开关，只计用户态
+    // 组长打不开时整组不可用；其他计数器打不开时只缺那一项
+    struct perf_counters_t {
+        int leader_fd;
+        int fds[COUNTER_COUNT];
+        int slots[COUNTER_COUNT];   // 在组读取结果中的位置，-1为没有
+        int slot_count;
+
+        perf_counters_t() : leader_fd(-1), slot_count(0) {
+            for (int i = 0; i < COUNTER_COUNT; ++i) {
+                fds[i] = -1;
+                slots[i] = -1;
+            }
+        }
+
+#ifdef __linux__
+        ~perf_counters_t() {
+            for (int i = 0; i < COUNTER_COUNT; ++i) {
+                if (fds[i] != -1) {
+                    close(fds[i]);
+                }
+            }
+        }
+
+        static int open_counter(uint32_t type, uint64_t config, int group_fd) {
+            perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = type;
+            attr.config = config;
+            attr.disabled = group_fd == -1 ? 1 : 0;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            return static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0));
+        }
+
+        // 打开失败时返回errno
+        int open() {
+            static const uint32_t types[COUNTER_COUNT] = {
+                PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE
+            };
+            static const uint64_t configs[COUNTER_COUNT] = {
+                PERF_COUNT_HW_CPU_CYCLES,
+                PERF_COUNT_HW_INSTRUCTIONS,
+                PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+                PERF_COUNT_HW_CACHE_MISSES,
+                PERF_COUNT_HW_BRANCH_MISSES
+            };
+            for (int i = 0; i < COUNTER_COUNT; ++i) {
+                fds[i] = open_counter(types[i], configs[i], leader_fd);
+                if (fds[i] == -1) {
+                    if (i == 0) {
+                        return errno;
+                    }
+                    continue;
+                }
+                if (i == 0) {
+                    leader_fd = fds[0];
+                }
+                slots[i] = slot_count++;
+            }
+            return 0;
+        }
+
+        void reset() {
+            ioctl(leader_fd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        }
+
+        void enable() {
+            ioctl(leader_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        }
+
+        void disable() {
+            ioctl(leader_fd, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+        }
+
+        // 读取各计数器的值，被内核轮换调度时按运行时间比例放大；没有的项为-1
+        bool read_values(double *values) const {
+            uint64_t buf[3 + COUNTER_COUNT];
+            ssize_t size = ::read(leader_fd, buf, sizeof(buf));
+            if (size < static_cast<ssize_t>((3 + slot_count) * sizeof(uint64_t)) || buf[2] == 0) {
+                return false;
+            }
+            double scale = static_cast<double>(buf[1]) / static_cast<double>(buf[2]);
+            for (int i = 0; i < COUNTER_COUNT; ++i) {
+                values[i] = slots[i] == -1 ? -1.0 : static_cast<double>(buf[3 + slots[i]]) * scale;
+            }
+            return true;
+        }
+#else
+        int open() { return ENOSYS; }
+        void reset() { }
+        void enable() { }
+        void disable() { }
+        bool read_values(double *) const { return false; }
+#endif
+    };
+
+    volatile intptr_t bench_sink;  // 防止结果被优化掉
+
+    struct bench_options_t {
+        const char *filter;
+        double min_time_ms;
+        string version;
+        perf_counters_t *counters;  // 不可用时为nullptr
+    };
+
+    typedef std::function<intptr_t (size_t)> bench_op_t;
+    typedef std::function<void (size_t)> bench_prepare_t;
+
+    double elapsed_ns(std::chrono::steady_clock::time_point begin, std::chrono::steady_clock::time_point end) {
+        return static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count());
+    }
+
+    // 运行一个基准：依次调用各牌例，直到总耗时超过min_time_ms且每个牌例至少调用一次
+    // 有prepare时每次调用前都要重置，每个样本只调用1次
+    void run_bench(const bench_options_t &options, const char *name, size_t case_cnt, const bench_op_t &op,
+        const bench_prepare_t &prepare = bench_prepare_t()) {
+        if (case_cnt == 0 || (options.filter != nullptr && strstr(name, options.filter) == nullptr)) {
+            return;
+        }
+
+#ifdef MAHJONG_SEARCH_STATS
+        SEARCH_STATS_STACK_BEGIN();
+        search_stats.peak_paths = 0;
+#endif
+
+        // 先试跑一遍，估计每次调用的耗时，确定每个样本的调用次数
+        intptr_t sink = 0;
+        int reps = 1;
+        if (!prepare) {
+            std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < case_cnt; ++i) {
+                sink += op(i);
+            }
+            double ns = elapsed_ns(begin, std::chrono::steady_clock::now()) / static_cast<double>(case_cnt);
+            reps = std::max(1, std::min(1000, static_cast<int>(2000.0 / std::max(ns, 1.0))));
+        }
+
+        std::vector<double> samples;
+        double total_ns = 0;
+        intptr_t ops = 0;
+        perf_counters_t *counters = options.counters;
+        if (counters != nullptr) {
+            counters->reset();
+        }
+        for (size_t i = 0; total_ns < options.min_time_ms * 1e6 || i < case_cnt; ++i) {
+            size_t idx = i % case_cnt;
+            if (prepare) {
+                prepare(idx);
+            }
+            // 计数器只在计时的部分打开，不含重置
+            if (counters != nullptr) {
+                counters->enable();
+            }
+            std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+            for (int r = 0; r < reps; ++r) {
+                sink += op(idx);
+            }
+            std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+            if (counters != nullptr) {
+                counters->disable();
+            }
+            double ns = elapsed_ns(begin, end);
+            total_ns += ns;
+            ops += reps;
+            samples.push_back(ns / reps);
+        }
+        bench_sink = sink;
+
+        std::sort(samples.begin(), samples.end());
+        double ns_per_op = total_ns / static_cast<double>(ops);
+        printf("{\"bench\":\"%s\",\"corpus\":\"%s\",\"ops\":%ld,\"ns_per_op\":%.1f,"
+            "\"p50_ns\":%.1f,\"p90_ns\":%.1f,\"p99_ns\":%.1f,\"max_ns\":%.1f,\"calls_per_sec\":%.1f",
+            name, options.version.c_str(), static_cast<long>(ops), ns_per_op,
+            sorted_percentile(samples, 0.5), sorted_percentile(samples, 0.9), sorted_percentile(samples, 0.99), samples.back(), 1e9 / ns_per_op);
+        double values[COUNTER_COUNT];
+        if (counters != nullptr && counters->read_values(values)) {
+            for (int k = 0; k < COUNTER_COUNT; ++k) {
+                if (values[k] < 0) {
+                    printf(",\"%s\":null", counter_names[k]);
+                }
+                else {
+                    printf(",\"%s\":%.1f", counter_names[k], values[k] / static_cast<double>(ops));
+                }
+            }
+            if (values[COUNTER_INSTRUCTIONS] >= 0 && values[COUNTER_CYCLES] > 0) {
+                printf(",\"ipc\":%.2f", values[COUNTER_INSTRUCTIONS] / values[COUNTER_CYCLES]);
+            }
+            else {
+                printf(",\"ipc\":null");
+            }
+        }
+#ifdef MAHJONG_SEARCH_STATS
+        printf(",\"peak_stack_bytes\":%lu,\"peak_depth\":%ld,\"peak_paths\":%ld,\"max_state\":%d",
+            static_cast<unsigned long>(stack_stats_peak_bytes()), static_cast<long>(stack_stats.peak_depth),
+            static_cast<long>(search_stats.peak_paths), MAX_STATE);
+#endif
+        printf("}\n");
+        fflush(stdout);
+    }
+
+}
+
+int main(int argc, char **argv) {
+    const char *corpus_path = "tools/corpus/bench_v1.txt";
+    bench_options_t options;
+    options.filter = nullptr;
+    options.min_time_ms = 500;
+    bool use_counters = true;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--corpus") == 0 && i + 1 < argc) {
+            corpus_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            options.filter = argv[++i];
+        }
+        else if (strcmp(argv[i], "--min-time") == 0 && i + 1 < argc) {
+            options.min_time_ms = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--no-counters") == 0) {
+            use_counters = false;
+        }
+        else {
+            fprintf(stderr, "usage: %s [--corpus file] [--filter substring] [--min-time ms] [--no-counters]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    bench_corpus_t corpus;
+    if (!load_corpus(corpus_path, &corpus)) {
+        return 1;
+    }
+    options.version = corpus.version;
+
+    perf_counters_t counters;
+    options.counters = nullptr;
+    if (use_counters) {
+        int err = counters.open();
+        if (err == 0) {
+            options.counters = &counters;
+        }
+        else {
+            fprintf(stderr, "hardware counters unavailable (%s), reporting wall-clock only\n", strerror(err));
+        }
+    }
+    for (size_t i = 0; i < corpus.standing.size(); ++i) {
+        fill_unseen_wall(corpus.standing[i].hand_tiles, corpus.standing[i].wall);
+    }
+
+    // 只有13张立牌的牌例才能计算七对、十三幺、全不靠
+    std::vector<bench_case_t> concealed;
+    for (size_t i = 0; i < corpus.standing.size(); ++i) {
+        if (corpus.standing[i].hand_tiles.tile_count == 13) {
+            concealed.push_back(corpus.standing[i]);
+        }
+    }
+    const std::vector<bench_case_t> &s = corpus.standing;
+    const std::vector<bench_case_t> &c13 = concealed;
+
+    run_bench(options, "basic_form_shanten", s.size(), [&s](size_t i) {
+        return static_cast<intptr_t>(basic_form_shanten(s[i].hand_tiles.standing_tiles, s[i].hand_tiles.tile_count, nullptr));
+    }, [&s](size_t i) { reset_bot_state(s[i]); });
+
+    run_bench(options, "basic_form_shanten_useful", s.size(), [&s](size_t i) {
+        useful_table_t useful_table;
+        return static_cast<intptr_t>(basic_form_shanten(s[i].hand_tiles.standing_tiles, s[i].hand_tiles.tile_count, &useful_table));
+    }, [&s](size_t i) { reset_bot_state(s[i]); });
+
+    run_bench(options, "seven_pairs_shanten", c13.size(), [&c13](size_t i) {
+        useful_table_t useful_table;
+        return static_cast<intptr_t>(seven_pairs_shanten(c13[i].hand_tiles.standing_tiles, 13, &useful_table));
+    });
+
+    run_bench(options, "thirteen_orphans_shanten", c13.size(), [&c13](size_t i) {
+        useful_table_t useful_table;
+        return static_cast<intptr_t>(thirteen_orphans_shanten(c13[i].hand_tiles.standing_tiles, 13, &useful_table));
+    });
+
+    run_bench(options, "honors_and_knitted_tiles_shanten", c13.size(), [&c13](size_t i) {
+        useful_table_t useful_table;
+        return static_cast<intptr_t>(honors_and_knitted_tiles_shanten(c13[i].hand_tiles.standing_tiles, 13, &useful_table));
+    });
+
+    run_bench(options, "knitted_straight_shanten", c13.size(), [&c13](size_t i) {
+        useful_table_t useful_table;
+        return static_cast<intptr_t>(knitted_straight_shanten(c13[i].hand_tiles.standing_tiles, 13, &useful_table));
+    });
+
+    run_bench(options, "special_forms_shanten", c13.size(), [&c13](size_t i) {
+        tile_count_masks_t masks;
+        map_tile_count_masks(c13[i].hand_tiles.standing_tiles, 13, &masks);
+        special_shanten_t result;
+        return static_cast<intptr_t>(special_forms_shanten(masks, &result));
+    });
+
+    run_bench(options, "is_basic_form_wait", s.size(), [&s](size_t i) {
+        useful_table_t waiting_table;
+        return static_cast<intptr_t>(is_basic_form_wait(s[i].hand_tiles.standing_tiles, s[i].hand_tiles.tile_count, &waiting_table));
+    });
+
+    // 和牌的拆分（divide_win_hand）只能通过算番调用
+    const std::vector<bench_case_t> &w = corpus.win;
+    run_bench(options, "calculate_fan", w.size(), [&w](size_t i) {
+        calculate_param_t param;
+        param.hand_tiles = w[i].hand_tiles;
+        param.win_tile = w[i].serving_tile;
+        param.flower_count = 0;
+        param.win_flag = w[i].win_flag;
+        param.prevalent_wind = w[i].prevalent_wind;
+        param.seat_wind = w[i].seat_wind;
+        fan_table_t fan_table;
+        return static_cast<intptr_t>(calculate_fan(&param, &fan_table));
+    });
+
+    const std::vector<bench_case_t> &p = corpus.policy;
+    run_bench(options, "Policy", p.size(), [&p](size_t i) {
+        return static_cast<intptr_t>(Policy(p[i].text.c_str()));
+    }, [&p](size_t i) { reset_bot_state(p[i]); });
+
+    const std::vector<bench_case_t> &c = corpus.claim;
+    run_bench(options, "Chi_Peng_Gang", c.size(), [&c](size_t i) {
+        std::vector<string> vectorform_hand;
+        for (intptr_t k = 0; k < c[i].hand_tiles.tile_count; ++k) {
+            vectorform_hand.push_back(tile_to_string(c[i].hand_tiles.standing_tiles[k]));
+        }
+        std::vector<string> action = Chi_Peng_Gang(c[i].text.c_str(), tile_to_string(c[i].discard_tile), vectorform_hand, c[i].cannoteat);
+        return static_cast<intptr_t>(action.size());
+    }, [&c](size_t i) { reset_bot_state(c[i]); });
+
+    return 0;
+}
@@ -0,0 +1,629 @@
+// 分层随机生成合法手牌，写成二进制牌例文件，格式见hand_corpus.h
+//
+// 编译（在仓库根目录下）：
+//   g++ -O2 -std=c++11 -pthread -o corpus_gen tools/corpus_gen.cpp
+// 运行：
+//   ./corpus_gen [--seed 种子] [--count 条数] [--out 文件] [--threads 线程数] [--walk-steps 步数] [--no-label]
+//
+// 第i条牌例的分层目标由i按混合进制展开得到，依次为：目标和型(4)、上听数-1~6(8)、副露组数0~4(5)、
+// 花色数1~4(4)、场上已见牌的档次0~3(4)，每2560条覆盖一遍全部组合。
+// 特殊和型没有副露，十三幺和全不靠用到全部花色；目标达不到的（比如4组副露时上听数不会超过0）取最接近的值。
+// 每条牌例用种子和序号单独播种，同样的种子和条数无论用几个线程，生成的文件都逐字节相同。
+// 搭出的手牌再随机换牌游走，向目标上听数靠拢，最多--walk-steps步（默认32）。换牌时只重新拆分变动的那一门，
+// 七对、十三幺、全不靠由各张数的位掩码直接算出，不逐张试打。
+// 记录中的上听数是实际算出来的，不是目标值，统计信息输出到stderr，包括各目标上听数达到的比例。
+// 1~2种花色时较大的上听数本来就凑不出，这些分层的比例低是正常的。
+// --no-label不游走也不标注，上听数记为HAND_CORPUS_SHANTEN_UNKNOWN，只需要大量手牌时用，文件与标注时的不同。
+
+#define MAHJONG_NO_MAIN
+#include "../mahjong.cpp"
+#include "hand_corpus.h"
+
+#include <chrono>
+#include <climits>
+#include <thread>
+
+namespace {
+
+    struct gen_options_t {
+        uint64_t seed;
+        uint64_t count;
+        const char *out;
+        int threads;
+        bool label;         // 是否标注上听数，不标注时也不做随机游走
+        int walk_steps;     // 每条牌例随机游走的最多步数
+    };
+
+    // 分层目标
+    struct stratum_t {
+        int form;
+        int shanten;
+        int pack_count;
+        int suit_count;
+        int wall_level;
+    };
+
+    stratum_t index_to_stratum(uint64_t index) {
+        stratum_t s;
+        s.form = static_cast<int>(index % HAND_FORM_COUNT); index /= HAND_FORM_COUNT;
+        s.shanten = static_cast<int>(index % 8) - 1; index /= 8;
+        s.pack_count = static_cast<int>(index % 5); index /= 5;
+        s.suit_count = static_cast<int>(index % 4) + 1; index /= 4;
+        s.wall_level = static_cast<int>(index % 4);
+        if (s.form != HAND_FORM_BASIC) {
+            s.pack_count = 0;
+        }
+        if (s.form == HAND_FORM_THIRTEEN_ORPHANS || s.form == HAND_FORM_HONORS_AND_KNITTED) {
+            s.suit_count = 4;
+        }
+        return s;
+    }
+
+    // 14张的七对、十三幺、全不靠上听数：打出多余的那张后与13张的算法相同，凑齐时为-1
+    int special_forms_shanten_14(const tile_count_masks_t &masks) {
+        const uint64_t present = masks.at_least[0];
+        const int pair_cnt = popcount64(masks.at_least[1]) + popcount64(masks.at_least[3]);
+        const bool has_pair = (masks.at_least[1] & standard_thirteen_orphans_mask) != 0;
+        const int orphan_cnt = popcount64(present & standard_thirteen_orphans_mask);
+        if (pair_cnt == 7 || (has_pair && orphan_cnt == 13)) {
+            return -1;
+        }
+        int ret = std::min(6 - pair_cnt, (has_pair ? 12 : 13) - orphan_cnt);
+        for (int i = 0; i < 6; ++i) {
+            const int n = popcount64(present & (standard_knitted_straight_mask[i] | standard_honors_mask));
+            if (n == 14) {
+                return -1;
+            }
+            ret = std::min(ret, 13 - n);
+        }
+        return ret;
+    }
+
+    // 生成一条牌例时的工作区
+    struct builder_t {
+        splitmix64_t rng;
+        tile_t allowed[34];         // 可用的牌
+        int allowed_cnt;
+        uint64_t allowed_mask;      // 可用的牌的位掩码，位定义同tile_count_masks_t
+        bool chow_allowed;          // 可用的花色中有数牌
+        int used[TILE_TABLE_SIZE];  // 手牌和副露已用的张数
+        tile_t tiles[14];           // 立牌连同上牌
+        int tile_cnt;
+
+        // 随机游走时增量标注：立牌各组的张数、拆分结果和各张数的位掩码，换1张牌只重新拆分变动的组
+        int group_cnt[4][9];
+        partition_table_t group_table[4];
+        bool group_dirty[4];
+        tile_count_masks_t masks;
+
+        tile_t random_allowed() {
+            return allowed[rng.below(allowed_cnt)];
+        }
+
+        bool add(tile_t t, int n = 1) {
+            if (used[t] + n > 4 || tile_cnt + n > 14) {
+                return false;
+            }
+            used[t] += n;
+            for (int i = 0; i < n; ++i) {
+                tiles[tile_cnt++] = t;
+            }
+            return true;
+        }
+
+        // 随机选一张能作顺子起点的牌
+        tile_t random_chow_start() {
+            tile_t t;
+            do {
+                t = random_allowed();
+            } while (!is_numbered_suit_quick(t) || tile_get_rank(t) > 7);
+            return t;
+        }
+
+        // 尽量加入指定的结构，加不进去的就算了，之后的随机游走会修正
+        void add_meld() {
+            if (chow_allowed && rng.below(2) == 0) {
+                tile_t t = random_chow_start();
+                if (used[t] < 4 && used[t + 1] < 4 && used[t + 2] < 4) {
+                    add(t); add(static_cast<tile_t>(t + 1)); add(static_cast<tile_t>(t + 2));
+                    return;
+                }
+            }
+            add(random_allowed(), 3);
+        }
+
+        void add_taatsu() {
+            if (chow_allowed && rng.below(3) != 0) {
+                tile_t t = random_chow_start();
+                tile_t t2 = static_cast<tile_t>(t + 1 + rng.below(2));
+                if (used[t] < 4 && used[t2] < 4) {
+                    add(t); add(t2);
+                    return;
+                }
+            }
+            add(random_allowed(), 2);
+        }
+
+        // 由tiles建立标注状态
+        void begin_label() {
+            memset(group_cnt, 0, sizeof(group_cnt));
+            memset(&masks, 0, sizeof(masks));
+            for (int i = 0; i < tile_cnt; ++i) {
+                label_add(tiles[i]);
+            }
+            std::fill(std::begin(group_dirty), std::end(group_dirty), true);
+        }
+
+        void label_add(tile_t t) {
+            int &n = group_cnt[tile_get_suit(t) - 1][tile_get_rank(t) - 1];
+            masks.at_least[n++] |= 1ULL << (t - TILE_1m);
+            group_dirty[tile_get_suit(t) - 1] = true;
+        }
+
+        void label_remove(tile_t t) {
+            int &n = group_cnt[tile_get_suit(t) - 1][tile_get_rank(t) - 1];
+            masks.at_least[--n] &= ~(1ULL << (t - TILE_1m));
+            group_dirty[tile_get_suit(t) - 1] = true;
+        }
+
+        // 换掉第i张牌，张数表used不动
+        void replace_tile(int i, tile_t t) {
+            label_remove(tiles[i]);
+            tiles[i] = t;
+            label_add(t);
+        }
+
+        // 连同上牌的上听数，各和型取最小，-1为已和牌
+        int shanten() {
+            for (int g = 0; g < 4; ++g) {
+                if (group_dirty[g]) {
+                    partition_tiles_cached(group_cnt[g], g, group_table[g]);
+                    group_dirty[g] = false;
+                }
+            }
+            partition_table_t table;
+            merge_partition(group_table[0], group_table[1], table);
+            merge_partition(table, group_table[2], table);
+            merge_partition(table, group_table[3], table);
+            int ret = partition_shanten(table, tile_cnt / 3);
+            if (tile_cnt != 14 || ret == -1) {
+                return ret;
+            }
+            return std::min(ret, special_forms_shanten_14(masks));
+        }
+
+        // 随机游走要升上听数时换进的牌：与立牌都不相同也不相邻，几次找不到就随便选一张
+        tile_t random_isolated() {
+            tile_t t = random_allowed();
+            for (int retry = 0; retry < 4; ++retry) {
+                const int *cnt = group_cnt[tile_get_suit(t) - 1];
+                int r = tile_get_rank(t) - 1;
+                bool near = cnt[r] > 0;
+                if (is_numbered_suit_quick(t)) {
+                    for (int d = std::max(r - 2, 0); d <= std::min(r + 2, 8) && !near; ++d) {
+                        near = cnt[d] > 0;
+                    }
+                }
+                if (!near) {
+                    break;
+                }
+                t = random_allowed();
+            }
+            return t;
+        }
+
+        // 随机游走要降上听数时换进的牌：与某张立牌相同或相邻，不可用时随便选一张
+        tile_t random_near() {
+            tile_t t = tiles[rng.below(tile_cnt)];
+            if (is_numbered_suit_quick(t)) {
+                int r = tile_get_rank(t) + rng.below(5) - 2;
+                if (r >= 1 && r <= 9) {
+                    t = make_tile(tile_get_suit(t), static_cast<rank_t>(r));
+                }
+            }
+            return (allowed_mask & (1ULL << (t - TILE_1m))) ? t : random_allowed();
+        }
+
+        // 与已有的牌都不相邻的孤张，找不到就随便加一张
+        void add_isolated() {
+            for (int retry = 0; retry < 16; ++retry) {
+                tile_t t = random_allowed();
+                bool near = false;
+                for (int i = 0; i < tile_cnt && !near; ++i) {
+                    int d = tiles[i] > t ? tiles[i] - t : t - tiles[i];
+                    near = is_numbered_suit_quick(t) ? d <= 2 : d == 0;
+                }
+                if (!near && add(t)) {
+                    return;
+                }
+            }
+            for (int retry = 0; retry < 64 && !add(random_allowed()); ++retry) {
+            }
+        }
+    };
+
+    // 选定可用的花色
+    void choose_suits(builder_t *b, int suit_count) {
+        int suits[4] = { 1, 2, 3, 4 };
+        for (int i = 3; i > 0; --i) {
+            std::swap(suits[i], suits[b->rng.below(i + 1)]);
+        }
+        b->allowed_cnt = 0;
+        b->chow_allowed = false;
+        for (int i = 0; i < suit_count; ++i) {  // all_tiles中同花色的牌是连续的
+            int len = suits[i] == TILE_SUIT_HONORS ? 7 : 9;
+            memcpy(b->allowed + b->allowed_cnt, all_tiles + (suits[i] - 1) * 9, len);
+            b->allowed_cnt += len;
+            b->chow_allowed |= suits[i] != TILE_SUIT_HONORS;
+        }
+        b->allowed_mask = 0;
+        for (int i = 0; i < b->allowed_cnt; ++i) {
+            b->allowed_mask |= 1ULL << (b->allowed[i] - TILE_1m);
+        }
+    }
+
+    // 特殊和型只用限定的一些牌，其中的牌在allowed中重新排列
+    void choose_special_tiles(builder_t *b, int form) {
+        b->allowed_cnt = 0;
+        if (form == HAND_FORM_THIRTEEN_ORPHANS) {
+            memcpy(b->allowed, standard_thirteen_orphans, sizeof(standard_thirteen_orphans));
+            b->allowed_cnt = 13;
+        }
+        else {
+            memcpy(b->allowed, standard_knitted_straight[b->rng.below(6)], 9);
+            for (int i = 0; i < 7; ++i) {
+                b->allowed[9 + i] = static_cast<tile_t>(TILE_E + i);
+            }
+            b->allowed_cnt = 16;
+        }
+        for (int i = b->allowed_cnt - 1; i > 0; --i) {
+            std::swap(b->allowed[i], b->allowed[b->rng.below(i + 1)]);
+        }
+    }
+
+    // 随机副露
+    void build_fixed_packs(builder_t *b, int pack_count, hand_tiles_t *hand_tiles) {
+        hand_tiles->pack_count = 0;
+        for (int i = 0; i < pack_count; ++i) {
+            for (int retry = 0; retry < 64; ++retry) {
+                int kind = b->rng.below(b->chow_allowed ? 3 : 2);
+                uint8_t offer = static_cast<uint8_t>(1 + b->rng.below(3));
+                if (kind == 2) {
+                    tile_t t = b->random_chow_start();
+                    if (b->used[t] < 4 && b->used[t + 1] < 4 && b->used[t + 2] < 4) {
+                        ++b->used[t]; ++b->used[t + 1]; ++b->used[t + 2];
+                        hand_tiles->fixed_packs[hand_tiles->pack_count++] = make_pack(offer, PACK_TYPE_CHOW, static_cast<tile_t>(t + 1));
+                        break;
+                    }
+                }
+                else {
+                    tile_t t = b->random_allowed();
+                    int n = kind == 1 ? 4 : 3;
+                    if (b->used[t] == 0) {
+                        b->used[t] = n;
+                        if (kind == 1 && b->rng.below(4) == 0) {
+                            offer = 0;  // 暗杠
+                        }
+                        hand_tiles->fixed_packs[hand_tiles->pack_count++] = make_pack(offer, kind == 1 ? PACK_TYPE_KONG : PACK_TYPE_PUNG, t);
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    // 基本和型：副露n组时，m组面子、t个搭子、q个雀头的上听数为2(4-n)-2m-t-q，凑一组接近目标的组合
+    void build_basic(builder_t *b, int target, int pack_count) {
+        int need = 4 - pack_count;
+        int total = 14 - pack_count * 3;
+        int best_m = 0, best_t = 0, best_q = 0, best_diff = INT_MAX;
+        for (int retry = 0; retry < 16 && best_diff != 0; ++retry) {
+            int m = b->rng.below(need + 1);
+            int t = b->rng.below(need - m + 1);
+            int q = b->rng.below(2);
+            if (m * 3 + t * 2 + q * 2 > total) {
+                continue;
+            }
+            int diff = std::abs(2 * need - 2 * m - t - q - target);
+            if (diff < best_diff) {
+                best_diff = diff;
+                best_m = m; best_t = t; best_q = q;
+            }
+        }
+        for (int i = 0; i < best_m; ++i) {
+            b->add_meld();
+        }
+        if (best_q) {
+            for (int retry = 0; retry < 64 && !b->add(b->random_allowed(), 2); ++retry) {
+            }
+        }
+        for (int i = 0; i < best_t; ++i) {
+            b->add_taatsu();
+        }
+        while (b->tile_cnt < total) {
+            b->add_isolated();
+        }
+    }
+
+    // 特殊和型：七对为6-s对，十三幺为12-s种幺九加一对，全不靠为13-s种组合龙和字牌，其余为不相干的牌
+    void build_special(builder_t *b, int form, int target) {
+        int k;
+        if (form == HAND_FORM_SEVEN_PAIRS) {
+            for (int i = b->allowed_cnt - 1; i > 0; --i) {
+                std::swap(b->allowed[i], b->allowed[b->rng.below(i + 1)]);
+            }
+            k = 6 - target;
+            for (int i = 0; i < k && i < b->allowed_cnt; ++i) {
+                b->add(b->allowed[i], 2);
+            }
+            for (int i = k; b->tile_cnt < 14 && i < b->allowed_cnt; ++i) {
+                b->add(b->allowed[i]);
+            }
+        }
+        else {
+            choose_special_tiles(b, form);
+            k = form == HAND_FORM_THIRTEEN_ORPHANS ? 12 - target : 13 - target;
+            if (form == HAND_FORM_THIRTEEN_ORPHANS && target == -1) {
+                k = 13;
+            }
+            for (int i = 0; i < k && i < b->allowed_cnt; ++i) {
+                b->add(b->allowed[i]);
+            }
+            if (form == HAND_FORM_THIRTEEN_ORPHANS) {
+                b->add(b->allowed[b->rng.below(std::max(k, 1))]);
+            }
+            // 其余用中张，不会增加特殊和型的进展
+            for (int retry = 0; b->tile_cnt < 14 && retry < 256; ++retry) {
+                tile_t t = make_tile(static_cast<suit_t>(1 + b->rng.below(3)), static_cast<rank_t>(2 + b->rng.below(7)));
+                bool member = std::find(b->allowed, b->allowed + k, t) != b->allowed + k;
+                if (!member) {
+                    b->add(t);
+                }
+            }
+        }
+        for (int retry = 0; b->tile_cnt < 14 && retry < 256; ++retry) {
+            b->add(all_tiles[b->rng.below(34)]);
+        }
+    }
+
+    // 随机换牌，上听数离目标不更远就接受。每步只重新拆分换牌的组，步数可以放宽
+    int random_walk(builder_t *b, int target, int steps) {
+        b->begin_label();
+        int shanten = b->shanten();
+        for (int step = 0; step < steps && shanten != target; ++step) {
+            int i = b->rng.below(b->tile_cnt);
+            tile_t old_tile = b->tiles[i];
+            tile_t new_tile;
+            if (b->rng.below(2) == 0) {
+                new_tile = b->random_allowed();
+            }
+            else {
+                new_tile = shanten < target ? b->random_isolated() : b->random_near();
+            }
+            if (new_tile == old_tile || b->used[new_tile] >= 4) {
+                continue;
+            }
+            b->replace_tile(i, new_tile);
+            int s = b->shanten();
+            if (std::abs(s - target) <= std::abs(shanten - target)) {
+                --b->used[old_tile];
+                ++b->used[new_tile];
+                shanten = s;
+            }
+            else {
+                b->replace_tile(i, old_tile);
+            }
+        }
+        return shanten;
+    }
+
+    // 场上已见的牌从牌墙中随机去掉
+    void build_wall(builder_t *b, int wall_level, hand_record_t *record) {
+        int remain = 0;
+        for (int i = 0; i < 34; ++i) {
+            record->wall[i] = static_cast<uint8_t>(4 - b->used[all_tiles[i]]);
+            remain += record->wall[i];
+        }
+        record->wall_level = wall_level;
+        record->seen_count = wall_level * 25;
+        for (int n = 0; n < record->seen_count; ++n) {
+            int r = b->rng.below(remain--);
+            int i = 0;
+            while (r >= record->wall[i]) {
+                r -= record->wall[i++];
+            }
+            --record->wall[i];
+        }
+    }
+
+    // 生成第index条牌例，返回分层的目标上听数（已按副露组数截断）
+    // 不标注时跳过随机游走，手牌只按目标结构搭出，上听数记为HAND_CORPUS_SHANTEN_UNKNOWN
+    int generate_record(uint64_t seed, uint64_t index, const gen_options_t &opt, hand_record_t *record) {
+        builder_t b;
+        b.rng.state = seed ^ (index * 0xD1B54A32D192ED03ULL);
+        b.rng.next();
+        memset(b.used, 0, sizeof(b.used));
+        b.tile_cnt = 0;
+
+        stratum_t s = index_to_stratum(index);
+        record->form = s.form;
+        memset(&record->hand_tiles, 0, sizeof(record->hand_tiles));
+
+        choose_suits(&b, s.suit_count);
+        build_fixed_packs(&b, s.pack_count, &record->hand_tiles);
+        int pack_count = static_cast<int>(record->hand_tiles.pack_count);
+        int target = std::min(s.shanten, 2 * (4 - pack_count));
+        if (s.form == HAND_FORM_BASIC) {
+            build_basic(&b, target, pack_count);
+        }
+        else {
+            build_special(&b, s.form, target);
+            choose_suits(&b, s.suit_count);
+        }
+        record->shanten = opt.label ? random_walk(&b, target, opt.walk_steps) : HAND_CORPUS_SHANTEN_UNKNOWN;
+
+        // 随机一张作为上牌
+        int serving = b.rng.below(b.tile_cnt);
+        std::swap(b.tiles[serving], b.tiles[b.tile_cnt - 1]);
+        record->serving_tile = b.tiles[b.tile_cnt - 1];
+        tile_table_t cnt_table = { 0 };
+        map_tiles(b.tiles, b.tile_cnt - 1, &cnt_table);
+        record->hand_tiles.tile_count = 0;
+        for (int i = 0; i < 34; ++i) {  // 立牌按顺序排列
+            for (int n = 0; n < cnt_table[all_tiles[i]]; ++n) {
+                record->hand_tiles.standing_tiles[record->hand_tiles.tile_count++] = all_tiles[i];
+            }
+        }
+
+        uint8_t suits = 0;
+        for (int i = 0; i < 34; ++i) {
+            if (b.used[all_tiles[i]] > 0) {
+                suits |= 1 << tile_get_suit(all_tiles[i]);
+            }
+        }
+        record->suit_count = static_cast<int>(popcount64(suits));
+        build_wall(&b, s.wall_level, record);
+        return target;
+    }
+
+    // 各线程的统计，下标为[目标和型][上听数+1]
+    struct gen_stats_t {
+        uint64_t shanten[HAND_FORM_COUNT][8];   // 实际上听数的分布
+        uint64_t target[HAND_FORM_COUNT][8];    // 各目标上听数的条数
+        uint64_t hit[HAND_FORM_COUNT][8];       // 其中达到目标的条数
+    };
+
+    bool parse_options(int argc, char *argv[], gen_options_t *opt) {
+        opt->seed = 1;
+        opt->count = 100000;
+        opt->out = "corpus.bin";
+        opt->threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+        opt->label = true;
+        opt->walk_steps = 32;
+        for (int i = 1; i < argc; ++i) {
+            string arg = argv[i];
+            if (arg == "--no-label") {
+                opt->label = false;
+                continue;
+            }
+            if (i + 1 >= argc) {
+                return false;
+            }
+            if (arg == "--seed") {
+                opt->seed = strtoull(argv[++i], nullptr, 10);
+            }
+            else if (arg == "--count") {
+                opt->count = strtoull(argv[++i], nullptr, 10);
+            }
+            else if (arg == "--out") {
+                opt->out = argv[++i];
+            }
+            else if (arg == "--threads") {
+                opt->threads = std::max(1, atoi(argv[++i]));
+            }
+            else if (arg == "--walk-steps") {
+                opt->walk_steps = std::max(0, atoi(argv[++i]));
+            }
+            else {
+                return false;
+            }
+        }
+        return true;
+    }
+
+}
+
+#define CORPUS_BLOCK_SIZE 4096
+
+int main(int argc, char *argv[]) {
+    gen_options_t opt;
+    if (!parse_options(argc, argv, &opt)) {
+        fprintf(stderr, "usage: %s [--seed N] [--count N] [--out FILE] [--threads N] [--walk-steps N] [--no-label]\n", argv[0]);
+        return 1;
+    }
+    FILE *fp = fopen(opt.out, "wb");
+    if (fp == nullptr || !write_hand_corpus_header(fp, opt.count, opt.seed)) {
+        fprintf(stderr, "cannot write %s\n", opt.out);
+        return 1;
+    }
+
+    // 每轮每个线程生成一块，按顺序写出
+    std::vector<std::vector<uint8_t> > blocks(opt.threads, std::vector<uint8_t>(CORPUS_BLOCK_SIZE * HAND_CORPUS_RECORD_SIZE));
+    std::vector<gen_stats_t> stats(opt.threads);
+    memset(&stats[0], 0, sizeof(gen_stats_t) * stats.size());
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    for (uint64_t round_begin = 0; round_begin < opt.count; round_begin += static_cast<uint64_t>(opt.threads) * CORPUS_BLOCK_SIZE) {
+        std::vector<std::thread> workers;
+        for (int k = 0; k < opt.threads; ++k) {
+            workers.push_back(std::thread([&opt, &blocks, &stats, round_begin, k]() {
+                uint64_t first = round_begin + static_cast<uint64_t>(k) * CORPUS_BLOCK_SIZE;
+                for (uint64_t i = first; i < first + CORPUS_BLOCK_SIZE && i < opt.count; ++i) {
+                    hand_record_t record;
+                    int target = generate_record(opt.seed, i, opt, &record);
+                    encode_hand_record(record, &blocks[k][(i - first) * HAND_CORPUS_RECORD_SIZE]);
+                    ++stats[k].target[record.form][target + 1];
+                    if (opt.label) {
+                        ++stats[k].shanten[record.form][record.shanten + 1];
+                        stats[k].hit[record.form][target + 1] += record.shanten == target;
+                    }
+                }
+            }));
+        }
+        for (int k = 0; k < opt.threads; ++k) {
+            workers[k].join();
+            uint64_t first = round_begin + static_cast<uint64_t>(k) * CORPUS_BLOCK_SIZE;
+            if (first < opt.count) {
+                size_t n = static_cast<size_t>(std::min<uint64_t>(CORPUS_BLOCK_SIZE, opt.count - first));
+                if (fwrite(&blocks[k][0], HAND_CORPUS_RECORD_SIZE, n, fp) != n) {
+                    fprintf(stderr, "cannot write %s\n", opt.out);
+                    fclose(fp);
+                    return 1;
+                }
+            }
+        }
+    }
+    fclose(fp);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    fprintf(stderr, "%llu hands, %d threads, %.3f s, %.0f hands/s\n", static_cast<unsigned long long>(opt.count),
+        opt.threads, seconds, static_cast<double>(opt.count) / std::max(seconds, 1e-9));
+    if (!opt.label) {
+        return 0;
+    }
+
+    // 各行为目标和型，上表为实际上听数的分布，下表为各目标上听数达到的比例
+    static const char *form_names[HAND_FORM_COUNT] = { "basic", "seven_pairs", "thirteen_orphans", "honors_and_knitted" };
+    gen_stats_t total;
+    memset(&total, 0, sizeof(total));
+    for (int k = 0; k < opt.threads; ++k) {
+        for (int f = 0; f < HAND_FORM_COUNT; ++f) {
+            for (int s = 0; s < 8; ++s) {
+                total.shanten[f][s] += stats[k].shanten[f][s];
+                total.target[f][s] += stats[k].target[f][s];
+                total.hit[f][s] += stats[k].hit[f][s];
+            }
+        }
+    }
+    fprintf(stderr, "%-20s %8s %8s %8s %8s %8s %8s %8s %8s\n", "target\\shanten", "-1", "0", "1", "2", "3", "4", "5", "6");
+    for (int f = 0; f < HAND_FORM_COUNT; ++f) {
+        fprintf(stderr, "%-20s", form_names[f]);
+        for (int s = 0; s < 8; ++s) {
+            fprintf(stderr, " %8llu", static_cast<unsigned long long>(total.shanten[f][s]));
+        }
+        fprintf(stderr, "\n");
+    }
+    fprintf(stderr, "%-20s %8s %8s %8s %8s %8s %8s %8s %8s\n", "hit%", "-1", "0", "1", "2", "3", "4", "5", "6");
+    for (int f = 0; f < HAND_FORM_COUNT; ++f) {
+        fprintf(stderr, "%-20s", form_names[f]);
+        for (int s = 0; s < 8; ++s) {
+            if (total.target[f][s] == 0) {
+                fprintf(stderr, " %8s", "-");
+            }
+            else {
+                fprintf(stderr, " %8.1f", 100.0 * static_cast<double>(total.hit[f][s]) / static_cast<double>(total.target[f][s]));
+            }
+        }
+        fprintf(stderr, "\n");
+    }
+    return 0;
+}
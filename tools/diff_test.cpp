@@ -0,0 +1,1165 @@
+// 查表/位运算实现与递归参考实现的差分测试
+//
+// 编译（在仓库根目录下）：
+//   g++ -O2 -std=c++11 -pthread -o diff_test tools/diff_test.cpp
+// 运行：
+//   ./diff_test [--threads 线程数] [--random 条数] [--seed 种子] [--corpus 牌例文件] [--no-exhaustive]
+//               [--bench 基准牌例文件] [--no-bench] [--out 文件]
+//   ./diff_test --repro 文件     重新运行一个复现用例
+//
+// 输入有三种来源，合在一起按序号分给各线程：
+//   1. 穷举：一门数牌（每种0~4张，共不超过14张）以及字牌的所有张数模式，数牌轮流放在万条饼中。
+//      3n+1张的模式中有4张的牌，再各加上第5张检查win，与wait列出的第5张听牌张对照
+//   2. 随机：按种子生成的14张手牌，一半是随机拼成的和牌，和牌时随机把部分面子作为副露
+//   3. 牌例文件：corpus_gen生成的二进制牌例，格式见hand_corpus.h
+// 每条输入按张数做以下对比，参考实现都写在本文件中，只用最朴素的递归，不依赖mahjong.cpp的表：
+//   win       3n+2张：is_basic_form_win（两种重载）与divide_win_hand、参考递归
+//   divide    3n+2张和牌：divide_win_hand的所有划分与参考递归枚举出的划分
+//   wait      3n+1张：is_basic_form_wait（两种重载）的听牌张与逐张加牌后的参考递归
+//   shanten   3n+1、3n+2张：basic_form_shanten_ignoring_fan、basic_form_discard_shanten与参考递归
+//   special   13张：special_forms_shanten与seven_pairs_shanten等三个函数
+//   fan       和牌：calculate_fan_cached（未命中与命中各一次）与calculate_fan
+//   distance  13-3n张：fan_distance与逐张摸牌、换牌后calculate_fan的参考，参考只能确认2张以内的距离，
+//             比这远时只要求fan_distance搜完时不报2张以内。每个要算上万次番，所以只抽取随机和牌例输入的一部分
+// 机器人的basic_form_shanten带番数限制并依赖全局状态，没有对应的快速实现，不在此列；
+// 但它的路径查重只是剪枝，不应改变结果，所以单线程把基准牌例文件（默认tools/corpus/bench_v1.txt）
+// 中的S牌例逐个与关掉查重的搜索对照，上听数和有效牌都要相同。
+// 差分之前先跑一遍回归用例，即以前出过错的固定输入，机器人的函数也在其中，再做上面的对照，有不通过的就不再做差分。
+// 发现第一个不一致就停止，把用例缩小（去掉3张牌、把牌换成更小的牌，不一致仍在才接受）后写入复现文件。
+
+#define MAHJONG_NO_MAIN
+#include "../mahjong.cpp"
+#include "hand_corpus.h"
+
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <fstream>
+#include <mutex>
+#include <thread>
+
+namespace {
+
+    //-------------------------------- 参考实现 --------------------------------
+    // 牌表为34格，下标同all_tiles，允许有5张（听第5张牌时）
+
+    bool ref_chow_start(int i) {
+        return i < 27 && i % 9 <= 6;
+    }
+
+    // 从第i种牌开始能否全部拆成面子（need_pair时另加1对雀头）
+    bool ref_complete(int (&c)[34], int i, bool need_pair) {
+        while (i < 34 && c[i] == 0) {
+            ++i;
+        }
+        if (i == 34) {
+            return !need_pair;
+        }
+        bool ok = false;
+        if (c[i] >= 3) {
+            c[i] -= 3;
+            ok = ref_complete(c, i, need_pair);
+            c[i] += 3;
+        }
+        if (!ok && need_pair && c[i] >= 2) {
+            c[i] -= 2;
+            ok = ref_complete(c, i, false);
+            c[i] += 2;
+        }
+        if (!ok && ref_chow_start(i) && c[i + 1] > 0 && c[i + 2] > 0) {
+            --c[i], --c[i + 1], --c[i + 2];
+            ok = ref_complete(c, i, need_pair);
+            ++c[i], ++c[i + 1], ++c[i + 2];
+        }
+        return ok;
+    }
+
+    int ref_total(const int (&c)[34]) {
+        int n = 0;
+        for (int i = 0; i < 34; ++i) {
+            n += c[i];
+        }
+        return n;
+    }
+
+    bool ref_win(int (&c)[34]) {
+        return ref_total(c) % 3 == 2 && ref_complete(c, 0, true);
+    }
+
+    // 逐张加牌判断和牌，返回听牌张的位掩码（第i位为all_tiles[i]）
+    uint64_t ref_waits(int (&c)[34]) {
+        uint64_t mask = 0;
+        for (int i = 0; i < 34; ++i) {
+            ++c[i];
+            if (ref_win(c)) {
+                mask |= 1ULL << i;
+            }
+            --c[i];
+        }
+        return mask;
+    }
+
+    // 枚举所有划分：最小的一张牌只能属于刻子、以它开头的顺子或雀头
+    // 同一种划分可能由不同的选法得到（比如6678m的雀头与顺子），由调用者去重
+    void ref_divide(int (&c)[34], int i, bool need_pair, std::vector<pack_t> &packs, std::vector<std::vector<pack_t> > &out) {
+        while (i < 34 && c[i] == 0) {
+            ++i;
+        }
+        if (i == 34) {
+            if (!need_pair) {
+                std::vector<pack_t> d(packs);
+                std::sort(d.begin(), d.end());
+                out.push_back(d);
+            }
+            return;
+        }
+        if (c[i] >= 3) {
+            c[i] -= 3;
+            packs.push_back(make_pack(0, PACK_TYPE_PUNG, all_tiles[i]));
+            ref_divide(c, i, need_pair, packs, out);
+            packs.pop_back();
+            c[i] += 3;
+        }
+        if (need_pair && c[i] >= 2) {
+            c[i] -= 2;
+            packs.push_back(make_pack(0, PACK_TYPE_PAIR, all_tiles[i]));
+            ref_divide(c, i, false, packs, out);
+            packs.pop_back();
+            c[i] += 2;
+        }
+        if (ref_chow_start(i) && c[i + 1] > 0 && c[i + 2] > 0) {
+            --c[i], --c[i + 1], --c[i + 2];
+            packs.push_back(make_pack(0, PACK_TYPE_CHOW, all_tiles[i + 1]));
+            ref_divide(c, i, need_pair, packs, out);
+            packs.pop_back();
+            ++c[i], ++c[i + 1], ++c[i + 2];
+        }
+    }
+
+    // 上听数：穷举面子、雀头、搭子、孤张的所有拆法，取(need-m)*2-min(t,need-m)-p的最小值
+    void ref_shanten_recursively(int (&c)[34], int i, int need, int m, int t, int p, int &best) {
+        while (i < 34 && c[i] == 0) {
+            ++i;
+        }
+        if (i == 34) {
+            best = std::min(best, (need - m) * 2 - std::min(t, need - m) - p);
+            return;
+        }
+        if (c[i] >= 3) {
+            c[i] -= 3;
+            ref_shanten_recursively(c, i, need, m + 1, t, p, best);
+            c[i] += 3;
+        }
+        if (ref_chow_start(i) && c[i + 1] > 0 && c[i + 2] > 0) {
+            --c[i], --c[i + 1], --c[i + 2];
+            ref_shanten_recursively(c, i, need, m + 1, t, p, best);
+            ++c[i], ++c[i + 1], ++c[i + 2];
+        }
+        if (c[i] >= 2) {
+            c[i] -= 2;
+            if (p == 0) {
+                ref_shanten_recursively(c, i, need, m, t, 1, best);
+            }
+            ref_shanten_recursively(c, i, need, m, t + 1, p, best);
+            c[i] += 2;
+        }
+        for (int d = 1; d <= 2; ++d) {
+            if (i < 27 && i % 9 + d <= 8 && c[i + d] > 0) {
+                --c[i], --c[i + d];
+                ref_shanten_recursively(c, i, need, m, t + 1, p, best);
+                ++c[i], ++c[i + d];
+            }
+        }
+        --c[i];
+        ref_shanten_recursively(c, i, need, m, t, p, best);
+        ++c[i];
+    }
+
+    int ref_shanten(int (&c)[34]) {
+        int best = INT_MAX;
+        ref_shanten_recursively(c, 0, ref_total(c) / 3, 0, 0, 0, best);
+        return best;
+    }
+
+    // 8番和牌距离的参考：再摸1张能和出不少于min_fan的牌，返回这些牌的位掩码
+    uint64_t ref_fan_win_tiles(const fan_distance_param_t &param, const hand_tiles_t &hand_tiles, const tile_table_t &wall_table) {
+        calculate_param_t calculate_param;
+        memset(&calculate_param, 0, sizeof(calculate_param));
+        calculate_param.hand_tiles = hand_tiles;
+        calculate_param.win_flag = param.win_flag;
+        calculate_param.prevalent_wind = param.prevalent_wind;
+        calculate_param.seat_wind = param.seat_wind;
+        uint64_t mask = 0;
+        for (int i = 0; i < 34; ++i) {
+            calculate_param.win_tile = all_tiles[i];
+            if (wall_table[all_tiles[i]] > 0 && calculate_fan(&calculate_param, nullptr) >= param.min_fan) {
+                mask |= 1ULL << i;
+            }
+        }
+        return mask;
+    }
+
+    // 距离为1：摸1张就和；距离为2：摸1张换掉1张立牌后距离为1。都不是时返回3，表示比2远
+    int ref_fan_distance(const fan_distance_param_t &param, uint64_t *useful) {
+        *useful = ref_fan_win_tiles(param, param.hand_tiles, param.wall_table);
+        if (*useful != 0) {
+            return 1;
+        }
+        const hand_tiles_t &hand_tiles = param.hand_tiles;
+        for (int i = 0; i < 34; ++i) {
+            tile_t t = all_tiles[i];
+            if (param.wall_table[t] == 0) {
+                continue;
+            }
+            tile_table_t wall_table;
+            memcpy(wall_table, param.wall_table, sizeof(wall_table));
+            --wall_table[t];
+            for (intptr_t x = 0; x < hand_tiles.tile_count; ++x) {
+                tile_t discard = hand_tiles.standing_tiles[x];
+                if (discard == t || std::find(hand_tiles.standing_tiles, hand_tiles.standing_tiles + x, discard) != hand_tiles.standing_tiles + x) {
+                    continue;
+                }
+                hand_tiles_t next = hand_tiles;
+                next.standing_tiles[x] = t;
+                if (ref_fan_win_tiles(param, next, wall_table) != 0) {
+                    *useful |= 1ULL << i;
+                    break;
+                }
+            }
+        }
+        return *useful != 0 ? 2 : 3;
+    }
+
+    //-------------------------------- 用例 --------------------------------
+
+    enum check_t { CHECK_WIN, CHECK_DIVIDE, CHECK_WAIT, CHECK_SHANTEN, CHECK_SPECIAL, CHECK_FAN, CHECK_DISTANCE, CHECK_COUNT };
+    const char *check_names[CHECK_COUNT] = { "win", "divide", "wait", "shanten", "special", "fan", "distance" };
+
+    enum result_t { RESULT_PASS, RESULT_FAIL, RESULT_INVALID };
+
+    // 一个用例：立牌连同上牌（3n+1张时没有上牌），算番时还有副露和场况
+    struct diff_case_t {
+        int check;
+        hand_tiles_t hand_tiles;
+        tile_t serving_tile;
+        win_flag_t win_flag;
+        wind_t prevalent_wind;
+        wind_t seat_wind;
+    };
+
+    int case_tiles(const diff_case_t &dc, tile_t *tiles) {
+        int cnt = static_cast<int>(dc.hand_tiles.tile_count);
+        memcpy(tiles, dc.hand_tiles.standing_tiles, cnt);
+        if (dc.serving_tile != 0) {
+            tiles[cnt++] = dc.serving_tile;
+        }
+        return cnt;
+    }
+
+    void case_table(const tile_t *tiles, int cnt, int (&c)[34]) {
+        memset(c, 0, sizeof(c));
+        for (int i = 0; i < cnt; ++i) {
+            ++c[tile_index(tiles[i])];
+        }
+    }
+
+    string mask_string(uint64_t mask) {
+        tile_t tiles[34];
+        int cnt = 0;
+        for (int i = 0; i < 34; ++i) {
+            if (mask & (1ULL << i)) {
+                tiles[cnt++] = all_tiles[i];
+            }
+        }
+        char buf[64] = "-";
+        if (cnt > 0) {
+            tiles_to_string(tiles, cnt, buf, sizeof(buf));
+        }
+        return buf;
+    }
+
+    string division_string(const std::vector<std::vector<pack_t> > &divisions) {
+        std::ostringstream ss;
+        for (size_t i = 0; i < divisions.size(); ++i) {
+            ss << (i ? " |" : "");
+            for (size_t k = 0; k < divisions[i].size(); ++k) {
+                ss << " " << std::hex << divisions[i][k] << std::dec;
+            }
+        }
+        return ss.str();
+    }
+
+    result_t run_check(const diff_case_t &dc, string *detail) {
+        tile_t tiles[14];
+        const int cnt = case_tiles(dc, tiles);
+        int c[34];
+        case_table(tiles, cnt, c);
+        for (int i = 0; i < 34; ++i) {
+            // 只有和牌检查允许上牌是第5张
+            if (c[i] > 4 && (dc.check != CHECK_WIN || c[i] > 5 || tiles[cnt - 1] != all_tiles[i])) {
+                return RESULT_INVALID;
+            }
+        }
+        packed_hand_t packed;
+        map_tiles(tiles, cnt, &packed);
+        std::ostringstream ss;
+
+        switch (dc.check) {
+        case CHECK_WIN: {
+            if (cnt % 3 != 2) {
+                return RESULT_INVALID;
+            }
+            bool ref = ref_win(c);
+            bool fast = is_basic_form_win(tiles, cnt - 1, tiles[cnt - 1]);
+            bool fast_packed = is_basic_form_win(packed);
+            pack_t dummy_packs[4] = { 0 };
+            division_result_t result;
+            bool divided = divide_win_hand(tiles, dummy_packs, (14 - cnt) / 3, &result) && result.count > 0;
+            ss << "ref " << ref << " is_basic_form_win " << fast << " packed " << fast_packed << " divide_win_hand " << divided;
+            *detail = ss.str();
+            return ref == fast && ref == fast_packed && ref == divided ? RESULT_PASS : RESULT_FAIL;
+        }
+        case CHECK_DIVIDE: {
+            if (cnt % 3 != 2) {
+                return RESULT_INVALID;
+            }
+            std::vector<std::vector<pack_t> > ref, fast;
+            std::vector<pack_t> packs;
+            ref_divide(c, 0, true, packs, ref);
+            if (ref.empty()) {
+                return RESULT_INVALID;
+            }
+            const intptr_t fixed_cnt = (14 - cnt) / 3;
+            pack_t dummy_packs[4] = { 0 };
+            division_result_t result;
+            divide_win_hand(tiles, dummy_packs, fixed_cnt, &result);
+            for (intptr_t i = 0; i < result.count; ++i) {
+                std::vector<pack_t> d(&result.divisions[i].packs[fixed_cnt], &result.divisions[i].packs[5]);
+                std::sort(d.begin(), d.end());
+                fast.push_back(d);
+            }
+            std::sort(ref.begin(), ref.end());
+            ref.erase(std::unique(ref.begin(), ref.end()), ref.end());
+            std::sort(fast.begin(), fast.end());
+            ss << "ref" << division_string(ref) << "\ndivide_win_hand" << division_string(fast);
+            *detail = ss.str();
+            return ref == fast ? RESULT_PASS : RESULT_FAIL;
+        }
+        case CHECK_WAIT: {
+            if (cnt % 3 != 1) {
+                return RESULT_INVALID;
+            }
+            uint64_t ref = ref_waits(c);
+            useful_table_t table, table_packed;
+            bool fast = is_basic_form_wait(tiles, cnt, &table);
+            bool fast_packed = is_basic_form_wait(packed, &table_packed);
+            ss << "ref " << mask_string(ref) << " is_basic_form_wait " << fast << " " << mask_string(useful_table_to_dense(table))
+                << " packed " << fast_packed << " " << mask_string(useful_table_to_dense(table_packed));
+            *detail = ss.str();
+            return fast == (ref != 0) && fast_packed == (ref != 0) && useful_table_to_dense(table) == ref && useful_table_to_dense(table_packed) == ref
+                ? RESULT_PASS : RESULT_FAIL;
+        }
+        case CHECK_SHANTEN: {
+            if (cnt % 3 == 0) {
+                return RESULT_INVALID;
+            }
+            int ref = ref_shanten(c);
+            int fast = basic_form_shanten_ignoring_fan(packed);
+            ss << "ref " << ref << " basic_form_shanten_ignoring_fan " << fast;
+            bool ok = ref == fast;
+            if (cnt % 3 == 2) {
+                basic_form_discard_t discard;
+                int discard_shanten = basic_form_discard_shanten(packed, &discard);
+                int combined = is_basic_form_win(packed) ? -1 : discard_shanten;
+                ss << " basic_form_discard_shanten " << discard_shanten;
+                ok = ok && ref == combined;
+            }
+            *detail = ss.str();
+            return ok ? RESULT_PASS : RESULT_FAIL;
+        }
+        case CHECK_SPECIAL: {
+            if (cnt != 13) {
+                return RESULT_INVALID;
+            }
+            useful_table_t useful[3];
+            int ref[3] = {
+                seven_pairs_shanten(tiles, cnt, &useful[0]),
+                thirteen_orphans_shanten(tiles, cnt, &useful[1]),
+                honors_and_knitted_tiles_shanten(tiles, cnt, &useful[2])
+            };
+            tile_count_masks_t masks;
+            map_tile_count_masks(tiles, cnt, &masks);
+            special_shanten_t fast;
+            special_forms_shanten(masks, &fast);
+            bool ok = true;
+            for (int f = 0; f < 3; ++f) {
+                // 有效牌的位定义不同，统一成all_tiles的顺序
+                uint64_t fast_mask = 0;
+                for (int i = 0; i < 34; ++i) {
+                    if (fast.useful_mask[f] & (1ULL << (all_tiles[i] - TILE_1m))) {
+                        fast_mask |= 1ULL << i;
+                    }
+                }
+                ss << (f ? "\n" : "") << "form " << f << " ref " << ref[f] << " " << mask_string(useful_table_to_dense(useful[f]))
+                    << " special_forms_shanten " << fast.shanten[f] << " " << mask_string(fast_mask);
+                ok = ok && ref[f] == fast.shanten[f] && useful_table_to_dense(useful[f]) == fast_mask;
+            }
+            *detail = ss.str();
+            return ok ? RESULT_PASS : RESULT_FAIL;
+        }
+        case CHECK_FAN: {
+            if (dc.serving_tile == 0 || check_calculator_input(&dc.hand_tiles, dc.serving_tile) != 0) {
+                return RESULT_INVALID;
+            }
+            calculate_param_t param;
+            memset(&param, 0, sizeof(param));
+            param.hand_tiles = dc.hand_tiles;
+            param.win_tile = dc.serving_tile;
+            param.win_flag = dc.win_flag;
+            param.prevalent_wind = dc.prevalent_wind;
+            param.seat_wind = dc.seat_wind;
+            int ref = calculate_fan(&param, nullptr);
+            if (ref == ERROR_NOT_WIN) {
+                return RESULT_INVALID;
+            }
+            clear_fan_cache();
+            int miss = calculate_fan_cached(&param);
+            int hit = calculate_fan_cached(&param);
+            ss << "calculate_fan " << ref << " calculate_fan_cached miss " << miss << " hit " << hit;
+            *detail = ss.str();
+            return ref == miss && ref == hit ? RESULT_PASS : RESULT_FAIL;
+        }
+        case CHECK_DISTANCE: {
+            // 还能摸到的牌为手牌和副露之外的全部
+            fan_distance_param_t param;
+            memset(&param, 0, sizeof(param));
+            param.hand_tiles = dc.hand_tiles;
+            if (!map_hand_tiles(&dc.hand_tiles, &param.wall_table)) {
+                return RESULT_INVALID;
+            }
+            for (int i = 0; i < 34; ++i) {
+                tile_t t = all_tiles[i];
+                if (param.wall_table[t] > 4) {
+                    return RESULT_INVALID;
+                }
+                param.wall_table[t] = static_cast<uint16_t>(4 - param.wall_table[t]);
+            }
+            param.win_flag = dc.win_flag;
+            param.prevalent_wind = dc.prevalent_wind;
+            param.seat_wind = dc.seat_wind;
+            param.min_fan = 8;
+            fan_distance_result_t result;
+            if (!fan_distance(&param, &result)) {
+                return RESULT_INVALID;
+            }
+            uint64_t ref_useful;
+            int ref = ref_fan_distance(param, &ref_useful);
+            ss << "ref " << (ref <= 2 ? std::to_string(ref) : string(">2")) << " " << mask_string(ref_useful)
+                << " fan_distance " << result.distance << " " << mask_string(useful_table_to_dense(result.useful_table))
+                << (result.complete ? "" : " (incomplete)");
+            *detail = ss.str();
+            if (ref <= 2) {
+                return result.distance == ref && useful_table_to_dense(result.useful_table) == ref_useful ? RESULT_PASS : RESULT_FAIL;
+            }
+            return result.complete && result.distance <= 2 ? RESULT_FAIL : RESULT_PASS;
+        }
+        default:
+            return RESULT_INVALID;
+        }
+    }
+
+    //-------------------------------- 输入 --------------------------------
+
+    // 穷举的张数模式，数牌9种、字牌7种，每种0~4张，共不超过14张，张数模3不为0
+    void enumerate_patterns(int len, std::vector<uint32_t> *patterns) {
+        std::vector<uint32_t> all;
+        enumerate_count_patterns(len, &all);
+        for (size_t i = 0; i < all.size(); ++i) {
+            int n = 0;
+            for (uint32_t x = all[i]; x > 0; x /= 5) {
+                n += x % 5;
+            }
+            if (n % 3 != 0) {
+                patterns->push_back(all[i]);
+            }
+        }
+    }
+
+    // 一组牌放入用例，3n+2张时最后一张作为上牌
+    void set_case_tiles(const tile_t *tiles, int cnt, diff_case_t *dc) {
+        memset(&dc->hand_tiles, 0, sizeof(dc->hand_tiles));
+        dc->serving_tile = 0;
+        int standing = cnt % 3 == 2 ? cnt - 1 : cnt;
+        memcpy(dc->hand_tiles.standing_tiles, tiles, standing);
+        dc->hand_tiles.tile_count = standing;
+        dc->hand_tiles.pack_count = (13 - standing) / 3;  // 只用于张数，各项检查不看副露的内容
+        if (standing < cnt) {
+            dc->serving_tile = tiles[standing];
+        }
+        dc->win_flag = WIN_FLAG_DISCARD;
+        dc->prevalent_wind = wind_t::EAST;
+        dc->seat_wind = wind_t::EAST;
+    }
+
+    // 随机生成14张：一半是随机拼成的和牌，和牌时随机把部分面子作为副露
+    void random_hand(splitmix64_t &rng, hand_tiles_t *hand_tiles, tile_t *serving_tile, win_flag_t *win_flag, wind_t *prevalent, wind_t *seat) {
+        int c[34] = { 0 };
+        tile_t tiles[14];
+        int cnt = 0;
+        memset(hand_tiles, 0, sizeof(*hand_tiles));
+        if (rng.below(2) == 0) {
+            int pack_cnt = rng.below(5);
+            for (int k = 0; k < 4; ++k) {
+                for (int retry = 0; retry < 64; ++retry) {
+                    int i = rng.below(34);
+                    bool chow = ref_chow_start(i) && rng.below(2) == 0;
+                    if (chow ? (c[i] < 4 && c[i + 1] < 4 && c[i + 2] < 4) : c[i] <= 1) {
+                        if (k < pack_cnt) {
+                            hand_tiles->fixed_packs[hand_tiles->pack_count++] = make_pack(static_cast<uint8_t>(1 + rng.below(3)),
+                                chow ? PACK_TYPE_CHOW : PACK_TYPE_PUNG, all_tiles[chow ? i + 1 : i]);
+                        }
+                        for (int d = 0; d < 3; ++d) {
+                            int j = chow ? i + d : i;
+                            ++c[j];
+                            if (k >= pack_cnt) {
+                                tiles[cnt++] = all_tiles[j];
+                            }
+                        }
+                        break;
+                    }
+                }
+            }
+            for (int retry = 0; retry < 64; ++retry) {
+                int i = rng.below(34);
+                if (c[i] <= 2) {
+                    c[i] += 2;
+                    tiles[cnt++] = all_tiles[i];
+                    tiles[cnt++] = all_tiles[i];
+                    break;
+                }
+            }
+        }
+        else {
+            while (cnt < 14) {
+                int i = rng.below(34);
+                if (c[i] < 4) {
+                    ++c[i];
+                    tiles[cnt++] = all_tiles[i];
+                }
+            }
+        }
+        for (int i = cnt - 1; i > 0; --i) {
+            std::swap(tiles[i], tiles[rng.below(i + 1)]);
+        }
+        *serving_tile = tiles[cnt - 1];
+        std::sort(tiles, tiles + cnt - 1);
+        memcpy(hand_tiles->standing_tiles, tiles, cnt - 1);
+        hand_tiles->tile_count = cnt - 1;
+        static const win_flag_t flags[] = { WIN_FLAG_DISCARD, WIN_FLAG_SELF_DRAWN, WIN_FLAG_4TH_TILE, WIN_FLAG_ABOUT_KONG,
+            WIN_FLAG_WALL_LAST, WIN_FLAG_SELF_DRAWN | WIN_FLAG_4TH_TILE, WIN_FLAG_SELF_DRAWN | WIN_FLAG_WALL_LAST };
+        *win_flag = flags[rng.below(7)];
+        *prevalent = static_cast<wind_t>(rng.below(4));
+        *seat = static_cast<wind_t>(rng.below(4));
+    }
+
+    // 一手牌（可带副露）的所有检查，distance为是否也检查和牌距离
+    void hand_cases(const hand_tiles_t &hand_tiles, tile_t serving_tile, win_flag_t win_flag, wind_t prevalent, wind_t seat,
+        bool distance, std::vector<diff_case_t> *cases) {
+        diff_case_t dc;
+        tile_t tiles[14];
+        int cnt = static_cast<int>(hand_tiles.tile_count);
+        memcpy(tiles, hand_tiles.standing_tiles, cnt);
+        set_case_tiles(tiles, cnt, &dc);
+        dc.check = CHECK_WAIT;
+        cases->push_back(dc);
+        dc.check = CHECK_SHANTEN;
+        cases->push_back(dc);
+        if (cnt == 13) {
+            dc.check = CHECK_SPECIAL;
+            cases->push_back(dc);
+        }
+
+        tiles[cnt++] = serving_tile;
+        set_case_tiles(tiles, cnt, &dc);
+        for (int check = CHECK_WIN; check <= CHECK_SHANTEN; ++check) {
+            if (check != CHECK_WAIT) {
+                dc.check = check;
+                cases->push_back(dc);
+            }
+        }
+
+        dc.check = CHECK_FAN;
+        dc.hand_tiles = hand_tiles;
+        dc.serving_tile = serving_tile;
+        dc.win_flag = win_flag;
+        dc.prevalent_wind = prevalent;
+        dc.seat_wind = seat;
+        cases->push_back(dc);
+
+        if (distance) {
+            dc.check = CHECK_DISTANCE;
+            dc.serving_tile = 0;
+            cases->push_back(dc);
+        }
+    }
+
+    struct diff_options_t {
+        int threads;
+        uint64_t random_count;
+        uint64_t seed;
+        const char *corpus;
+        bool exhaustive;
+        const char *bench;          // 对照机器人搜索剪枝的基准牌例文件，nullptr为不对照
+        const char *out;
+        const char *repro;
+    };
+
+    // 随机输入和牌例输入每这么多条检查一次和牌距离
+#define DIFF_DISTANCE_INTERVAL 1024
+
+    // 所有输入，按序号取用
+    struct diff_inputs_t {
+        std::vector<uint32_t> suit_patterns;
+        std::vector<uint32_t> honor_patterns;
+        std::vector<hand_record_t> records;
+        uint64_t random_count;
+        uint64_t seed;
+
+        uint64_t size() const {
+            return suit_patterns.size() + honor_patterns.size() + random_count + records.size();
+        }
+
+        void cases(uint64_t index, std::vector<diff_case_t> *out) const {
+            out->clear();
+            if (index < suit_patterns.size() + honor_patterns.size()) {
+                bool honor = index >= suit_patterns.size();
+                uint32_t code = honor ? honor_patterns[index - suit_patterns.size()] : suit_patterns[index];
+                tile_t first = honor ? static_cast<tile_t>(TILE_E) : make_tile(static_cast<suit_t>(1 + index % 3), 1);
+                tile_t tiles[15];
+                int cnt = 0;
+                uint16_t fours = 0;  // 有4张的牌
+                for (int r = 0; code > 0; ++r, code /= 5) {
+                    for (uint32_t n = 0; n < code % 5; ++n) {
+                        tiles[cnt++] = static_cast<tile_t>(first + r);
+                    }
+                    if (code % 5 == 4) {
+                        fours |= static_cast<uint16_t>(1 << r);
+                    }
+                }
+                diff_case_t dc;
+                set_case_tiles(tiles, cnt, &dc);
+                static const int checks[2][3] = { { CHECK_WAIT, CHECK_SHANTEN, -1 }, { CHECK_WIN, CHECK_DIVIDE, CHECK_SHANTEN } };
+                for (int k = 0; k < 3; ++k) {
+                    dc.check = checks[cnt % 3 - 1][k];
+                    if (dc.check >= 0) {
+                        out->push_back(dc);
+                    }
+                }
+                if (cnt % 3 == 1) {
+                    for (int r = 0; r < 9; ++r) {
+                        if (fours & (1 << r)) {
+                            tiles[cnt] = static_cast<tile_t>(first + r);
+                            set_case_tiles(tiles, cnt + 1, &dc);
+                            dc.check = CHECK_WIN;
+                            out->push_back(dc);
+                        }
+                    }
+                }
+                return;
+            }
+            index -= suit_patterns.size() + honor_patterns.size();
+            if (index < random_count) {
+                splitmix64_t rng = { seed ^ (index * 0xD1B54A32D192ED03ULL) };
+                hand_tiles_t hand_tiles;
+                tile_t serving_tile;
+                win_flag_t win_flag;
+                wind_t prevalent, seat;
+                random_hand(rng, &hand_tiles, &serving_tile, &win_flag, &prevalent, &seat);
+                hand_cases(hand_tiles, serving_tile, win_flag, prevalent, seat, index % DIFF_DISTANCE_INTERVAL == 0, out);
+                return;
+            }
+            index -= random_count;
+            const hand_record_t &r = records[static_cast<size_t>(index)];
+            hand_cases(r.hand_tiles, r.serving_tile, WIN_FLAG_SELF_DRAWN, wind_t::EAST, wind_t::EAST, index % DIFF_DISTANCE_INTERVAL == 0, out);
+        }
+    };
+
+    bool load_corpus(const char *path, std::vector<hand_record_t> *records) {
+        FILE *fp = fopen(path, "rb");
+        hand_corpus_header_t header;
+        if (fp == nullptr || !read_hand_corpus_header(fp, &header)) {
+            fprintf(stderr, "cannot read corpus %s\n", path);
+            if (fp != nullptr) {
+                fclose(fp);
+            }
+            return false;
+        }
+        uint8_t buf[HAND_CORPUS_RECORD_SIZE];
+        hand_record_t record;
+        while (fread(buf, 1, sizeof(buf), fp) == sizeof(buf)) {
+            if (decode_hand_record(buf, &record)) {
+                records->push_back(record);
+            }
+        }
+        fclose(fp);
+        return true;
+    }
+
+    //-------------------------------- 回归用例 --------------------------------
+
+    // 用pattern填满一段栈，之后调用的函数若读到没有写过的局部变量，结果就会随pattern而变
+    __attribute__((noinline)) void fill_stack(uint8_t pattern) {
+        uint8_t buf[1 << 20];
+        memset(buf, pattern, sizeof(buf));
+        __asm__ __volatile__("" : : "r"(buf) : "memory");
+    }
+
+    struct bot_shanten_t {
+        int shanten;
+        uint64_t useful;
+    };
+
+    // 机器人带番数限制的basic_form_shanten，手牌之外的牌都还能摸到，dedup为是否用路径查重剪枝
+    bot_shanten_t bot_shanten(const hand_tiles_t &hand_tiles, uint8_t pattern, bool dedup) {
+        uint8_t wall[34];
+        fill_unseen_wall(hand_tiles, wall);
+        reset_bot_state(hand_tiles, wall, wind_t::EAST, wind_t::EAST);
+
+        basic_form_branch_dedup = dedup;
+        fill_stack(pattern);
+        useful_table_t useful_table;
+        bot_shanten_t result;
+        result.shanten = basic_form_shanten(hand_tiles.standing_tiles, hand_tiles.tile_count, &useful_table);
+        result.useful = useful_table_to_dense(useful_table);
+        basic_form_branch_dedup = true;
+        return result;
+    }
+
+    bot_shanten_t bot_shanten(const char *str, uint8_t pattern, bool dedup) {
+        hand_tiles_t hand_tiles;
+        tile_t serving_tile;
+        string_to_tiles(str, &hand_tiles, &serving_tile);
+        return bot_shanten(hand_tiles, pattern, dedup);
+    }
+
+    string bot_shanten_string(const bot_shanten_t &r) {
+        return std::to_string(r.shanten) + " " + mask_string(r.useful);
+    }
+
+    // 路径查重曾读到当前深度之后没有写过的格子，结果随栈上的残留数据而变
+    bool regression_path_dedup(string *detail) {
+        bot_shanten_t zero = bot_shanten("111m6889m234789s", 0x00, true);
+        bot_shanten_t ones = bot_shanten("111m6889m234789s", 0xFF, true);
+        *detail = "stack 00: " + bot_shanten_string(zero) + ", stack ff: " + bot_shanten_string(ones);
+        return zero.shanten == ones.shanten && zero.useful == ones.useful;
+    }
+
+    // 路径查重曾在当前路径只是保存过的路径的子集时就剪枝，三暗刻16番的1上听被算成2上听
+    bool regression_path_subset(string *detail) {
+        bot_shanten_t pruned = bot_shanten("333m366999pCCCF", 0x00, true);
+        bot_shanten_t full = bot_shanten("333m366999pCCCF", 0x00, false);
+        *detail = "pruned: " + bot_shanten_string(pruned) + ", unpruned: " + bot_shanten_string(full);
+        return pruned.shanten == 1 && full.shanten == 1 && pruned.useful == full.useful;
+    }
+
+    // Makeup_Hu把搭子12当作以1为中张、缺t-1的顺子时，曾读写剩余牌表下标-1的格子。
+    // 表前放一格非0的守卫，旧实现会把它当成能摸到的牌而凑成
+    bool regression_makeup_edge_chow(string *detail) {
+        struct {
+            uint8_t guard;
+            dense_tile_table_t table;
+        } left;
+        left.guard = 4;
+        memset(left.table, 4, sizeof(left.table));
+        pack_t hand[5] = {
+            make_pack(1, PACK_TYPE_CHOW, TILE_1m),
+            make_pack(0, PACK_TYPE_PUNG, TILE_5p),
+            make_pack(0, PACK_TYPE_PUNG, TILE_7s),
+            make_pack(0, PACK_TYPE_PUNG, TILE_E),
+            make_pack(0, PACK_TYPE_PAIR, TILE_C),
+        };
+        hand_tiles_t hand_tiles;
+        tile_t win_tile = 0;
+        bool made = Makeup_Hu(hand, 5, &hand_tiles, &win_tile, left.table);
+        *detail = made ? "made up a hand from edge chow 12m" : "";
+        return !made;
+    }
+
+    // 叶子全是自己的牌时没有和牌张，Makeup_Hu曾照样凑成，win_tile未赋值，立牌写到第14张
+    bool regression_makeup_no_offer(string *detail) {
+        dense_tile_table_t left;
+        memset(left, 4, sizeof(left));
+        pack_t hand[5] = {
+            make_pack(0, PACK_TYPE_PUNG, TILE_1m),
+            make_pack(0, PACK_TYPE_PUNG, TILE_5p),
+            make_pack(0, PACK_TYPE_PUNG, TILE_7s),
+            make_pack(0, PACK_TYPE_PUNG, TILE_E),
+            make_pack(0, PACK_TYPE_PAIR, TILE_C),
+        };
+        struct {
+            hand_tiles_t hand_tiles;
+            tile_t overflow[4];
+        } out;
+        tile_t win_tile = 0;
+        bool made = Makeup_Hu(hand, 5, &out.hand_tiles, &win_tile, left);
+        *detail = made ? "made up a hand with no tile to win on" : "";
+        return !made;
+    }
+
+    struct regression_case_t {
+        const char *name;
+        bool (*run)(string *detail);
+    };
+
+    const regression_case_t regression_cases[] = {
+        { "path_dedup", &regression_path_dedup },
+        { "path_subset", &regression_path_subset },
+        { "makeup_edge_chow", &regression_makeup_edge_chow },
+        { "makeup_no_offer", &regression_makeup_no_offer },
+    };
+
+    // 跑全部回归用例，返回不通过的个数
+    int run_regression_cases() {
+        int failed = 0;
+        for (size_t i = 0; i < sizeof(regression_cases) / sizeof(regression_cases[0]); ++i) {
+            string detail;
+            if (!regression_cases[i].run(&detail)) {
+                fprintf(stderr, "regression %s FAILED: %s\n", regression_cases[i].name, detail.c_str());
+                ++failed;
+            }
+        }
+        return failed;
+    }
+
+    // 基准牌例文件中的S牌例逐个对照机器人剪枝与不剪枝的搜索，返回不一致的个数，读不到文件时返回-1。
+    // 机器人的函数依赖全局状态，只能单线程跑
+    int run_bot_dedup_check(const char *path, int *checked) {
+        std::ifstream in(path);
+        if (!in) {
+            fprintf(stderr, "cannot open bench corpus %s\n", path);
+            return -1;
+        }
+        int failed = 0;
+        *checked = 0;
+        string line;
+        while (std::getline(in, line)) {
+            std::istringstream ss(line);
+            string kind, text;
+            if (!(ss >> kind >> text) || kind != "S") {
+                continue;
+            }
+            hand_tiles_t hand_tiles;
+            tile_t serving_tile;
+            if (string_to_tiles(text.c_str(), &hand_tiles, &serving_tile) != 0 || serving_tile != 0) {
+                continue;
+            }
+            ++*checked;
+            bot_shanten_t pruned = bot_shanten(hand_tiles, 0x00, true);
+            bot_shanten_t full = bot_shanten(hand_tiles, 0x00, false);
+            if (pruned.shanten != full.shanten || pruned.useful != full.useful) {
+                fprintf(stderr, "bot dedup MISMATCH %s: pruned %s, unpruned %s\n", text.c_str(),
+                    bot_shanten_string(pruned).c_str(), bot_shanten_string(full).c_str());
+                ++failed;
+            }
+        }
+        return failed;
+    }
+
+    //-------------------------------- 缩小与复现 --------------------------------
+
+    bool is_failing(const diff_case_t &dc) {
+        string detail;
+        return run_check(dc, &detail) == RESULT_FAIL;
+    }
+
+    // 贪心缩小：先尽量去掉3张牌，再尽量把牌换成更小的牌，每步都要求不一致仍在
+    // 算番、和牌距离用例的副露和张数是绑定的，只换牌
+    void minimize_case(diff_case_t *dc) {
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            tile_t tiles[14];
+            int cnt = case_tiles(*dc, tiles);
+            if (dc->check != CHECK_FAN && dc->check != CHECK_SPECIAL && dc->check != CHECK_DISTANCE && cnt > 3) {
+                for (int a = 0; a < cnt && !changed; ++a) {
+                    for (int b = a + 1; b < cnt && !changed; ++b) {
+                        for (int d = b + 1; d < cnt && !changed; ++d) {
+                            tile_t rest[14];
+                            int n = 0;
+                            for (int i = 0; i < cnt; ++i) {
+                                if (i != a && i != b && i != d) {
+                                    rest[n++] = tiles[i];
+                                }
+                            }
+                            diff_case_t trial = *dc;
+                            set_case_tiles(rest, n, &trial);
+                            trial.check = dc->check;
+                            if (is_failing(trial)) {
+                                *dc = trial;
+                                changed = true;
+                            }
+                        }
+                    }
+                }
+            }
+            // 换一张牌，或者把同种的牌全部换掉（雀头、刻子只能整体换）
+            for (int whole = 0; whole < 2 && !changed; ++whole) {
+                for (int i = 0; i < cnt && !changed; ++i) {
+                    for (int k = 0; k < tile_index(tiles[i]) && !changed; ++k) {
+                        diff_case_t trial = *dc;
+                        for (int j = 0; j < cnt; ++j) {
+                            if (whole ? tiles[j] != tiles[i] : j != i) {
+                                continue;
+                            }
+                            if (j < trial.hand_tiles.tile_count) {
+                                trial.hand_tiles.standing_tiles[j] = all_tiles[k];
+                            }
+                            else {
+                                trial.serving_tile = all_tiles[k];
+                            }
+                        }
+                        std::sort(trial.hand_tiles.standing_tiles, trial.hand_tiles.standing_tiles + trial.hand_tiles.tile_count);
+                        if (is_failing(trial)) {
+                            *dc = trial;
+                            changed = true;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    string case_text(const diff_case_t &dc) {
+        char buf[64];
+        intptr_t len = hand_tiles_to_string(&dc.hand_tiles, buf, sizeof(buf));
+        if (dc.serving_tile != 0) {
+            tiles_to_string(&dc.serving_tile, 1, buf + len, static_cast<intptr_t>(sizeof(buf)) - len);
+        }
+        return buf;
+    }
+
+    // 复现文件：check、hand、flag三行，其余为注释
+    bool write_repro(const char *path, const diff_case_t &original, const diff_case_t &minimized) {
+        std::ofstream out(path);
+        if (!out) {
+            return false;
+        }
+        string detail;
+        run_check(minimized, &detail);
+        out << "# mahjong.cpp differential test mismatch, replay with: diff_test --repro " << path << "\n";
+        out << "# original input: " << case_text(original) << "\n";
+        out << "check " << check_names[minimized.check] << "\n";
+        out << "hand " << case_text(minimized) << "\n";
+        out << "flag " << static_cast<int>(minimized.win_flag) << " " << static_cast<int>(minimized.prevalent_wind)
+            << " " << static_cast<int>(minimized.seat_wind) << "\n";
+        std::istringstream lines(detail);
+        string line;
+        while (std::getline(lines, line)) {
+            out << "# " << line << "\n";
+        }
+        return true;
+    }
+
+    bool read_repro(const char *path, diff_case_t *dc) {
+        std::ifstream in(path);
+        string line, check, hand;
+        int flag = 0, prevalent = 0, seat = 0;
+        while (std::getline(in, line)) {
+            std::istringstream ss(line);
+            string key;
+            ss >> key;
+            if (key == "check") {
+                ss >> check;
+            }
+            else if (key == "hand") {
+                ss >> hand;
+            }
+            else if (key == "flag") {
+                ss >> flag >> prevalent >> seat;
+            }
+        }
+        dc->check = static_cast<int>(std::find(check_names, check_names + CHECK_COUNT, check) - check_names);
+        dc->win_flag = static_cast<win_flag_t>(flag);
+        dc->prevalent_wind = static_cast<wind_t>(prevalent);
+        dc->seat_wind = static_cast<wind_t>(seat);
+        return dc->check < CHECK_COUNT && string_to_tiles(hand.c_str(), &dc->hand_tiles, &dc->serving_tile) == 0;
+    }
+
+    bool parse_options(int argc, char *argv[], diff_options_t *opt) {
+        opt->threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+        opt->random_count = 1000000;
+        opt->seed = 1;
+        opt->corpus = nullptr;
+        opt->exhaustive = true;
+        opt->bench = "tools/corpus/bench_v1.txt";
+        opt->out = "diff_repro.txt";
+        opt->repro = nullptr;
+        for (int i = 1; i < argc; ++i) {
+            string arg = argv[i];
+            if (arg == "--no-exhaustive") {
+                opt->exhaustive = false;
+                continue;
+            }
+            if (arg == "--no-bench") {
+                opt->bench = nullptr;
+                continue;
+            }
+            if (i + 1 >= argc) {
+                return false;
+            }
+            const char *value = argv[++i];
+            if (arg == "--threads") {
+                opt->threads = std::max(1, atoi(value));
+            }
+            else if (arg == "--random") {
+                opt->random_count = strtoull(value, nullptr, 10);
+            }
+            else if (arg == "--seed") {
+                opt->seed = strtoull(value, nullptr, 10);
+            }
+            else if (arg == "--corpus") {
+                opt->corpus = value;
+            }
+            else if (arg == "--bench") {
+                opt->bench = value;
+            }
+            else if (arg == "--out") {
+                opt->out = value;
+            }
+            else if (arg == "--repro") {
+                opt->repro = value;
+            }
+            else {
+                return false;
+            }
+        }
+        return true;
+    }
+
+}
+
+#define DIFF_CHUNK_SIZE 256
+
+int main(int argc, char *argv[]) {
+    diff_options_t opt;
+    if (!parse_options(argc, argv, &opt)) {
+        fprintf(stderr, "usage: %s [--threads N] [--random N] [--seed N] [--corpus FILE] [--no-exhaustive] [--bench FILE] [--no-bench] [--out FILE] [--repro FILE]\n", argv[0]);
+        return 2;
+    }
+
+    if (opt.repro != nullptr) {
+        diff_case_t dc;
+        if (!read_repro(opt.repro, &dc)) {
+            fprintf(stderr, "cannot read %s\n", opt.repro);
+            return 2;
+        }
+        string detail;
+        result_t result = run_check(dc, &detail);
+        printf("%s %s: %s\n%s\n", check_names[dc.check], case_text(dc).c_str(),
+            result == RESULT_PASS ? "pass" : (result == RESULT_FAIL ? "FAIL" : "invalid"), detail.c_str());
+        return result == RESULT_FAIL ? 1 : 0;
+    }
+
+    int regression_failed = run_regression_cases();
+    fprintf(stderr, "regression cases: %d failed\n", regression_failed);
+    if (regression_failed > 0) {
+        return 1;
+    }
+
+    if (opt.bench != nullptr) {
+        int checked = 0;
+        int dedup_failed = run_bot_dedup_check(opt.bench, &checked);
+        fprintf(stderr, "bot dedup: %d hands, %d failed\n", checked, dedup_failed);
+        if (dedup_failed != 0) {
+            return 1;
+        }
+    }
+
+    diff_inputs_t inputs;
+    if (opt.exhaustive) {
+        enumerate_patterns(9, &inputs.suit_patterns);
+        enumerate_patterns(7, &inputs.honor_patterns);
+    }
+    inputs.random_count = opt.random_count;
+    inputs.seed = opt.seed;
+    if (opt.corpus != nullptr && !load_corpus(opt.corpus, &inputs.records)) {
+        return 2;
+    }
+    const uint64_t total = inputs.size();
+
+    // 各线程按块领取序号，发现不一致后其他线程做完手上的块就停止，只保留序号最小的不一致
+    std::atomic<uint64_t> next_index(0);
+    std::atomic<bool> stop(false);
+    std::mutex fail_mutex;
+    uint64_t fail_index = UINT64_MAX;
+    diff_case_t fail_case;
+    std::vector<std::vector<uint64_t> > counts(opt.threads, std::vector<uint64_t>(CHECK_COUNT * 2));
+
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (int k = 0; k < opt.threads; ++k) {
+        workers.push_back(std::thread([&, k]() {
+            std::vector<diff_case_t> cases;
+            string detail;
+            while (!stop.load()) {
+                uint64_t first = next_index.fetch_add(DIFF_CHUNK_SIZE);
+                if (first >= total) {
+                    break;
+                }
+                for (uint64_t index = first; index < std::min(first + DIFF_CHUNK_SIZE, total); ++index) {
+                    inputs.cases(index, &cases);
+                    for (size_t i = 0; i < cases.size(); ++i) {
+                        result_t result = run_check(cases[i], &detail);
+                        if (result == RESULT_INVALID) {
+                            continue;
+                        }
+                        ++counts[k][cases[i].check * 2 + (result == RESULT_FAIL)];
+                        if (result == RESULT_FAIL) {
+                            std::lock_guard<std::mutex> lock(fail_mutex);
+                            if (index < fail_index) {
+                                fail_index = index;
+                                fail_case = cases[i];
+                            }
+                            stop.store(true);
+                        }
+                    }
+                }
+            }
+        }));
+    }
+    for (int k = 0; k < opt.threads; ++k) {
+        workers[k].join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    fprintf(stderr, "%d threads, %.1f s, inputs: %d suit patterns, %d honor patterns, %llu random, %d corpus\n", opt.threads, seconds,
+        static_cast<int>(inputs.suit_patterns.size()), static_cast<int>(inputs.honor_patterns.size()),
+        static_cast<unsigned long long>(inputs.random_count), static_cast<int>(inputs.records.size()));
+    for (int check = 0; check < CHECK_COUNT; ++check) {
+        uint64_t pass = 0, fail = 0;
+        for (int k = 0; k < opt.threads; ++k) {
+            pass += counts[k][check * 2];
+            fail += counts[k][check * 2 + 1];
+        }
+        fprintf(stderr, "  %-8s %12llu passed %6llu failed\n", check_names[check], static_cast<unsigned long long>(pass),
+            static_cast<unsigned long long>(fail));
+    }
+
+    if (fail_index == UINT64_MAX) {
+        fprintf(stderr, "no mismatch\n");
+        return 0;
+    }
+    diff_case_t minimized = fail_case;
+    minimize_case(&minimized);
+    string detail;
+    run_check(minimized, &detail);
+    fprintf(stderr, "MISMATCH at input %llu, check %s: %s -> %s\n%s\n", static_cast<unsigned long long>(fail_index),
+        check_names[fail_case.check], case_text(fail_case).c_str(), case_text(minimized).c_str(), detail.c_str());
+    if (!write_repro(opt.out, fail_case, minimized)) {
+        fprintf(stderr, "cannot write %s\n", opt.out);
+    }
+    else {
+        fprintf(stderr, "reproduction written to %s\n", opt.out);
+    }
+    return 1;
+}
@@ -0,0 +1,259 @@
+// 手牌二进制牌例文件的格式，由corpus_gen写入，其他工具读取
+// 另外放各工具共用的小函数：随机数、百分位数、张数模式的穷举、机器人全局状态的重置
+// 使用前须先包含mahjong.cpp
+//
+// 文件头32字节，之后是定长的记录，所有多字节整数都是小端序：
+//   0-3   magic "MJHC"
+//   4-7   uint32 版本，目前为1
+//   8-11  uint32 每条记录的字节数，目前为64
+//   12-15 保留
+//   16-23 uint64 记录数
+//   24-31 uint64 生成时的种子
+//
+// 记录64字节：
+//   0     uint8 副露组数
+//   1     uint8 立牌数（不含上牌）
+//   2     uint8 上牌
+//   3     int8 连同上牌的上听数，各和型的最小值，-1为已和牌，未标注时为127
+//   4     uint8 用到的花色数，字牌算1种
+//   5     uint8 生成时的目标和型，HAND_FORM_xxx
+//   6     uint8 场上已见牌的档次
+//   7     uint8 场上已见的牌数
+//   8-15  uint16 x4 副露，即pack_t
+//   16-28 uint8 x13 立牌
+//   29-62 uint8 x34 剩余牌，顺序同all_tiles
+//   63    保留
+
+#ifndef __MAHJONG_TOOLS__HAND_CORPUS_H__
+#define __MAHJONG_TOOLS__HAND_CORPUS_H__
+
+#include <stdio.h>
+#include <algorithm>
+#include <vector>
+
+#define HAND_CORPUS_MAGIC "MJHC"
+#define HAND_CORPUS_VERSION 1
+#define HAND_CORPUS_HEADER_SIZE 32
+#define HAND_CORPUS_RECORD_SIZE 64
+#define HAND_CORPUS_SHANTEN_UNKNOWN 127  ///< 未标注的上听数
+
+#define HAND_FORM_BASIC 0               ///< 基本和型
+#define HAND_FORM_SEVEN_PAIRS 1         ///< 七对
+#define HAND_FORM_THIRTEEN_ORPHANS 2    ///< 十三幺
+#define HAND_FORM_HONORS_AND_KNITTED 3  ///< 全不靠
+#define HAND_FORM_COUNT 4
+
+/**
+ * @brief 一条牌例
+ */
+struct hand_record_t {
+    hand_tiles_t hand_tiles;    ///< 手牌
+    tile_t serving_tile;        ///< 上牌
+    int shanten;                ///< 连同上牌的上听数，未标注时为HAND_CORPUS_SHANTEN_UNKNOWN
+    int suit_count;             ///< 用到的花色数
+    int form;                   ///< 生成时的目标和型
+    int wall_level;             ///< 场上已见牌的档次
+    int seen_count;             ///< 场上已见的牌数
+    uint8_t wall[34];           ///< 剩余牌
+};
+
+/**
+ * @brief 牌例文件头
+ */
+struct hand_corpus_header_t {
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t record_count;
+    uint64_t seed;
+};
+
+static inline void hand_corpus_put_u16(uint8_t *p, uint16_t v) {
+    p[0] = static_cast<uint8_t>(v);
+    p[1] = static_cast<uint8_t>(v >> 8);
+}
+
+static inline uint16_t hand_corpus_get_u16(const uint8_t *p) {
+    return static_cast<uint16_t>(p[0] | (p[1] << 8));
+}
+
+static inline void hand_corpus_put_u32(uint8_t *p, uint32_t v) {
+    for (int i = 0; i < 4; ++i) {
+        p[i] = static_cast<uint8_t>(v >> (i * 8));
+    }
+}
+
+static inline uint32_t hand_corpus_get_u32(const uint8_t *p) {
+    uint32_t v = 0;
+    for (int i = 3; i >= 0; --i) {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+static inline void hand_corpus_put_u64(uint8_t *p, uint64_t v) {
+    for (int i = 0; i < 8; ++i) {
+        p[i] = static_cast<uint8_t>(v >> (i * 8));
+    }
+}
+
+static inline uint64_t hand_corpus_get_u64(const uint8_t *p) {
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; --i) {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+/**
+ * @brief 写文件头
+ */
+static inline bool write_hand_corpus_header(FILE *fp, uint64_t record_count, uint64_t seed) {
+    uint8_t buf[HAND_CORPUS_HEADER_SIZE] = { 0 };
+    memcpy(buf, HAND_CORPUS_MAGIC, 4);
+    hand_corpus_put_u32(buf + 4, HAND_CORPUS_VERSION);
+    hand_corpus_put_u32(buf + 8, HAND_CORPUS_RECORD_SIZE);
+    hand_corpus_put_u64(buf + 16, record_count);
+    hand_corpus_put_u64(buf + 24, seed);
+    return fwrite(buf, 1, sizeof(buf), fp) == sizeof(buf);
+}
+
+/**
+ * @brief 读文件头，格式或版本不对时返回false
+ */
+static inline bool read_hand_corpus_header(FILE *fp, hand_corpus_header_t *header) {
+    uint8_t buf[HAND_CORPUS_HEADER_SIZE];
+    if (fread(buf, 1, sizeof(buf), fp) != sizeof(buf) || memcmp(buf, HAND_CORPUS_MAGIC, 4) != 0) {
+        return false;
+    }
+    header->version = hand_corpus_get_u32(buf + 4);
+    header->record_size = hand_corpus_get_u32(buf + 8);
+    header->record_count = hand_corpus_get_u64(buf + 16);
+    header->seed = hand_corpus_get_u64(buf + 24);
+    return header->version == HAND_CORPUS_VERSION && header->record_size == HAND_CORPUS_RECORD_SIZE;
+}
+
+/**
+ * @brief 记录编码成字节
+ */
+static inline void encode_hand_record(const hand_record_t &record, uint8_t *buf) {
+    memset(buf, 0, HAND_CORPUS_RECORD_SIZE);
+    buf[0] = static_cast<uint8_t>(record.hand_tiles.pack_count);
+    buf[1] = static_cast<uint8_t>(record.hand_tiles.tile_count);
+    buf[2] = record.serving_tile;
+    buf[3] = static_cast<uint8_t>(static_cast<int8_t>(record.shanten));
+    buf[4] = static_cast<uint8_t>(record.suit_count);
+    buf[5] = static_cast<uint8_t>(record.form);
+    buf[6] = static_cast<uint8_t>(record.wall_level);
+    buf[7] = static_cast<uint8_t>(record.seen_count);
+    for (intptr_t i = 0; i < record.hand_tiles.pack_count; ++i) {
+        hand_corpus_put_u16(buf + 8 + i * 2, record.hand_tiles.fixed_packs[i]);
+    }
+    memcpy(buf + 16, record.hand_tiles.standing_tiles, static_cast<size_t>(record.hand_tiles.tile_count));
+    memcpy(buf + 29, record.wall, 34);
+}
+
+/**
+ * @brief 字节解码成记录，张数不合法时返回false
+ */
+static inline bool decode_hand_record(const uint8_t *buf, hand_record_t *record) {
+    memset(&record->hand_tiles, 0, sizeof(record->hand_tiles));
+    record->hand_tiles.pack_count = buf[0];
+    record->hand_tiles.tile_count = buf[1];
+    if (record->hand_tiles.pack_count > 4 || record->hand_tiles.pack_count * 3 + record->hand_tiles.tile_count != 13) {
+        return false;
+    }
+    record->serving_tile = buf[2];
+    record->shanten = static_cast<int8_t>(buf[3]);
+    record->suit_count = buf[4];
+    record->form = buf[5];
+    record->wall_level = buf[6];
+    record->seen_count = buf[7];
+    for (intptr_t i = 0; i < record->hand_tiles.pack_count; ++i) {
+        record->hand_tiles.fixed_packs[i] = hand_corpus_get_u16(buf + 8 + i * 2);
+    }
+    memcpy(record->hand_tiles.standing_tiles, buf + 16, static_cast<size_t>(record->hand_tiles.tile_count));
+    memcpy(record->wall, buf + 29, 34);
+    return true;
+}
+
+/**
+ * @brief splitmix64随机数，用种子直接初始化state，同一种子总是得到同样的序列
+ */
+struct splitmix64_t {
+    uint64_t state;
+
+    uint64_t next() {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+
+    int below(int n) {
+        return static_cast<int>(next() % static_cast<uint64_t>(n));
+    }
+};
+
+/**
+ * @brief 已排序样本的百分位数，p取0~1，取最近的样本不插值
+ */
+static inline double sorted_percentile(const std::vector<double> &sorted, double p) {
+    size_t idx = static_cast<size_t>(p * static_cast<double>(sorted.size() - 1) + 0.5);
+    return sorted[std::min(idx, sorted.size() - 1)];
+}
+
+/**
+ * @brief 一类牌的所有张数模式，len种牌每种0~4张、共不超过14张，以5进制编码，第0种牌为最低位
+ */
+static inline void enumerate_count_patterns(int len, std::vector<uint32_t> *patterns) {
+    int pow5 = 1;
+    for (int i = 0; i < len; ++i) {
+        pow5 *= 5;
+    }
+    for (int code = 0; code < pow5; ++code) {
+        int n = 0;
+        for (int x = code; x > 0; x /= 5) {
+            n += x % 5;
+        }
+        if (n <= 14) {
+            patterns->push_back(static_cast<uint32_t>(code));
+        }
+    }
+}
+
+/**
+ * @brief 没有剩余牌信息时，以除自己的牌以外都未出现作为剩余牌
+ *
+ * @param [in] hand_tiles 手牌，连同副露
+ * @param [out] wall 剩余牌，顺序同all_tiles
+ */
+static inline void fill_unseen_wall(const hand_tiles_t &hand_tiles, uint8_t *wall) {
+    tile_table_t cnt_table;
+    map_hand_tiles(&hand_tiles, &cnt_table);
+    for (int i = 0; i < 34; ++i) {
+        wall[i] = static_cast<uint8_t>(4 - std::min<int>(cnt_table[all_tiles[i]], 4));
+    }
+}
+
+/**
+ * @brief 按手牌、剩余牌和场况重置机器人的全局状态，同main()每回合开始时的状态，并清空算番缓存
+ *
+ * @param [in] hand_tiles 手牌，只用其副露
+ * @param [in] wall 剩余牌，顺序同all_tiles
+ */
+static inline void reset_bot_state(const hand_tiles_t &hand_tiles, const uint8_t *wall, wind_t prevalent, wind_t seat) {
+    for (int i = 0; i < 34; ++i) {
+        Table[all_tiles[i]] = wall[i];
+    }
+    memcpy(fixed_packs, hand_tiles.fixed_packs, sizeof(hand_tiles.fixed_packs));
+    pack_count = hand_tiles.pack_count;
+    prevalent_wind = prevalent;
+    seat_wind = seat;
+    win_flag = WIN_FLAG_SELF_DRAWN;
+    cur_min = 2146483647;
+    useful = 0;
+    useless = 0;
+    clear_fan_cache();
+}
+
+#endif
@@ -0,0 +1,232 @@
+// 一门牌所有张数模式的普查，写成二进制表，作为查表实现的数据来源，同时测试枚举本身的吞吐量
+//
+// 编译（在仓库根目录下）：
+//   g++ -O2 -std=c++11 -pthread -o pattern_census tools/pattern_census.cpp
+// 运行：
+//   ./pattern_census [--threads 线程数] [--out 文件]
+//
+// 张数模式：数牌9种、字牌7种，每种0~4张，共不超过14张，以5进制编码，第r种牌的张数为第r位。
+// 每种模式的结果都由mahjong.cpp现有的函数得到：
+//   完整性   is_basic_form_win：能否全部拆成面子（另加1对别门的雀头后判断），能否拆成面子加1对雀头
+//   划分数   divide_win_hand：可完整拆开时的划分种数，不足14张的用别门的副露补足
+//   听牌     is_basic_form_wait：加哪张牌后能完整拆开（张数模3余1时为面子加雀头，余2时为面子，余0时及14张时没有）
+//   上听贡献 partition_tiles：[有无雀头][面子数]能得到的最多搭子数，与别门合并即可算上听数
+//
+// 文件头32字节，之后先是数牌的全部记录，再是字牌的全部记录，都按编码从小到大排列，整数为小端序：
+//   0-3   magic "MJPC"
+//   4-7   uint32 版本，目前为1
+//   8-11  uint32 每条记录的字节数，目前为24
+//   12-15 uint32 数牌的记录数
+//   16-19 uint32 字牌的记录数
+//   20-31 保留
+// 记录24字节：
+//   0-3   uint32 编码
+//   4     uint8 张数
+//   5     uint8 完整性，第0位为全部是面子，第1位为面子加雀头
+//   6     uint8 可完整拆开时的划分种数
+//   7     保留
+//   8-9   uint16 听牌掩码，第r位为再加1张第r种牌
+//   10-19 int8 x10 上听贡献，[有无雀头][面子数0~4]，-1为无此拆分
+//   20-23 保留
+
+#define MAHJONG_NO_MAIN
+#include "../mahjong.cpp"
+#include "hand_corpus.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#define CENSUS_MAGIC "MJPC"
+#define CENSUS_VERSION 1
+#define CENSUS_HEADER_SIZE 32
+#define CENSUS_RECORD_SIZE 24
+
+namespace {
+
+    struct census_record_t {
+        uint32_t code;
+        uint8_t tile_count;
+        uint8_t complete;
+        uint8_t division_count;
+        uint16_t waits;
+        partition_table_t partition;
+    };
+
+    void encode_record(const census_record_t &record, uint8_t *buf) {
+        memset(buf, 0, CENSUS_RECORD_SIZE);
+        hand_corpus_put_u32(buf, record.code);
+        buf[4] = record.tile_count;
+        buf[5] = record.complete;
+        buf[6] = record.division_count;
+        buf[8] = static_cast<uint8_t>(record.waits);
+        buf[9] = static_cast<uint8_t>(record.waits >> 8);
+        memcpy(buf + 10, record.partition, sizeof(record.partition));
+    }
+
+    // 可完整拆开的牌的划分种数，张数不足14的用别门的刻子作为副露补足
+    int count_divisions(const tile_t *tiles, int cnt) {
+        static const pack_t filler_packs[4] = { 0 };
+        division_result_t result;
+        if (!divide_win_hand(tiles, filler_packs, (14 - cnt) / 3, &result)) {
+            return 0;
+        }
+        return static_cast<int>(result.count);
+    }
+
+    void census_one(int len, uint32_t code, census_record_t *record) {
+        const bool numbered = len == 9;
+        const tile_t first = numbered ? static_cast<tile_t>(TILE_1s) : static_cast<tile_t>(TILE_E);
+        const tile_t other = numbered ? static_cast<tile_t>(TILE_E) : static_cast<tile_t>(TILE_1m);  // 别门的牌，用作补足的雀头
+
+        int cnt[9] = { 0 };
+        tile_t tiles[16];
+        int n = 0;
+        uint32_t x = code;
+        for (int r = 0; r < len; ++r, x /= 5) {
+            cnt[r] = static_cast<int>(x % 5);
+            for (int k = 0; k < cnt[r]; ++k) {
+                tiles[n++] = static_cast<tile_t>(first + r);
+            }
+        }
+
+        memset(record, 0, sizeof(*record));
+        record->code = code;
+        record->tile_count = static_cast<uint8_t>(n);
+        partition_tiles(cnt, len, numbered, record->partition);
+
+        useful_table_t waiting_table;
+        memset(waiting_table, 0, sizeof(waiting_table));
+        if (n % 3 == 2) {
+            if (is_basic_form_win(tiles, n - 1, tiles[n - 1])) {
+                record->complete |= 2;
+                record->division_count = static_cast<uint8_t>(count_divisions(tiles, n));
+            }
+            // 加1对别门的雀头后听牌，就是这门牌加1张能全部拆成面子；14张时再加1张超过一手牌的张数，没有听牌
+            if (n + 2 <= 13) {
+                tiles[n] = other;
+                tiles[n + 1] = other;
+                is_basic_form_wait(tiles, n + 2, &waiting_table);
+            }
+        }
+        else if (n % 3 == 0) {
+            // 另加1对别门的雀头
+            tiles[n] = other;
+            tiles[n + 1] = other;
+            if (is_basic_form_win(tiles, n + 1, other)) {
+                record->complete |= 1;
+                record->division_count = static_cast<uint8_t>(count_divisions(tiles, n + 2));
+            }
+        }
+        else {
+            is_basic_form_wait(tiles, n, &waiting_table);
+        }
+        for (int r = 0; r < len; ++r) {
+            if (waiting_table[first + r]) {
+                record->waits |= static_cast<uint16_t>(1 << r);
+            }
+        }
+    }
+
+    struct census_options_t {
+        int threads;
+        const char *out;
+    };
+
+    bool parse_options(int argc, char *argv[], census_options_t *opt) {
+        opt->threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+        opt->out = "census.bin";
+        for (int i = 1; i + 1 < argc; i += 2) {
+            string arg = argv[i];
+            if (arg == "--threads") {
+                opt->threads = std::max(1, atoi(argv[i + 1]));
+            }
+            else if (arg == "--out") {
+                opt->out = argv[i + 1];
+            }
+            else {
+                return false;
+            }
+        }
+        return argc % 2 == 1;
+    }
+
+}
+
+#define CENSUS_CHUNK_SIZE 1024
+
+int main(int argc, char *argv[]) {
+    census_options_t opt;
+    if (!parse_options(argc, argv, &opt)) {
+        fprintf(stderr, "usage: %s [--threads N] [--out FILE]\n", argv[0]);
+        return 1;
+    }
+
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    std::vector<uint32_t> suit_codes, honor_codes;
+    enumerate_count_patterns(9, &suit_codes);
+    enumerate_count_patterns(7, &honor_codes);
+    const size_t total = suit_codes.size() + honor_codes.size();
+    std::vector<uint8_t> records(total * CENSUS_RECORD_SIZE);
+
+    // 各线程按块领取，结果直接写到对应的位置，输出与线程数无关
+    std::atomic<size_t> next_index(0);
+    std::vector<std::thread> workers;
+    for (int k = 0; k < opt.threads; ++k) {
+        workers.push_back(std::thread([&]() {
+            census_record_t record;
+            for (;;) {
+                size_t first = next_index.fetch_add(CENSUS_CHUNK_SIZE);
+                if (first >= total) {
+                    break;
+                }
+                for (size_t i = first; i < std::min(first + CENSUS_CHUNK_SIZE, total); ++i) {
+                    if (i < suit_codes.size()) {
+                        census_one(9, suit_codes[i], &record);
+                    }
+                    else {
+                        census_one(7, honor_codes[i - suit_codes.size()], &record);
+                    }
+                    encode_record(record, &records[i * CENSUS_RECORD_SIZE]);
+                }
+            }
+        }));
+    }
+    for (int k = 0; k < opt.threads; ++k) {
+        workers[k].join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    FILE *fp = fopen(opt.out, "wb");
+    uint8_t header[CENSUS_HEADER_SIZE] = { 0 };
+    memcpy(header, CENSUS_MAGIC, 4);
+    hand_corpus_put_u32(header + 4, CENSUS_VERSION);
+    hand_corpus_put_u32(header + 8, CENSUS_RECORD_SIZE);
+    hand_corpus_put_u32(header + 12, static_cast<uint32_t>(suit_codes.size()));
+    hand_corpus_put_u32(header + 16, static_cast<uint32_t>(honor_codes.size()));
+    if (fp == nullptr || fwrite(header, 1, sizeof(header), fp) != sizeof(header)
+        || fwrite(&records[0], CENSUS_RECORD_SIZE, total, fp) != total) {
+        fprintf(stderr, "cannot write %s\n", opt.out);
+        if (fp != nullptr) {
+            fclose(fp);
+        }
+        return 1;
+    }
+    fclose(fp);
+
+    // 摘要
+    size_t complete[2] = { 0 }, waiting = 0, max_divisions = 0;
+    for (size_t i = 0; i < total; ++i) {
+        const uint8_t *r = &records[i * CENSUS_RECORD_SIZE];
+        complete[0] += r[5] & 1;
+        complete[1] += (r[5] >> 1) & 1;
+        waiting += (r[8] | r[9]) != 0;
+        max_divisions = std::max<size_t>(max_divisions, r[6]);
+    }
+    fprintf(stderr, "%d suit patterns, %d honor patterns, %d threads, %.3f s, %.0f patterns/s\n",
+        static_cast<int>(suit_codes.size()), static_cast<int>(honor_codes.size()), opt.threads, seconds,
+        static_cast<double>(total) / std::max(seconds, 1e-9));
+    fprintf(stderr, "melds only %d, melds and pair %d, waiting %d, max divisions %d, wrote %s\n", static_cast<int>(complete[0]),
+        static_cast<int>(complete[1]), static_cast<int>(waiting), static_cast<int>(max_divisions), opt.out);
+    return 0;
+}
@@ -0,0 +1,393 @@
+// 用存下的对局记录逐回合回放机器人的决策，统计每回合的耗时，按回合类型和对局阶段给出百分位数
+//
+// 编译（在仓库根目录下）：
+//   g++ -O2 -std=c++11 -o turn_replay tools/turn_replay.cpp
+// 运行：
+//   ./turn_replay [--jobs 进程数] [--top 条数] [--csv 文件] 记录文件...
+// 示例记录为tools/corpus/replay_v2.txt，是本机器人4家自对局8局的记录。记录一经提交就不再修改，决策改变后另录新版本；
+// replay_v1.txt是路径查重修正前录的，现在回放有15回合changed
+//
+// 记录文件中每段是某一家在一局中最后一回合的输入，即Botzone简单交互的格式：
+//   第一行回合数n，之后是n-1组请求、输出各一行，最后是第n回合的请求
+// 段与段直接相连，空行和以#开头的行忽略。前k个请求和前k-1个输出就是第k回合main()读到的输入，所以一段就能回放这一家的每一回合。
+// 每回合在进程内调用decide_turn，之前用reset_turn_state恢复全局状态，与Botzone每回合重新启动进程一致，重置不计入耗时。
+// 回放的输出与记录中的不同时计为changed，记录由同一版本的代码产生时应当为0，不为0时退出码为2。
+//
+// 回合类型按本回合的请求分：
+//   draw     自己摸牌（2 T）
+//   discard  他家打牌（3 p PLAY T）
+//   claim    他家吃、碰后打牌或补杠（3 p CHI/PENG/BUGANG ...）
+//   other    其余（开局、他家摸牌、杠、自己动作的回显），只需回答PASS
+// 对局阶段按到本回合为止全场摸过的牌数分：early不到28张，mid不到56张，late为其余
+// 搜索统计打开时（默认）还给出各回合中用到的栈和work_state路径数的最大值，以及出现在哪一回合
+//
+// 机器人的全局状态不是线程安全的，所以用fork出的子进程并行，各回放一部分段，结束时把结果经管道交给父进程汇总
+
+#define MAHJONG_NO_MAIN
+#include "../mahjong.cpp"
+#include "hand_corpus.h"
+
+#include <chrono>
+#include <fstream>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+    // 某一家一局的记录
+    struct game_log_t {
+        std::vector<string> requests;
+        std::vector<string> responses;  // 比requests少最后一个
+    };
+
+    enum { TURN_DRAW, TURN_DISCARD, TURN_CLAIM, TURN_OTHER, TURN_TYPE_COUNT };
+    enum { PHASE_EARLY, PHASE_MID, PHASE_LATE, PHASE_COUNT };
+
+    const char *const turn_type_names[TURN_TYPE_COUNT] = { "draw", "discard", "claim", "other" };
+    const char *const phase_names[PHASE_COUNT] = { "early", "mid", "late" };
+
+    // 一回合的结果，子进程原样写进管道
+    struct turn_record_t {
+        uint32_t log_index;
+        uint32_t turn;          // 从1开始，同n
+        uint8_t type;
+        uint8_t phase;
+        uint8_t changed;
+        double us;
+        uint32_t stack_bytes;   // 从decide_turn起用到的栈
+        uint32_t peak_paths;    // work_state路径数的峰值
+    };
+
+    bool read_content_line(std::istream &in, string *line) {
+        while (std::getline(in, *line)) {
+            if (!line->empty() && (*line)[line->length() - 1] == '\r') {
+                line->erase(line->length() - 1);
+            }
+            if (!line->empty() && (*line)[0] != '#') {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool load_logs(const char *path, std::vector<game_log_t> *logs) {
+        std::ifstream in(path);
+        if (!in) {
+            fprintf(stderr, "cannot open %s\n", path);
+            return false;
+        }
+        string line;
+        while (read_content_line(in, &line)) {
+            int n = atoi(line.c_str());
+            if (n < 1) {
+                fprintf(stderr, "%s: bad turn count \"%s\"\n", path, line.c_str());
+                return false;
+            }
+            game_log_t log;
+            for (int i = 0; i < n * 2 - 1; ++i) {
+                // 请求和输出逐行交替，中间不会有空行
+                if (!std::getline(in, line)) {
+                    fprintf(stderr, "%s: truncated log\n", path);
+                    return false;
+                }
+                if (!line.empty() && line[line.length() - 1] == '\r') {
+                    line.erase(line.length() - 1);
+                }
+                (i % 2 == 0 ? log.requests : log.responses).push_back(line);
+            }
+            logs->push_back(log);
+        }
+        return true;
+    }
+
+    int classify_turn(const string &request, int my_id) {
+        std::istringstream sin(request);
+        int kind = -1, player = -1;
+        string op;
+        sin >> kind;
+        if (kind == 2) {
+            return TURN_DRAW;
+        }
+        if (kind != 3 || !(sin >> player >> op) || player == my_id) {
+            return TURN_OTHER;
+        }
+        if (op == "PLAY") {
+            return TURN_DISCARD;
+        }
+        if (op == "CHI" || op == "PENG" || op == "BUGANG") {
+            return TURN_CLAIM;
+        }
+        return TURN_OTHER;
+    }
+
+    bool is_draw_request(const string &request) {
+        std::istringstream sin(request);
+        int kind = -1, player = -1;
+        string op;
+        sin >> kind;
+        return kind == 2 || (kind == 3 && (sin >> player >> op) && op == "DRAW");
+    }
+
+    // 回放一段的每一回合
+    void replay_log(const game_log_t &log, uint32_t log_index, std::vector<turn_record_t> *records) {
+        int my_id = -1, itmp;
+        std::istringstream(log.requests[0]) >> itmp >> my_id;
+
+        int draw_count = 0;
+        std::vector<string> requests, responses;
+        for (size_t k = 0; k < log.requests.size(); ++k) {
+            requests.push_back(log.requests[k]);
+            if (k > 0) {
+                responses.push_back(log.responses[k - 1]);
+            }
+            draw_count += is_draw_request(log.requests[k]);
+
+            reset_turn_state();
+            std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+            string output = decide_turn(requests, responses);
+            std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+            turn_record_t record;
+            record.log_index = log_index;
+            record.turn = static_cast<uint32_t>(k + 1);
+            record.type = static_cast<uint8_t>(classify_turn(log.requests[k], my_id));
+            record.phase = static_cast<uint8_t>(draw_count < 28 ? PHASE_EARLY : (draw_count < 56 ? PHASE_MID : PHASE_LATE));
+            record.changed = k < log.responses.size() && output != log.responses[k];
+            record.us = std::chrono::duration<double, std::micro>(end - begin).count();
+#ifdef MAHJONG_SEARCH_STATS
+            record.stack_bytes = static_cast<uint32_t>(stack_stats_peak_bytes());
+            record.peak_paths = static_cast<uint32_t>(search_stats.peak_paths);
+#else
+            record.stack_bytes = 0;
+            record.peak_paths = 0;
+#endif
+            records->push_back(record);
+        }
+    }
+
+    bool write_all(int fd, const void *buf, size_t size) {
+        const char *p = static_cast<const char *>(buf);
+        while (size > 0) {
+            ssize_t n = write(fd, p, size);
+            if (n <= 0) {
+                return false;
+            }
+            p += n;
+            size -= static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    // 每个子进程回放下标模jobs为worker的段
+    bool replay_parallel(const std::vector<game_log_t> &logs, int jobs, std::vector<turn_record_t> *records) {
+        if (jobs == 1) {
+            for (size_t i = 0; i < logs.size(); ++i) {
+                replay_log(logs[i], static_cast<uint32_t>(i), records);
+            }
+            return true;
+        }
+
+        std::vector<int> fds;
+        std::vector<pid_t> pids;
+        for (int worker = 0; worker < jobs; ++worker) {
+            int fd[2];
+            if (pipe(fd) != 0) {
+                perror("pipe");
+                return false;
+            }
+            fflush(stdout);
+            pid_t pid = fork();
+            if (pid < 0) {
+                perror("fork");
+                return false;
+            }
+            if (pid == 0) {
+                close(fd[0]);
+                std::vector<turn_record_t> mine;
+                for (size_t i = static_cast<size_t>(worker); i < logs.size(); i += static_cast<size_t>(jobs)) {
+                    replay_log(logs[i], static_cast<uint32_t>(i), &mine);
+                }
+                // 算完再一起写，父进程逐个读管道时不会拖慢其他子进程
+                bool ok = mine.empty() || write_all(fd[1], &mine[0], mine.size() * sizeof(turn_record_t));
+                close(fd[1]);
+                _exit(ok ? 0 : 1);
+            }
+            close(fd[1]);
+            fds.push_back(fd[0]);
+            pids.push_back(pid);
+        }
+
+        bool ok = true;
+        for (int worker = 0; worker < jobs; ++worker) {
+            turn_record_t record;
+            char *p = reinterpret_cast<char *>(&record);
+            size_t got = 0;
+            ssize_t n;
+            while ((n = read(fds[worker], p + got, sizeof(record) - got)) > 0) {
+                got += static_cast<size_t>(n);
+                if (got == sizeof(record)) {
+                    records->push_back(record);
+                    got = 0;
+                }
+            }
+            close(fds[worker]);
+            int status = 0;
+            if (waitpid(pids[worker], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0 || got != 0) {
+                fprintf(stderr, "worker %d failed\n", worker);
+                ok = false;
+            }
+        }
+        return ok;
+    }
+
+    void print_row(const char *name, std::vector<double> &us) {
+        if (us.empty()) {
+            printf("%-10s %8d\n", name, 0);
+            return;
+        }
+        std::sort(us.begin(), us.end());
+        double sum = 0;
+        for (size_t i = 0; i < us.size(); ++i) {
+            sum += us[i];
+        }
+        printf("%-10s %8d %10.3f %10.3f %10.3f %10.3f %10.3f\n", name, static_cast<int>(us.size()),
+            sum / static_cast<double>(us.size()) / 1000.0, sorted_percentile(us, 0.5) / 1000.0, sorted_percentile(us, 0.9) / 1000.0,
+            sorted_percentile(us, 0.99) / 1000.0, us.back() / 1000.0);
+    }
+
+    struct replay_options_t {
+        int jobs;
+        int top;
+        const char *csv;
+        std::vector<const char *> paths;
+    };
+
+    bool parse_options(int argc, char *argv[], replay_options_t *opt) {
+        opt->jobs = std::max(1, static_cast<int>(sysconf(_SC_NPROCESSORS_ONLN)));
+        opt->top = 10;
+        opt->csv = nullptr;
+        for (int i = 1; i < argc; ++i) {
+            string arg = argv[i];
+            if (arg == "--jobs" && i + 1 < argc) {
+                opt->jobs = std::max(1, atoi(argv[++i]));
+            }
+            else if (arg == "--top" && i + 1 < argc) {
+                opt->top = std::max(0, atoi(argv[++i]));
+            }
+            else if (arg == "--csv" && i + 1 < argc) {
+                opt->csv = argv[++i];
+            }
+            else if (arg.compare(0, 2, "--") == 0) {
+                return false;
+            }
+            else {
+                opt->paths.push_back(argv[i]);
+            }
+        }
+        return !opt->paths.empty();
+    }
+
+}
+
+int main(int argc, char *argv[]) {
+    replay_options_t opt;
+    if (!parse_options(argc, argv, &opt)) {
+        fprintf(stderr, "usage: %s [--jobs N] [--top N] [--csv FILE] LOG...\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<game_log_t> logs;
+    for (size_t i = 0; i < opt.paths.size(); ++i) {
+        if (!load_logs(opt.paths[i], &logs)) {
+            return 1;
+        }
+    }
+    if (logs.empty()) {
+        fprintf(stderr, "no logs\n");
+        return 1;
+    }
+    opt.jobs = std::min(opt.jobs, static_cast<int>(logs.size()));
+
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    std::vector<turn_record_t> records;
+    if (!replay_parallel(logs, opt.jobs, &records)) {
+        return 1;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    // 按段、回合排好，输出与进程数无关
+    std::sort(records.begin(), records.end(), [](const turn_record_t &a, const turn_record_t &b) {
+        return a.log_index != b.log_index ? a.log_index < b.log_index : a.turn < b.turn;
+    });
+
+    std::vector<double> by_type[TURN_TYPE_COUNT], by_phase[PHASE_COUNT], all;
+    int changed = 0;
+    for (size_t i = 0; i < records.size(); ++i) {
+        by_type[records[i].type].push_back(records[i].us);
+        by_phase[records[i].phase].push_back(records[i].us);
+        all.push_back(records[i].us);
+        changed += records[i].changed;
+    }
+
+    printf("%-10s %8s %10s %10s %10s %10s %10s\n", "ms", "turns", "mean", "p50", "p90", "p99", "max");
+    for (int t = 0; t < TURN_TYPE_COUNT; ++t) {
+        print_row(turn_type_names[t], by_type[t]);
+    }
+    // 阶段只统计需要决策的回合，other几乎不耗时，混进来会压低百分位数
+    for (int ph = 0; ph < PHASE_COUNT; ++ph) {
+        std::vector<double> us;
+        for (size_t i = 0; i < records.size(); ++i) {
+            if (records[i].phase == ph && records[i].type != TURN_OTHER) {
+                us.push_back(records[i].us);
+            }
+        }
+        print_row(phase_names[ph], us);
+    }
+    print_row("all", all);
+
+    std::vector<size_t> order(records.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&records](size_t a, size_t b) { return records[a].us > records[b].us; });
+    for (size_t i = 0; i < std::min(order.size(), static_cast<size_t>(opt.top)); ++i) {
+        const turn_record_t &r = records[order[i]];
+        printf("slow %10.3f ms  log %u turn %u %s %s: %s\n", r.us / 1000.0, r.log_index, r.turn, turn_type_names[r.type],
+            phase_names[r.phase], logs[r.log_index].requests[r.turn - 1].c_str());
+    }
+
+#ifdef MAHJONG_SEARCH_STATS
+    size_t max_stack = 0, max_paths = 0;
+    for (size_t i = 1; i < records.size(); ++i) {
+        if (records[i].stack_bytes > records[max_stack].stack_bytes) {
+            max_stack = i;
+        }
+        if (records[i].peak_paths > records[max_paths].peak_paths) {
+            max_paths = i;
+        }
+    }
+    printf("max stack %u KB at log %u turn %u, max paths %u/%d at log %u turn %u\n", records[max_stack].stack_bytes / 1024,
+        records[max_stack].log_index, records[max_stack].turn, records[max_paths].peak_paths, MAX_STATE,
+        records[max_paths].log_index, records[max_paths].turn);
+#endif
+
+    if (opt.csv != nullptr) {
+        FILE *fp = fopen(opt.csv, "w");
+        if (fp == nullptr) {
+            fprintf(stderr, "cannot write %s\n", opt.csv);
+            return 1;
+        }
+        fprintf(fp, "log,turn,type,phase,us,changed,stack_bytes,peak_paths\n");
+        for (size_t i = 0; i < records.size(); ++i) {
+            const turn_record_t &r = records[i];
+            fprintf(fp, "%u,%u,%s,%s,%.3f,%d,%u,%u\n", r.log_index, r.turn, turn_type_names[r.type], phase_names[r.phase], r.us,
+                r.changed, r.stack_bytes, r.peak_paths);
+        }
+        fclose(fp);
+    }
+
+    fprintf(stderr, "%d logs, %d turns, %d jobs, %.3f s, %d changed\n", static_cast<int>(logs.size()),
+        static_cast<int>(records.size()), opt.jobs, seconds, changed);
+    return changed == 0 ? 0 : 2;
+}
@@ -0,0 +1,300 @@
+// 搜索让Policy最慢的手牌，输出成bench可读的牌例文件，用于跟踪尾部延迟
+//
+// 编译（在仓库根目录下）：
+//   g++ -O2 -std=c++11 -o worst_case tools/worst_case.cpp
+// 运行：
+//   ./worst_case [--seed 种子] [--restarts 次数] [--steps 步数] [--keep 条数] [--objective nodes|time] [--out 文件]
+// 跟踪：
+//   ./bench --corpus 文件 --filter Policy
+//
+// 爬山搜索：每次随机生成一手牌和场况，之后每步随机改动一处（换一张立牌、换上牌、在牌墙中挪一张牌），
+// 目标不变小就接受。目标为搜索的节点数（nodes，默认，可重复）或Policy的耗时（time，取3次中最快的）。
+// 节点数为basic_form_shanten_recursively、Makeup_Packs、overloaded_packs_fan的组合以及算番次数之和，
+// 由MAHJONG_SEARCH_STATS打开的统计得到。
+// 所有评估过的手牌（同样的牌只算牌墙最慢的一种）中取最慢的若干条写出，每条前有一行注释记录节点数、耗时和work_state路径数的峰值。
+
+#define MAHJONG_NO_MAIN
+#define MAHJONG_SEARCH_STATS
+#include "../mahjong.cpp"
+#include "hand_corpus.h"
+
+#include <chrono>
+#include <fstream>
+#include <map>
+
+namespace {
+
+    // 一个候选：手牌、上牌、场况
+    struct candidate_t {
+        hand_tiles_t hand_tiles;
+        tile_t serving_tile;
+        wind_t prevalent_wind;
+        wind_t seat_wind;
+        uint8_t wall[34];           // 剩余牌，顺序同all_tiles
+    };
+
+    // 一次评估的结果
+    struct measure_t {
+        uint64_t nodes;
+        double ns;
+        intptr_t peak_paths;
+        double score;
+    };
+
+    // 手牌和副露各种牌的张数
+    void count_own_tiles(const candidate_t &c, int (&own)[34]) {
+        tile_table_t cnt_table;
+        map_hand_tiles(&c.hand_tiles, &cnt_table);
+        ++cnt_table[c.serving_tile];
+        for (int i = 0; i < 34; ++i) {
+            own[i] = cnt_table[all_tiles[i]];
+        }
+    }
+
+    bool is_legal(const candidate_t &c) {
+        int own[34];
+        count_own_tiles(c, own);
+        for (int i = 0; i < 34; ++i) {
+            if (own[i] + c.wall[i] > 4) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    string candidate_text(const candidate_t &c) {
+        char buf[64];
+        intptr_t len = hand_tiles_to_string(&c.hand_tiles, buf, sizeof(buf));
+        tiles_to_string(&c.serving_tile, 1, buf + len, static_cast<intptr_t>(sizeof(buf)) - len);
+        return buf;
+    }
+
+    string wall_text(const candidate_t &c) {
+        string str(34, '0');
+        for (int i = 0; i < 34; ++i) {
+            str[i] = static_cast<char>('0' + c.wall[i]);
+        }
+        return str;
+    }
+
+    // 偏向一两种花色的随机手牌，搭子密集的牌搜索量大
+    void random_candidate(splitmix64_t &rng, candidate_t *c) {
+        memset(&c->hand_tiles, 0, sizeof(c->hand_tiles));
+        int own[34] = { 0 };
+        const suit_t main_suit = static_cast<suit_t>(1 + rng.below(3));
+        const suit_t side_suit = static_cast<suit_t>(1 + rng.below(4));
+        auto random_tile = [&rng, main_suit, side_suit]() {
+            int r = rng.below(8);
+            suit_t suit = r < 5 ? main_suit : (r < 7 ? side_suit : static_cast<suit_t>(1 + rng.below(4)));
+            return suit == TILE_SUIT_HONORS ? static_cast<tile_t>(TILE_E + rng.below(7)) : make_tile(suit, static_cast<rank_t>(1 + rng.below(9)));
+        };
+
+        // 副露只用刻子，0~2组
+        int pack_cnt = rng.below(3);
+        while (c->hand_tiles.pack_count < pack_cnt) {
+            tile_t t = random_tile();
+            int i = tile_index(t);
+            if (own[i] == 0) {
+                own[i] = 3;
+                c->hand_tiles.fixed_packs[c->hand_tiles.pack_count++] = make_pack(static_cast<uint8_t>(1 + rng.below(3)), PACK_TYPE_PUNG, t);
+            }
+        }
+        tile_t tiles[14];
+        int cnt = 0;
+        while (cnt < 14 - pack_cnt * 3) {
+            tile_t t = random_tile();
+            int i = tile_index(t);
+            if (own[i] < 4) {
+                ++own[i];
+                tiles[cnt++] = t;
+            }
+        }
+        c->serving_tile = tiles[cnt - 1];
+        std::sort(tiles, tiles + cnt - 1);
+        memcpy(c->hand_tiles.standing_tiles, tiles, cnt - 1);
+        c->hand_tiles.tile_count = cnt - 1;
+
+        c->prevalent_wind = static_cast<wind_t>(rng.below(4));
+        c->seat_wind = static_cast<wind_t>(rng.below(4));
+        for (int i = 0; i < 34; ++i) {
+            c->wall[i] = static_cast<uint8_t>(rng.below(5 - own[i]));
+        }
+    }
+
+    // 随机改动一处，改动后不合法就换一种改法
+    void mutate(splitmix64_t &rng, const candidate_t &from, candidate_t *to) {
+        for (;;) {
+            *to = from;
+            int kind = rng.below(3);
+            if (kind == 0) {  // 立牌或上牌换成相近的牌
+                int i = rng.below(static_cast<int>(to->hand_tiles.tile_count) + 1);
+                tile_t &t = i < to->hand_tiles.tile_count ? to->hand_tiles.standing_tiles[i] : to->serving_tile;
+                int idx = tile_index(t) + rng.below(5) - 2;
+                if (rng.below(4) == 0) {
+                    idx = rng.below(34);
+                }
+                if (idx < 0 || idx >= 34 || all_tiles[idx] == t) {
+                    continue;
+                }
+                t = all_tiles[idx];
+                std::sort(to->hand_tiles.standing_tiles, to->hand_tiles.standing_tiles + to->hand_tiles.tile_count);
+            }
+            else if (kind == 1) {  // 上牌与一张立牌互换，相当于摸到别的牌
+                int i = rng.below(static_cast<int>(to->hand_tiles.tile_count));
+                std::swap(to->hand_tiles.standing_tiles[i], to->serving_tile);
+                std::sort(to->hand_tiles.standing_tiles, to->hand_tiles.standing_tiles + to->hand_tiles.tile_count);
+            }
+            else {  // 牌墙中一种牌的一张挪到另一种牌
+                int i = rng.below(34), j = rng.below(34);
+                if (to->wall[i] == 0 || i == j) {
+                    continue;
+                }
+                --to->wall[i];
+                ++to->wall[j];
+            }
+            if (is_legal(*to)) {
+                return;
+            }
+        }
+    }
+
+    // 按候选设置机器人的全局状态，并清空搜索统计
+    void reset_bot_state(const candidate_t &c) {
+        ::reset_bot_state(c.hand_tiles, c.wall, c.prevalent_wind, c.seat_wind);
+        memset(&search_stats, 0, sizeof(search_stats));
+    }
+
+    volatile int measure_sink;  // 防止结果被优化掉
+
+    measure_t measure(const candidate_t &c, bool by_time) {
+        const string text = candidate_text(c);
+        measure_t m;
+        m.ns = 1e300;
+        for (int rep = 0; rep < (by_time ? 3 : 1); ++rep) {
+            reset_bot_state(c);
+            std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+            measure_sink = Policy(text.c_str());
+            std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+            m.ns = std::min(m.ns, static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count()));
+        }
+        m.nodes = search_stats.recursion_nodes + search_stats.makeup_nodes + search_stats.overload_subsets + search_stats.fan_calls;
+        m.peak_paths = search_stats.peak_paths;
+        m.score = by_time ? m.ns : static_cast<double>(m.nodes);
+        return m;
+    }
+
+    struct search_options_t {
+        uint64_t seed;
+        int restarts;
+        int steps;
+        size_t keep;
+        bool by_time;
+        const char *out;
+    };
+
+    bool parse_options(int argc, char *argv[], search_options_t *opt) {
+        opt->seed = 1;
+        opt->restarts = 16;
+        opt->steps = 200;
+        opt->keep = 64;
+        opt->by_time = false;
+        opt->out = "worst.txt";
+        for (int i = 1; i + 1 < argc; i += 2) {
+            string arg = argv[i];
+            if (arg == "--seed") {
+                opt->seed = strtoull(argv[i + 1], nullptr, 10);
+            }
+            else if (arg == "--restarts") {
+                opt->restarts = atoi(argv[i + 1]);
+            }
+            else if (arg == "--steps") {
+                opt->steps = atoi(argv[i + 1]);
+            }
+            else if (arg == "--keep") {
+                opt->keep = static_cast<size_t>(std::max(1, atoi(argv[i + 1])));
+            }
+            else if (arg == "--objective") {
+                opt->by_time = strcmp(argv[i + 1], "time") == 0;
+                if (!opt->by_time && strcmp(argv[i + 1], "nodes") != 0) {
+                    return false;
+                }
+            }
+            else if (arg == "--out") {
+                opt->out = argv[i + 1];
+            }
+            else {
+                return false;
+            }
+        }
+        return argc % 2 == 1;
+    }
+
+}
+
+int main(int argc, char *argv[]) {
+    search_options_t opt;
+    if (!parse_options(argc, argv, &opt)) {
+        fprintf(stderr, "usage: %s [--seed N] [--restarts N] [--steps N] [--keep N] [--objective nodes|time] [--out FILE]\n", argv[0]);
+        return 1;
+    }
+
+    // 同样的牌只留牌墙最慢的一种，最后保留最慢的keep条
+    typedef std::pair<candidate_t, measure_t> entry_t;
+    std::map<string, entry_t> slowest;
+    splitmix64_t rng = { opt.seed };
+    uint64_t evaluations = 0;
+    for (int restart = 0; restart < opt.restarts; ++restart) {
+        candidate_t cur, next;
+        random_candidate(rng, &cur);
+        measure_t cur_m = measure(cur, opt.by_time);
+        for (int step = 0; step <= opt.steps; ++step) {
+            ++evaluations;
+            std::map<string, entry_t>::iterator it = slowest.find(candidate_text(cur));
+            if (it == slowest.end()) {
+                slowest.insert(std::make_pair(candidate_text(cur), entry_t(cur, cur_m)));
+            }
+            else if (cur_m.score > it->second.second.score) {
+                it->second = entry_t(cur, cur_m);
+            }
+            if (step == opt.steps) {
+                break;
+            }
+            mutate(rng, cur, &next);
+            measure_t next_m = measure(next, opt.by_time);
+            if (next_m.score >= cur_m.score) {
+                cur = next;
+                cur_m = next_m;
+            }
+        }
+        fprintf(stderr, "restart %d: %llu nodes, %.0f us, %d paths  %s\n", restart, static_cast<unsigned long long>(cur_m.nodes),
+            cur_m.ns / 1000.0, static_cast<int>(cur_m.peak_paths), candidate_text(cur).c_str());
+    }
+
+    std::vector<entry_t> entries;
+    for (std::map<string, entry_t>::const_iterator it = slowest.begin(); it != slowest.end(); ++it) {
+        entries.push_back(it->second);
+    }
+    std::sort(entries.begin(), entries.end(), [](const entry_t &a, const entry_t &b) {
+        return a.second.score > b.second.score;
+    });
+    entries.resize(std::min(entries.size(), opt.keep));
+
+    std::ofstream out(opt.out);
+    if (!out) {
+        fprintf(stderr, "cannot write %s\n", opt.out);
+        return 1;
+    }
+    out << "# mahjong.cpp worst-case Policy corpus, seed " << opt.seed << ", objective " << (opt.by_time ? "time" : "nodes")
+        << ", version worst_v1\n";
+    out << "# P <hand><serving_tile> <prevalent> <seat> <wall>, same as bench_v1\n";
+    for (size_t i = 0; i < entries.size(); ++i) {
+        const candidate_t &c = entries[i].first;
+        const measure_t &m = entries[i].second;
+        out << "# nodes " << m.nodes << " us " << static_cast<int64_t>(m.ns / 1000.0) << " paths " << m.peak_paths << "/" << MAX_STATE << "\n";
+        out << "P " << candidate_text(c) << " " << static_cast<int>(c.prevalent_wind) << " " << static_cast<int>(c.seat_wind)
+            << " " << wall_text(c) << "\n";
+    }
+    fprintf(stderr, "%llu evaluations, %d distinct hands, wrote %d to %s\n", static_cast<unsigned long long>(evaluations),
+        static_cast<int>(slowest.size()), static_cast<int>(entries.size()), opt.out);
+    return 0;
+}